@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libcoro.h"
+#include "number_file_reader.h"
+#include "timespec_helpers.h"
+#include "utils.h"
+
+/**
+ * Чтение нескольких файлов корутинами при разных способах ввода-вывода (coro_read):
+ * io_uring, пул потоков и блокирующий read. Каждая корутина разбирает свой файл.
+ * Запуск: bench_coro_io [FILES] [COUNT]. По умолчанию 4 файла по 2M чисел.
+ * "Холодный" замер - страницы файлов перед замером выбрасываются из page cache
+ */
+
+#define BATCH_SIZE 1024
+#define READ_BUFFER_SIZE (64 * 1024)
+
+typedef struct read_task
+{
+    int fd;
+    long long sum;
+} read_task_t;
+
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/** Сгенерировать файл со случайными числами через пробел */
+static void generate_file(int fd, int count, uint32_t seed)
+{
+    char *text = (char *)malloc((size_t)count * 12);
+    long long size = 0;
+    uint32_t state = seed;
+    for (int i = 0; i < count; i++)
+    {
+        size += sprintf(text + size, "%d ", (int)next_random(&state));
+    }
+
+    if (write(fd, text, size) != size)
+    {
+        perror("write");
+        exit(1);
+    }
+
+    free(text);
+}
+
+/** Выбросить страницы файла из page cache. Грязные страницы сначала сбрасываются на диск */
+static void drop_cache(int fd)
+{
+    if (fdatasync(fd) == -1)
+    {
+        perror("fdatasync");
+        exit(1);
+    }
+
+    int error = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (error != 0)
+    {
+        fprintf(stderr, "posix_fadvise: %s\n", strerror(error));
+        exit(1);
+    }
+}
+
+static int read_coro(void *arg)
+{
+    read_task_t *task = (read_task_t *)arg;
+    if (lseek(task->fd, 0, SEEK_SET) == -1)
+    {
+        perror("lseek");
+        exit(1);
+    }
+
+    file_read_state *state = file_read_state_new(task->fd, READ_BUFFER_SIZE);
+    int numbers[BATCH_SIZE];
+    int count;
+    task->sum = 0;
+    while ((count = file_read_state_get_numbers(state, numbers, BATCH_SIZE)) > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            task->sum += numbers[i];
+        }
+        coro_yield();
+    }
+    file_read_state_delete(state);
+    return 0;
+}
+
+/** Прочитать все файлы корутинами, возвращает время в мс */
+static double read_all(read_task_t *tasks, int files, coro_io_backend_t backend, bool cold)
+{
+    if (cold)
+    {
+        for (int i = 0; i < files; i++)
+        {
+            drop_cache(tasks[i].fd);
+        }
+    }
+
+    struct timespec quantum = {0, 1000 * 1000};
+    coro_sched_init(&quantum);
+    coro_io_set_backend(backend);
+
+    struct timespec start, end, diff;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < files; i++)
+    {
+        coro_new(read_coro, tasks + i);
+    }
+    struct coro *c;
+    while ((c = coro_sched_wait()) != NULL)
+    {
+        coro_delete(c);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    timespec_sub(&end, &start, &diff);
+    return diff.tv_sec * 1e3 + diff.tv_nsec / 1e6;
+}
+
+int main(int argc, const char **argv)
+{
+    int files = argc < 2
+                    ? 4
+                    : (int)strtol(argv[1], NULL, 10);
+    int count = argc < 3
+                    ? 2 * 1000 * 1000
+                    : (int)strtol(argv[2], NULL, 10);
+
+    temp_file_t **temp_files = (temp_file_t **)malloc(sizeof(temp_file_t *) * files);
+    read_task_t *tasks = (read_task_t *)malloc(sizeof(read_task_t) * files);
+    for (int i = 0; i < files; i++)
+    {
+        temp_files[i] = temp_file_new();
+        tasks[i].fd = temp_file_fd(temp_files[i]);
+        generate_file(tasks[i].fd, count, 2463534242u + i);
+    }
+    printf("Файлов: %d по %d чисел\n", files, count);
+
+    const struct
+    {
+        const char *name;
+        coro_io_backend_t backend;
+    } backends[] = {
+        {"io_uring", CORO_IO_URING},
+        {"threads", CORO_IO_THREADS},
+        {"read", CORO_IO_SYNC},
+    };
+    long long expected_sum = 0;
+    for (unsigned long b = 0; b < sizeof(backends) / sizeof(backends[0]); b++)
+    {
+        double warm_ms = read_all(tasks, files, backends[b].backend, false);
+        double cold_ms = read_all(tasks, files, backends[b].backend, true);
+
+        long long sum = 0;
+        for (int i = 0; i < files; i++)
+        {
+            sum += tasks[i].sum;
+        }
+        if (b == 0)
+        {
+            expected_sum = sum;
+        }
+        printf("%-24s теплый: %8.1f мс, холодный: %8.1f мс%s\n", backends[b].name, warm_ms, cold_ms,
+               sum == expected_sum ? "" : "  (сумма не совпадает!)");
+    }
+
+    for (int i = 0; i < files; i++)
+    {
+        temp_file_free(temp_files[i]);
+    }
+    free(temp_files);
+    free(tasks);
+    return 0;
+}
@@ -0,0 +1,129 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libcoro.h"
+#include "timespec_helpers.h"
+
+/**
+ * Стоимость создания корутины (с новым стеком и со стеком из пула), переключения контекста
+ * и yield без переключения (квант не истек - "ложное" переключение).
+ * Собирается дважды: bench_coro_switch (sigaltstack + sigsetjmp) и bench_coro_switch_asm (CORO_ASM_SWITCH).
+ * Запуск: bench_coro_switch [CORO_COUNT] [YIELDS]. По умолчанию 1000 корутин и 1M переключений
+ */
+
+#ifdef CORO_ASM_SWITCH
+#define BACKEND_NAME "asm"
+#else
+#define BACKEND_NAME "sigaltstack"
+#endif
+
+static int empty_coro(void *arg)
+{
+    (void)arg;
+    return 0;
+}
+
+static int yield_coro(void *arg)
+{
+    long long yields = *(long long *)arg;
+    for (long long i = 0; i < yields; i++)
+    {
+        coro_yield();
+    }
+    return 0;
+}
+
+static double elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    struct timespec diff;
+    timespec_sub(end, start, &diff);
+    return diff.tv_sec * 1e9 + diff.tv_nsec;
+}
+
+/** Создать coro_count корутин со стеком stack_size, возвращает среднее время создания одной */
+static double create_many(int coro_count, size_t stack_size)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < coro_count; i++)
+    {
+        coro_new_with_stack(empty_coro, NULL, stack_size);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_ns(&start, &end) / coro_count;
+}
+
+static void wait_all()
+{
+    struct coro *c;
+    while ((c = coro_sched_wait()) != NULL)
+    {
+        coro_delete(c);
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    int coro_count = argc < 2
+                         ? 1000
+                         : (int)strtol(argv[1], NULL, 10);
+    long long yields = argc < 3
+                           ? 1000 * 1000
+                           : strtoll(argv[2], NULL, 10);
+
+    /* Нулевой квант: каждый yield переключает контекст */
+    struct timespec quantum = {0, 0};
+    coro_sched_init(&quantum);
+
+    /* Пул держит все стеки: первый проход отображает новые стеки, второй берет их из пула */
+    coro_stack_pool_set_retention(coro_count);
+    double create_ns = create_many(coro_count, 1024 * 1024);
+    wait_all();
+    double pooled_ns = create_many(coro_count, 1024 * 1024);
+    wait_all();
+    double small_ns = create_many(coro_count, 64 * 1024);
+    wait_all();
+    coro_stack_pool_clear();
+
+    struct timespec start, end;
+
+    /* Две корутины: каждый yield - переключение на другую корутину */
+    long long yields_half = yields / 2;
+    coro_new(yield_coro, &yields_half);
+    coro_new(yield_coro, &yields_half);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wait_all();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double pair_ns = elapsed_ns(&start, &end) / (yields_half * 2);
+
+    coro_stack_pool_stats_t stats;
+    coro_stack_pool_stats(&stats);
+    /* coro_count корутин по очереди: переключения напрямую между корутинами */
+    long long yields_each = yields / coro_count + 1;
+    for (int i = 0; i < coro_count; i++)
+    {
+        coro_new(yield_coro, &yields_each);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wait_all();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ring_ns = elapsed_ns(&start, &end) / (yields_each * coro_count);
+
+    /* Квант 10 мс: почти каждый yield возвращается сразу, переключений почти нет */
+    struct timespec long_quantum = {0, 10 * 1000 * 1000};
+    coro_sched_init(&long_quantum);
+    coro_new(yield_coro, &yields);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wait_all();
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double false_switch_ns = elapsed_ns(&start, &end) / yields;
+
+    printf("%-12s yield без переключения: %6.1f нс, переключение между 2 корутинами: %6.0f нс, между %d: %6.0f нс\n",
+           BACKEND_NAME, false_switch_ns, pair_ns, coro_count, ring_ns);
+    printf("%-12s создание: %8.0f нс (из пула %6.0f нс, стек 64 КБ %6.0f нс)\n",
+           BACKEND_NAME, create_ns, pooled_ns, small_ns);
+    printf("%-12s стеков выделено: %lld, повторно использовано: %lld, пиковый RSS: %lld КБ\n",
+           BACKEND_NAME, stats.allocated, stats.reused, stats.peak_rss_kb);
+    return 0;
+}
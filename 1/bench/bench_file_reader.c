@@ -0,0 +1,140 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "number_file_reader.h"
+#include "timespec_helpers.h"
+#include "utils.h"
+
+/**
+ * Сравнение чтения файла через read() и через mmap().
+ * Запуск: bench_file_reader [COUNT]. COUNT - количество чисел в файле, по умолчанию 10M.
+ * "Теплый" замер - файл уже в page cache. "Холодный" - страницы файла перед замером
+ * выбрасываются из кэша через posix_fadvise(POSIX_FADV_DONTNEED)
+ */
+
+#define BATCH_SIZE 1024
+#define READ_BUFFER_SIZE 4096
+
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/** Сгенерировать файл со случайными числами через пробел. Возвращает размер файла */
+static long long generate_file(int fd, int count)
+{
+    char *text = (char *)malloc((size_t)count * 12);
+    long long size = 0;
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < count; i++)
+    {
+        size += sprintf(text + size, "%d ", (int)next_random(&state));
+    }
+
+    if (write(fd, text, size) != size)
+    {
+        perror("write");
+        exit(1);
+    }
+
+    free(text);
+    return size;
+}
+
+/** Выбросить страницы файла из page cache. Грязные страницы сначала сбрасываются на диск */
+static void drop_cache(int fd)
+{
+    if (fdatasync(fd) == -1)
+    {
+        perror("fdatasync");
+        exit(1);
+    }
+
+    int error = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    if (error != 0)
+    {
+        fprintf(stderr, "posix_fadvise: %s\n", strerror(error));
+        exit(1);
+    }
+}
+
+static long long sum_numbers(int fd, file_reader_mode_t mode)
+{
+    if (lseek(fd, 0, SEEK_SET) == -1)
+    {
+        perror("lseek");
+        exit(1);
+    }
+
+    file_read_state *state = mode == FILE_READER_MMAP
+                                 ? file_read_state_new_mmap(fd, READ_BUFFER_SIZE)
+                                 : file_read_state_new(fd, READ_BUFFER_SIZE);
+    int numbers[BATCH_SIZE];
+    long long sum = 0;
+    int count;
+    while ((count = file_read_state_get_numbers(state, numbers, BATCH_SIZE)) > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            sum += numbers[i];
+        }
+    }
+    file_read_state_delete(state);
+    return sum;
+}
+
+static double elapsed_s(struct timespec *start, struct timespec *end)
+{
+    struct timespec diff;
+    timespec_sub(end, start, &diff);
+    return diff.tv_sec + diff.tv_nsec / 1e9;
+}
+
+static void run(const char *name, int fd, file_reader_mode_t mode, bool cold, long long size, long long expected_sum)
+{
+    if (cold)
+    {
+        drop_cache(fd);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long sum = sum_numbers(fd, mode);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    printf("%-24s %8.3f GB/s%s\n", name, size / elapsed_s(&start, &end) / 1e9,
+           sum == expected_sum ? "" : "  (сумма не совпадает!)");
+}
+
+int main(int argc, const char **argv)
+{
+    int count = argc < 2
+                    ? 10 * 1000 * 1000
+                    : (int)strtol(argv[1], NULL, 10);
+    temp_file_t *file = temp_file_new();
+    int fd = temp_file_fd(file);
+    long long size = generate_file(fd, count);
+    printf("Файл: %d чисел, %lld байт\n", count, size);
+
+    /* Прогрев кэша и эталонная сумма */
+    long long expected_sum = sum_numbers(fd, FILE_READER_READ);
+
+    run("read (теплый)", fd, FILE_READER_READ, false, size, expected_sum);
+    run("mmap (теплый)", fd, FILE_READER_MMAP, false, size, expected_sum);
+    run("read (холодный)", fd, FILE_READER_READ, true, size, expected_sum);
+    run("mmap (холодный)", fd, FILE_READER_MMAP, true, size, expected_sum);
+
+    temp_file_free(file);
+    return 0;
+}
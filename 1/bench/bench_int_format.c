@@ -0,0 +1,178 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "page_writer.h"
+#include "timespec_helpers.h"
+#include "utils.h"
+
+/**
+ * Проверка и скорость форматирования чисел.
+ * Вначале format_int сверяется с snprintf("%d") побайтово: граничные значения, все числа из [-2^20, 2^20]
+ * и случайные числа. Затем page_writer_write_many сверяется с прежним форматом файла ("%d " подряд).
+ * После замеряется скорость: snprintf, format_int и page_writer_write_many в /dev/null.
+ * Запуск: bench_int_format [COUNT]. COUNT - количество чисел для замера, по умолчанию 10M
+ */
+
+#define BATCH_SIZE 256
+
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void check_number(int number)
+{
+    char expected[16];
+    char actual[16];
+    int expected_length = snprintf(expected, sizeof(expected), "%d", number);
+    int actual_length = format_int(actual, number);
+    if (expected_length != actual_length || memcmp(expected, actual, expected_length) != 0)
+    {
+        printf("Ошибка форматирования %s: получено '%.*s'\n", expected, actual_length, actual);
+        exit(1);
+    }
+}
+
+static void validate_format_int()
+{
+    for (uint32_t power = 1; power <= 1000000000u; power *= 10)
+    {
+        check_number((int)power);
+        check_number((int)power - 1);
+        check_number(-(int)power);
+        check_number(-(int)power + 1);
+    }
+    check_number(INT_MIN);
+    check_number(INT_MAX);
+    check_number(INT_MIN + 1);
+
+    for (int number = -(1 << 20); number <= (1 << 20); number++)
+    {
+        check_number(number);
+    }
+
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < 10000000; i++)
+    {
+        check_number((int)next_random(&state));
+    }
+    printf("format_int совпадает с snprintf\n");
+}
+
+/** Записать числа через page_writer с маленьким буфером (чтобы было много сбросов) и сравнить с "%d " */
+static void validate_writer(const int *numbers, int count)
+{
+    temp_file_t *file = temp_file_new();
+    int fd = temp_file_fd(file);
+    page_writer_t writer;
+    page_writer_init(&writer, fd, 4096);
+    for (int i = 0; i < count; i += BATCH_SIZE)
+    {
+        int batch = count - i < BATCH_SIZE ? count - i : BATCH_SIZE;
+        page_writer_write_many(&writer, numbers + i, batch);
+    }
+    page_writer_flush(&writer);
+    page_writer_free(&writer);
+
+    char *expected = (char *)malloc((size_t)count * (MAX_INT_TEXT_LENGTH + 1) + 1);
+    long long expected_size = 0;
+    for (int i = 0; i < count; i++)
+    {
+        expected_size += sprintf(expected + expected_size, "%d ", numbers[i]);
+    }
+
+    off_t actual_size = lseek(fd, 0, SEEK_END);
+    char *actual = (char *)malloc(actual_size);
+    if (pread(fd, actual, actual_size, 0) != actual_size)
+    {
+        perror("pread");
+        exit(1);
+    }
+
+    if (actual_size != expected_size || memcmp(expected, actual, expected_size) != 0)
+    {
+        printf("Вывод page_writer отличается от \"%%d \"\n");
+        exit(1);
+    }
+    printf("Вывод page_writer совпадает побайтово (%lld байт)\n", expected_size);
+
+    free(expected);
+    free(actual);
+    temp_file_free(file);
+}
+
+static double elapsed_s(struct timespec *start, struct timespec *end)
+{
+    struct timespec diff;
+    timespec_sub(end, start, &diff);
+    return diff.tv_sec + diff.tv_nsec / 1e9;
+}
+
+int main(int argc, const char **argv)
+{
+    int count = argc < 2
+                    ? 10 * 1000 * 1000
+                    : (int)strtol(argv[1], NULL, 10);
+    int *numbers = (int *)malloc(sizeof(int) * count);
+    uint32_t state = 88172645u;
+    for (int i = 0; i < count; i++)
+    {
+        numbers[i] = (int)next_random(&state);
+    }
+
+    validate_format_int();
+    validate_writer(numbers, count < 1000000 ? count : 1000000);
+
+    struct timespec start, end;
+    char buf[16];
+    long long total = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++)
+    {
+        total += snprintf(buf, sizeof(buf), "%d", numbers[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double snprintf_s = elapsed_s(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i++)
+    {
+        total -= format_int(buf, numbers[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double format_s = elapsed_s(&start, &end);
+
+    int null_fd = open("/dev/null", O_WRONLY);
+    page_writer_t writer;
+    page_writer_init(&writer, null_fd, 1024 * 1024);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < count; i += BATCH_SIZE)
+    {
+        int batch = count - i < BATCH_SIZE ? count - i : BATCH_SIZE;
+        page_writer_write_many(&writer, numbers + i, batch);
+    }
+    page_writer_flush(&writer);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double writer_s = elapsed_s(&start, &end);
+    page_writer_free(&writer);
+    close(null_fd);
+
+    printf("%-24s %10.1f нс/число\n", "snprintf", snprintf_s * 1e9 / count);
+    printf("%-24s %10.1f нс/число\n", "format_int", format_s * 1e9 / count);
+    printf("%-24s %10.1f нс/число\n", "page_writer_write_many", writer_s * 1e9 / count);
+
+    free(numbers);
+    return total == 0 ? 0 : 1;
+}
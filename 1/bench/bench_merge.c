@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#include "merge_files.h"
+#include "radix_sort.h"
+#include "timespec_helpers.h"
+#include "utils.h"
+
+/**
+ * Сравнение алгоритмов слияния (куча и дерево проигравших) на 16, 128 и 1024 сериях.
+ * Запуск: bench_merge [TOTAL]. TOTAL - общее количество чисел во всех сериях, по умолчанию 4M.
+ * Результат пишется в /dev/null, т.е. замеряется слияние вместе с форматированием чисел
+ */
+
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/** Поднять мягкий лимит открытых файлов до жесткого - для 1024 серий стандартного лимита не хватит */
+static void raise_fd_limit()
+{
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1)
+    {
+        perror("getrlimit");
+        exit(1);
+    }
+
+    rl.rlim_cur = rl.rlim_max;
+    if (setrlimit(RLIMIT_NOFILE, &rl) == -1)
+    {
+        perror("setrlimit");
+        exit(1);
+    }
+}
+
+/** Создать runs_count временных файлов с отсортированными сериями */
+static sorted_run_t **create_runs(int runs_count, int total)
+{
+    sorted_run_t **runs = (sorted_run_t **)malloc(sizeof(sorted_run_t *) * runs_count);
+    int run_size = total / runs_count;
+    int *array = (int *)malloc(sizeof(int) * run_size);
+    int *scratch = (int *)malloc(sizeof(int) * run_size);
+    uint32_t state = 2463534242u;
+    for (int r = 0; r < runs_count; r++)
+    {
+        for (int i = 0; i < run_size; i++)
+        {
+            array[i] = (int)next_random(&state);
+        }
+        radix_sort_int32(array, scratch, run_size);
+
+        runs[r] = sorted_run_new();
+        run_writer_t writer;
+        run_writer_init(&writer, temp_file_fd(runs[r]->file), 256 * 1024, RUN_FORMAT_RAW, &runs[r]->index);
+        run_writer_write_many(&writer, array, run_size);
+        run_writer_finish(&writer);
+        run_writer_free(&writer);
+        temp_file_close(runs[r]->file);
+    }
+
+    free(array);
+    free(scratch);
+    return runs;
+}
+
+static double bench_strategy(merge_strategy_t strategy, sorted_run_t **runs, int runs_count, int null_fd)
+{
+    /* Памяти с запасом, чтобы все серии сливались за один проход */
+    merge_options_t options = {
+        .strategy = strategy,
+        .max_memory_bytes = 1024LL * 1024 * 1024,
+        .max_fan_in = 0,
+        .write_buffer_size = 0,
+        .run_format = RUN_FORMAT_RAW,
+        .threads = 1,
+    };
+    struct timespec start, end, diff;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    merge_files(null_fd, runs, runs_count, &options);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    timespec_sub(&end, &start, &diff);
+    return diff.tv_sec + diff.tv_nsec / 1e9;
+}
+
+int main(int argc, const char **argv)
+{
+    int total = argc < 2
+                    ? 4 * 1000 * 1000
+                    : (int)strtol(argv[1], NULL, 10);
+    raise_fd_limit();
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1)
+    {
+        perror("open");
+        exit(1);
+    }
+
+    const int runs_counts[] = {16, 128, 1024};
+    printf("%8s %12s %16s %16s\n", "runs", "elements", "heap, elem/s", "loser, elem/s");
+    for (unsigned long c = 0; c < sizeof(runs_counts) / sizeof(runs_counts[0]); c++)
+    {
+        int runs_count = runs_counts[c];
+        sorted_run_t **runs = create_runs(runs_count, total);
+        long long elements = (long long)(total / runs_count) * runs_count;
+
+        double heap_s = bench_strategy(MERGE_STRATEGY_HEAP, runs, runs_count, null_fd);
+        double loser_s = bench_strategy(MERGE_STRATEGY_LOSER_TREE, runs, runs_count, null_fd);
+        printf("%8d %12lld %16.0f %16.0f\n", runs_count, elements, elements / heap_s, elements / loser_s);
+
+        for (int r = 0; r < runs_count; r++)
+        {
+            sorted_run_free(runs[r]);
+        }
+        free(runs);
+    }
+
+    close(null_fd);
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "number_file_reader.h"
+#include "timespec_helpers.h"
+#include "utils.h"
+
+/**
+ * Скорость разбора чисел из текстового файла (ГБ/с).
+ * Запуск: bench_number_parser [COUNT]. COUNT - количество чисел в файле, по умолчанию 10M.
+ * Файл лежит в /tmp и после генерации находится в page cache, т.е. замеряется сам разбор
+ */
+
+#define BATCH_SIZE 1024
+#define READ_BUFFER_SIZE (64 * 1024)
+
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/** Сгенерировать файл со случайными числами через пробел. Возвращает размер файла */
+static long long generate_file(int fd, int count)
+{
+    char *text = (char *)malloc((size_t)count * 12);
+    long long size = 0;
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < count; i++)
+    {
+        size += sprintf(text + size, "%d ", (int)next_random(&state));
+    }
+
+    if (write(fd, text, size) != size)
+    {
+        perror("write");
+        exit(1);
+    }
+
+    free(text);
+    return size;
+}
+
+static void rewind_file(int fd)
+{
+    if (lseek(fd, 0, SEEK_SET) == -1)
+    {
+        perror("lseek");
+        exit(1);
+    }
+}
+
+/** Прежний способ: isspace + strtol по буферу в памяти (без учета чтения) */
+static long long sum_strtol(int fd, long long size)
+{
+    rewind_file(fd);
+    char *text = (char *)malloc(size + 1);
+    if (read(fd, text, size) != size)
+    {
+        perror("read");
+        exit(1);
+    }
+    text[size] = '\0';
+
+    long long sum = 0;
+    char *pos = text;
+    while (true)
+    {
+        while (isspace(*pos))
+        {
+            pos++;
+        }
+        if (*pos == '\0')
+        {
+            break;
+        }
+        sum += (int)strtol(pos, &pos, 10);
+    }
+
+    free(text);
+    return sum;
+}
+
+static long long sum_one_by_one(int fd)
+{
+    rewind_file(fd);
+    file_read_state *state = file_read_state_new(fd, READ_BUFFER_SIZE);
+    long long sum = 0;
+    int number;
+    while (file_read_state_get_next_number(state, &number))
+    {
+        sum += number;
+    }
+    file_read_state_delete(state);
+    return sum;
+}
+
+/** Разбор пачками указанной реализацией. Возвращает false, если реализация не поддерживается */
+static bool sum_batch(int fd, number_parser_t parser, long long *sum)
+{
+    rewind_file(fd);
+    file_read_state *state = file_read_state_new(fd, READ_BUFFER_SIZE);
+    if (!file_read_state_set_parser(state, parser))
+    {
+        file_read_state_delete(state);
+        return false;
+    }
+
+    int numbers[BATCH_SIZE];
+    *sum = 0;
+    int count;
+    while ((count = file_read_state_get_numbers(state, numbers, BATCH_SIZE)) > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            *sum += numbers[i];
+        }
+    }
+    file_read_state_delete(state);
+    return true;
+}
+
+static double elapsed_s(struct timespec *start, struct timespec *end)
+{
+    struct timespec diff;
+    timespec_sub(end, start, &diff);
+    return diff.tv_sec + diff.tv_nsec / 1e9;
+}
+
+static void report(const char *name, long long size, double seconds, long long sum, long long expected_sum)
+{
+    printf("%-24s %8.3f GB/s%s\n", name, size / seconds / 1e9, sum == expected_sum ? "" : "  (сумма не совпадает!)");
+}
+
+int main(int argc, const char **argv)
+{
+    int count = argc < 2
+                    ? 10 * 1000 * 1000
+                    : (int)strtol(argv[1], NULL, 10);
+    temp_file_t *file = temp_file_new();
+    int fd = temp_file_fd(file);
+    long long size = generate_file(fd, count);
+    printf("Файл: %d чисел, %lld байт\n", count, size);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long expected_sum = sum_strtol(fd, size);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("isspace + strtol", size, elapsed_s(&start, &end), expected_sum, expected_sum);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long sum = sum_one_by_one(fd);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    report("get_next_number", size, elapsed_s(&start, &end), sum, expected_sum);
+
+    const struct
+    {
+        const char *name;
+        number_parser_t parser;
+    } parsers[] = {
+        {"get_numbers (scalar)", NUMBER_PARSER_SCALAR},
+        {"get_numbers (sse2)", NUMBER_PARSER_SSE2},
+        {"get_numbers (avx2)", NUMBER_PARSER_AVX2},
+    };
+    for (unsigned long i = 0; i < sizeof(parsers) / sizeof(parsers[0]); i++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        bool supported = sum_batch(fd, parsers[i].parser, &sum);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        if (!supported)
+        {
+            printf("%-24s не поддерживается\n", parsers[i].name);
+            continue;
+        }
+        report(parsers[i].name, size, elapsed_s(&start, &end), sum, expected_sum);
+    }
+
+    temp_file_free(file);
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "merge_files.h"
+#include "run_file.h"
+#include "radix_sort.h"
+#include "timespec_helpers.h"
+#include "utils.h"
+
+/**
+ * Масштабирование последнего прохода слияния по потокам: 1, 2, 4, 8 и 16 потоков,
+ * каждый сливает свой диапазон чисел. Для сравнения каждый результат проверяется на упорядоченность и размер.
+ * Запуск: bench_parallel_merge [TOTAL] [RUNS]. TOTAL - общее количество чисел, по умолчанию 16M, RUNS - количество серий, по умолчанию 64
+ */
+
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double elapsed_s(struct timespec *start, struct timespec *end)
+{
+    struct timespec diff;
+    timespec_sub(end, start, &diff);
+    return diff.tv_sec + diff.tv_nsec / 1e9;
+}
+
+/** Создать runs_count серий в упакованном формате с индексами */
+static sorted_run_t **create_runs(int runs_count, int total)
+{
+    sorted_run_t **runs = (sorted_run_t **)malloc(sizeof(sorted_run_t *) * runs_count);
+    int run_size = total / runs_count;
+    int *array = (int *)malloc(sizeof(int) * run_size);
+    int *scratch = (int *)malloc(sizeof(int) * run_size);
+    uint32_t state = 2463534242u;
+    for (int r = 0; r < runs_count; r++)
+    {
+        for (int i = 0; i < run_size; i++)
+        {
+            array[i] = (int)next_random(&state);
+        }
+        radix_sort_int32(array, scratch, run_size);
+
+        runs[r] = sorted_run_new();
+        run_writer_t writer;
+        run_writer_init(&writer, temp_file_fd(runs[r]->file), 256 * 1024, RUN_FORMAT_PACKED, &runs[r]->index);
+        run_writer_write_many(&writer, array, run_size);
+        run_writer_finish(&writer);
+        run_writer_free(&writer);
+        temp_file_close(runs[r]->file);
+    }
+
+    free(array);
+    free(scratch);
+    return runs;
+}
+
+/** Проверить, что в файле elements чисел по неубыванию */
+static bool check_result(temp_file_t *file, long long elements)
+{
+    int fd = temp_file_open(file);
+    FILE *stream = fdopen(fd, "r");
+    long long count = 0;
+    long long prev = INT64_MIN;
+    int number;
+    bool sorted = true;
+    while (fscanf(stream, "%d", &number) == 1)
+    {
+        sorted = sorted && prev <= number;
+        prev = number;
+        ++count;
+    }
+    fclose(stream);
+    return sorted && count == elements;
+}
+
+int main(int argc, const char **argv)
+{
+    int total = argc < 2
+                    ? 16 * 1000 * 1000
+                    : (int)strtol(argv[1], NULL, 10);
+    int runs_count = argc < 3
+                         ? 64
+                         : (int)strtol(argv[2], NULL, 10);
+    sorted_run_t **runs = create_runs(runs_count, total);
+    long long elements = (long long)(total / runs_count) * runs_count;
+    printf("%d серий, %lld чисел, процессоров: %ld\n", runs_count, elements, sysconf(_SC_NPROCESSORS_ONLN));
+    printf("%8s %16s %10s\n", "threads", "merge, elem/s", "speedup");
+
+    double base_s = 0;
+    for (int threads = 1; threads <= 16; threads *= 2)
+    {
+        merge_options_t options = {
+            .strategy = MERGE_STRATEGY_LOSER_TREE,
+            .max_memory_bytes = 256LL * 1024 * 1024,
+            .max_fan_in = 0,
+            .write_buffer_size = 0,
+            .run_format = RUN_FORMAT_PACKED,
+            .threads = threads,
+        };
+        temp_file_t *result = temp_file_new();
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        merge_files(temp_file_fd(result), runs, runs_count, &options);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = elapsed_s(&start, &end);
+        if (threads == 1)
+        {
+            base_s = seconds;
+        }
+
+        temp_file_close(result);
+        printf("%8d %16.0f %9.2fx%s\n", threads, elements / seconds, base_s / seconds,
+               check_result(result, elements) ? "" : "  (результат неверный!)");
+        temp_file_free(result);
+    }
+
+    for (int r = 0; r < runs_count; r++)
+    {
+        sorted_run_free(runs[r]);
+    }
+    free(runs);
+    return 0;
+}
@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "priority_queue.h"
+#include "timespec_helpers.h"
+
+/**
+ * Сравнение d-арной кучи (priority_queue.c) с прежней бинарной кучей {int key; void *value}.
+ * Запуск: bench_priority_queue [OPS]. OPS - количество операций в каждом замере, по умолчанию 10M.
+ * Два сценария на очередях разного размера:
+ * - слияние: вершина заменяется следующим ключом того же источника (в бинарной куче - извлечение и вставка)
+ * - заполнение и опустошение: OPS вставок случайных ключей, затем OPS извлечений
+ */
+
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/** Прежняя бинарная куча: ключ и значение хранятся вместе */
+typedef struct binary_heap_entry
+{
+    int key;
+    void *value;
+} binary_heap_entry_t;
+
+typedef struct binary_heap
+{
+    binary_heap_entry_t *heap;
+    int size;
+    int capacity;
+} binary_heap_t;
+
+static void binary_heap_init(binary_heap_t *bh)
+{
+    bh->size = 0;
+    bh->capacity = 16;
+    bh->heap = (binary_heap_entry_t *)malloc(sizeof(binary_heap_entry_t) * bh->capacity);
+}
+
+static void binary_heap_delete(binary_heap_t *bh)
+{
+    free(bh->heap);
+}
+
+static inline void binary_heap_swap(binary_heap_entry_t *heap, int left, int right)
+{
+    binary_heap_entry_t tmp = heap[left];
+    heap[left] = heap[right];
+    heap[right] = tmp;
+}
+
+static void binary_heap_enqueue(binary_heap_t *bh, int key, void *value)
+{
+    if (bh->size == bh->capacity)
+    {
+        bh->capacity *= 2;
+        bh->heap = (binary_heap_entry_t *)realloc(bh->heap, sizeof(binary_heap_entry_t) * bh->capacity);
+    }
+
+    bh->heap[bh->size] = (binary_heap_entry_t){.key = key, .value = value};
+    int current = bh->size++;
+    while (0 < current && bh->heap[current].key < bh->heap[(current - 1) / 2].key)
+    {
+        binary_heap_swap(bh->heap, current, (current - 1) / 2);
+        current = (current - 1) / 2;
+    }
+}
+
+static int binary_heap_dequeue(binary_heap_t *bh, void **value)
+{
+    int key = bh->heap[0].key;
+    *value = bh->heap[0].value;
+    binary_heap_swap(bh->heap, 0, bh->size - 1);
+    bh->size--;
+
+    int current = 0;
+    while (2 * current + 1 < bh->size)
+    {
+        int left = 2 * current + 1;
+        int right = left + 1;
+        int min = right < bh->size && bh->heap[right].key < bh->heap[left].key
+                      ? right
+                      : left;
+        if (bh->heap[current].key <= bh->heap[min].key)
+        {
+            break;
+        }
+
+        binary_heap_swap(bh->heap, min, current);
+        current = min;
+    }
+    return key;
+}
+
+static double elapsed_s(struct timespec *start)
+{
+    struct timespec end, diff;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    timespec_sub(&end, start, &diff);
+    return diff.tv_sec + diff.tv_nsec / 1e9;
+}
+
+/** Следующий ключ источника при слиянии: не меньше предыдущего */
+static inline int next_key(int key, uint32_t *state)
+{
+    return key + (int)(next_random(state) & 63);
+}
+
+static double merge_binary(int size, int ops, long long *checksum)
+{
+    binary_heap_t bh;
+    binary_heap_init(&bh);
+    uint32_t state = 2463534242u;
+    for (long i = 0; i < size; i++)
+    {
+        binary_heap_enqueue(&bh, (int)(next_random(&state) & 0xFFFFF), (void *)i);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long sum = 0;
+    for (int i = 0; i < ops; i++)
+    {
+        void *value;
+        int key = binary_heap_dequeue(&bh, &value);
+        sum += key;
+        binary_heap_enqueue(&bh, next_key(key, &state), value);
+    }
+    double seconds = elapsed_s(&start);
+
+    *checksum = sum;
+    binary_heap_delete(&bh);
+    return seconds;
+}
+
+static double merge_dary(int size, int ops, long long *checksum)
+{
+    priority_queue_t pq;
+    priority_queue_init(&pq);
+    uint32_t state = 2463534242u;
+    for (long i = 0; i < size; i++)
+    {
+        priority_queue_enqueue(&pq, (int)(next_random(&state) & 0xFFFFF), (void *)i);
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long sum = 0;
+    for (int i = 0; i < ops; i++)
+    {
+        int64_t key = 0;
+        void *value = NULL;
+        priority_queue_peek(&pq, &key, &value);
+        sum += key;
+        priority_queue_replace_top(&pq, next_key((int)key, &state), value);
+    }
+    double seconds = elapsed_s(&start);
+
+    *checksum = sum;
+    priority_queue_delete(&pq);
+    return seconds;
+}
+
+static double fill_drain_binary(int ops, long long *checksum)
+{
+    binary_heap_t bh;
+    binary_heap_init(&bh);
+    uint32_t state = 88675123u;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < ops; i++)
+    {
+        binary_heap_enqueue(&bh, (int)next_random(&state), (void *)i);
+    }
+
+    long long sum = 0;
+    int prev = INT32_MIN;
+    for (int i = 0; i < ops; i++)
+    {
+        void *value;
+        int key = binary_heap_dequeue(&bh, &value);
+        sum += key < prev ? -1 : key;
+        prev = key;
+    }
+    double seconds = elapsed_s(&start);
+
+    *checksum = sum;
+    binary_heap_delete(&bh);
+    return seconds;
+}
+
+static double fill_drain_dary(int ops, long long *checksum)
+{
+    priority_queue_t pq;
+    priority_queue_init(&pq);
+    uint32_t state = 88675123u;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (long i = 0; i < ops; i++)
+    {
+        priority_queue_enqueue(&pq, (int)next_random(&state), (void *)i);
+    }
+
+    long long sum = 0;
+    int64_t prev = INT32_MIN;
+    int64_t key;
+    void *value;
+    while (priority_queue_try_dequeue(&pq, &key, &value))
+    {
+        sum += key < prev ? -1 : key;
+        prev = key;
+    }
+    double seconds = elapsed_s(&start);
+
+    *checksum = sum;
+    priority_queue_delete(&pq);
+    return seconds;
+}
+
+static void check_same(long long expected, long long actual)
+{
+    if (expected != actual)
+    {
+        fprintf(stderr, "Результаты куч не совпадают: %lld != %lld\n", expected, actual);
+        exit(1);
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    int ops = argc < 2
+                  ? 10 * 1000 * 1000
+                  : (int)strtol(argv[1], NULL, 10);
+
+    const int sizes[] = {16, 128, 1024, 65536, 1024 * 1024};
+    printf("%-12s %10s %18s %18s %8s\n", "scenario", "size", "binary, ops/s", "d-ary, ops/s", "speedup");
+    for (unsigned long s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+    {
+        long long binary_sum, dary_sum;
+        double binary_s = merge_binary(sizes[s], ops, &binary_sum);
+        double dary_s = merge_dary(sizes[s], ops, &dary_sum);
+        check_same(binary_sum, dary_sum);
+        printf("%-12s %10d %18.0f %18.0f %8.2f\n", "merge", sizes[s], ops / binary_s, ops / dary_s, binary_s / dary_s);
+    }
+
+    long long binary_sum, dary_sum;
+    double binary_s = fill_drain_binary(ops, &binary_sum);
+    double dary_s = fill_drain_dary(ops, &dary_sum);
+    check_same(binary_sum, dary_sum);
+    printf("%-12s %10d %18.0f %18.0f %8.2f\n", "fill-drain", ops, 2.0 * ops / binary_s, 2.0 * ops / dary_s, binary_s / dary_s);
+    return 0;
+}
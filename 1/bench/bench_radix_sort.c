@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "radix_sort.h"
+#include "timespec_helpers.h"
+
+/**
+ * Сравнение radix_sort_int32 с qsort на случайных числах,
+ * а также radix_sort_records с qsort на 64-битных ключах (8 байт) и записях по 16 байт (ключ + нагрузка).
+ * Запуск: bench_radix_sort [COUNT...]. По умолчанию 1M, 10M и 100M чисел (записи - не больше RECORDS_MAX_COUNT)
+ */
+
+/** Записи занимают в 2-4 раза больше памяти, поэтому на самых больших размерах не сортируются */
+#define RECORDS_MAX_COUNT (10 * 1000 * 1000)
+
+static int compare_int(const void *left, const void *right)
+{
+    int l = *(const int *)left;
+    int r = *(const int *)right;
+    return (l > r) - (l < r);
+}
+
+/** Простой xorshift, чтобы данные были одинаковыми между запусками */
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static double elapsed_ms(struct timespec *start, struct timespec *end)
+{
+    struct timespec diff;
+    timespec_sub(end, start, &diff);
+    return diff.tv_sec * 1000.0 + diff.tv_nsec / 1000000.0;
+}
+
+static void run_bench(int count)
+{
+    int *source = (int *)malloc(sizeof(int) * count);
+    int *radix_array = (int *)malloc(sizeof(int) * count);
+    int *qsort_array = (int *)malloc(sizeof(int) * count);
+    int *scratch = (int *)malloc(sizeof(int) * count);
+    if (source == NULL || radix_array == NULL || qsort_array == NULL || scratch == NULL)
+    {
+        printf("%d: недостаточно памяти\n", count);
+        exit(1);
+    }
+
+    uint32_t state = 2463534242u;
+    for (int i = 0; i < count; i++)
+    {
+        source[i] = (int)next_random(&state);
+    }
+    memcpy(radix_array, source, sizeof(int) * count);
+    memcpy(qsort_array, source, sizeof(int) * count);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    radix_sort_int32(radix_array, scratch, count);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double radix_ms = elapsed_ms(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    qsort(qsort_array, count, sizeof(int), compare_int);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double qsort_ms = elapsed_ms(&start, &end);
+
+    if (memcmp(radix_array, qsort_array, sizeof(int) * count) != 0)
+    {
+        printf("%d: результаты сортировки не совпадают\n", count);
+        exit(1);
+    }
+
+    printf("%12d %12.2f %12.2f %10.2fx\n", count, radix_ms, qsort_ms, qsort_ms / radix_ms);
+
+    free(source);
+    free(radix_array);
+    free(qsort_array);
+    free(scratch);
+}
+
+static int compare_record_key(const void *left, const void *right)
+{
+    int64_t l;
+    int64_t r;
+    memcpy(&l, left, sizeof(l));
+    memcpy(&r, right, sizeof(r));
+    return (l > r) - (l < r);
+}
+
+/** Записи по width байт со случайным ключом в начале записи */
+static void run_bench_records(int count, int width)
+{
+    size_t size = (size_t)count * width;
+    char *source = (char *)malloc(size);
+    char *radix_array = (char *)malloc(size);
+    char *qsort_array = (char *)malloc(size);
+    char *scratch = (char *)malloc(size);
+    if (source == NULL || radix_array == NULL || qsort_array == NULL || scratch == NULL)
+    {
+        printf("%d: недостаточно памяти\n", count);
+        exit(1);
+    }
+
+    uint32_t state = 2463534242u;
+    for (size_t i = 0; i < size; i += sizeof(uint32_t))
+    {
+        uint32_t value = next_random(&state);
+        memcpy(source + i, &value, sizeof(value));
+    }
+    memcpy(radix_array, source, size);
+    memcpy(qsort_array, source, size);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    radix_sort_records(radix_array, scratch, count, width, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double radix_ms = elapsed_ms(&start, &end);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    qsort(qsort_array, count, width, compare_record_key);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double qsort_ms = elapsed_ms(&start, &end);
+
+    /* qsort неустойчива, поэтому сравниваются только ключи */
+    for (int i = 0; i < count; i++)
+    {
+        if (compare_record_key(radix_array + (size_t)i * width, qsort_array + (size_t)i * width) != 0)
+        {
+            printf("%d: результаты сортировки записей не совпадают\n", count);
+            exit(1);
+        }
+    }
+
+    printf("%12d %12.2f %12.2f %10.2fx  (записи по %d байт)\n", count, radix_ms, qsort_ms, qsort_ms / radix_ms,
+           width);
+
+    free(source);
+    free(radix_array);
+    free(qsort_array);
+    free(scratch);
+}
+
+static void run_all(int count)
+{
+    run_bench(count);
+    if (count <= RECORDS_MAX_COUNT)
+    {
+        run_bench_records(count, 8);
+        run_bench_records(count, 16);
+    }
+}
+
+int main(int argc, const char **argv)
+{
+    printf("%12s %12s %12s %11s\n", "count", "radix, ms", "qsort, ms", "speedup");
+    if (argc < 2)
+    {
+        run_all(1000000);
+        run_all(10000000);
+        run_all(100000000);
+        return 0;
+    }
+
+    for (int i = 1; i < argc; i++)
+    {
+        run_all((int)strtol(argv[i], NULL, 10));
+    }
+    return 0;
+}
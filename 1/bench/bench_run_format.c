@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "merge_files.h"
+#include "run_file.h"
+#include "radix_sort.h"
+#include "timespec_helpers.h"
+#include "utils.h"
+
+/**
+ * Сравнение форматов серий (raw и packed) на равномерных и скошенных данных:
+ * объем временных файлов, скорость записи серий и скорость слияния.
+ * Запуск: bench_run_format [TOTAL] [RUNS]. TOTAL - общее количество чисел, по умолчанию 16M, RUNS - количество серий, по умолчанию 16.
+ * Результат слияния пишется в /dev/null
+ */
+
+static uint32_t next_random(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/** Равномерно распределенные числа */
+static int uniform_value(uint32_t *state)
+{
+    return (int)next_random(state);
+}
+
+/** Скошенное распределение: разрядность числа равномерна, т.е. маленьких чисел намного больше */
+static int skewed_value(uint32_t *state)
+{
+    uint32_t x = next_random(state);
+    return (int)(x >> (x & 31));
+}
+
+static double elapsed_s(struct timespec *start, struct timespec *end)
+{
+    struct timespec diff;
+    timespec_sub(end, start, &diff);
+    return diff.tv_sec + diff.tv_nsec / 1e9;
+}
+
+/** Создать runs_count временных файлов с отсортированными сериями. В bytes - суммарный размер, в seconds - время записи */
+static sorted_run_t **create_runs(int runs_count, int total, int (*generate)(uint32_t *), run_format_t format,
+                                 long long *bytes, double *seconds)
+{
+    sorted_run_t **runs = (sorted_run_t **)malloc(sizeof(sorted_run_t *) * runs_count);
+    int run_size = total / runs_count;
+    int *array = (int *)malloc(sizeof(int) * run_size);
+    int *scratch = (int *)malloc(sizeof(int) * run_size);
+    uint32_t state = 2463534242u;
+    *bytes = 0;
+    *seconds = 0;
+    for (int r = 0; r < runs_count; r++)
+    {
+        for (int i = 0; i < run_size; i++)
+        {
+            array[i] = generate(&state);
+        }
+        radix_sort_int32(array, scratch, run_size);
+
+        runs[r] = sorted_run_new();
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        run_writer_t writer;
+        run_writer_init(&writer, temp_file_fd(runs[r]->file), 256 * 1024, format, &runs[r]->index);
+        run_writer_write_many(&writer, array, run_size);
+        run_writer_finish(&writer);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        *bytes += writer.bytes_written;
+        *seconds += elapsed_s(&start, &end);
+        run_writer_free(&writer);
+        temp_file_close(runs[r]->file);
+    }
+
+    free(array);
+    free(scratch);
+    return runs;
+}
+
+static double bench_merge(sorted_run_t **runs, int runs_count, run_format_t format, int null_fd)
+{
+    merge_options_t options = {
+        .strategy = MERGE_STRATEGY_LOSER_TREE,
+        .max_memory_bytes = 256LL * 1024 * 1024,
+        .max_fan_in = 0,
+        .write_buffer_size = 0,
+        .run_format = format,
+        .threads = 1,
+    };
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    merge_files(null_fd, runs, runs_count, &options);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_s(&start, &end);
+}
+
+int main(int argc, const char **argv)
+{
+    int total = argc < 2
+                    ? 16 * 1000 * 1000
+                    : (int)strtol(argv[1], NULL, 10);
+    int runs_count = argc < 3
+                         ? 16
+                         : (int)strtol(argv[2], NULL, 10);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd == -1)
+    {
+        perror("open");
+        exit(1);
+    }
+
+    const struct
+    {
+        const char *name;
+        int (*generate)(uint32_t *);
+    } datasets[] = {
+        {"uniform", uniform_value},
+        {"skewed", skewed_value},
+    };
+    const struct
+    {
+        const char *name;
+        run_format_t format;
+    } formats[] = {
+        {"raw", RUN_FORMAT_RAW},
+        {"packed", RUN_FORMAT_PACKED},
+    };
+
+    long long elements = (long long)(total / runs_count) * runs_count;
+    printf("%d серий, %lld чисел\n", runs_count, elements);
+    printf("%-8s %-8s %14s %10s %16s %16s\n", "data", "format", "bytes", "ratio", "write, elem/s", "merge, elem/s");
+    for (unsigned long d = 0; d < sizeof(datasets) / sizeof(datasets[0]); d++)
+    {
+        for (unsigned long f = 0; f < sizeof(formats) / sizeof(formats[0]); f++)
+        {
+            long long bytes;
+            double write_s;
+            sorted_run_t **runs = create_runs(runs_count, total, datasets[d].generate, formats[f].format, &bytes, &write_s);
+            double merge_s = bench_merge(runs, runs_count, formats[f].format, null_fd);
+            printf("%-8s %-8s %14lld %9.1f%% %16.0f %16.0f\n", datasets[d].name, formats[f].name, bytes,
+                   100.0 * bytes / (elements * sizeof(int)), elements / write_s, elements / merge_s);
+
+            for (int r = 0; r < runs_count; r++)
+            {
+                sorted_run_free(runs[r]);
+            }
+            free(runs);
+        }
+    }
+
+    close(null_fd);
+    return 0;
+}
@@ -0,0 +1,421 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "number_file_reader.h"
+#include "page_writer.h"
+#include "timespec_helpers.h"
+
+/**
+ * Сортировщик целиком на разных данных и параметрах.
+ * Генерирует наборы данных (равномерные, отсортированные, почти отсортированные, обратные, с повторами, Zipf),
+ * запускает сортировщик (coroutines) с разным количеством корутин, бюджетом памяти и потоков,
+ * проверяет результат и печатает CSV: время фаз из --stats, объем ввода-вывода и пиковый RSS.
+ * Запуск: bench_sorter [COUNT] [SORTER]. По умолчанию 4M чисел (в FILES файлах),
+ * сортировщик - coroutines рядом с bench_sorter
+ */
+
+/** На сколько файлов делится каждый набор данных */
+#define FILES 4
+#define WRITE_BUFFER_SIZE (1024 * 1024)
+#define READ_BUFFER_SIZE (64 * 1024)
+/** Сколько разных чисел в наборе "с повторами" */
+#define DUPLICATE_VALUES 100
+/** Сколько разных чисел в наборе Zipf и показатель распределения */
+#define ZIPF_VALUES (1024 * 1024)
+#define ZIPF_EXPONENT 1.0
+/** Раз в сколько чисел почти отсортированный набор нарушает порядок случайным числом */
+#define NEARLY_SORTED_STRIDE 1000
+
+typedef enum dataset
+{
+    DATASET_UNIFORM,
+    DATASET_SORTED,
+    DATASET_NEARLY_SORTED,
+    DATASET_REVERSE,
+    DATASET_DUPLICATES,
+    DATASET_ZIPF,
+} dataset_t;
+
+static const char *DATASET_NAMES[] = {"uniform", "sorted", "nearly-sorted", "reverse", "duplicates", "zipf"};
+
+/** Генератор чисел набора: i-е из count чисел */
+typedef struct generator
+{
+    dataset_t dataset;
+    long long count;
+    uint64_t state;
+    /** Функция распределения Zipf: zipf_cdf[k] - вероятность ранга не больше k */
+    double *zipf_cdf;
+} generator_t;
+
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void generator_init(generator_t *g, dataset_t dataset, long long count)
+{
+    g->dataset = dataset;
+    g->count = count;
+    g->state = 88172645463325252ull;
+    g->zipf_cdf = NULL;
+    if (dataset != DATASET_ZIPF)
+    {
+        return;
+    }
+
+    g->zipf_cdf = (double *)malloc(sizeof(double) * ZIPF_VALUES);
+    double sum = 0;
+    for (int k = 0; k < ZIPF_VALUES; k++)
+    {
+        sum += 1.0 / pow(k + 1, ZIPF_EXPONENT);
+        g->zipf_cdf[k] = sum;
+    }
+    for (int k = 0; k < ZIPF_VALUES; k++)
+    {
+        g->zipf_cdf[k] /= sum;
+    }
+}
+
+static void generator_free(generator_t *g)
+{
+    free(g->zipf_cdf);
+    g->zipf_cdf = NULL;
+}
+
+/** Ранг Zipf по равномерному числу из [0, 1): первый ранг, у которого функция распределения больше u */
+static int zipf_rank(const double *cdf, double u)
+{
+    int low = 0;
+    int high = ZIPF_VALUES - 1;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (u < cdf[middle])
+        {
+            high = middle;
+        }
+        else
+        {
+            low = middle + 1;
+        }
+    }
+    return low;
+}
+
+static int generator_next(generator_t *g, long long i)
+{
+    /* Отсортированные наборы равномерно покрывают весь диапазон int */
+    long long step = ((long long)UINT32_MAX + 1) / g->count;
+    switch (g->dataset)
+    {
+    case DATASET_SORTED:
+        return (int)(INT_MIN + i * step);
+    case DATASET_NEARLY_SORTED:
+        return i % NEARLY_SORTED_STRIDE == 0
+                   ? (int)(uint32_t)next_random(&g->state)
+                   : (int)(INT_MIN + i * step);
+    case DATASET_REVERSE:
+        return (int)(INT_MAX - i * step);
+    case DATASET_DUPLICATES:
+        return (int)(next_random(&g->state) % DUPLICATE_VALUES);
+    case DATASET_ZIPF:
+        return zipf_rank(g->zipf_cdf, (next_random(&g->state) >> 11) * (1.0 / 9007199254740992.0));
+    case DATASET_UNIFORM:
+    default:
+        return (int)(uint32_t)next_random(&g->state);
+    }
+}
+
+/** Сгенерировать набор в FILES файлов dir/input<N>.txt, возвращает сумму чисел для проверки результата */
+static long long generate_dataset(const char *dir, dataset_t dataset, long long count)
+{
+    generator_t g;
+    generator_init(&g, dataset, count);
+    long long sum = 0;
+    long long i = 0;
+    for (int f = 0; f < FILES; f++)
+    {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/input%d.txt", dir, f);
+        int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+        {
+            perror("open");
+            exit(1);
+        }
+
+        page_writer_t writer;
+        page_writer_init(&writer, fd, WRITE_BUFFER_SIZE);
+        for (long long end = count * (f + 1) / FILES; i < end; i++)
+        {
+            int number = generator_next(&g, i);
+            sum += number;
+            page_writer_write(&writer, number);
+        }
+        page_writer_flush(&writer);
+        page_writer_free(&writer);
+        close(fd);
+    }
+
+    generator_free(&g);
+    return sum;
+}
+
+static void remove_dataset(const char *dir)
+{
+    char path[PATH_MAX];
+    for (int f = 0; f < FILES; f++)
+    {
+        snprintf(path, sizeof(path), "%s/input%d.txt", dir, f);
+        unlink(path);
+    }
+    snprintf(path, sizeof(path), "%s/result.txt", dir);
+    unlink(path);
+    snprintf(path, sizeof(path), "%s/stats.txt", dir);
+    unlink(path);
+}
+
+/** Статистика одного запуска: из файла --stats сортировщика и от wait4 */
+typedef struct run_result
+{
+    double wall_ms;
+    long long peak_rss_kb;
+    long long sort_wall_ns;
+    long long merge_wall_ns;
+    long long parse_ns;
+    long long sort_ns;
+    long long spill_ns;
+    long long runs;
+    long long intermediate_runs;
+    long long presorted_numbers;
+    long long input_bytes;
+    long long spill_bytes;
+    long long merge_read_bytes;
+    long long merge_write_bytes;
+    bool ok;
+} run_result_t;
+
+static void read_stats(const char *path, run_result_t *result)
+{
+    const struct
+    {
+        const char *name;
+        long long *value;
+    } fields[] = {
+        {"sort_wall_ns", &result->sort_wall_ns},
+        {"merge_wall_ns", &result->merge_wall_ns},
+        {"parse_ns", &result->parse_ns},
+        {"sort_ns", &result->sort_ns},
+        {"spill_ns", &result->spill_ns},
+        {"presorted_numbers", &result->presorted_numbers},
+        {"runs", &result->runs},
+        {"intermediate_runs", &result->intermediate_runs},
+        {"input_bytes", &result->input_bytes},
+        {"spill_bytes", &result->spill_bytes},
+        {"merge_read_bytes", &result->merge_read_bytes},
+        {"merge_write_bytes", &result->merge_write_bytes},
+    };
+
+    FILE *in = fopen(path, "r");
+    if (in == NULL)
+    {
+        result->ok = false;
+        return;
+    }
+
+    char name[64];
+    long long value;
+    while (fscanf(in, "%63s %lld", name, &value) == 2)
+    {
+        for (unsigned long f = 0; f < sizeof(fields) / sizeof(fields[0]); f++)
+        {
+            if (strcmp(name, fields[f].name) == 0)
+            {
+                *fields[f].value = value;
+            }
+        }
+    }
+    fclose(in);
+}
+
+/** Проверить результат: числа не убывают, их столько же и сумма та же */
+static bool check_result(const char *path, long long count, long long sum)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    file_read_state *state = file_read_state_new(fd, READ_BUFFER_SIZE);
+    int numbers[1024];
+    int read_count;
+    long long seen = 0;
+    long long seen_sum = 0;
+    long long previous = LLONG_MIN;
+    bool sorted = true;
+    while ((read_count = file_read_state_get_numbers(state, numbers, 1024)) > 0)
+    {
+        for (int i = 0; i < read_count; i++)
+        {
+            sorted &= previous <= numbers[i];
+            previous = numbers[i];
+            seen_sum += numbers[i];
+        }
+        seen += read_count;
+    }
+    file_read_state_delete(state);
+    close(fd);
+    return sorted && seen == count && seen_sum == sum;
+}
+
+/** Запустить сортировщик в каталоге dir на файлах набора */
+static void run_sorter(const char *sorter, const char *dir, int coro_count, const char *memory, int threads,
+                       run_result_t *result)
+{
+    char coro_arg[16];
+    char threads_arg[16];
+    snprintf(coro_arg, sizeof(coro_arg), "%d", coro_count);
+    snprintf(threads_arg, sizeof(threads_arg), "%d", threads);
+
+    const char *argv[9 + FILES + 1] = {sorter, "-c", coro_arg, "-m", memory, "-t", threads_arg, "-S", "stats.txt"};
+    char inputs[FILES][16];
+    for (int f = 0; f < FILES; f++)
+    {
+        snprintf(inputs[f], sizeof(inputs[f]), "input%d.txt", f);
+        argv[9 + f] = inputs[f];
+    }
+
+    struct timespec start, end, diff;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    pid_t pid = fork();
+    if (pid == -1)
+    {
+        perror("fork");
+        exit(1);
+    }
+
+    if (pid == 0)
+    {
+        /* Сортировщик пишет result.txt в текущий каталог, а его вывод CSV не нужен */
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (chdir(dir) == -1 || null_fd == -1)
+        {
+            perror("chdir");
+            _exit(127);
+        }
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+        execv(sorter, (char *const *)argv);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) == -1)
+    {
+        perror("wait4");
+        exit(1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    timespec_sub(&end, &start, &diff);
+
+    memset(result, 0, sizeof(*result));
+    result->wall_ms = diff.tv_sec * 1e3 + diff.tv_nsec / 1e6;
+    result->peak_rss_kb = usage.ru_maxrss;
+    result->ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/stats.txt", dir);
+    read_stats(path, result);
+}
+
+int main(int argc, const char **argv)
+{
+    long long count = argc < 2
+                          ? 4 * 1000 * 1000
+                          : strtoll(argv[1], NULL, 10);
+
+    char sorter[PATH_MAX];
+    if (argc < 3)
+    {
+        /* По умолчанию сортировщик собран рядом с бенчмарком */
+        const char *slash = strrchr(argv[0], '/');
+        int dir_length = slash == NULL ? 1 : (int)(slash - argv[0]);
+        snprintf(sorter, sizeof(sorter), "%.*s/coroutines", dir_length, slash == NULL ? "." : argv[0]);
+    }
+    else
+    {
+        snprintf(sorter, sizeof(sorter), "%s", argv[2]);
+    }
+    /* Сортировщик запускается из каталога с данными, поэтому путь должен быть абсолютным */
+    char sorter_path[PATH_MAX];
+    if (realpath(sorter, sorter_path) == NULL || access(sorter_path, X_OK) == -1)
+    {
+        fprintf(stderr, "Не найден сортировщик: %s\n", sorter);
+        return 1;
+    }
+
+    char dir[] = "/tmp/bench_sorter.XXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    const int coro_counts[] = {1, 4};
+    const char *memories[] = {"1M", "16M", "256M"};
+    const int thread_counts[] = {1, 2};
+
+    printf("dataset,numbers,coro,memory,threads,wall_ms,sort_ms,merge_ms,parse_ms,radix_ms,spill_ms,presorted,runs,"
+           "intermediate_runs,input_bytes,spill_bytes,merge_read_bytes,merge_write_bytes,peak_rss_kb,ok\n");
+    for (int d = 0; d < (int)(sizeof(DATASET_NAMES) / sizeof(DATASET_NAMES[0])); d++)
+    {
+        long long sum = generate_dataset(dir, (dataset_t)d, count);
+        for (unsigned long c = 0; c < sizeof(coro_counts) / sizeof(coro_counts[0]); c++)
+        {
+            for (unsigned long m = 0; m < sizeof(memories) / sizeof(memories[0]); m++)
+            {
+                for (unsigned long t = 0; t < sizeof(thread_counts) / sizeof(thread_counts[0]); t++)
+                {
+                    run_result_t r;
+                    run_sorter(sorter_path, dir, coro_counts[c], memories[m], thread_counts[t], &r);
+
+                    char result_path[PATH_MAX];
+                    snprintf(result_path, sizeof(result_path), "%s/result.txt", dir);
+                    r.ok = r.ok && check_result(result_path, count, sum);
+
+                    printf("%s,%lld,%d,%s,%d,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%s\n",
+                           DATASET_NAMES[d], count, coro_counts[c], memories[m], thread_counts[t], r.wall_ms,
+                           r.sort_wall_ns / 1e6, r.merge_wall_ns / 1e6, r.parse_ns / 1e6, r.sort_ns / 1e6,
+                           r.spill_ns / 1e6, r.presorted_numbers, r.runs, r.intermediate_runs, r.input_bytes, r.spill_bytes,
+                           r.merge_read_bytes, r.merge_write_bytes, r.peak_rss_kb, r.ok ? "yes" : "no");
+                    fflush(stdout);
+                }
+            }
+        }
+        remove_dataset(dir);
+    }
+
+    rmdir(dir);
+    return 0;
+}
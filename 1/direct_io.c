@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "direct_io.h"
+
+bool direct_output_init(direct_output_t *out, int fd, int buffer_size)
+{
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1)
+    {
+        return false;
+    }
+
+    /* У пайпа позиции нет, а с невыровненной позиции O_DIRECT писать не может */
+    off_t offset = lseek(fd, 0, SEEK_CUR);
+    if (offset == -1 || offset % DIRECT_IO_ALIGNMENT != 0)
+    {
+        return false;
+    }
+
+    /* Файловые системы без поддержки O_DIRECT (например, tmpfs) отвечают EINVAL */
+    if (fcntl(fd, F_SETFL, flags | O_DIRECT) == -1)
+    {
+        return false;
+    }
+
+    size_t size = (buffer_size + DIRECT_IO_ALIGNMENT - 1) / DIRECT_IO_ALIGNMENT * DIRECT_IO_ALIGNMENT;
+    for (int i = 0; i < 2; i++)
+    {
+        void *buffer = NULL;
+        if (posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, size) != 0)
+        {
+            perror("posix_memalign");
+            exit(1);
+        }
+        out->buffers[i] = (char *)buffer;
+    }
+
+    out->fd = fd;
+    out->saved_flags = flags;
+    out->direct = true;
+    out->current = 0;
+    out->in_flight = false;
+    out->offset = offset;
+    return true;
+}
+
+void direct_output_free(direct_output_t *out)
+{
+    assert(!out->in_flight);
+    free(out->buffers[0]);
+    free(out->buffers[1]);
+    out->buffers[0] = NULL;
+    out->buffers[1] = NULL;
+    /* Вне планировщика io_uring потока больше никому не нужен */
+    if (coro_this() == NULL)
+    {
+        coro_io_release();
+    }
+}
+
+/** Вернуть дескриптору исходные флаги: дальше запись идет через кэш страниц */
+static void disable_direct(direct_output_t *out)
+{
+    if (fcntl(out->fd, F_SETFL, out->saved_flags) == -1)
+    {
+        perror("fcntl");
+        exit(1);
+    }
+    out->direct = false;
+}
+
+/**
+ * Записать size байт со смещения offset и дождаться завершения.
+ * Если файловая система все-таки отвергла O_DIRECT (EINVAL), запись повторяется и дальше идет без него
+ */
+static void write_at(direct_output_t *out, const char *data, size_t size, off_t offset)
+{
+    while (0 < size)
+    {
+        coro_pwrite_start(&out->op, out->fd, data, size, offset);
+        ssize_t written = coro_io_wait(&out->op);
+        if (written == -1 && errno == EINVAL && out->direct)
+        {
+            disable_direct(out);
+            continue;
+        }
+
+        if (written == -1)
+        {
+            perror("write");
+            exit(1);
+        }
+
+        data += written;
+        size -= written;
+        offset += written;
+    }
+}
+
+/** Дождаться записи второго буфера, дописав то, что не записалось */
+static void wait_in_flight(direct_output_t *out)
+{
+    if (!out->in_flight)
+    {
+        return;
+    }
+
+    out->in_flight = false;
+    ssize_t written = coro_io_wait(&out->op);
+    if (written == -1 && errno == EINVAL && out->direct)
+    {
+        disable_direct(out);
+        written = 0;
+    }
+
+    if (written == -1)
+    {
+        perror("write");
+        exit(1);
+    }
+
+    const char *data = (const char *)out->op.buf;
+    write_at(out, data + written, out->op.count - written, out->op.offset + written);
+}
+
+char *direct_output_submit(direct_output_t *out, int size)
+{
+    assert(size % DIRECT_IO_ALIGNMENT == 0);
+
+    wait_in_flight(out);
+    coro_pwrite_start(&out->op, out->fd, out->buffers[out->current], size, out->offset);
+    out->in_flight = true;
+    out->offset += size;
+    out->current ^= 1;
+    return out->buffers[out->current];
+}
+
+void direct_output_finish(direct_output_t *out, int size)
+{
+    wait_in_flight(out);
+
+    const char *buffer = out->buffers[out->current];
+    int aligned = size - size % DIRECT_IO_ALIGNMENT;
+    write_at(out, buffer, aligned, out->offset);
+    if (out->direct)
+    {
+        disable_direct(out);
+    }
+    write_at(out, buffer + aligned, size - aligned, out->offset + aligned);
+    out->offset += size;
+
+    if (lseek(out->fd, out->offset, SEEK_SET) == -1)
+    {
+        perror("lseek");
+        exit(1);
+    }
+}
@@ -8,51 +8,318 @@
 #include <stdio.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <time.h>
 
 #include "external_sort.h"
 #include "libcoro.h"
 #include "number_file_reader.h"
-#include "insertion_sort.h"
+#include "utils.h"
+#include "radix_sort.h"
+#include "run_file.h"
+#include "page_writer.h"
 
-static void read_and_sort_coro(int src_fd, insertion_sort_state *is, int max_memory_bytes)
+/** Минимальное количество чисел в одной серии, даже если бюджет памяти меньше */
+#define MIN_RUN_CAPACITY 1024
+
+/** Сколько чисел читается за раз между вызовами yield() */
+#define READ_BATCH_SIZE 256
+
+/** Сколько чисел записывается в серию за раз между вызовами yield() */
+#define SPILL_BATCH_SIZE (64 * 1024)
+
+/** Размер буфера записи серии, если бюджет памяти его позволяет */
+#define SPILL_BUFFER_SIZE (256 * 1024)
+
+/** Какую часть бюджета памяти могут занять буферы записи (1/SPILL_BUDGET_SHARE) */
+#define SPILL_BUDGET_SHARE 4
+
+/** Сколько байт записей читается за раз между вызовами yield() */
+#define RECORD_READ_SIZE (256 * 1024)
+
+/**
+ * Сколько естественных серий буфера сбрасывается как есть, без сортировки.
+ * Если их больше, буфер сортируется: лишние серии дороже обойдутся слиянию
+ */
+#define NATURAL_RUNS_MAX 4
+
+/** Буфер, в котором накапливается очередная серия */
+typedef struct run_buffer
 {
-    file_read_state *read_state = file_read_state_new(src_fd, max_memory_bytes);
-    
-    int number;
-    yield();
-    while (file_read_state_get_next_number(read_state, &number))
+    /** Числа текущей серии */
+    int *array;
+    /** Вспомогательный массив того же размера для поразрядной сортировки */
+    int *scratch;
+    /** Максимальное количество чисел в серии */
+    int capacity;
+    /** Текущее количество чисел в серии */
+    int size;
+} run_buffer_t;
+
+static void run_buffer_init(run_buffer_t *rb, int capacity)
+{
+    rb->array = (int *)malloc(sizeof(int) * capacity);
+    rb->scratch = (int *)malloc(sizeof(int) * capacity);
+    rb->capacity = capacity;
+    rb->size = 0;
+}
+
+static void run_buffer_free(run_buffer_t *rb)
+{
+    free(rb->array);
+    free(rb->scratch);
+    rb->array = NULL;
+    rb->scratch = NULL;
+    rb->capacity = 0;
+    rb->size = 0;
+}
+
+/**
+ * Заполнить буфер серии числами из файла. Числа читаются пачками прямо в буфер серии.
+ * Возвращает false, если файл закончился
+ */
+static bool read_run_coro(file_read_state *read_state, run_buffer_t *rb)
+{
+    while (rb->size < rb->capacity)
     {
-        insertion_sort_insert(is, number);
+        int to_read = rb->capacity - rb->size;
+        if (READ_BATCH_SIZE < to_read)
+        {
+            to_read = READ_BATCH_SIZE;
+        }
+
+        int read_count = file_read_state_get_numbers(read_state, rb->array + rb->size, to_read);
+        rb->size += read_count;
+        if (read_count < to_read)
+        {
+            return false;
+        }
+
         yield();
     }
 
-    file_read_state_delete(read_state);
+    return true;
 }
 
-static void save_to_temp_file_coro(insertion_sort_state *is, int fd)
+/**
+ * Время работы текущей корутины, нс. Время, пока работали другие корутины, не входит -
+ * поэтому фазы корутин одного потока можно складывать. Вне планировщика - просто монотонное время
+ */
+static long long work_time_ns()
 {
-    char *buffer = (char*) insertion_sort_array(is);
-    int array_size = insertion_sort_size(is);
-    int left = array_size * sizeof(int);
+    struct timespec time;
+    struct coro *this = coro_this();
+    if (this == NULL)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &time);
+    }
+    else
+    {
+        coro_stats_t coro_stats_value;
+        coro_stats(this, &coro_stats_value);
+        time = coro_stats_value.worktime;
+    }
+
+    return time.tv_sec * 1000000000LL + time.tv_nsec;
+}
+
+/**
+ * Естественная серия буфера (как в timsort): неубывающая либо строго убывающая последовательность.
+ * Строго - чтобы разворот не переставлял равные числа
+ */
+typedef struct natural_run
+{
+    int start;
+    int end;
+    bool descending;
+} natural_run_t;
+
+/**
+ * Разбить буфер на естественные серии. Возвращает их количество,
+ * либо max_count + 1, если серий больше - тогда просмотр прекращается сразу, и на случайных данных он почти ничего не стоит
+ */
+static int find_natural_runs(const int *array, int size, natural_run_t *natural, int max_count)
+{
+    int count = 0;
     int pos = 0;
-    while (0 < left)
+    while (pos < size)
     {
-        int written = write(fd, buffer + pos, left);
-        if (written == -1)
+        if (count == max_count)
         {
-            perror("write");
-            exit(1);
+            return max_count + 1;
+        }
+
+        int end = pos + 1;
+        bool descending = end < size && array[end] < array[pos];
+        if (descending)
+        {
+            while (end < size && array[end] < array[end - 1])
+            {
+                ++end;
+            }
+        }
+        else
+        {
+            while (end < size && array[end - 1] <= array[end])
+            {
+                ++end;
+            }
+        }
+
+        natural[count++] = (natural_run_t){.start = pos, .end = end, .descending = descending};
+        pos = end;
+    }
+
+    return count;
+}
+
+static void reverse_numbers(int *array, int start, int end)
+{
+    for (int left = start, right = end - 1; left < right; left++, right--)
+    {
+        int tmp = array[left];
+        array[left] = array[right];
+        array[right] = tmp;
+    }
+}
+
+/**
+ * Упорядочить буфер: если он состоит не более чем из max_count естественных серий,
+ * убывающие разворачиваются на месте, иначе буфер сортируется целиком.
+ * Возвращает количество получившихся отсортированных кусков (natural)
+ */
+static int sort_natural_runs(run_buffer_t *rb, natural_run_t *natural, int max_count, external_sort_stats_t *stats)
+{
+    int count = find_natural_runs(rb->array, rb->size, natural, max_count);
+    if (max_count < count)
+    {
+        radix_sort_int32(rb->array, rb->scratch, rb->size);
+        natural[0] = (natural_run_t){.start = 0, .end = rb->size, .descending = false};
+        return 1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (natural[i].descending)
+        {
+            reverse_numbers(rb->array, natural[i].start, natural[i].end);
+        }
+    }
+    stats->presorted_numbers += rb->size;
+    return count;
+}
+
+/**
+ * Серия, в которую еще можно дописывать: пока следующие числа не меньше последнего записанного,
+ * они продолжают ту же серию - даже из следующего буфера. Уже отсортированный файл дает одну серию
+ */
+typedef struct open_run
+{
+    /** Серия, либо NULL, если открытой серии нет */
+    sorted_run_t *run;
+    run_writer_t writer;
+    /** Последнее записанное число */
+    int last;
+} open_run_t;
+
+/** Дописать отсортированные числа в открытую серию */
+static void append_to_run_coro(open_run_t *open, const int *numbers, int count)
+{
+    for (int pos = 0; pos < count; pos += SPILL_BATCH_SIZE)
+    {
+        int batch = count - pos;
+        if (SPILL_BATCH_SIZE < batch)
+        {
+            batch = SPILL_BATCH_SIZE;
         }
 
-        pos += written;
-        left -= written;
+        run_writer_write_many(&open->writer, numbers + pos, batch);
         yield();
     }
+    open->last = numbers[count - 1];
+}
+
+/** Закончить открытую серию и добавить ее в стек серий */
+static void close_run(open_run_t *open, stack_t *runs, external_sort_stats_t *stats)
+{
+    if (open->run == NULL)
+    {
+        return;
+    }
+
+    run_writer_finish(&open->writer);
+    stats->bytes_written += open->writer.bytes_written;
+    run_writer_free(&open->writer);
+    /* До слияния серия не должна занимать дескриптор */
+    temp_file_close(open->run->file);
+    stack_push(runs, open->run);
+    ++stats->runs;
+    open->run = NULL;
+}
+
+/**
+ * Рассчитать размер буфера записи серии.
+ * Буферы записи (при O_DIRECT их два) занимают не больше 1/SPILL_BUDGET_SHARE бюджета,
+ * иначе при маленьком -m и многих корутинах одни только буферы превысили бы лимит.
+ * Размер кратен DIRECT_IO_ALIGNMENT, как того требует запись через O_DIRECT
+ */
+static int get_spill_buffer_size(const external_sort_options_t *options)
+{
+    long long buffers = options->direct_io ? 2 : 1;
+    long long size = options->max_memory_bytes / SPILL_BUDGET_SHARE / buffers;
+    size -= size % DIRECT_IO_ALIGNMENT;
+    if (size < DIRECT_IO_ALIGNMENT)
+    {
+        return DIRECT_IO_ALIGNMENT;
+    }
+
+    return size < SPILL_BUFFER_SIZE
+               ? (int)size
+               : SPILL_BUFFER_SIZE;
+}
+
+/**
+ * Упорядочить накопленные числа и сбросить их в серии.
+ * Каждый отсортированный кусок продолжает открытую серию, если не меньше ее последнего числа, иначе начинает новую
+ */
+static void spill_run_coro(run_buffer_t *rb, open_run_t *open, stack_t *runs, const external_sort_options_t *options,
+                           external_sort_stats_t *stats)
+{
+    long long start = work_time_ns();
+    natural_run_t natural[NATURAL_RUNS_MAX];
+    int count = sort_natural_runs(rb, natural, NATURAL_RUNS_MAX, stats);
+    long long sorted = work_time_ns();
+
+    for (int i = 0; i < count; i++)
+    {
+        const int *numbers = rb->array + natural[i].start;
+        if (open->run != NULL && numbers[0] < open->last)
+        {
+            close_run(open, runs, stats);
+        }
+
+        if (open->run == NULL)
+        {
+            open->run = sorted_run_new();
+            run_writer_init(&open->writer, temp_file_fd(open->run->file), get_spill_buffer_size(options), options->run_format,
+                            &open->run->index);
+            if (options->direct_io)
+            {
+                run_writer_enable_direct(&open->writer);
+            }
+        }
+        append_to_run_coro(open, numbers, natural[i].end - natural[i].start);
+    }
+
+    stats->sort_ns += sorted - start;
+    stats->spill_ns += work_time_ns() - sorted;
+    stats->numbers += rb->size;
+    rb->size = 0;
 }
 
 static int get_chunk_read_size()
 {
-    int result = (int) sysconf(_SC_PAGESIZE); 
+    int result = (int) sysconf(_SC_PAGESIZE);
     if (result == -1)
     {
         return 4096 /* Размер по умолчанию, думаю на большинстве систем такое значение */;
@@ -61,16 +328,385 @@ static int get_chunk_read_size()
     return result;
 }
 
-void sort_file_external_coro(int src_fd, int temp_fd)
+/**
+ * Рассчитать максимальное количество чисел в серии.
+ * Из бюджета вычитаются буферы чтения и записи (при O_DIRECT их два), а оставшееся делится между массивом серии и вспомогательным массивом
+ */
+static int get_run_capacity(const external_sort_options_t *options, int chunk_size)
+{
+    long long spill_memory = options->direct_io
+                                 ? 2LL * get_spill_buffer_size(options)
+                                 : get_spill_buffer_size(options);
+    long long capacity = (options->max_memory_bytes - chunk_size - spill_memory) / (long long)(2 * sizeof(int));
+    if (capacity < MIN_RUN_CAPACITY)
+    {
+        return MIN_RUN_CAPACITY;
+    }
+
+    if (INT_MAX / (int)sizeof(int) < capacity)
+    {
+        return INT_MAX / (int)sizeof(int);
+    }
+
+    return (int)capacity;
+}
+
+/** Прочитать очередную серию, учитывая время разбора */
+static bool read_run_timed_coro(file_read_state *read_state, run_buffer_t *rb, external_sort_stats_t *stats)
+{
+    long long start = work_time_ns();
+    bool has_more = read_run_coro(read_state, rb);
+    stats->parse_ns += work_time_ns() - start;
+    return has_more;
+}
+
+/**
+ * Дочитать файл сериями: как только буфер заполнился - упорядочиваем его и сбрасываем во временный файл.
+ * Уже прочитанные в буфер числа идут первыми
+ */
+static void spill_remaining_runs_coro(file_read_state *read_state, run_buffer_t *rb, stack_t *runs,
+                                      const external_sort_options_t *options, external_sort_stats_t *stats)
+{
+    open_run_t open;
+    open.run = NULL;
+    bool has_more;
+    do
+    {
+        has_more = read_run_timed_coro(read_state, rb, stats);
+        if (0 < rb->size)
+        {
+            spill_run_coro(rb, &open, runs, options, stats);
+        }
+    } while (has_more);
+
+    long long start = work_time_ns();
+    close_run(&open, runs, stats);
+    stats->spill_ns += work_time_ns() - start;
+}
+
+/** Отсортировать серию (если она еще не упорядочена) и записать ее текстом в результат - когда серия единственная */
+static void write_sorted_coro(run_buffer_t *rb, int result_fd, const external_sort_options_t *options,
+                              external_sort_stats_t *stats)
 {
-    insertion_sort_state sorted_state;
-    insertion_sort_init(&sorted_state);
+    long long start = work_time_ns();
+    natural_run_t natural;
+    sort_natural_runs(rb, &natural, 1, stats);
+    long long sorted = work_time_ns();
 
-    /* Вначале читаем файл и одновременно строим сортированный массив */
-    read_and_sort_coro(src_fd, &sorted_state, get_chunk_read_size());
-    
-    /* После сохраняем готовый сортированный массив в результирующий файл */
-    save_to_temp_file_coro(&sorted_state, temp_fd);
+    page_writer_t writer;
+    page_writer_init(&writer, result_fd, get_spill_buffer_size(options));
+    if (options->direct_io)
+    {
+        page_writer_enable_direct(&writer);
+    }
+    for (int pos = 0; pos < rb->size; pos += SPILL_BATCH_SIZE)
+    {
+        int count = rb->size - pos;
+        if (SPILL_BATCH_SIZE < count)
+        {
+            count = SPILL_BATCH_SIZE;
+        }
 
-    insertion_sort_free(&sorted_state);
+        page_writer_write_many(&writer, rb->array + pos, count);
+        yield();
+    }
+    page_writer_flush(&writer);
+
+    stats->sort_ns += sorted - start;
+    stats->spill_ns += work_time_ns() - sorted;
+    stats->bytes_written += writer.bytes_written;
+    stats->numbers += rb->size;
+    page_writer_free(&writer);
+    rb->size = 0;
+}
+
+/** Создать объект чтения исходного файла выбранным способом */
+static file_read_state *open_read_state(int src_fd, const external_sort_options_t *options, int chunk_size)
+{
+    /*
+     * Отображенный файл не занимает кучу: его страницы лежат в кэше страниц и
+     * отпускаются по мере чтения, поэтому из бюджета вычитается только буфер read()
+     */
+    return options->reader == FILE_READER_MMAP
+               ? file_read_state_new_mmap(src_fd, chunk_size)
+               : file_read_state_new(src_fd, chunk_size);
+}
+
+/** Буфер, в котором накапливается очередная серия записей */
+typedef struct record_buffer
+{
+    /** Записи текущей серии подряд */
+    char *array;
+    /** Вспомогательный буфер того же размера для поразрядной сортировки */
+    char *scratch;
+    /** Максимальное количество записей в серии */
+    int capacity;
+    /** Текущее количество записей в серии */
+    int size;
+} record_buffer_t;
+
+static void record_buffer_init(record_buffer_t *rb, int capacity, int width)
+{
+    rb->array = (char *)malloc((size_t)capacity * width);
+    rb->scratch = (char *)malloc((size_t)capacity * width);
+    rb->capacity = capacity;
+    rb->size = 0;
+}
+
+static void record_buffer_free(record_buffer_t *rb)
+{
+    free(rb->array);
+    free(rb->scratch);
+    rb->array = NULL;
+    rb->scratch = NULL;
+    rb->capacity = 0;
+    rb->size = 0;
+}
+
+/** Исходный файл записей. Он читается прямо в буфер серии - разбирать нечего */
+typedef struct record_source
+{
+    int fd;
+    /** Сколько байт осталось прочитать, либо -1 - до конца файла */
+    long long remaining;
+    /** Сколько байт прочитано */
+    long long bytes_read;
+} record_source_t;
+
+/** Максимальное количество записей в серии: бюджет без буфера записи делится между буфером серии и вспомогательным */
+static int get_record_capacity(const external_sort_options_t *options, int width)
+{
+    long long capacity = (options->max_memory_bytes - get_spill_buffer_size(options)) / (2LL * width);
+    if (capacity < MIN_RUN_CAPACITY)
+    {
+        return MIN_RUN_CAPACITY;
+    }
+
+    if (INT_MAX / width < capacity)
+    {
+        return INT_MAX / width;
+    }
+
+    return (int)capacity;
+}
+
+/** Заполнить буфер серии записями из файла. Возвращает false, если файл закончился */
+static bool read_records_coro(record_source_t *source, record_buffer_t *rb, int width)
+{
+    long long capacity_bytes = (long long)rb->capacity * width;
+    long long filled = (long long)rb->size * width;
+    while (filled < capacity_bytes)
+    {
+        long long to_read = capacity_bytes - filled;
+        if (RECORD_READ_SIZE < to_read)
+        {
+            to_read = RECORD_READ_SIZE;
+        }
+        if (0 <= source->remaining && source->remaining < to_read)
+        {
+            to_read = source->remaining;
+        }
+
+        int read_count = to_read == 0
+                             ? 0
+                             : coro_read(source->fd, rb->array + filled, (int)to_read);
+        if (read_count == -1)
+        {
+            perror("read");
+            exit(1);
+        }
+
+        if (read_count == 0)
+        {
+            if (filled % width != 0)
+            {
+                fprintf(stderr, "Размер файла не кратен размеру записи (%d байт)\n", width);
+                exit(1);
+            }
+
+            rb->size = (int)(filled / width);
+            return false;
+        }
+
+        filled += read_count;
+        source->bytes_read += read_count;
+        if (0 <= source->remaining)
+        {
+            source->remaining -= read_count;
+        }
+
+        yield();
+    }
+
+    rb->size = rb->capacity;
+    return true;
+}
+
+/** Записать отсортированные записи в файл, возвращает количество записанных байт */
+static long long write_records_coro(record_buffer_t *rb, int fd, int width, int buffer_size)
+{
+    record_writer_t writer;
+    record_writer_init(&writer, fd, buffer_size, width);
+    int batch = SPILL_BATCH_SIZE * (int)sizeof(int) / width;
+    if (batch < 1)
+    {
+        batch = 1;
+    }
+
+    for (int pos = 0; pos < rb->size; pos += batch)
+    {
+        int count = rb->size - pos;
+        if (batch < count)
+        {
+            count = batch;
+        }
+
+        record_writer_write_many(&writer, rb->array + (long long)pos * width, count);
+        yield();
+    }
+    record_writer_flush(&writer);
+
+    long long bytes_written = writer.bytes_written;
+    record_writer_free(&writer);
+    return bytes_written;
+}
+
+/**
+ * Отсортировать накопленные записи и записать их: в новую серию или, если result_fd != -1, сразу в результат
+ */
+static void spill_records_coro(record_buffer_t *rb, stack_t *runs, int result_fd, const external_sort_options_t *options,
+                               external_sort_stats_t *stats)
+{
+    const record_format_t *format = &options->record;
+    int buffer_size = get_spill_buffer_size(options);
+    long long start = work_time_ns();
+    radix_sort_records(rb->array, rb->scratch, rb->size, format->width, format->key_offset);
+    long long sorted = work_time_ns();
+
+    if (result_fd == -1)
+    {
+        sorted_run_t *run = sorted_run_new();
+        stats->bytes_written += write_records_coro(rb, temp_file_fd(run->file), format->width, buffer_size);
+        temp_file_close(run->file);
+        stack_push(runs, run);
+        ++stats->runs;
+    }
+    else
+    {
+        stats->bytes_written += write_records_coro(rb, result_fd, format->width, buffer_size);
+    }
+
+    stats->sort_ns += sorted - start;
+    stats->spill_ns += work_time_ns() - sorted;
+    stats->numbers += rb->size;
+    rb->size = 0;
+}
+
+/**
+ * Сортировка двоичных записей - тот же конвейер, что и для чисел: серии по бюджету памяти,
+ * поразрядная сортировка по ключу и сброс во временные файлы.
+ * Если result_fd != -1 и все записи поместились в одну серию, она пишется сразу в result_fd (возвращается true)
+ */
+static bool sort_records_coro(int src_fd, long long length, int result_fd, stack_t *runs,
+                              const external_sort_options_t *options, external_sort_stats_t *stats)
+{
+    const record_format_t *format = &options->record;
+    record_source_t source = {src_fd, length, 0};
+    record_buffer_t rb;
+    record_buffer_init(&rb, get_record_capacity(options, format->width), format->width);
+
+    yield();
+    bool has_more = true;
+    bool in_memory = false;
+    for (bool first = true; has_more; first = false)
+    {
+        long long start = work_time_ns();
+        has_more = read_records_coro(&source, &rb, format->width);
+        stats->parse_ns += work_time_ns() - start;
+
+        in_memory = first && !has_more && result_fd != -1;
+        if (0 < rb.size || in_memory)
+        {
+            spill_records_coro(&rb, runs, in_memory ? result_fd : -1, options, stats);
+        }
+    }
+
+    stats->bytes_read += source.bytes_read;
+    record_buffer_free(&rb);
+    return in_memory;
+}
+
+bool sort_stream_coro(int src_fd, int result_fd, stack_t *runs, const external_sort_options_t *options,
+                      external_sort_stats_t *stats)
+{
+    external_sort_stats_t local_stats = {0};
+    if (stats == NULL)
+    {
+        stats = &local_stats;
+    }
+
+    if (options->record.width != 0)
+    {
+        return sort_records_coro(src_fd, -1, result_fd, runs, options, stats);
+    }
+
+    int chunk_size = get_chunk_read_size();
+    file_read_state *read_state = open_read_state(src_fd, options, chunk_size);
+
+    /*
+     * Буфер серии выделяется на весь бюджет, но malloc такого размера отображает память лениво:
+     * для небольшого ввода в RSS попадают только страницы, до которых дошло чтение
+     */
+    run_buffer_t rb;
+    run_buffer_init(&rb, get_run_capacity(options, chunk_size));
+
+    bool in_memory = !read_run_timed_coro(read_state, &rb, stats);
+    if (in_memory)
+    {
+        write_sorted_coro(&rb, result_fd, options, stats);
+    }
+    else
+    {
+        /* Буфер полон, поэтому первым делом он сбрасывается в серию */
+        spill_remaining_runs_coro(read_state, &rb, runs, options, stats);
+    }
+
+    stats->bytes_read += file_read_state_bytes_read(read_state);
+    run_buffer_free(&rb);
+    file_read_state_delete(read_state);
+    return in_memory;
+}
+
+void sort_file_external_coro(int src_fd, long long length, stack_t *runs, const external_sort_options_t *options,
+                             external_sort_stats_t *stats)
+{
+    external_sort_stats_t local_stats = {0};
+    if (stats == NULL)
+    {
+        stats = &local_stats;
+    }
+
+    if (options->record.width != 0)
+    {
+        sort_records_coro(src_fd, length, -1, runs, options, stats);
+        return;
+    }
+
+    int chunk_size = get_chunk_read_size();
+    file_read_state *read_state = open_read_state(src_fd, options, chunk_size);
+    if (0 <= length)
+    {
+        file_read_state_set_limit(read_state, length);
+    }
+
+    run_buffer_t rb;
+    run_buffer_init(&rb, get_run_capacity(options, chunk_size));
+
+    /* Пустой файл серий не порождает */
+    yield();
+    spill_remaining_runs_coro(read_state, &rb, runs, options, stats);
+
+    stats->bytes_read += file_read_state_bytes_read(read_state);
+    run_buffer_free(&rb);
+    file_read_state_delete(read_state);
 }
@@ -0,0 +1,73 @@
+#ifndef DIRECT_IO_H
+#define DIRECT_IO_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "libcoro.h"
+
+/** Выравнивание адресов буферов, длин и смещений записи через O_DIRECT */
+#define DIRECT_IO_ALIGNMENT 4096
+
+/**
+ * @brief Запись в файл через O_DIRECT, мимо кэша страниц, с двумя выровненными буферами:
+ * пока один буфер пишется на диск, вызывающий заполняет второй.
+ * Запись идет по явным смещениям, начиная с позиции файла на момент direct_output_init
+ */
+typedef struct direct_output
+{
+    int fd;
+    /** Флаги дескриптора до включения O_DIRECT */
+    int saved_flags;
+    /** Пишется ли еще через O_DIRECT: если файловая система отвергла первую запись, дальше пишется обычным образом */
+    bool direct;
+    /** Буферы, выровненные по DIRECT_IO_ALIGNMENT */
+    char *buffers[2];
+    /** Какой буфер сейчас заполняется */
+    int current;
+    /** Запись второго буфера */
+    coro_io_op_t op;
+    bool in_flight;
+    /** Смещение следующей записи */
+    off_t offset;
+} direct_output_t;
+
+/**
+ * @brief Включить O_DIRECT на дескрипторе и выделить буферы.
+ * Не получится, если файловая система не принимает O_DIRECT (tmpfs, пайп) или позиция файла не выровнена -
+ * тогда писать нужно как обычно
+ *
+ * @param out Объект записи
+ * @param fd Дескриптор файла
+ * @param buffer_size Размер каждого буфера
+ * @return true O_DIRECT включен
+ */
+bool direct_output_init(direct_output_t *out, int fd, int buffer_size);
+
+/** Освободить буферы. Запись должна быть закончена через direct_output_finish */
+void direct_output_free(direct_output_t *out);
+
+/** Буфер, который сейчас заполняется */
+static inline char *direct_output_buffer(direct_output_t *out)
+{
+    return out->buffers[out->current];
+}
+
+/**
+ * @brief Отправить начало текущего буфера на запись и переключиться на второй буфер
+ * (дождавшись, пока закончится его предыдущая запись)
+ *
+ * @param out Объект записи
+ * @param size Сколько байт записать, кратно DIRECT_IO_ALIGNMENT
+ * @return char* Буфер, который теперь нужно заполнять
+ */
+char *direct_output_submit(direct_output_t *out, int size);
+
+/**
+ * @brief Дописать последние size байт текущего буфера и дождаться всех записей.
+ * Хвост, не кратный выравниванию, пишется уже без O_DIRECT. Флаги дескриптора восстанавливаются,
+ * а позиция файла ставится в конец записанного
+ */
+void direct_output_finish(direct_output_t *out, int size);
+
+#endif
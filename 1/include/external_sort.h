@@ -1,12 +1,76 @@
 #ifndef EXTERNAL_SORT_H
 #define EXTERNAL_SORT_H
 
+#include "stack.h"
+#include "number_file_reader.h"
+#include "run_file.h"
+#include "record_file.h"
+
+/** @brief Параметры сортировки одного файла */
+typedef struct external_sort_options
+{
+    /** Максимальный объем памяти (в байтах), который может быть использован для сортировки */
+    long long max_memory_bytes;
+    /** Способ чтения исходного файла */
+    file_reader_mode_t reader;
+    /** Формат временных файлов с сериями */
+    run_format_t run_format;
+    /** Формат двоичных записей. Если width == 0 - сортируются текстовые числа */
+    record_format_t record;
+    /** Писать серии через O_DIRECT, с двумя буферами записи (см. direct_output_t) */
+    bool direct_io;
+} external_sort_options_t;
+
+/**
+ * @brief Статистика сортировки: время фаз и объем ввода-вывода. Накапливается по всем вызовам.
+ * Время фаз - время работы корутины (см. coro_stats): пока работают другие корутины или идет ввод-вывод, оно не идет
+ */
+typedef struct external_sort_stats
+{
+    /** Чтение и разбор исходного файла, нс */
+    long long parse_ns;
+    /** Поразрядная сортировка серий, нс */
+    long long sort_ns;
+    /** Запись серий во временные файлы (или сразу результата, см. sort_stream_coro), нс */
+    long long spill_ns;
+    /** Сколько байт прочитано из исходных файлов */
+    long long bytes_read;
+    /** Сколько байт записано в серии (или в результат) */
+    long long bytes_written;
+    /** Сколько чисел (или записей) отсортировано */
+    long long numbers;
+    /** Сколько чисел не понадобилось сортировать: буфер уже состоял из нескольких естественных серий */
+    long long presorted_numbers;
+    /** Сколько серий создано */
+    int runs;
+} external_sort_stats_t;
+
 /** 
- * @brief Запустить корутину для внешней сортировки файла
- * @param src_fd Дескриптор исходного файла
- * @param temp_fd Дескриптор временного файла, куда необходимо записать результат
- * @param max_memory_bytes Максимальный объем памяти (в байтах), который может быть использован для сортировки
+ * @brief Запустить корутину для внешней сортировки файла.
+ * Числа из файла читаются в буфер ограниченного размера, буфер сортируется
+ * и сбрасывается во временный файл (серию). Так продолжается, пока файл не закончится
+ * @param src_fd Дескриптор исходного файла. Числа читаются с текущей позиции
+ * @param length Сколько байт прочитать (граница должна приходиться на разделитель), либо -1 - до конца файла
+ * @param runs Стек, в который добавляются отсортированные серии (sorted_run_t*)
+ * @param options Параметры сортировки
+ * @param stats Статистика, к которой прибавляется статистика этого файла, либо NULL
+ */
+void sort_file_external_coro(int src_fd, long long length, stack_t *runs, const external_sort_options_t *options,
+                             external_sort_stats_t *stats);
+
+/**
+ * @brief Отсортировать поток (стандартный ввод, пайп) и записать результат текстом в result_fd.
+ * Если все числа поместились в бюджет памяти, они сортируются в памяти и сразу пишутся в результат -
+ * без временных файлов. Иначе поток сортируется как файл (см. sort_file_external_coro),
+ * и серии из runs нужно слить в result_fd
+ * @param src_fd Дескриптор потока. Числа читаются до конца потока
+ * @param result_fd Дескриптор для результата
+ * @param runs Стек, в который добавляются отсортированные серии (sorted_run_t*)
+ * @param options Параметры сортировки
+ * @param stats Статистика, к которой прибавляется статистика потока, либо NULL
+ * @return true Результат уже записан, серий нет
  */
-void sort_file_external_coro(int src_fd, int temp_fd);
+bool sort_stream_coro(int src_fd, int result_fd, stack_t *runs, const external_sort_options_t *options,
+                      external_sort_stats_t *stats);
 
-#endif // EXTERNAL_SORT_H
\ No newline at end of file
+#endif // EXTERNAL_SORT_H
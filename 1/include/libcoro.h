@@ -1,6 +1,10 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/types.h>
 
 struct coro;
 typedef int (*coro_f)(void *);
@@ -27,6 +31,13 @@ coro_this(void);
 struct coro *
 coro_new(coro_f func, void *func_arg);
 
+/**
+ * Создать корутину со стеком заданного размера (округляется вверх до страницы).
+ * coro_new использует стек в 1 МБ
+ */
+struct coro *
+coro_new_with_stack(coro_f func, void *func_arg, size_t stack_size);
+
 /** Return status of the coroutine. */
 int
 coro_status(const struct coro *c);
@@ -38,7 +49,7 @@ coro_switch_count(const struct coro *c);
 bool
 coro_is_finished(const struct coro *c);
 
-/** Free coroutine stack and it itself. */
+/** Free coroutine stack (return it to the pool) and it itself. */
 void
 coro_delete(struct coro *c);
 
@@ -46,6 +57,72 @@ coro_delete(struct coro *c);
 void
 coro_yield(void);
 
+/** Способ выполнения coro_read/coro_write */
+typedef enum coro_io_backend
+{
+    /** io_uring, а если он недоступен - пул потоков. По умолчанию */
+    CORO_IO_URING,
+    /** Пул потоков, выполняющих read/write */
+    CORO_IO_THREADS,
+    /** Обычные блокирующие read/write */
+    CORO_IO_SYNC,
+} coro_io_backend_t;
+
+/** Задать способ ввода-вывода для корутин этого потока. Вызывается, пока нет незавершенных запросов */
+void
+coro_io_set_backend(coro_io_backend_t backend);
+
+/**
+ * Аналог read (с текущей позиции файла). Вызывающая корутина паркуется до завершения чтения,
+ * а процессор достается другим корутинам. Вне корутины - обычный read
+ */
+ssize_t
+coro_read(int fd, void *buf, size_t count);
+
+/** Аналог write, см. coro_read */
+ssize_t
+coro_write(int fd, const void *buf, size_t count);
+
+/**
+ * Запрос ввода-вывода, который выполняется, пока корутина работает дальше (см. coro_pwrite_start).
+ * Поля заполняет libcoro
+ */
+typedef struct coro_io_op
+{
+    bool is_write;
+    int fd;
+    void *buf;
+    size_t count;
+    /** Смещение в файле, либо -1 - текущая позиция */
+    off_t offset;
+    /** Корутина, которая ждет завершения, либо NULL */
+    struct coro *waiter;
+    bool done;
+    ssize_t result;
+    int error;
+    /** Следующий запрос в очереди пула потоков */
+    struct coro_io_op *next;
+} coro_io_op_t;
+
+/**
+ * Начать запись (как pwrite) и сразу вернуться: запрос выполняется, пока вызывающий работает дальше.
+ * Буфер нельзя менять, а корутину - завершать, пока запрос не дождались через coro_io_wait.
+ * Работает и вне корутин (тогда coro_io_wait просто блокирует поток). С CORO_IO_SYNC запись выполняется сразу
+ */
+void
+coro_pwrite_start(coro_io_op_t *op, int fd, const void *buf, size_t count, off_t offset);
+
+/** Дождаться завершения запроса. Возвращает результат как у pwrite, errno выставляется */
+ssize_t
+coro_io_wait(coro_io_op_t *op);
+
+/**
+ * Освободить io_uring и пул потоков этого потока. Для потоков без планировщика, которые
+ * пользовались coro_pwrite_start: планировщик освобождает их сам. Незавершенных запросов быть не должно
+ */
+void
+coro_io_release(void);
+
 #ifdef NO_CORO
 #define yield() (void)0
 #else
@@ -53,6 +130,12 @@ coro_yield(void);
 #endif /* NO_CORO */
 
 
+/**
+ * Количество корзин гистограммы задержек: в корзине i (i > 0) - задержки из [2^(i-1), 2^i) нс,
+ * в корзине 0 - нулевые. Последняя корзина собирает все задержки больше 2^38 нс (~4.6 мин)
+ */
+#define CORO_LATENCY_BUCKETS 40
+
 typedef struct coro_stats
 {
     /**
@@ -71,8 +154,101 @@ typedef struct coro_stats
      * @brief Суммарное время работы корутины
      */
     struct timespec worktime;
+
+    /**
+     * @brief Гистограмма задержек от момента, когда корутина стала готовой к работе
+     * (создана, отдала квант, дождалась ввода-вывода), до ее запуска
+     */
+    long long latency_histogram[CORO_LATENCY_BUCKETS];
+    /** Количество замеров задержки */
+    long long latency_samples;
+    /** Суммарная и максимальная задержка, нс */
+    long long total_latency_ns;
+    long long max_latency_ns;
 } coro_stats_t;
 
 /** Получить статистику работы этой корутины */
 void 
 coro_stats(struct coro *c, coro_stats_t *stats);
+
+/**
+ * Оценить процентиль задержки до запуска по гистограмме (с точностью до корзины), нс.
+ * fraction - доля замеров, например 0.99
+ */
+long long
+coro_stats_latency_percentile(const coro_stats_t *stats, double fraction);
+
+/** Почему произошло переключение */
+typedef enum coro_switch_reason
+{
+    /** Корутина отдала управление по истечении кванта */
+    CORO_SWITCH_QUANTUM,
+    /** Корутина ждет ввода-вывода (coro_read/coro_write) */
+    CORO_SWITCH_IO_WAIT,
+    /** Корутина завершилась */
+    CORO_SWITCH_FINISH,
+    /** Планировщик запустил готовую корутину */
+    CORO_SWITCH_SCHEDULE,
+} coro_switch_reason_t;
+
+/** Событие трассировки: переключение с корутины from на корутину to */
+typedef struct coro_trace_event
+{
+    /** Время переключения (CLOCK_MONOTONIC), нс */
+    long long time_ns;
+    /** Номера корутин в потоке, у планировщика - 0 */
+    int from;
+    int to;
+    coro_switch_reason_t reason;
+} coro_trace_event_t;
+
+typedef struct coro_trace coro_trace_t;
+
+/**
+ * Начать запись переключений корутин этого потока в кольцевой буфер на capacity событий
+ * (округляется до степени двойки). Когда буфер заполнен, старые события перезаписываются
+ */
+void
+coro_trace_start(int capacity);
+
+/** Остановить запись и забрать буфер (NULL, если запись не велась). Освобождается coro_trace_free */
+coro_trace_t *
+coro_trace_stop(void);
+
+void
+coro_trace_free(coro_trace_t *trace);
+
+/**
+ * Записать буферы нескольких потоков в формате Chrome trace event (JSON для chrome://tracing и Perfetto):
+ * поток - процесс, корутина - поток, отрезок работы корутины - событие "X" с причиной переключения
+ */
+void
+coro_trace_write_json(FILE *out, coro_trace_t **traces, int count);
+
+/**
+ * Стеки корутин отображаются через mmap со сторожевой страницей и после coro_delete
+ * возвращаются в пул (свой у каждого потока), откуда их берут следующие корутины того же размера
+ */
+typedef struct coro_stack_pool_stats
+{
+    /** Сколько стеков было отображено */
+    long long allocated;
+    /** Сколько раз стек был взят из пула */
+    long long reused;
+    /** Сколько стеков сейчас в пуле */
+    int cached;
+    /** Пиковый RSS процесса, КБ */
+    long long peak_rss_kb;
+} coro_stack_pool_stats_t;
+
+/** Задать, сколько освобожденных стеков держит пул (по умолчанию 16). Лишние стеки освобождаются */
+void
+coro_stack_pool_set_retention(int max_stacks);
+
+/** Освободить все стеки из пула этого потока */
+void
+coro_stack_pool_clear(void);
+
+/** Получить статистику пула стеков этого потока */
+void
+coro_stack_pool_stats(coro_stack_pool_stats_t *stats);
@@ -0,0 +1,106 @@
+#ifndef LOSER_TREE_H
+#define LOSER_TREE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Дерево проигравших (турнирное дерево) для k-путевого слияния.
+ * Каждый лист - очередное число одного из источников.
+ * Во внутренних узлах хранятся проигравшие соответствующего матча, победитель всего турнира хранится отдельно.
+ * После замены числа победителя достаточно переиграть матчи на пути от его листа до корня - log(k) сравнений без лишних перестановок
+ */
+typedef struct loser_tree
+{
+    /** Количество листьев (источников) */
+    int count;
+    /**
+     * Ключи листьев. Число хранится со сдвигом в беззнаковый диапазон,
+     * а исчерпанный источник - как значение больше любого числа.
+     * Благодаря этому матч - это одно сравнение
+     */
+    uint64_t *keys;
+    /** Внутренние узлы с индексами проигравших. В нулевом элементе - индекс победителя */
+    int *nodes;
+} loser_tree_t;
+
+/**
+ * @brief Инициализировать дерево для указанного количества источников.
+ * Изначально все источники считаются исчерпанными
+ *
+ * @param lt Дерево
+ * @param count Количество источников
+ */
+void loser_tree_init(loser_tree_t *lt, int count);
+
+/** Освободить ресурсы дерева */
+void loser_tree_free(loser_tree_t *lt);
+
+/**
+ * @brief Выставить начальное значение источника. Вызывается до loser_tree_build
+ *
+ * @param lt Дерево
+ * @param index Индекс источника
+ * @param key Первое число источника
+ */
+void loser_tree_set_leaf(loser_tree_t *lt, int index, int key);
+
+/** Провести турнир по всем листьям. Вызывается один раз после выставления начальных значений */
+void loser_tree_build(loser_tree_t *lt);
+
+/**
+ * @brief Получить текущее минимальное число и индекс его источника
+ *
+ * @return true Число есть
+ * @return false Все источники исчерпаны
+ */
+bool loser_tree_top(loser_tree_t *lt, int *key, int *index);
+
+/** Заменить число победителя следующим числом из того же источника */
+void loser_tree_replace_top(loser_tree_t *lt, int key);
+
+/** Пометить источник победителя исчерпанным */
+void loser_tree_pop_top(loser_tree_t *lt);
+
+/**
+ * @brief Дерево проигравших для 64-битных ключей (слияние записей).
+ * Ключи занимают весь диапазон uint64_t, поэтому исчерпанный источник отмечается отдельным флагом
+ */
+typedef struct loser_tree64
+{
+    int count;
+    /** Ключи листьев со сдвигом в беззнаковый диапазон */
+    uint64_t *keys;
+    /** Исчерпан ли источник */
+    bool *exhausted;
+    /** Внутренние узлы с индексами проигравших. В нулевом элементе - индекс победителя */
+    int *nodes;
+} loser_tree64_t;
+
+/** Инициализировать дерево для count источников, изначально все исчерпаны */
+void loser_tree64_init(loser_tree64_t *lt, int count);
+
+/** Освободить ресурсы дерева */
+void loser_tree64_free(loser_tree64_t *lt);
+
+/** Выставить начальный ключ источника. Вызывается до loser_tree64_build */
+void loser_tree64_set_leaf(loser_tree64_t *lt, int index, int64_t key);
+
+/** Провести турнир по всем листьям */
+void loser_tree64_build(loser_tree64_t *lt);
+
+/**
+ * @brief Получить индекс источника с минимальным ключом
+ *
+ * @return true Источник есть
+ * @return false Все источники исчерпаны
+ */
+bool loser_tree64_top(loser_tree64_t *lt, int *index);
+
+/** Заменить ключ победителя следующим ключом из того же источника */
+void loser_tree64_replace_top(loser_tree64_t *lt, int64_t key);
+
+/** Пометить источник победителя исчерпанным */
+void loser_tree64_pop_top(loser_tree64_t *lt);
+
+#endif
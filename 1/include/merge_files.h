@@ -1,13 +1,80 @@
 #ifndef MERGE_FILES_H
 #define MERGE_FILES_H
 
+#include "run_file.h"
+#include "record_file.h"
+
+struct temp_file_struct;
+
+/** Отсортированная серия: временный файл и его разреженный индекс */
+typedef struct sorted_run
+{
+    struct temp_file_struct *file;
+    run_index_t index;
+} sorted_run_t;
+
+/** Создать серию с новым временным файлом и пустым индексом */
+sorted_run_t *sorted_run_new();
+
+/** Удалить временный файл серии и освободить ее */
+void sorted_run_free(sorted_run_t *run);
+
+/** Алгоритм выбора очередного минимального числа при слиянии */
+typedef enum merge_strategy
+{
+    /** d-арная куча (priority_queue.c) */
+    MERGE_STRATEGY_HEAP,
+    /** Дерево проигравших (loser_tree.c) */
+    MERGE_STRATEGY_LOSER_TREE,
+} merge_strategy_t;
+
+/** Статистика слияния */
+typedef struct merge_stats
+{
+    /** Сколько промежуточных серий создано до последнего прохода */
+    int intermediate_runs;
+    /** Сколько байт прочитано: серии и части результата, слитые отдельными потоками */
+    long long bytes_read;
+    /** Сколько байт записано: промежуточные серии, части результата и сам результат */
+    long long bytes_written;
+} merge_stats_t;
+
+/** Параметры слияния */
+typedef struct merge_options
+{
+    /** Алгоритм выбора минимального числа */
+    merge_strategy_t strategy;
+    /** Объем памяти под буферы чтения и записи одного прохода слияния */
+    long long max_memory_bytes;
+    /** Максимальное количество серий, сливаемых за один проход. 0 - определяется лимитом дескрипторов и памятью */
+    int max_fan_in;
+    /** Размер буфера записи результата и промежуточных серий. 0 - размер по умолчанию (1 МБ) */
+    int write_buffer_size;
+    /** Формат серий: и исходных, и промежуточных */
+    run_format_t run_format;
+    /** Сколько потоков сливают последний проход: каждый - свой диапазон чисел. 1 - без потоков */
+    int threads;
+    /** Куда записать статистику слияния, либо NULL */
+    merge_stats_t *stats;
+    /**
+     * Формат двоичных записей (если width != 0): серии и результат - записи подряд.
+     * Записи сливаются в одном потоке, threads на них не влияет
+     */
+    record_format_t record;
+    /** Писать промежуточные серии и текстовый результат через O_DIRECT, с двумя буферами записи (см. direct_output_t) */
+    bool direct_io;
+} merge_options_t;
+
 /**
- * @brief Выполнить слияние файлов, с отсортированными значениями в указанный
+ * @brief Выполнить слияние файлов, с отсортированными значениями в указанный.
+ * Если серий больше, чем можно слить за раз, то выполняются промежуточные проходы:
+ * группы серий сливаются в новые временные серии, пока их количество не станет допустимым
  * 
  * @param result_fd Файл для записей результатов
- * @param fds Файловые дескрипторы файлов с отсортированными числами
- * @param count Размер массива файловых дескрипторов
+ * @param runs Отсортированные серии. Дескрипторы открываются на время слияния
+ * @param count Количество серий
+ * @param options Параметры слияния
  */
-void merge_files(int result_fd, int *fds, int count);
+void merge_files(int result_fd, sorted_run_t **runs, int count, const merge_options_t *options);
 
 #endif
\ No newline at end of file
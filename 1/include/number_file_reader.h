@@ -9,6 +9,31 @@
  */
 typedef struct file_read_state file_read_state;
 
+/**
+ * @brief Реализация поиска границ чисел.
+ * По умолчанию выбирается самая быстрая из поддерживаемых процессором
+ */
+typedef enum number_parser
+{
+    /** Посимвольный разбор */
+    NUMBER_PARSER_SCALAR,
+    /** Поиск разделителей по 16 байт (SSE2) */
+    NUMBER_PARSER_SSE2,
+    /** Поиск разделителей по 32 байта (AVX2) */
+    NUMBER_PARSER_AVX2,
+} number_parser_t;
+
+/**
+ * @brief Способ получения данных файла
+ */
+typedef enum file_reader_mode
+{
+    /** Чтение чанками через read() в собственный буфер */
+    FILE_READER_READ,
+    /** Отображение файла в память через mmap() - без копирования в буфер */
+    FILE_READER_MMAP,
+} file_reader_mode_t;
+
 /**
  * @brief Создать новый экземпляр для чтения чисел из файла
  * 
@@ -18,6 +43,26 @@ typedef struct file_read_state file_read_state;
  */
 file_read_state *file_read_state_new(int fd, int buffer_size);
 
+/**
+ * @brief Создать новый экземпляр для чтения чисел из файла, отображенного в память.
+ * Если файл нельзя отобразить (не обычный файл, пустой файл, ошибка mmap), используется чтение через read()
+ *
+ * @param fd Файловый дескриптор файла
+ * @param buffer_size Размер буфера для чтения, если отобразить файл не удалось
+ * @return file_read_state* Новый экземпляр
+ */
+file_read_state *file_read_state_new_mmap(int fd, int buffer_size);
+
+/**
+ * @brief Ограничить чтение: разбирается не больше length байт, начиная с текущей позиции файла.
+ * Вызывается сразу после создания, до чтения чисел. Граница должна приходиться на разделитель,
+ * иначе число на границе будет обрезано
+ *
+ * @param state Объект состояния
+ * @param length Сколько байт можно прочитать
+ */
+void file_read_state_set_limit(file_read_state *state, long long length);
+
 /**
  * @brief Очистить экземпляр, освободить занятые ресурсы
  * 
@@ -35,4 +80,32 @@ void file_read_state_delete(file_read_state *state);
  */
 bool file_read_state_get_next_number(file_read_state* state, int *number);
 
+/**
+ * @brief Прочитать из файла пачку чисел
+ * 
+ * @param state Указатель на объект чтения
+ * @param out Массив, в который записываются числа
+ * @param max Максимальное количество чисел, которое нужно прочитать
+ * @return int Количество прочитанных чисел. Меньше max только если файл закончился
+ */
+int file_read_state_get_numbers(file_read_state *state, int *out, int max);
+
+/**
+ * @brief Явно выбрать реализацию разбора чисел
+ * 
+ * @param state Указатель на объект чтения
+ * @param parser Реализация
+ * @return true Реализация выбрана
+ * @return false Процессор (или сборка) не поддерживает эту реализацию
+ */
+bool file_read_state_set_parser(file_read_state *state, number_parser_t parser);
+
+/**
+ * @brief Сколько байт файла уже прочитано: через read() или сдвигом окна отображения
+ *
+ * @param state Указатель на объект чтения
+ * @return long long Количество байт
+ */
+long long file_read_state_bytes_read(const file_read_state *state);
+
 #endif
\ No newline at end of file
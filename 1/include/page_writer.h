@@ -0,0 +1,73 @@
+#ifndef PAGE_WRITER_H
+#define PAGE_WRITER_H
+
+#include <stdbool.h>
+
+struct direct_output;
+
+/** Максимальная длина текстового представления int: знак + 10 цифр */
+#define MAX_INT_TEXT_LENGTH 11
+
+/**
+ * @brief Буферизированная запись чисел в файл текстом (через пробел).
+ * На диск всегда сбрасывается ровно capacity байт (кроме последнего сброса),
+ * для этого за буфером зарезервировано место под одно число, которое "перелилось" через границу
+ */
+typedef struct page_file_writer_state
+{
+    char *chunk;
+    int size;
+    int capacity;
+    int fd;
+    /** Сколько байт записано в файл */
+    long long bytes_written;
+    /** Запись через O_DIRECT (см. page_writer_enable_direct), либо NULL. Тогда chunk - ее текущий буфер */
+    struct direct_output *direct;
+} page_writer_t;
+
+/**
+ * @brief Инициализировать объект записи
+ *
+ * @param writer Объект записи
+ * @param fd Дескриптор файла
+ * @param capacity Размер буфера
+ */
+void page_writer_init(page_writer_t *writer, int fd, int capacity);
+
+/**
+ * @brief Писать мимо кэша страниц через O_DIRECT, с двумя буферами: пока один пишется, заполняется второй.
+ * Вызывается сразу после page_writer_init. После page_writer_flush запись снова идет обычным образом
+ *
+ * @param writer Объект записи, capacity кратна DIRECT_IO_ALIGNMENT
+ * @return false O_DIRECT недоступен (tmpfs, пайп) - запись идет как обычно
+ */
+bool page_writer_enable_direct(page_writer_t *writer);
+
+/** Освободить буфер. Несброшенные данные теряются */
+void page_writer_free(page_writer_t *writer);
+
+/** Сбросить все накопленные данные в файл */
+void page_writer_flush(page_writer_t *writer);
+
+/** Записать одно число */
+void page_writer_write(page_writer_t *writer, int number);
+
+/**
+ * @brief Записать пачку чисел
+ *
+ * @param writer Объект записи
+ * @param numbers Числа
+ * @param count Количество чисел
+ */
+void page_writer_write_many(page_writer_t *writer, const int *numbers, int count);
+
+/**
+ * @brief Записать текстовое представление числа (как "%d") без завершающего нуля
+ *
+ * @param dst Буфер, в нем должно быть хотя бы MAX_INT_TEXT_LENGTH байт
+ * @param number Число
+ * @return int Количество записанных символов
+ */
+int format_int(char *dst, int number);
+
+#endif
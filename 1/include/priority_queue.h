@@ -2,23 +2,60 @@
 #define PRIORITY_QUEUE_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
-typedef struct priority_queue_entry
-{
-    int key;
-    void *value;
-} pq_entry_t;
+/** Арность кучи: 4 потомка с 64-битными ключами занимают 32 байта и не пересекают границу кэш-линии */
+#define PRIORITY_QUEUE_ARITY 4
 
+/**
+ * @brief Приоритетная очередь на d-арной куче с минимумом в вершине.
+ * Ключи и значения хранятся в отдельных массивах: при просеивании читаются только ключи,
+ * а массив ключей выровнен так, что все потомки узла лежат в одной кэш-линии.
+ * Ключ 64-битный, поэтому в очереди можно хранить как числа серий, так и, например, моменты времени в наносекундах
+ */
 typedef struct priority_queue
 {
-    pq_entry_t *heap;
+    /** Ключи узлов. Указывает внутрь выровненного блока keys_block */
+    int64_t *keys;
+    /** Значения узлов */
+    void **values;
+    /** Выделенный блок под ключи */
+    int64_t *keys_block;
     int size;
     int capacity;
 } priority_queue_t;
 
 void priority_queue_init(priority_queue_t *pq);
 void priority_queue_delete(priority_queue_t *pq);
-void priority_queue_enqueue(priority_queue_t *pq, int key, void *value);
-bool priority_queue_try_dequeue(priority_queue_t *pq, int *key, void **value);
+void priority_queue_enqueue(priority_queue_t *pq, int64_t key, void *value);
+bool priority_queue_try_dequeue(priority_queue_t *pq, int64_t *key, void **value);
+
+/**
+ * @brief Получить минимальный элемент, не извлекая его
+ *
+ * @return true Элемент есть
+ * @return false Очередь пуста
+ */
+static inline bool priority_queue_peek(const priority_queue_t *pq, int64_t *key, void **value)
+{
+    if (pq->size == 0)
+    {
+        return false;
+    }
+
+    *key = pq->keys[0];
+    *value = pq->values[0];
+    return true;
+}
+
+/**
+ * @brief Заменить минимальный элемент новым: одно просеивание вниз вместо извлечения и вставки.
+ * Очередь не должна быть пустой
+ *
+ * @param pq Очередь
+ * @param key Новый ключ
+ * @param value Новое значение
+ */
+void priority_queue_replace_top(priority_queue_t *pq, int64_t key, void *value);
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,41 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <stdint.h>
+
+/**
+ * @brief Отсортировать массив 32-битных знаковых чисел поразрядной сортировкой (LSD).
+ * Используется 4 прохода по 8 бит, гистограммы всех разрядов строятся за один проход по массиву.
+ * Проходы, в которых у всех чисел одинаковый разряд, пропускаются
+ *
+ * @param array Массив чисел. В нем же сохраняется результат
+ * @param scratch Вспомогательный массив размером не меньше count элементов.
+ * Выделяется вызывающей стороной, после сортировки его содержимое не определено
+ * @param count Количество чисел в массиве
+ */
+void radix_sort_int32(int *array, int *scratch, int count);
+
+/**
+ * @brief Отсортировать массив 64-битных знаковых чисел поразрядной сортировкой (LSD): 8 проходов по 8 бит.
+ * Как и в radix_sort_int32, проходы с одинаковым разрядом у всех чисел пропускаются
+ *
+ * @param array Массив чисел. В нем же сохраняется результат
+ * @param scratch Вспомогательный массив размером не меньше count элементов
+ * @param count Количество чисел в массиве
+ */
+void radix_sort_int64(int64_t *array, int64_t *scratch, int count);
+
+/**
+ * @brief Отсортировать записи фиксированного размера по 64-битному знаковому ключу (LSD, без компаратора).
+ * Сортировка устойчивая: записи с одинаковым ключом сохраняют порядок.
+ * Если запись - это только ключ, сортировка сводится к radix_sort_int64
+ *
+ * @param records Записи подряд. В них же сохраняется результат
+ * @param scratch Вспомогательный буфер размером не меньше count * width байт
+ * @param count Количество записей
+ * @param width Размер записи в байтах
+ * @param key_offset Смещение ключа (int64_t в порядке байтов процессора) внутри записи
+ */
+void radix_sort_records(char *records, char *scratch, int count, int width, int key_offset);
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef RECORD_FILE_H
+#define RECORD_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+/** Максимальный размер записи: запись должна помещаться в страницу буфера чтения */
+#define RECORD_MAX_WIDTH 4096
+
+/**
+ * @brief Формат двоичных записей фиксированного размера с 64-битным знаковым ключом.
+ * Ключ хранится в порядке байтов процессора, остальные байты записи (полезная нагрузка) переносятся как есть.
+ * width == 0 - записей нет, сортируются текстовые числа
+ */
+typedef struct record_format
+{
+    /** Размер записи в байтах */
+    int width;
+    /** Смещение ключа внутри записи */
+    int key_offset;
+} record_format_t;
+
+/** Ключ записи */
+static inline int64_t record_key(const record_format_t *format, const char *record)
+{
+    int64_t key;
+    memcpy(&key, record + format->key_offset, sizeof(key));
+    return key;
+}
+
+/**
+ * @brief Буферизированная запись записей (серии или результата).
+ * На диск, как и в run_writer, сбрасывается ровно capacity байт - запись может разрезаться границей буфера
+ */
+typedef struct record_writer
+{
+    int fd;
+    int width;
+    char *chunk;
+    int size;
+    int capacity;
+    /** Сколько байт записано в файл */
+    long long bytes_written;
+} record_writer_t;
+
+/**
+ * @brief Инициализировать объект записи
+ *
+ * @param writer Объект записи
+ * @param fd Дескриптор файла
+ * @param capacity Размер буфера
+ * @param width Размер записи
+ */
+void record_writer_init(record_writer_t *writer, int fd, int capacity, int width);
+
+/** Освободить буфер. Несброшенные данные теряются */
+void record_writer_free(record_writer_t *writer);
+
+/**
+ * @brief Записать несколько записей подряд
+ *
+ * @param writer Объект записи
+ * @param records Записи
+ * @param count Количество записей
+ */
+void record_writer_write_many(record_writer_t *writer, const char *records, int count);
+
+/** Сбросить все накопленные данные в файл */
+void record_writer_flush(record_writer_t *writer);
+
+/**
+ * @brief Чтение записей: record_reader_next возвращает указатель прямо в буфер,
+ * запись, разрезанная границей буфера, переносится в его начало при следующем чтении
+ */
+typedef struct record_reader
+{
+    int fd;
+    int width;
+    char *chunk;
+    int capacity;
+    int size;
+    int pos;
+    bool eof;
+    /** Сколько байт прочитано из файла */
+    long long bytes_read;
+} record_reader_t;
+
+/**
+ * @brief Инициализировать объект чтения. Чтение идет с текущей позиции файла
+ *
+ * @param reader Объект чтения
+ * @param fd Дескриптор файла
+ * @param capacity Размер буфера, не меньше width
+ * @param width Размер записи
+ */
+void record_reader_init(record_reader_t *reader, int fd, int capacity, int width);
+
+/** Освободить буфер */
+void record_reader_free(record_reader_t *reader);
+
+/** Дочитать буфер и вернуть следующую запись. Файл, обрезанный посередине записи, считается поврежденным */
+const char *record_reader_fill_next(record_reader_t *reader);
+
+/**
+ * @brief Прочитать следующую запись. Указатель действителен до следующего вызова
+ *
+ * @return const char* Запись, либо NULL, если файл закончился
+ */
+static inline const char *record_reader_next(record_reader_t *reader)
+{
+    if (reader->size - reader->pos < reader->width)
+    {
+        return record_reader_fill_next(reader);
+    }
+
+    const char *record = reader->chunk + reader->pos;
+    reader->pos += reader->width;
+    return record;
+}
+
+#endif
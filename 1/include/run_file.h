@@ -0,0 +1,195 @@
+#ifndef RUN_FILE_H
+#define RUN_FILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct direct_output;
+
+/** Количество чисел в одном блоке упакованной серии */
+#define RUN_BLOCK_SIZE 128
+
+/** Раз в сколько чисел в индекс серии добавляется запись. Кратно RUN_BLOCK_SIZE */
+#define RUN_INDEX_STRIDE (64 * RUN_BLOCK_SIZE)
+
+/** Формат временных файлов с отсортированными сериями */
+typedef enum run_format
+{
+    /** Числа как в памяти, по 4 байта */
+    RUN_FORMAT_RAW,
+    /**
+     * Блоки по RUN_BLOCK_SIZE чисел: заголовок {count, min, bits} и разности соседних чисел,
+     * упакованные по bits бит (bits - разрядность максимальной разности в блоке)
+     */
+    RUN_FORMAT_PACKED,
+} run_format_t;
+
+/** Запись разреженного индекса серии: с какого места файла начинается блок и какое у него первое число */
+typedef struct run_index_entry
+{
+    /** Первое число блока */
+    int key;
+    /** Смещение блока в файле */
+    long long offset;
+} run_index_entry_t;
+
+/**
+ * @brief Разреженный индекс серии: запись на каждые RUN_INDEX_STRIDE чисел.
+ * По нему можно начать чтение серии не с начала, а с блока перед нужным числом
+ */
+typedef struct run_index
+{
+    run_index_entry_t *entries;
+    int size;
+    int capacity;
+} run_index_t;
+
+/** Инициализировать пустой индекс */
+void run_index_init(run_index_t *index);
+
+/** Освободить индекс */
+void run_index_free(run_index_t *index);
+
+/**
+ * @brief Найти, откуда читать серию, чтобы не пропустить числа, не меньшие key
+ *
+ * @return long long Смещение в файле, с которого нужно начать чтение
+ */
+long long run_index_find(const run_index_t *index, int key);
+
+/**
+ * @brief Буферизированная запись отсортированной серии.
+ * Как и в page_writer, на диск всегда сбрасывается ровно capacity байт (кроме последнего сброса)
+ */
+typedef struct run_writer
+{
+    int fd;
+    run_format_t format;
+    char *chunk;
+    int size;
+    int capacity;
+    /** Числа, которые еще не набрали целый блок (только для RUN_FORMAT_PACKED) */
+    int *pending;
+    int pending_count;
+    /** Сколько байт записано в файл */
+    long long bytes_written;
+    /** Сколько чисел записано (включая еще не сброшенные) */
+    long long numbers_written;
+    /** Индекс, который заполняется при записи, либо NULL */
+    run_index_t *index;
+    /** Запись через O_DIRECT (см. run_writer_enable_direct), либо NULL. Тогда chunk - ее текущий буфер */
+    struct direct_output *direct;
+} run_writer_t;
+
+/**
+ * @brief Инициализировать объект записи серии
+ *
+ * @param writer Объект записи
+ * @param fd Дескриптор файла
+ * @param capacity Размер буфера, должен быть кратен sizeof(int)
+ * @param format Формат серии
+ * @param index Индекс, который нужно заполнить, либо NULL
+ */
+void run_writer_init(run_writer_t *writer, int fd, int capacity, run_format_t format, run_index_t *index);
+
+/**
+ * @brief Писать серию мимо кэша страниц через O_DIRECT, с двумя буферами: пока один пишется, заполняется второй.
+ * Вызывается сразу после run_writer_init
+ *
+ * @param writer Объект записи, capacity кратна DIRECT_IO_ALIGNMENT
+ * @return false O_DIRECT недоступен (например, временные файлы на tmpfs) - запись идет как обычно
+ */
+bool run_writer_enable_direct(run_writer_t *writer);
+
+/** Освободить буферы. Несброшенные данные теряются */
+void run_writer_free(run_writer_t *writer);
+
+/**
+ * @brief Записать пачку чисел. Числа должны идти по возрастанию (в том числе относительно предыдущих пачек)
+ *
+ * @param writer Объект записи
+ * @param numbers Числа
+ * @param count Количество чисел
+ */
+void run_writer_write_many(run_writer_t *writer, const int *numbers, int count);
+
+/** Дописать неполный блок и сбросить все накопленные данные в файл. После этого серия закончена */
+void run_writer_finish(run_writer_t *writer);
+
+/**
+ * @brief Чтение серии блоками: за раз в values раскодируется целый блок,
+ * а числа из него отдаются через run_reader_next без лишних проверок
+ */
+typedef struct run_reader
+{
+    int fd;
+    run_format_t format;
+    char *chunk;
+    int capacity;
+    int size;
+    int pos;
+    bool eof;
+    /** Текущий раскодированный блок */
+    const int *values;
+    int count;
+    int index;
+    /** Место под раскодированный блок (только для RUN_FORMAT_PACKED) */
+    int *block;
+    /** Числа, не меньшие этой границы, не читаются: серия на них заканчивается */
+    long long upper;
+    /** Серия закончилась (файл или граница upper) */
+    bool finished;
+    /** Сколько байт прочитано из файла */
+    long long bytes_read;
+} run_reader_t;
+
+/**
+ * @brief Инициализировать объект чтения серии. Чтение идет с текущей позиции файла
+ *
+ * @param reader Объект чтения
+ * @param fd Дескриптор файла
+ * @param capacity Размер буфера чтения, должен быть кратен sizeof(int)
+ * @param format Формат серии
+ */
+void run_reader_init(run_reader_t *reader, int fd, int capacity, run_format_t format);
+
+/** Освободить буферы */
+void run_reader_free(run_reader_t *reader);
+
+/**
+ * @brief Ограничить читаемую часть серии диапазоном [lower, upper).
+ * Вызывается до чтения чисел. Файл уже должен стоять на позиции, не дальше первого числа из диапазона
+ * (см. run_index_find): числа меньше lower пропускаются
+ *
+ * @param reader Объект чтения
+ * @param lower Нижняя граница (включительно)
+ * @param upper Верхняя граница (не включительно)
+ */
+void run_reader_set_range(run_reader_t *reader, long long lower, long long upper);
+
+/**
+ * @brief Прочитать (раскодировать) следующий блок серии
+ *
+ * @return false Серия закончилась
+ */
+bool run_reader_next_block(run_reader_t *reader);
+
+/**
+ * @brief Прочитать следующее число серии
+ *
+ * @param reader Объект чтения
+ * @param number Указатель на число, в который записывается результат
+ * @return false Серия закончилась
+ */
+static inline bool run_reader_next(run_reader_t *reader, int *number)
+{
+    if (reader->index == reader->count && !run_reader_next_block(reader))
+    {
+        return false;
+    }
+
+    *number = reader->values[reader->index++];
+    return true;
+}
+
+#endif
@@ -1,6 +1,17 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include "merge_files.h"
+#include "number_file_reader.h"
+#include "libcoro.h"
+
+/** Имя "файла", вместо которого читается стандартный ввод */
+#define STREAM_FILENAME "-"
+
+/** Файлы результата: текстовые числа и двоичные записи */
+#define RESULT_FILENAME "result.txt"
+#define RECORD_RESULT_FILENAME "result.bin"
+
 typedef struct program_args
 {
     /** Названия файлов, которые необходимо обработать */
@@ -11,6 +22,32 @@ typedef struct program_args
     long long latency_us;
     /** Количество корутин в пуле, которое нужно использовать */
     int coro_count;
+    /** Максимальный объем памяти (в байтах), который можно использовать для сортировки всех файлов */
+    long long max_memory_bytes;
+    /** Алгоритм слияния отсортированных серий */
+    merge_strategy_t merge_strategy;
+    /** Максимальное количество серий, сливаемых за один проход, либо 0, если определяется автоматически */
+    int max_fan_in;
+    /** Размер буфера записи при слиянии, либо 0, если используется размер по умолчанию */
+    int write_buffer_size;
+    /** Способ чтения исходных файлов */
+    file_reader_mode_t reader;
+    /** Формат временных файлов с сериями */
+    run_format_t run_format;
+    /** Количество потоков сортировки и слияния */
+    int threads;
+    /** Как корутины сортировки читают исходные файлы и пишут серии */
+    coro_io_backend_t io_backend;
+    /** Файл для трассировки переключений корутин, либо NULL */
+    const char *trace_path;
+    /** Файл для статистики по фазам (время, ввод-вывод, пиковый RSS), либо NULL */
+    const char *stats_path;
+    /** Сортировать стандартный ввод в стандартный вывод (вместо файлов указан "-") */
+    bool stream;
+    /** Формат двоичных записей, либо width == 0 - файлы с текстовыми числами */
+    record_format_t record;
+    /** Писать серии и результат через O_DIRECT, мимо кэша страниц */
+    bool direct_io;
 } prog_args_t;
 
 /// @brief Получить все имена файлов, которые необходимо отсортировать.
@@ -33,11 +70,28 @@ typedef struct temp_file_struct temp_file_t;
 temp_file_t *temp_file_new();
 
 /**
- * @brief Получить дескриптор для указанного временного файла
+ * @brief Получить дескриптор для указанного временного файла.
+ * Если файл был закрыт через temp_file_close, то он открывается заново
  *
  * @param temp_file
  */
 int temp_file_fd(temp_file_t *temp_file);
+
+/**
+ * @brief Открыть временный файл на чтение отдельным дескриптором (со своей позицией).
+ * Дескриптор закрывает вызывающий
+ *
+ * @param temp_file
+ */
+int temp_file_open(temp_file_t *temp_file);
+
+/**
+ * @brief Закрыть дескриптор временного файла, но оставить сам файл.
+ * Нужно, чтобы множество серий не держало открытыми дескрипторы, пока ждет слияния
+ *
+ * @param temp_file
+ */
+void temp_file_close(temp_file_t *temp_file);
 void temp_file_free(temp_file_t *temp_file);
 
 #endif
\ No newline at end of file
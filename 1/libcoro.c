@@ -7,6 +7,13 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
 
 #include "libcoro.h"
 #include "timespec_helpers.h"
@@ -20,12 +27,19 @@ struct coro
     int ret;
     /** Stack, used by the coroutine. */
     void *stack;
+    /** Размер стека (без сторожевой страницы) */
+    size_t stack_size;
     /** An argument for the function func. */
     void *func_arg;
     /** A function to call as a coroutine. */
     coro_f func;
+#ifdef CORO_ASM_SWITCH
+    /** Указатель стека, на котором сохранены callee-saved регистры остановленной корутины */
+    void *sp;
+#else
     /** Last remembered coroutine context. */
     sigjmp_buf ctx;
+#endif
     /** True, if the coroutine has finished. */
     bool is_finished;
     /** Количество переключений контекста */
@@ -40,53 +54,263 @@ struct coro
     struct timespec start_time;
     /** Минимальный квант времени работы этой корутины */
     struct timespec quantum;
-    /** Links in the coroutine list, used by scheduler. */
-    struct coro *next, *prev;
+    /** Сколько еще вызовов yield пропустить, прежде чем смотреть на часы */
+    long long yield_countdown;
+    /** Сколько вызовов yield было с начала текущего кванта */
+    long long slice_yields;
+    /** Сколько вызовов yield укладывается в квант (по прошлому кванту) */
+    long long yields_per_quantum;
+    /** Номер корутины в этом потоке (у планировщика - 0), для трассировки */
+    int id;
+    /** Когда корутина в последний раз стала готовой к работе (попала в очередь готовых) */
+    struct timespec runnable_since;
+    long long total_latency_ns;
+    long long max_latency_ns;
+    /** Link in the finished coroutines list, used by scheduler. */
+    struct coro *next;
+    /** Гистограмма задержек от готовности до запуска, см. CORO_LATENCY_BUCKETS */
+    long long latency_histogram[CORO_LATENCY_BUCKETS];
 };
 
+/*
+ * Состояние планировщика - свое у каждого потока: в каждом потоке
+ * работает отдельный планировщик со своим списком корутин.
+ */
+
 /**
  * Scheduler is a main coroutine - it catches and returns dead
  * ones to a user.
  */
-static struct coro coro_sched;
+static __thread struct coro coro_sched;
 /**
  * True, if in that moment the scheduler is waiting for a
  * coroutine finish.
  */
-static bool is_sched_waiting = false;
+static __thread bool is_sched_waiting = false;
 /** Which coroutine works at this moment. */
-static struct coro *coro_this_ptr = NULL;
-/** List of all the coroutines. */
-static struct coro *coro_list = NULL;
+static __thread struct coro *coro_this_ptr = NULL;
+/**
+ * Кольцевой буфер готовых к работе корутин (кроме работающей сейчас): yield кладет текущую
+ * корутину в конец и переключается на первую
+ */
+static __thread struct coro **ready_ring = NULL;
+static __thread int ready_capacity = 0;
+static __thread int ready_head = 0;
+static __thread int ready_count = 0;
+/** Завершившиеся корутины, которые еще не забрал coro_sched_wait */
+static __thread struct coro *finished_list = NULL;
+/** Номер следующей созданной корутины */
+static __thread int next_coro_id = 1;
+#ifndef CORO_ASM_SWITCH
 /**
  * Buffer, used by the coroutine constructor to escape from the
  * signal handler back into the constructor to rollback
  * sigaltstack etc.
  */
-static sigjmp_buf start_point;
+static __thread sigjmp_buf start_point;
+#endif
+
+/** Размер стека корутины по умолчанию */
+#define CORO_DEFAULT_STACK_SIZE (1024 * 1024)
+/** Сколько освобожденных стеков пул держит по умолчанию */
+#define CORO_DEFAULT_STACK_RETENTION 16
+
+/** Сколько разных размеров стеков может одновременно лежать в пуле */
+#define CORO_STACK_POOL_CLASSES 8
+
+/**
+ * Освобожденный стек в пуле. Заголовок хранится в верхних байтах самого стека,
+ * поэтому пулу не нужна дополнительная память
+ */
+struct coro_cached_stack
+{
+    struct coro_cached_stack *next;
+};
+
+/**
+ * Стеки одного размера. Поиск идет по нескольким классам, а не по всему списку:
+ * чтобы найти стек нужного размера, не нужно обходить (и подгружать) чужие стеки
+ */
+struct coro_stack_class
+{
+    size_t size;
+    struct coro_cached_stack *head;
+    int count;
+};
+
+/* Пул стеков - свой у каждого потока, как и планировщик */
+
+/** Освобожденные стеки, готовые к повторному использованию */
+static __thread struct coro_stack_class stack_pool[CORO_STACK_POOL_CLASSES];
+/** Количество стеков в пуле */
+static __thread int stack_pool_size = 0;
+/** Сколько стеков пул может держать */
+static __thread int stack_pool_retention = CORO_DEFAULT_STACK_RETENTION;
+/** Сколько стеков было отображено и сколько взято из пула */
+static __thread long long stacks_allocated = 0;
+static __thread long long stacks_reused = 0;
+
+static size_t
+coro_page_size(void)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    return page_size <= 0
+               ? 4096
+               : (size_t)page_size;
+}
 
-/** Add a new coroutine to the beginning of the list. */
+/** Освободить отображение стека вместе со сторожевой страницей */
 static void
-coro_list_add(struct coro *c)
+coro_stack_unmap(void *stack, size_t size)
+{
+    size_t page_size = coro_page_size();
+    if (munmap((char *)stack - page_size, size + page_size) != 0)
+        handle_error();
+}
+
+/** Взять стек из класса. Класс не должен быть пустым */
+static void *
+coro_stack_class_pop(struct coro_stack_class *class)
+{
+    struct coro_cached_stack *cached = class->head;
+    class->head = cached->next;
+    --class->count;
+    --stack_pool_size;
+    return (char *)cached + sizeof(*cached) - class->size;
+}
+
+/**
+ * Выделить стек: взять из пула стек того же размера, либо отобразить новый.
+ * Под стеком (стек растет вниз) - страница PROT_NONE: переполнение стека падает на ней,
+ * а не портит чужую память. Физические страницы выделяются ядром только при первом обращении
+ */
+static void *
+coro_stack_alloc(size_t size)
 {
-    c->next = coro_list;
-    c->prev = NULL;
-    if (coro_list != NULL)
-        coro_list->prev = c;
-    coro_list = c;
+    for (int i = 0; i < CORO_STACK_POOL_CLASSES; ++i)
+    {
+        if (stack_pool[i].count > 0 && stack_pool[i].size == size)
+        {
+            ++stacks_reused;
+            return coro_stack_class_pop(&stack_pool[i]);
+        }
+    }
+
+    size_t page_size = coro_page_size();
+    char *mapping = (char *)mmap(NULL, size + page_size, PROT_READ | PROT_WRITE,
+                                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (mapping == MAP_FAILED)
+        handle_error();
+    if (mprotect(mapping, page_size, PROT_NONE) != 0)
+        handle_error();
+
+    ++stacks_allocated;
+    return mapping + page_size;
 }
 
-/** Remove a coroutine from the list. */
+/** Вернуть стек в пул, либо освободить, если пул заполнен или нет свободного класса */
 static void
-coro_list_delete(struct coro *c)
+coro_stack_release(void *stack, size_t size)
+{
+    struct coro_stack_class *class = NULL;
+    for (int i = 0; i < CORO_STACK_POOL_CLASSES; ++i)
+    {
+        if (stack_pool[i].count > 0 && stack_pool[i].size == size)
+        {
+            class = &stack_pool[i];
+            break;
+        }
+        if (stack_pool[i].count == 0 && class == NULL)
+            class = &stack_pool[i];
+    }
+
+    if (stack_pool_retention <= stack_pool_size || class == NULL)
+    {
+        coro_stack_unmap(stack, size);
+        return;
+    }
+
+    struct coro_cached_stack *cached =
+        (struct coro_cached_stack *)((char *)stack + size - sizeof(struct coro_cached_stack));
+    cached->next = class->head;
+    class->head = cached;
+    class->size = size;
+    ++class->count;
+    ++stack_pool_size;
+}
+
+void
+coro_stack_pool_set_retention(int max_stacks)
 {
-    struct coro *prev = c->prev, *next = c->next;
-    if (prev != NULL)
-        prev->next = next;
-    if (next != NULL)
-        next->prev = prev;
-    if (prev == NULL)
-        coro_list = next;
+    stack_pool_retention = max_stacks < 0
+                               ? 0
+                               : max_stacks;
+    for (int i = 0; i < CORO_STACK_POOL_CLASSES && stack_pool_retention < stack_pool_size; ++i)
+    {
+        struct coro_stack_class *class = &stack_pool[i];
+        while (class->count > 0 && stack_pool_retention < stack_pool_size)
+            coro_stack_unmap(coro_stack_class_pop(class), class->size);
+    }
+}
+
+void
+coro_stack_pool_clear(void)
+{
+    int retention = stack_pool_retention;
+    coro_stack_pool_set_retention(0);
+    stack_pool_retention = retention;
+}
+
+void
+coro_stack_pool_stats(coro_stack_pool_stats_t *stats)
+{
+    stats->allocated = stacks_allocated;
+    stats->reused = stacks_reused;
+    stats->cached = stack_pool_size;
+
+    struct rusage usage;
+    stats->peak_rss_kb = getrusage(RUSAGE_SELF, &usage) == 0
+                             ? usage.ru_maxrss
+                             : 0;
+}
+
+/** Добавить корутину в конец очереди готовых. now - время, с которого она готова к работе */
+static void
+coro_ready_push(struct coro *c, struct timespec *now)
+{
+    c->runnable_since = *now;
+    if (ready_count == ready_capacity)
+    {
+        int new_capacity = ready_capacity == 0
+                               ? 16
+                               : ready_capacity * 2;
+        struct coro **new_ring = (struct coro **)malloc(sizeof(*new_ring) * new_capacity);
+        if (new_ring == NULL)
+            handle_error();
+        for (int i = 0; i < ready_count; ++i)
+            new_ring[i] = ready_ring[(ready_head + i) % ready_capacity];
+        free(ready_ring);
+        ready_ring = new_ring;
+        ready_capacity = new_capacity;
+        ready_head = 0;
+    }
+
+    int tail = ready_head + ready_count;
+    if (tail >= ready_capacity)
+        tail -= ready_capacity;
+    ready_ring[tail] = c;
+    ++ready_count;
+}
+
+/** Взять первую корутину из очереди готовых. Очередь не должна быть пустой */
+static struct coro *
+coro_ready_pop(void)
+{
+    struct coro *c = ready_ring[ready_head];
+    if (++ready_head == ready_capacity)
+        ready_head = 0;
+    --ready_count;
+    return c;
 }
 
 int coro_status(const struct coro *c)
@@ -107,7 +331,7 @@ bool coro_is_finished(const struct coro *c)
 
 void coro_delete(struct coro *c)
 {
-    free(c->stack);
+    coro_stack_release(c->stack, c->stack_size);
     free(c);
 }
 
@@ -120,62 +344,909 @@ coro_current_work_time(struct coro *c, struct timespec *work_time)
     timespec_sub(&now, &c->start_time, work_time);
 }
 
+#ifdef CORO_ASM_SWITCH
+
+/*
+ * Переключение контекста без сигналов и setjmp: сохраняются только callee-saved регистры
+ * (остальные по ABI и так сохраняет вызывающий), указатель стека запоминается в from->sp,
+ * затем загружается стек to и с него восстанавливаются регистры.
+ * Новая корутина начинает с "возврата" в coro_trampoline, который вызывает coro_entry(c)
+ */
+void coro_switch_context(void **from_sp, void *to_sp);
+void coro_trampoline(void);
+
+#if defined(__x86_64__)
+
+/* Сохраняемые регистры: rbp, rbx, r12-r15. Указатель на корутину для coro_trampoline - в r12 */
+__asm__(
+    ".text\n"
+    ".globl coro_switch_context\n"
+    ".type coro_switch_context, @function\n"
+    "coro_switch_context:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size coro_switch_context, .-coro_switch_context\n"
+    ".globl coro_trampoline\n"
+    ".type coro_trampoline, @function\n"
+    "coro_trampoline:\n"
+    "    movq %r12, %rdi\n"
+    "    call coro_entry\n"
+    "    ud2\n"
+    ".size coro_trampoline, .-coro_trampoline\n");
+
+/** Количество слов в сохраненном контексте: 6 регистров и адрес возврата */
+#define CORO_CONTEXT_WORDS 7
+/** Слот регистра r12 - в нем coro_trampoline получает корутину */
+#define CORO_CONTEXT_ARG_SLOT 3
+#define CORO_CONTEXT_RET_SLOT 6
+
+#elif defined(__aarch64__)
+
+/* Сохраняемые регистры: x19-x28, x29 (fp), x30 (lr), d8-d15. Указатель на корутину для coro_trampoline - в x19 */
+__asm__(
+    ".text\n"
+    ".globl coro_switch_context\n"
+    ".type coro_switch_context, %function\n"
+    "coro_switch_context:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x2, sp\n"
+    "    str x2, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size coro_switch_context, .-coro_switch_context\n"
+    ".globl coro_trampoline\n"
+    ".type coro_trampoline, %function\n"
+    "coro_trampoline:\n"
+    "    mov x0, x19\n"
+    "    bl coro_entry\n"
+    "    brk #0\n"
+    ".size coro_trampoline, .-coro_trampoline\n");
+
+/** Количество слов в сохраненном контексте: 20 регистров */
+#define CORO_CONTEXT_WORDS 20
+/** Слот регистра x19 - в нем coro_trampoline получает корутину */
+#define CORO_CONTEXT_ARG_SLOT 0
+/** Слот регистра x30 (lr) - по нему coro_switch_context "возвращается" */
+#define CORO_CONTEXT_RET_SLOT 11
+
+#else
+#error "CORO_ASM_SWITCH поддерживается только на x86-64 и aarch64"
+#endif
+
+static void
+coro_context_switch(struct coro *from, struct coro *to)
+{
+    coro_switch_context(&from->sp, to->sp);
+}
+
+#else
+
+static void
+coro_context_switch(struct coro *from, struct coro *to)
+{
+    if (sigsetjmp(from->ctx, 0) == 0)
+    {
+        siglongjmp(to->ctx, 1);
+    }
+}
+
+#endif
+
+/*
+ * Трассировка переключений. Буфер свой у каждого потока и пишется только им самим,
+ * поэтому обходится без блокировок: событие записывается в ячейку, затем атомарно
+ * публикуется новый счетчик. Старые события перезаписываются
+ */
+struct coro_trace
+{
+    coro_trace_event_t *events;
+    /** Размер буфера, степень двойки */
+    long long capacity;
+    /** Сколько событий записано всего (с учетом перезаписанных) */
+    long long count;
+};
+
+/** Буфер трассировки этого потока, либо NULL */
+static __thread struct coro_trace *trace = NULL;
+
+static long long
+coro_timespec_ns(const struct timespec *ts)
+{
+    return ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+/** Записать переключение from -> to */
+static void
+coro_trace_switch(struct timespec *now, struct coro *from, struct coro *to, coro_switch_reason_t reason)
+{
+    struct coro_trace *t = trace;
+    if (t == NULL)
+        return;
+
+    long long count = t->count;
+    coro_trace_event_t *event = &t->events[count & (t->capacity - 1)];
+    event->time_ns = coro_timespec_ns(now);
+    event->from = from->id;
+    event->to = to->id;
+    event->reason = reason;
+    __atomic_store_n(&t->count, count + 1, __ATOMIC_RELEASE);
+}
+
+/** Учесть задержку корутины c от готовности до запуска в момент now */
+static void
+coro_record_latency(struct coro *c, struct timespec *now)
+{
+    long long latency = coro_timespec_ns(now) - coro_timespec_ns(&c->runnable_since);
+    if (latency < 0)
+        latency = 0;
+
+    int bucket = latency == 0
+                     ? 0
+                     : 64 - __builtin_clzll((unsigned long long)latency);
+    if (CORO_LATENCY_BUCKETS <= bucket)
+        bucket = CORO_LATENCY_BUCKETS - 1;
+    ++c->latency_histogram[bucket];
+    c->total_latency_ns += latency;
+    if (c->max_latency_ns < latency)
+        c->max_latency_ns = latency;
+}
+
+/**
+ * Записать переключение в трассировку и задержку запуска to в гистограмму.
+ * Не встраивается, чтобы coro_yield_to оставалась маленькой и встраивалась в coro_yield
+ */
+static __attribute__((noinline)) void
+coro_account_switch(struct coro *from, struct coro *to, struct timespec *now, coro_switch_reason_t reason)
+{
+    coro_trace_switch(now, from, to, reason);
+    if (to != &coro_sched)
+        coro_record_latency(to, now);
+}
+
+void
+coro_trace_start(int capacity)
+{
+    if (trace != NULL)
+        coro_trace_free(coro_trace_stop());
+
+    long long rounded = 1;
+    while (rounded < capacity)
+        rounded *= 2;
+
+    struct coro_trace *t = (struct coro_trace *)malloc(sizeof(*t));
+    t->events = (coro_trace_event_t *)malloc(sizeof(coro_trace_event_t) * rounded);
+    if (t->events == NULL)
+        handle_error();
+    t->capacity = rounded;
+    t->count = 0;
+    trace = t;
+}
+
+coro_trace_t *
+coro_trace_stop(void)
+{
+    struct coro_trace *t = trace;
+    trace = NULL;
+    return t;
+}
+
+void
+coro_trace_free(coro_trace_t *t)
+{
+    if (t == NULL)
+        return;
+    free(t->events);
+    free(t);
+}
+
+static const char *
+coro_switch_reason_name(coro_switch_reason_t reason)
+{
+    switch (reason)
+    {
+    case CORO_SWITCH_QUANTUM:
+        return "quantum";
+    case CORO_SWITCH_IO_WAIT:
+        return "io_wait";
+    case CORO_SWITCH_FINISH:
+        return "finish";
+    case CORO_SWITCH_SCHEDULE:
+        return "schedule";
+    }
+    return "unknown";
+}
+
+/** Первое событие буфера, которое еще не перезаписано */
+static long long
+coro_trace_first(const struct coro_trace *t, long long count)
+{
+    return count > t->capacity
+               ? count - t->capacity
+               : 0;
+}
+
+void
+coro_trace_write_json(FILE *out, coro_trace_t **traces, int count)
+{
+    /* Время отсчитывается от первого события: в формате trace event - микросекунды */
+    long long base_ns = -1;
+    for (int i = 0; i < count; ++i)
+    {
+        long long events = __atomic_load_n(&traces[i]->count, __ATOMIC_ACQUIRE);
+        long long first = coro_trace_first(traces[i], events);
+        if (first < events)
+        {
+            long long time_ns = traces[i]->events[first & (traces[i]->capacity - 1)].time_ns;
+            if (base_ns < 0 || time_ns < base_ns)
+                base_ns = time_ns;
+        }
+    }
+
+    fprintf(out, "{\"traceEvents\":[\n");
+    bool first_event = true;
+    for (int i = 0; i < count; ++i)
+    {
+        const struct coro_trace *t = traces[i];
+        long long events = __atomic_load_n(&t->count, __ATOMIC_ACQUIRE);
+        long long first = coro_trace_first(t, events);
+        long long mask = t->capacity - 1;
+
+        int max_id = 0;
+        for (long long e = first; e < events; ++e)
+        {
+            const coro_trace_event_t *event = &t->events[e & mask];
+            if (max_id < event->from)
+                max_id = event->from;
+            if (max_id < event->to)
+                max_id = event->to;
+        }
+
+        fprintf(out, "%s{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                first_event ? "" : ",\n", i, i);
+        first_event = false;
+        for (int id = 0; id <= max_id; ++id)
+        {
+            if (id == 0)
+                fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"scheduler\"}}", i);
+            else
+                fprintf(out, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"coro %d\"}}", i, id, id);
+        }
+
+        /* Отрезок работы корутины - от переключения на нее до переключения с нее */
+        long long *run_start = (long long *)malloc(sizeof(long long) * (max_id + 1));
+        for (int id = 0; id <= max_id; ++id)
+            run_start[id] = -1;
+        for (long long e = first; e < events; ++e)
+        {
+            const coro_trace_event_t *event = &t->events[e & mask];
+            long long start_ns = run_start[event->from];
+            if (0 <= start_ns)
+            {
+                fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"end\":\"%s\",\"to\":%d}}",
+                        event->from == 0 ? "scheduler" : "run", i, event->from,
+                        (start_ns - base_ns) / 1000.0, (event->time_ns - start_ns) / 1000.0,
+                        coro_switch_reason_name(event->reason), event->to);
+            }
+            run_start[event->from] = -1;
+            run_start[event->to] = event->time_ns;
+        }
+        free(run_start);
+    }
+    fprintf(out, "\n]}\n");
+}
+
+/** Начать новый квант корутины: отсчет yield до проверки часов - по прошлому кванту */
+static void
+coro_start_slice(struct coro *c)
+{
+    c->slice_yields = 0;
+    c->yield_countdown = c->yields_per_quantum;
+}
+
 /** Switch the current coroutine to an arbitrary one. */
 static void
-coro_yield_to(struct coro *to)
+coro_yield_to(struct coro *to, struct timespec *now, coro_switch_reason_t reason)
 {
     struct coro *from = coro_this_ptr;
     ++from->switch_count;
+    coro_account_switch(from, to, now, reason);
     
     struct timespec current_work_time;
     struct timespec new_work_time;
-    coro_current_work_time(from, &current_work_time);
+    timespec_sub(now, &from->start_time, &current_work_time);
     timespec_add(&from->total_work_time, &current_work_time, &new_work_time);
     from->total_work_time = new_work_time;
-    memset(&to->start_time, 0, sizeof(struct timespec));
     from->is_running = false;
+    /* Время переключения - это и время запуска to: часы не нужно проверять второй раз */
+    to->start_time = *now;
 
-    if (sigsetjmp(from->ctx, 0) == 0)
-    {
-        siglongjmp(to->ctx, 1);
-    }
+    coro_context_switch(from, to);
 
     from->is_running = true;
-    clock_gettime(CLOCK_MONOTONIC, &from->start_time);
+    coro_start_slice(from);
 
     coro_this_ptr = from;
 }
 
-/** Проверить, что указанная корутина превысила свой квантум времени */
+/** Верхняя граница отсчета yield: чтобы оценка не переполнялась и часы все же проверялись */
+#define CORO_MAX_YIELD_COUNTDOWN (1LL << 30)
+
+/**
+ * Проверить, что указанная корутина превысила свой квантум времени.
+ * Часы проверяются не на каждом yield: отсчет yield_countdown задается по тому, сколько yield
+ * укладывалось в квант раньше, а если квант еще не истек - по скорости yield в текущем кванте
+ */
 static bool
-coro_quantum_passes(struct coro *c)
+coro_quantum_passes(struct coro *c, struct timespec *now)
 {
     assert(c->is_running);
+    if (--c->yield_countdown > 0)
+        return false;
+
+    clock_gettime(CLOCK_MONOTONIC, now);
     struct timespec current_work_time;
-    coro_current_work_time(c, &current_work_time);
-    return timespec_le(&c->quantum, &current_work_time);
+    timespec_sub(now, &c->start_time, &current_work_time);
+
+    double elapsed_ns = current_work_time.tv_sec * 1e9 + current_work_time.tv_nsec;
+    double quantum_ns = c->quantum.tv_sec * 1e9 + c->quantum.tv_nsec;
+    /* Сколько yield укладывается в квант при текущей скорости */
+    double estimate = elapsed_ns > 0
+                          ? c->slice_yields * quantum_ns / elapsed_ns
+                          : 2.0 * c->slice_yields;
+    if (estimate > CORO_MAX_YIELD_COUNTDOWN)
+        estimate = CORO_MAX_YIELD_COUNTDOWN;
+
+    if (timespec_le(&c->quantum, &current_work_time))
+    {
+        c->yields_per_quantum = estimate < 1
+                                    ? 1
+                                    : (long long)estimate;
+        return true;
+    }
+
+    /* Оставшуюся часть кванта проверяем с запасом: до следующей проверки - половина оставшихся yield */
+    long long remaining = (long long)(estimate - c->slice_yields) / 2;
+    c->yield_countdown = remaining < 1
+                             ? 1
+                             : remaining;
+    return false;
 }
 
-void coro_yield(void)
+/*
+ * Асинхронный ввод-вывод. Корутина отправляет запрос (в io_uring, либо в пул потоков,
+ * если io_uring недоступен) и паркуется: она не стоит в очереди готовых, пока запрос
+ * не завершится, а процессор достается другим корутинам. Завершения собирают coro_yield,
+ * ожидающая корутина (если больше некому работать) и coro_sched_wait
+ */
+
+/** Размер очереди отправки io_uring */
+#define CORO_URING_ENTRIES 64
+/** Количество потоков в пуле, если io_uring недоступен */
+#define CORO_IO_POOL_THREADS 4
+
+/** Кольца io_uring, отображенные в память процесса */
+struct coro_uring
 {
-    struct coro *from = coro_this_ptr;
-    struct coro *to = from->next;
+    int fd;
+    unsigned entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    /** Общее отображение колец отправки и завершения */
+    void *rings;
+    size_t rings_size;
+    size_t sqes_size;
+};
+
+/** Пул потоков, выполняющих read/write за корутины */
+struct coro_io_pool
+{
+    pthread_t threads[CORO_IO_POOL_THREADS];
+    pthread_mutex_t mutex;
+    /** Появился новый запрос (или пора завершаться) */
+    pthread_cond_t queued;
+    /** Появился выполненный запрос */
+    pthread_cond_t done_cond;
+    coro_io_op_t *queue_head;
+    coro_io_op_t *queue_tail;
+    coro_io_op_t *done;
+    bool stop;
+};
+
+/** Какой способ ввода-вывода выбран для этого потока */
+static __thread coro_io_backend_t io_backend = CORO_IO_URING;
+/** Кольца io_uring, либо NULL */
+static __thread struct coro_uring *io_uring_state = NULL;
+/** Пул потоков, либо NULL */
+static __thread struct coro_io_pool *io_pool = NULL;
+/** Сколько запросов отправлено и еще не собрано */
+static __thread int io_inflight = 0;
+
+static int
+coro_sys_io_uring_setup(unsigned entries, struct io_uring_params *params)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int
+coro_sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
 
-    if (coro_quantum_passes(from))
+/**
+ * Создать io_uring. Нужно чтение и запись с текущей позиции файла (смещение -1),
+ * как у read/write, поэтому без IORING_FEAT_RW_CUR_POS (ядра до 5.6) io_uring не используется
+ */
+static struct coro_uring *
+coro_uring_new(void)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = coro_sys_io_uring_setup(CORO_URING_ENTRIES, &params);
+    if (fd < 0)
+        return NULL;
+    if ((params.features & IORING_FEAT_RW_CUR_POS) == 0 ||
+        (params.features & IORING_FEAT_SINGLE_MMAP) == 0)
     {
-        if (to == NULL)
+        close(fd);
+        return NULL;
+    }
+
+    struct coro_uring *ring = (struct coro_uring *)calloc(1, sizeof(*ring));
+    ring->fd = fd;
+    ring->entries = params.sq_entries;
+
+    /* Начиная с IORING_FEAT_SINGLE_MMAP кольца отправки и завершения отображаются одним вызовом */
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->rings_size = sq_size > cq_size
+                           ? sq_size
+                           : cq_size;
+    ring->rings = mmap(NULL, ring->rings_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->rings == MAP_FAILED)
+        handle_error();
+
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                             MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED)
+        handle_error();
+
+    char *sq = (char *)ring->rings;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    char *cq = (char *)ring->rings;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+static void
+coro_uring_delete(struct coro_uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    munmap(ring->rings, ring->rings_size);
+    close(ring->fd);
+    free(ring);
+}
+
+static void *
+coro_io_pool_thread(void *arg)
+{
+    struct coro_io_pool *pool = (struct coro_io_pool *)arg;
+    pthread_mutex_lock(&pool->mutex);
+    while (true)
+    {
+        while (pool->queue_head == NULL && !pool->stop)
+            pthread_cond_wait(&pool->queued, &pool->mutex);
+        if (pool->queue_head == NULL)
+            break;
+
+        coro_io_op_t *request = pool->queue_head;
+        pool->queue_head = request->next;
+        if (pool->queue_head == NULL)
+            pool->queue_tail = NULL;
+        pthread_mutex_unlock(&pool->mutex);
+
+        if (request->offset < 0)
+            request->result = request->is_write
+                                  ? write(request->fd, request->buf, request->count)
+                                  : read(request->fd, request->buf, request->count);
+        else
+            request->result = request->is_write
+                                  ? pwrite(request->fd, request->buf, request->count, request->offset)
+                                  : pread(request->fd, request->buf, request->count, request->offset);
+        request->error = errno;
+
+        pthread_mutex_lock(&pool->mutex);
+        request->next = pool->done;
+        pool->done = request;
+        pthread_cond_signal(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+static struct coro_io_pool *
+coro_io_pool_new(void)
+{
+    struct coro_io_pool *pool = (struct coro_io_pool *)calloc(1, sizeof(*pool));
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+    for (int i = 0; i < CORO_IO_POOL_THREADS; ++i)
+    {
+        int error = pthread_create(&pool->threads[i], NULL, coro_io_pool_thread, pool);
+        if (error != 0)
         {
-            coro_yield_to(&coro_sched);
+            errno = error;
+            handle_error();
         }
-        else
+    }
+    return pool;
+}
+
+static void
+coro_io_pool_delete(struct coro_io_pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i = 0; i < CORO_IO_POOL_THREADS; ++i)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->queued);
+    pthread_mutex_destroy(&pool->mutex);
+    free(pool);
+}
+
+/** Запрос op выполнен: ждущая его корутина снова готова к работе (с момента now) */
+static void
+coro_io_complete(coro_io_op_t *op, ssize_t result, int error, struct timespec *now)
+{
+    op->result = result;
+    op->error = error;
+    op->done = true;
+    --io_inflight;
+    /* Текущая корутина и так работает - в очередь ставятся только запаркованные */
+    if (op->waiter != NULL && op->waiter != coro_this_ptr)
+        coro_ready_push(op->waiter, now);
+}
+
+/**
+ * Собрать выполненные запросы.
+ * @param block Если ничего не выполнено - ждать хотя бы одного завершения
+ */
+static void
+coro_io_poll(bool block)
+{
+    if (io_inflight == 0)
+        return;
+
+    if (io_uring_state != NULL)
+    {
+        struct coro_uring *ring = io_uring_state;
+        unsigned head = *ring->cq_head;
+        if (block && head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+        {
+            while (coro_sys_io_uring_enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0)
+            {
+                if (errno != EINTR)
+                    handle_error();
+            }
+        }
+
+        unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        struct timespec now;
+        if (head != tail)
+            clock_gettime(CLOCK_MONOTONIC, &now);
+        for (; head != tail; ++head)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+            coro_io_op_t *op = (coro_io_op_t *)(uintptr_t)cqe->user_data;
+            if (cqe->res < 0)
+                coro_io_complete(op, -1, -cqe->res, &now);
+            else
+                coro_io_complete(op, cqe->res, 0, &now);
+        }
+        __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        return;
+    }
+
+    struct coro_io_pool *pool = io_pool;
+    pthread_mutex_lock(&pool->mutex);
+    while (block && pool->done == NULL)
+        pthread_cond_wait(&pool->done_cond, &pool->mutex);
+    coro_io_op_t *done = pool->done;
+    pool->done = NULL;
+    pthread_mutex_unlock(&pool->mutex);
+
+    struct timespec now;
+    if (done != NULL)
+        clock_gettime(CLOCK_MONOTONIC, &now);
+    while (done != NULL)
+    {
+        coro_io_op_t *next = done->next;
+        coro_io_complete(done, done->result, done->error, &now);
+        done = next;
+    }
+}
+
+/** Выбрать способ ввода-вывода при первом запросе в этом потоке */
+static void
+coro_io_init(void)
+{
+    if (io_uring_state != NULL || io_pool != NULL)
+        return;
+    if (io_backend == CORO_IO_URING)
+        io_uring_state = coro_uring_new();
+    if (io_uring_state == NULL)
+        io_pool = coro_io_pool_new();
+}
+
+/** Освободить io_uring и пул потоков. Вызывается, когда все корутины завершились */
+static void
+coro_io_destroy(void)
+{
+    assert(io_inflight == 0);
+    if (io_uring_state != NULL)
+    {
+        coro_uring_delete(io_uring_state);
+        io_uring_state = NULL;
+    }
+    if (io_pool != NULL)
+    {
+        coro_io_pool_delete(io_pool);
+        io_pool = NULL;
+    }
+}
+
+/** Отправить запрос op от текущей корутины, не дожидаясь его завершения */
+static void
+coro_io_submit(coro_io_op_t *op)
+{
+    coro_io_init();
+    op->waiter = NULL;
+    op->done = false;
+    op->next = NULL;
+
+    if (io_uring_state != NULL)
+    {
+        struct coro_uring *ring = io_uring_state;
+        /* Завершений не может быть больше, чем вмещает кольцо: освобождаем место */
+        while ((unsigned)io_inflight >= ring->entries)
+            coro_io_poll(true);
+
+        unsigned tail = *ring->sq_tail;
+        unsigned index = tail & *ring->sq_mask;
+        struct io_uring_sqe *sqe = &ring->sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = op->is_write
+                          ? IORING_OP_WRITE
+                          : IORING_OP_READ;
+        sqe->fd = op->fd;
+        sqe->addr = (uintptr_t)op->buf;
+        sqe->len = (unsigned)op->count;
+        /* -1 - текущая позиция файла, как у read/write */
+        sqe->off = (uint64_t)op->offset;
+        sqe->user_data = (uintptr_t)op;
+        ring->sq_array[index] = index;
+        __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        while (coro_sys_io_uring_enter(ring->fd, 1, 0, 0) < 0)
         {
-            coro_yield_to(to);
+            if (errno != EINTR)
+                handle_error();
         }
     }
     else
+    {
+        struct coro_io_pool *pool = io_pool;
+        pthread_mutex_lock(&pool->mutex);
+        if (pool->queue_tail == NULL)
+            pool->queue_head = op;
+        else
+            pool->queue_tail->next = op;
+        pool->queue_tail = op;
+        pthread_cond_signal(&pool->queued);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    ++io_inflight;
+}
+
+/**
+ * Ждать завершения запроса op. Пока он выполняется, работают другие корутины;
+ * если их нет - ожидание в io_uring_enter (или на условной переменной пула)
+ */
+static ssize_t
+coro_io_wait_op(coro_io_op_t *op)
+{
+    while (!op->done)
+    {
+        coro_io_poll(false);
+        if (op->done)
+            break;
+        if (ready_count == 0)
+        {
+            coro_io_poll(true);
+            continue;
+        }
+
+        /* Корутина вернется в очередь готовых, когда запрос выполнится */
+        op->waiter = coro_this_ptr;
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        coro_yield_to(coro_ready_pop(), &now, CORO_SWITCH_IO_WAIT);
+        op->waiter = NULL;
+    }
+
+    errno = op->error;
+    return op->result;
+}
+
+/** Отправить запрос от текущей корутины и ждать его завершения */
+static ssize_t
+coro_io_submit_and_wait(bool is_write, int fd, void *buf, size_t count)
+{
+    coro_io_op_t op;
+    op.is_write = is_write;
+    op.fd = fd;
+    op.buf = buf;
+    op.count = count;
+    op.offset = -1;
+    coro_io_submit(&op);
+    return coro_io_wait_op(&op);
+}
+
+/** Можно ли парковать вызывающего: он корутина, а не планировщик или посторонний поток */
+static bool
+coro_io_can_park(void)
+{
+    return io_backend != CORO_IO_SYNC && coro_this_ptr != NULL && coro_this_ptr != &coro_sched;
+}
+
+void
+coro_io_set_backend(coro_io_backend_t backend)
+{
+    assert(io_inflight == 0);
+    coro_io_destroy();
+    io_backend = backend;
+}
+
+ssize_t
+coro_read(int fd, void *buf, size_t count)
+{
+    if (!coro_io_can_park())
+        return read(fd, buf, count);
+    return coro_io_submit_and_wait(false, fd, buf, count);
+}
+
+ssize_t
+coro_write(int fd, const void *buf, size_t count)
+{
+    if (!coro_io_can_park())
+        return write(fd, buf, count);
+    return coro_io_submit_and_wait(true, fd, (void *)buf, count);
+}
+
+void
+coro_pwrite_start(coro_io_op_t *op, int fd, const void *buf, size_t count, off_t offset)
+{
+    op->is_write = true;
+    op->fd = fd;
+    op->buf = (void *)buf;
+    op->count = count;
+    op->offset = offset;
+    if (io_backend != CORO_IO_SYNC)
+    {
+        coro_io_submit(op);
+        return;
+    }
+
+    op->waiter = NULL;
+    op->result = pwrite(fd, buf, count, offset);
+    op->error = errno;
+    op->done = true;
+}
+
+ssize_t
+coro_io_wait(coro_io_op_t *op)
+{
+    if (coro_io_can_park())
+        return coro_io_wait_op(op);
+
+    /* Вне корутины переключаться не на кого - поток просто ждет завершения */
+    while (!op->done)
+        coro_io_poll(true);
+    errno = op->error;
+    return op->result;
+}
+
+void
+coro_io_release(void)
+{
+    coro_io_destroy();
+}
+
+void coro_yield(void)
+{
+    struct coro *from = coro_this_ptr;
+    assert(from != &coro_sched);
+    ++from->slice_yields;
+
+    struct timespec now;
+    if (!coro_quantum_passes(from, &now))
     {
         ++from->false_switch_count;
+        return;
+    }
+
+    coro_io_poll(false);
+
+    if (ready_count == 0)
+    {
+        /* Переключаться не на кого - начинается новый квант этой же корутины */
+        struct timespec current_work_time;
+        struct timespec new_work_time;
+        timespec_sub(&now, &from->start_time, &current_work_time);
+        timespec_add(&from->total_work_time, &current_work_time, &new_work_time);
+        from->total_work_time = new_work_time;
+        from->start_time = now;
+        coro_start_slice(from);
+        return;
     }
+
+    coro_ready_push(from, &now);
+    coro_yield_to(coro_ready_pop(), &now, CORO_SWITCH_QUANTUM);
 }
 
 static void coro_total_work_time(struct coro *c, struct timespec *work_time)
@@ -196,6 +1267,34 @@ void coro_stats(struct coro *c, coro_stats_t *stats)
     stats->switch_count = c->switch_count;
     stats->false_switch_count = c->false_switch_count;
     coro_total_work_time(c, &stats->worktime);
+    memcpy(stats->latency_histogram, c->latency_histogram, sizeof(stats->latency_histogram));
+    stats->latency_samples = 0;
+    for (int i = 0; i < CORO_LATENCY_BUCKETS; ++i)
+        stats->latency_samples += c->latency_histogram[i];
+    stats->total_latency_ns = c->total_latency_ns;
+    stats->max_latency_ns = c->max_latency_ns;
+}
+
+long long
+coro_stats_latency_percentile(const coro_stats_t *stats, double fraction)
+{
+    long long target = (long long)(stats->latency_samples * fraction);
+    long long seen = 0;
+    for (int i = 0; i < CORO_LATENCY_BUCKETS; ++i)
+    {
+        seen += stats->latency_histogram[i];
+        if (target < seen)
+        {
+            /* Верхняя граница корзины, но не больше максимальной задержки */
+            long long upper = i == 0
+                                  ? 0
+                                  : 1LL << i;
+            return upper < stats->max_latency_ns
+                       ? upper
+                       : stats->max_latency_ns;
+        }
+    }
+    return stats->max_latency_ns;
 }
 
 void coro_sched_init(struct timespec *quantum)
@@ -208,26 +1307,39 @@ void coro_sched_init(struct timespec *quantum)
      */
     coro_sched.quantum = *quantum;
     coro_sched.is_running = true;
+    clock_gettime(CLOCK_MONOTONIC, &coro_sched.start_time);
+    next_coro_id = 1;
 }
 
 struct coro *
 coro_sched_wait(void)
 {
-    // coro_sched.is_running = true;
-    while (coro_list != NULL)
+    while (finished_list == NULL && (ready_count > 0 || io_inflight > 0))
     {
-        for (struct coro *c = coro_list; c != NULL; c = c->next)
-        {
-            if (c->is_finished)
-            {
-                coro_list_delete(c);
-                return c;
-            }
-        }
+        /* Если готовых корутин нет, все ждут ввода-вывода - ждет и планировщик */
+        coro_io_poll(ready_count == 0);
+        if (ready_count == 0)
+            continue;
+
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
         is_sched_waiting = true;
-        coro_yield_to(coro_list);
+        coro_yield_to(coro_ready_pop(), &now, CORO_SWITCH_SCHEDULE);
         is_sched_waiting = false;
     }
+
+    struct coro *c = finished_list;
+    if (c != NULL)
+    {
+        finished_list = c->next;
+        return c;
+    }
+
+    coro_io_destroy();
+    free(ready_ring);
+    ready_ring = NULL;
+    ready_capacity = 0;
+    ready_head = 0;
     return NULL;
 }
 
@@ -237,6 +1349,75 @@ coro_this(void)
     return coro_this_ptr;
 }
 
+/**
+ * Работа корутины от старта до завершения. Вернуться из этой функции нельзя - адрес возврата
+ * уже недействителен, поэтому в конце управление передается планировщику
+ */
+static void
+coro_run(struct coro *c)
+{
+    coro_this_ptr = c;
+    c->is_running = true;
+    c->quantum = coro_sched.quantum;
+    coro_start_slice(c);
+
+    c->ret = c->func(c->func_arg);
+
+    struct timespec now;
+    struct timespec current_work_time;
+    struct timespec new_work_time;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    timespec_sub(&now, &c->start_time, &current_work_time);
+    timespec_add(&c->total_work_time, &current_work_time, &new_work_time);
+    c->total_work_time = new_work_time;
+    c->is_finished = true;
+    c->is_running = false;
+    c->next = finished_list;
+    finished_list = c;
+    coro_sched.start_time = now;
+    coro_trace_switch(&now, c, &coro_sched, CORO_SWITCH_FINISH);
+    /* Can not return - 'ret' address is invalid already! */
+    if (!is_sched_waiting)
+    {
+        printf("Critical error - no place to return!\n");
+        exit(-1);
+    }
+    coro_context_switch(c, &coro_sched);
+}
+
+#ifdef CORO_ASM_SWITCH
+
+/** Точка входа новой корутины, вызывается из coro_trampoline */
+void
+coro_entry(struct coro *c);
+
+void
+coro_entry(struct coro *c)
+{
+    coro_run(c);
+}
+
+/**
+ * Подготовить стек новой корутины так, будто она остановилась в coro_switch_context:
+ * при первом переключении на нее регистры загрузятся нулями, а "возврат" придет в coro_trampoline
+ */
+static void
+coro_context_init(struct coro *c)
+{
+    uintptr_t top = ((uintptr_t)c->stack + c->stack_size) & ~(uintptr_t)15;
+    /*
+     * После загрузки контекста указатель стека должен быть выровнен на 16 байт:
+     * на x86-64 coro_trampoline делает call, на aarch64 sp всегда выровнен
+     */
+    void **frame = (void **)(top - 16) - CORO_CONTEXT_WORDS;
+    memset(frame, 0, sizeof(void *) * CORO_CONTEXT_WORDS);
+    frame[CORO_CONTEXT_ARG_SLOT] = c;
+    frame[CORO_CONTEXT_RET_SLOT] = (void *)coro_trampoline;
+    c->sp = frame;
+}
+
+#else
+
 /**
  * The core part of the coroutines creation - this signal handler
  * is run on a separate stack using sigaltstack. On an invokation
@@ -259,38 +1440,22 @@ coro_body(int signum)
      * If the execution is here, then the coroutine should
      * finaly start work.
      */
-    coro_this_ptr = c;
-    c->is_running = true;
-    c->quantum = coro_sched.quantum;
-    clock_gettime(CLOCK_MONOTONIC, &c->start_time);
-
-    c->ret = c->func(c->func_arg);
-
-    c->is_finished = true;
-    c->is_running = false;
-    /* Can not return - 'ret' address is invalid already! */
-    if (!is_sched_waiting)
-    {
-        printf("Critical error - no place to return!\n");
-        exit(-1);
-    }
-    siglongjmp(coro_sched.ctx, 1);
+    coro_run(c);
 }
 
-struct coro *
-coro_new(coro_f func, void *func_arg)
+/**
+ * Создать контекст новой корутины: обработчик сигнала запускается на ее стеке (sigaltstack),
+ * запоминает там контекст и возвращается обратно в coro_new
+ */
+static void
+coro_context_init(struct coro *c)
 {
-    struct coro *c = (struct coro *)malloc(sizeof(*c));
-    c->ret = 0;
-    int stack_size = 1024 * 1024;
-    if (stack_size < SIGSTKSZ)
-        stack_size = SIGSTKSZ;
-
-    c->stack = malloc(stack_size);
-    c->func = func;
-    c->func_arg = func_arg;
-    c->is_finished = false;
-    c->switch_count = 0;
+    /*
+     * Обработчик сигнала общий для всего процесса, поэтому корутины
+     * разных потоков создаются по очереди.
+     */
+    static pthread_mutex_t sigaction_mutex = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_lock(&sigaction_mutex);
     /*
      * SIGUSR2 is used. First of all, block new signals to be
      * able to set a new handler.
@@ -298,7 +1463,7 @@ coro_new(coro_f func, void *func_arg)
     sigset_t news, olds, suss;
     sigemptyset(&news);
     sigaddset(&news, SIGUSR2);
-    if (sigprocmask(SIG_BLOCK, &news, &olds) != 0)
+    if (pthread_sigmask(SIG_BLOCK, &news, &olds) != 0)
         handle_error();
     /*
      * New handler should jump onto a new stack and remember
@@ -314,7 +1479,7 @@ coro_new(coro_f func, void *func_arg)
     /* Create that new stack. */
     stack_t oldst, newst;
     newst.ss_sp = c->stack;
-    newst.ss_size = stack_size;
+    newst.ss_size = c->stack_size;
     newst.ss_flags = 0;
     if (sigaltstack(&newst, &oldst) != 0)
         handle_error();
@@ -345,10 +1510,50 @@ coro_new(coro_f func, void *func_arg)
         handle_error();
     if (sigaction(SIGUSR2, &oldsa, NULL) != 0)
         handle_error();
-    if (sigprocmask(SIG_SETMASK, &olds, NULL) != 0)
+    if (pthread_sigmask(SIG_SETMASK, &olds, NULL) != 0)
         handle_error();
+    pthread_mutex_unlock(&sigaction_mutex);
+}
+
+#endif
+
+struct coro *
+coro_new(coro_f func, void *func_arg)
+{
+    return coro_new_with_stack(func, func_arg, CORO_DEFAULT_STACK_SIZE);
+}
+
+struct coro *
+coro_new_with_stack(coro_f func, void *func_arg, size_t stack_size)
+{
+    struct coro *c = (struct coro *)malloc(sizeof(*c));
+    c->ret = 0;
+    if (stack_size < (size_t)SIGSTKSZ)
+        stack_size = SIGSTKSZ;
+    /* Размер кратен странице - стеки одного запрошенного размера взаимозаменяемы в пуле */
+    size_t page_size = coro_page_size();
+    stack_size = (stack_size + page_size - 1) / page_size * page_size;
+
+    c->stack = coro_stack_alloc(stack_size);
+    c->stack_size = stack_size;
+    c->func = func;
+    c->func_arg = func_arg;
+    c->is_finished = false;
+    c->is_running = false;
+    c->switch_count = 0;
+    c->false_switch_count = 0;
+    memset(&c->total_work_time, 0, sizeof(c->total_work_time));
+    c->yields_per_quantum = 1;
+    c->id = next_coro_id++;
+    memset(c->latency_histogram, 0, sizeof(c->latency_histogram));
+    c->total_latency_ns = 0;
+    c->max_latency_ns = 0;
+    c->next = NULL;
+    coro_context_init(c);
 
     /* Now scheduler can work with that coroutine. */
-    coro_list_add(c);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    coro_ready_push(c, &now);
     return c;
 }
@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <assert.h>
+
+#include "loser_tree.h"
+
+/** Ключ исчерпанного источника - больше любого числа */
+#define EXHAUSTED_KEY (UINT64_C(1) << 32)
+
+/** Перевести число в ключ так, чтобы порядок сохранялся при беззнаковом сравнении */
+#define TO_KEY(x) ((uint64_t)((uint32_t)(x) ^ 0x80000000u))
+#define FROM_KEY(k) ((int)((uint32_t)(k) ^ 0x80000000u))
+
+void loser_tree_init(loser_tree_t *lt, int count)
+{
+    assert(0 < count);
+
+    lt->count = count;
+    lt->keys = (uint64_t *)malloc(sizeof(uint64_t) * count);
+    lt->nodes = (int *)malloc(sizeof(int) * count);
+    for (int i = 0; i < count; i++)
+    {
+        lt->keys[i] = EXHAUSTED_KEY;
+        lt->nodes[i] = 0;
+    }
+}
+
+void loser_tree_free(loser_tree_t *lt)
+{
+    free(lt->keys);
+    free(lt->nodes);
+    lt->keys = NULL;
+    lt->nodes = NULL;
+    lt->count = 0;
+}
+
+void loser_tree_set_leaf(loser_tree_t *lt, int index, int key)
+{
+    assert(0 <= index && index < lt->count);
+    lt->keys[index] = TO_KEY(key);
+}
+
+void loser_tree_build(loser_tree_t *lt)
+{
+    /*
+     * Листья лежат на позициях [count, 2 * count), внутренние узлы - [1, count).
+     * Для каждого узла временно запоминаем победителя, а в самом узле оставляем проигравшего
+     */
+    int count = lt->count;
+    int *winners = (int *)malloc(sizeof(int) * 2 * count);
+    for (int i = 0; i < count; i++)
+    {
+        winners[count + i] = i;
+    }
+
+    for (int p = count - 1; 1 <= p; p--)
+    {
+        int left = winners[2 * p];
+        int right = winners[2 * p + 1];
+        if (lt->keys[left] <= lt->keys[right])
+        {
+            winners[p] = left;
+            lt->nodes[p] = right;
+        }
+        else
+        {
+            winners[p] = right;
+            lt->nodes[p] = left;
+        }
+    }
+
+    lt->nodes[0] = count == 1
+                       ? 0
+                       : winners[1];
+    free(winners);
+}
+
+bool loser_tree_top(loser_tree_t *lt, int *key, int *index)
+{
+    int winner = lt->nodes[0];
+    uint64_t winner_key = lt->keys[winner];
+    if (winner_key == EXHAUSTED_KEY)
+    {
+        return false;
+    }
+
+    *key = FROM_KEY(winner_key);
+    *index = winner;
+    return true;
+}
+
+/** Переиграть матчи на пути от листа победителя до корня */
+static inline void replay(loser_tree_t *lt)
+{
+    int *nodes = lt->nodes;
+    uint64_t *keys = lt->keys;
+    int winner = nodes[0];
+    uint64_t winner_key = keys[winner];
+    for (int p = (winner + lt->count) / 2; 1 <= p; p /= 2)
+    {
+        int challenger = nodes[p];
+        uint64_t challenger_key = keys[challenger];
+        if (challenger_key < winner_key)
+        {
+            nodes[p] = winner;
+            winner = challenger;
+            winner_key = challenger_key;
+        }
+    }
+    nodes[0] = winner;
+}
+
+void loser_tree_replace_top(loser_tree_t *lt, int key)
+{
+    lt->keys[lt->nodes[0]] = TO_KEY(key);
+    replay(lt);
+}
+
+void loser_tree_pop_top(loser_tree_t *lt)
+{
+    lt->keys[lt->nodes[0]] = EXHAUSTED_KEY;
+    replay(lt);
+}
+
+#define TO_KEY_64(x) ((uint64_t)(x) ^ UINT64_C(0x8000000000000000))
+
+/** Выигрывает ли источник a у источника b (при равенстве - выигрывает a) */
+static inline bool beats64(const loser_tree64_t *lt, int a, int b)
+{
+    return !lt->exhausted[a] && (lt->exhausted[b] || lt->keys[a] <= lt->keys[b]);
+}
+
+void loser_tree64_init(loser_tree64_t *lt, int count)
+{
+    assert(0 < count);
+
+    lt->count = count;
+    lt->keys = (uint64_t *)malloc(sizeof(uint64_t) * count);
+    lt->exhausted = (bool *)malloc(sizeof(bool) * count);
+    lt->nodes = (int *)malloc(sizeof(int) * count);
+    for (int i = 0; i < count; i++)
+    {
+        lt->keys[i] = 0;
+        lt->exhausted[i] = true;
+        lt->nodes[i] = 0;
+    }
+}
+
+void loser_tree64_free(loser_tree64_t *lt)
+{
+    free(lt->keys);
+    free(lt->exhausted);
+    free(lt->nodes);
+    lt->keys = NULL;
+    lt->exhausted = NULL;
+    lt->nodes = NULL;
+    lt->count = 0;
+}
+
+void loser_tree64_set_leaf(loser_tree64_t *lt, int index, int64_t key)
+{
+    assert(0 <= index && index < lt->count);
+    lt->keys[index] = TO_KEY_64(key);
+    lt->exhausted[index] = false;
+}
+
+void loser_tree64_build(loser_tree64_t *lt)
+{
+    int count = lt->count;
+    int *winners = (int *)malloc(sizeof(int) * 2 * count);
+    for (int i = 0; i < count; i++)
+    {
+        winners[count + i] = i;
+    }
+
+    for (int p = count - 1; 1 <= p; p--)
+    {
+        int left = winners[2 * p];
+        int right = winners[2 * p + 1];
+        if (beats64(lt, left, right))
+        {
+            winners[p] = left;
+            lt->nodes[p] = right;
+        }
+        else
+        {
+            winners[p] = right;
+            lt->nodes[p] = left;
+        }
+    }
+
+    lt->nodes[0] = count == 1
+                       ? 0
+                       : winners[1];
+    free(winners);
+}
+
+bool loser_tree64_top(loser_tree64_t *lt, int *index)
+{
+    int winner = lt->nodes[0];
+    if (lt->exhausted[winner])
+    {
+        return false;
+    }
+
+    *index = winner;
+    return true;
+}
+
+static inline void replay64(loser_tree64_t *lt)
+{
+    int *nodes = lt->nodes;
+    int winner = nodes[0];
+    for (int p = (winner + lt->count) / 2; 1 <= p; p /= 2)
+    {
+        int challenger = nodes[p];
+        /* Претендент должен выиграть строго, иначе победитель остается прежним */
+        if (!beats64(lt, winner, challenger))
+        {
+            nodes[p] = winner;
+            winner = challenger;
+        }
+    }
+    nodes[0] = winner;
+}
+
+void loser_tree64_replace_top(loser_tree64_t *lt, int64_t key)
+{
+    lt->keys[lt->nodes[0]] = TO_KEY_64(key);
+    replay64(lt);
+}
+
+void loser_tree64_pop_top(loser_tree64_t *lt)
+{
+    lt->exhausted[lt->nodes[0]] = true;
+    replay64(lt);
+}
@@ -4,243 +4,688 @@
 #include <stdbool.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <sys/resource.h>
+#include <pthread.h>
 
 #include "merge_files.h"
 #include "priority_queue.h"
+#include "loser_tree.h"
+#include "utils.h"
+#include "page_writer.h"
+#include "run_file.h"
+#include "radix_sort.h"
+#include "record_file.h"
+
+/** Дескрипторы, которые оставляются под остальные нужды: стандартные потоки, результат, новая серия */
+#define MERGE_RESERVED_FDS 16
+/** Меньше двух серий за проход слияние не продвинется */
+#define MIN_FAN_IN 2
+/** Максимальный размер буфера одной серии - больше уже не ускоряет последовательное чтение */
+#define MAX_BUFFER_SIZE (16 * 1024 * 1024)
+/** Размер буфера записи по умолчанию */
+#define DEFAULT_WRITE_BUFFER_SIZE (1024 * 1024)
+/** Сколько чисел накапливается перед передачей в page_writer_write_many */
+#define OUTPUT_BATCH_SIZE 256
+/** Границы диапазона, в который попадают все числа */
+#define FULL_RANGE_LOWER ((long long)INT_MIN)
+#define FULL_RANGE_UPPER ((long long)INT_MAX + 1)
+
+sorted_run_t *sorted_run_new()
+{
+    sorted_run_t *run = (sorted_run_t *)malloc(sizeof(sorted_run_t));
+    run->file = temp_file_new();
+    run_index_init(&run->index);
+    return run;
+}
+
+void sorted_run_free(sorted_run_t *run)
+{
+    temp_file_free(run->file);
+    run_index_free(&run->index);
+    free(run);
+}
 
-typedef struct page_file_writer_state
+typedef struct merge_files_state
 {
-    char *chunk;
-    int size;
-    int capacity;
-    int fd;
-} page_writer_t;
+    run_reader_t *readers;
+    /** Собственные дескрипторы серий - несколько потоков могут читать одну серию одновременно */
+    int *fds;
+    int count;
+} merge_state;
 
-static void page_writer_init(page_writer_t *writer, int fd, int capacity)
+/** Открыть серии и подготовить чтение чисел из диапазона [lower, upper) */
+static void merge_state_init(merge_state *state, sorted_run_t **runs, int count, int buffer_size, run_format_t format,
+                             long long lower, long long upper)
 {
-    writer->chunk = (char *)malloc(sizeof(char) * capacity);
-    writer->fd = fd;
-    writer->capacity = capacity;
-    writer->size = 0;
+    state->count = count;
+    state->readers = (run_reader_t *)malloc(sizeof(run_reader_t) * count);
+    state->fds = (int *)malloc(sizeof(int) * count);
+    for (long i = 0; i < count; i++)
+    {
+        int fd = temp_file_open(runs[i]->file);
+        /* Пропускаем начало серии, в котором точно нет чисел из диапазона */
+        if (lseek(fd, run_index_find(&runs[i]->index, (int)lower), SEEK_SET) == -1)
+        {
+            perror("lseek");
+            exit(1);
+        }
+
+        state->fds[i] = fd;
+        run_reader_init(&state->readers[i], fd, buffer_size, format);
+        run_reader_set_range(&state->readers[i], lower, upper);
+    }
 }
 
-static void page_writer_free(page_writer_t *writer)
+/** Закрыть серии, возвращает количество прочитанных из них байт */
+static long long merge_state_free(merge_state *state)
 {
-    free(writer->chunk);
-    writer->capacity = 0;
-    writer->size = 0;
+    long long bytes_read = 0;
+    for (long i = 0; i < state->count; i++)
+    {
+        bytes_read += state->readers[i].bytes_read;
+        run_reader_free(&state->readers[i]);
+        close(state->fds[i]);
+    }
+    free(state->readers);
+    free(state->fds);
+    state->count = 0;
+    return bytes_read;
 }
 
-static void page_writer_flush(page_writer_t *writer)
+/** Куда пишется результат слияния: текстом в итоговый файл или новой серией для следующего прохода */
+typedef struct merge_output
 {
-    if (writer->size == 0)
+    page_writer_t *text;
+    run_writer_t *run;
+} merge_output_t;
+
+static void merge_output_write(merge_output_t *output, const int *numbers, int count)
+{
+    if (output->run != NULL)
     {
-        return;
+        run_writer_write_many(output->run, numbers, count);
     }
+    else
+    {
+        page_writer_write_many(output->text, numbers, count);
+    }
+}
 
-    int left = writer->size;
-    int pos = 0;
-    while (0 < left)
+/** Слияние с помощью d-арной кучи: на каждое число - одна замена вершины */
+static void merge_with_heap(merge_state *state, merge_output_t *output)
+{
+    priority_queue_t pq;
+    priority_queue_init(&pq);
+    for (long i = 0; i < state->count; i++)
     {
-        int written = write(writer->fd, writer->chunk + pos, left);
-        if (written == -1)
+        run_reader_t *reader = &state->readers[i];
+        int number;
+        if (run_reader_next(reader, &number))
         {
-            perror("write");
-            exit(1);
+            priority_queue_enqueue(&pq, number, (void *)reader);
+        }
+    }
+
+    int batch[OUTPUT_BATCH_SIZE];
+    int batch_size = 0;
+    int64_t key;
+    void *ptr = NULL;
+    while (priority_queue_peek(&pq, &key, &ptr))
+    {
+        batch[batch_size] = (int)key;
+        if (++batch_size == OUTPUT_BATCH_SIZE)
+        {
+            merge_output_write(output, batch, batch_size);
+            batch_size = 0;
         }
 
-        left -= written;
-        pos += written;
+        run_reader_t *reader = (run_reader_t *)ptr;
+        int next_number;
+        if (run_reader_next(reader, &next_number))
+        {
+            priority_queue_replace_top(&pq, next_number, reader);
+        }
+        else
+        {
+            priority_queue_try_dequeue(&pq, &key, &ptr);
+        }
     }
 
-    writer->size = 0;
+    merge_output_write(output, batch, batch_size);
+    priority_queue_delete(&pq);
 }
 
-static void page_writer_write(page_writer_t *writer, int number)
+/** Слияние с помощью дерева проигравших: на каждое число - один проход от листа до корня */
+static void merge_with_loser_tree(merge_state *state, merge_output_t *output)
 {
-    char buf[11 /* 10 (цифр в числе макс) + 1 (пробел) */];
-    int buf_size = snprintf(buf, 11, "%d", number);
-    buf[buf_size] = ' ';
-    ++buf_size;
-    int chunk_left = writer->capacity - writer->size;
+    loser_tree_t lt;
+    loser_tree_init(&lt, state->count);
+    for (int i = 0; i < state->count; i++)
+    {
+        int number;
+        if (run_reader_next(&state->readers[i], &number))
+        {
+            loser_tree_set_leaf(&lt, i, number);
+        }
+    }
+    loser_tree_build(&lt);
 
-    if (buf_size <= chunk_left)
+    int batch[OUTPUT_BATCH_SIZE];
+    int batch_size = 0;
+    int number;
+    int index;
+    while (loser_tree_top(&lt, &number, &index))
     {
-        /* Если есть свободное место в буфере, то просто копируем и возвращаемся */
-        memcpy(writer->chunk + writer->size, buf, buf_size);
-        writer->size += buf_size;
-        return;
+        batch[batch_size] = number;
+        if (++batch_size == OUTPUT_BATCH_SIZE)
+        {
+            merge_output_write(output, batch, batch_size);
+            batch_size = 0;
+        }
+
+        int next_number;
+        if (run_reader_next(&state->readers[index], &next_number))
+        {
+            loser_tree_replace_top(&lt, next_number);
+        }
+        else
+        {
+            loser_tree_pop_top(&lt);
+        }
     }
 
-    /*
-     * 1. Заполняем оставшееся место в чанке
-     * 2. Сбрасываем на диск
-     * 3. Копируем оставшееся из буфера в чанк
-     */
+    merge_output_write(output, batch, batch_size);
+    loser_tree_free(&lt);
+}
 
-    int to_write = writer->capacity - writer->size;
-    memcpy(writer->chunk + writer->size, buf, to_write);
-    writer->size += to_write;
-    page_writer_flush(writer);
+static int get_page_size()
+{
+    int result = (int)sysconf(_SC_PAGESIZE);
+    if (result == -1)
+    {
+        return 4096;
+    }
 
-    int left_buf_size = buf_size - to_write;
-    memcpy(writer->chunk, buf + to_write, left_buf_size);
-    writer->size = left_buf_size;
+    return result;
 }
 
-typedef struct page_reader
+/** Получить количество дескрипторов, которое можно открыть под серии */
+static int get_fd_fan_in_limit()
 {
-    int fd;
-    char *chunk;
-    int capacity;
-    int size;
-    int pos;
-    bool eof;
-} page_reader;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == -1 || rl.rlim_cur == RLIM_INFINITY || INT_MAX < rl.rlim_cur)
+    {
+        return INT_MAX;
+    }
+
+    return (int)rl.rlim_cur - MERGE_RESERVED_FDS;
+}
 
-static void page_reader_init(page_reader *reader, int fd, int capacity)
+/** Размер буфера записи: заданный в параметрах (или по умолчанию), выровненный по странице */
+static int get_write_buffer_size(const merge_options_t *options, int page_size)
 {
-    reader->fd = fd;
-    reader->chunk = (char *)malloc(sizeof(char) * capacity);
-    reader->capacity = capacity;
-    reader->size = 0;
-    reader->pos = 0;
-    reader->eof = false;
+    long long size = options->write_buffer_size == 0
+                         ? DEFAULT_WRITE_BUFFER_SIZE
+                         : options->write_buffer_size;
+    size -= size % page_size;
+    if (size < page_size)
+    {
+        return page_size;
+    }
+
+    return (int)size;
 }
 
-static void page_reader_delete(page_reader *reader)
+/** Память под буферы чтения серий - все, что осталось в бюджете после буферов записи */
+static long long get_read_memory(const merge_options_t *options, long long write_memory)
 {
-    free(reader->chunk);
-    reader->fd = -1;
-    reader->chunk = NULL;
-    reader->capacity = 0;
-    reader->size = 0;
-    reader->pos = 0;
-    reader->eof = true;
+    long long read_memory = options->max_memory_bytes - write_memory;
+    return read_memory < 0
+               ? 0
+               : read_memory;
 }
 
-#define IS_4_MULTIPLE(x) (((x) & 0b11) == 0)
+/** Количество потоков последнего прохода. Записи делить на диапазоны не по чему - у их серий нет индекса */
+static int get_partitions(const merge_options_t *options)
+{
+    return options->threads < 1 || options->record.width != 0
+               ? 1
+               : options->threads;
+}
 
-static bool page_reader_try_read_next_chunk(page_reader *reader)
+/**
+ * Рассчитать максимальное количество серий, которые сливаются за один проход.
+ * Ограничено лимитом дескрипторов, бюджетом памяти (каждой серии нужен буфер хотя бы в страницу)
+ * и явно заданным ограничением. В последнем проходе каждый поток открывает все серии заново,
+ * поэтому лимиты делятся на количество потоков
+ */
+static int get_fan_in(const merge_options_t *options, long long read_memory, int page_size, int partitions)
 {
-    assert(reader->pos == reader->size);
-    assert(!reader->eof);
+    long long fan_in = get_fd_fan_in_limit() / partitions;
 
-    /* При чтении нужно учитывать, что размер чанка должен быть кратен 4 - размер int */
+    long long memory_fan_in = read_memory / partitions / page_size;
+    if (memory_fan_in < fan_in)
+    {
+        fan_in = memory_fan_in;
+    }
 
-    int size = 0;
-    do
+    if (0 < options->max_fan_in && options->max_fan_in < fan_in)
     {
-        int current_read = read(reader->fd, reader->chunk + size, reader->capacity - size);
-        if (current_read == -1)
-        {
-            perror("read");
-            exit(1);
-        }
+        fan_in = options->max_fan_in;
+    }
+
+    if (fan_in < MIN_FAN_IN)
+    {
+        return MIN_FAN_IN;
+    }
 
-        size += current_read;
-    } while (!IS_4_MULTIPLE(size) && reader->capacity < size);
+    return (int)fan_in;
+}
+
+/**
+ * Рассчитать размер буфера чтения одной серии: память под чтение делится поровну между всеми сериями группы.
+ * Размер выравнивается по странице, чтобы чтения шли целыми страницами
+ */
+static int get_read_buffer_size(long long read_memory, int runs_count, int page_size)
+{
+    long long buffer_size = read_memory / runs_count;
+    buffer_size -= buffer_size % page_size;
+    if (buffer_size < page_size)
+    {
+        return page_size;
+    }
 
-    if (size == 0)
+    if (MAX_BUFFER_SIZE < buffer_size)
     {
-        reader->eof = true;
-        return false;
+        return MAX_BUFFER_SIZE;
     }
 
-    reader->pos = 0;
-    reader->size = size;
-    return true;
+    return (int)buffer_size;
+}
+
+/** Параметры проходов слияния, рассчитанные из merge_options_t */
+typedef struct merge_plan
+{
+    const merge_options_t *options;
+    int page_size;
+    int write_buffer_size;
+    long long read_memory;
+    int fan_in;
+    int partitions;
+} merge_plan_t;
+
+static void merge_plan_init(merge_plan_t *plan, const merge_options_t *options)
+{
+    plan->options = options;
+    plan->page_size = get_page_size();
+    plan->partitions = get_partitions(options);
+    plan->write_buffer_size = get_write_buffer_size(options, plan->page_size);
+    /* При O_DIRECT у каждого объекта записи два буфера */
+    int write_buffers = options->direct_io
+                            ? 2
+                            : 1;
+    plan->read_memory = get_read_memory(options, (long long)plan->write_buffer_size * write_buffers * plan->partitions);
+    plan->fan_in = get_fan_in(options, plan->read_memory, plan->page_size, plan->partitions);
 }
 
-static bool page_reader_try_read_number(page_reader *reader, int *number)
+/** Слить группу серий записей в файл: в новую серию output или в результат, если output == NULL */
+static void merge_record_group(int result_fd, sorted_run_t *output, sorted_run_t **runs, int count,
+                               const merge_plan_t *plan, long long read_memory, merge_stats_t *stats)
 {
-    if (reader->eof)
+    const record_format_t *format = &plan->options->record;
+    int buffer_size = get_read_buffer_size(read_memory, count, plan->page_size);
+    if (buffer_size < format->width)
     {
-        return false;
+        buffer_size = format->width;
     }
 
-    if (reader->pos == reader->size)
+    record_reader_t *readers = (record_reader_t *)malloc(sizeof(record_reader_t) * count);
+    int *fds = (int *)malloc(sizeof(int) * count);
+    /* Текущая запись каждой серии: указатель в буфер ее чтения */
+    const char **current = (const char **)malloc(sizeof(char *) * count);
+    loser_tree64_t lt;
+    loser_tree64_init(&lt, count);
+    for (int i = 0; i < count; i++)
     {
-        if (!page_reader_try_read_next_chunk(reader))
+        fds[i] = temp_file_open(runs[i]->file);
+        record_reader_init(&readers[i], fds[i], buffer_size, format->width);
+        current[i] = record_reader_next(&readers[i]);
+        if (current[i] != NULL)
         {
-            return false;
+            loser_tree64_set_leaf(&lt, i, record_key(format, current[i]));
         }
     }
+    loser_tree64_build(&lt);
+
+    int out_fd = output == NULL
+                     ? result_fd
+                     : temp_file_fd(output->file);
+    record_writer_t writer;
+    record_writer_init(&writer, out_fd, plan->write_buffer_size, format->width);
+    int index;
+    while (loser_tree64_top(&lt, &index))
+    {
+        record_writer_write_many(&writer, current[index], 1);
+        current[index] = record_reader_next(&readers[index]);
+        if (current[index] != NULL)
+        {
+            loser_tree64_replace_top(&lt, record_key(format, current[index]));
+        }
+        else
+        {
+            loser_tree64_pop_top(&lt);
+        }
+    }
+    record_writer_flush(&writer);
+    stats->bytes_written += writer.bytes_written;
+    record_writer_free(&writer);
+    if (output != NULL)
+    {
+        temp_file_close(output->file);
+    }
 
-    *number = *(int *)(reader->chunk + reader->pos);
-    reader->pos += sizeof(int);
-    return true;
+    for (int i = 0; i < count; i++)
+    {
+        stats->bytes_read += readers[i].bytes_read;
+        record_reader_free(&readers[i]);
+        close(fds[i]);
+    }
+    loser_tree64_free(&lt);
+    free(current);
+    free(fds);
+    free(readers);
 }
 
-typedef struct merge_files_state
+/**
+ * Слить числа из диапазона [lower, upper) группы серий в файл:
+ * текстом, если это последний проход (to_text), иначе - в новую серию output.
+ * Прочитанные и записанные байты прибавляются к stats
+ */
+static void merge_group(int result_fd, sorted_run_t *output, sorted_run_t **runs, int count, const merge_plan_t *plan,
+                        long long read_memory, long long lower, long long upper, merge_stats_t *stats)
+{
+    if (plan->options->record.width != 0)
+    {
+        merge_record_group(result_fd, output, runs, count, plan, read_memory, stats);
+        return;
+    }
+
+    run_format_t run_format = plan->options->run_format;
+    merge_state state;
+    merge_state_init(&state, runs, count, get_read_buffer_size(read_memory, count, plan->page_size), run_format,
+                     lower, upper);
+
+    page_writer_t text_writer;
+    run_writer_t run_writer;
+    merge_output_t merge_output = {NULL, NULL};
+    if (output == NULL)
+    {
+        page_writer_init(&text_writer, result_fd, plan->write_buffer_size);
+        if (plan->options->direct_io)
+        {
+            page_writer_enable_direct(&text_writer);
+        }
+        merge_output.text = &text_writer;
+    }
+    else
+    {
+        run_writer_init(&run_writer, temp_file_fd(output->file), plan->write_buffer_size, run_format, &output->index);
+        if (plan->options->direct_io)
+        {
+            run_writer_enable_direct(&run_writer);
+        }
+        merge_output.run = &run_writer;
+    }
+
+    switch (plan->options->strategy)
+    {
+    case MERGE_STRATEGY_HEAP:
+        merge_with_heap(&state, &merge_output);
+        break;
+    case MERGE_STRATEGY_LOSER_TREE:
+        merge_with_loser_tree(&state, &merge_output);
+        break;
+    }
+
+    if (output == NULL)
+    {
+        page_writer_flush(&text_writer);
+        stats->bytes_written += text_writer.bytes_written;
+        page_writer_free(&text_writer);
+    }
+    else
+    {
+        run_writer_finish(&run_writer);
+        stats->bytes_written += run_writer.bytes_written;
+        run_writer_free(&run_writer);
+        temp_file_close(output->file);
+    }
+
+    stats->bytes_read += merge_state_free(&state);
+}
+
+/** Часть последнего прохода: числа из диапазона [lower, upper) всех серий, которые сливает отдельный поток */
+typedef struct merge_partition
 {
-    page_reader *readers;
+    const merge_plan_t *plan;
+    sorted_run_t **runs;
     int count;
-    priority_queue_t pq;
-} merge_state;
+    long long lower;
+    long long upper;
+    /** Текстовый результат этой части */
+    temp_file_t *output;
+    /** Ввод-вывод этой части - складывается со статистикой слияния после завершения потока */
+    merge_stats_t stats;
+} merge_partition_t;
+
+static void *merge_partition_thread(void *arg)
+{
+    merge_partition_t *partition = (merge_partition_t *)arg;
+    const merge_plan_t *plan = partition->plan;
+    merge_group(temp_file_fd(partition->output), NULL, partition->runs, partition->count, plan,
+                plan->read_memory / plan->partitions, partition->lower, partition->upper, &partition->stats);
+    return NULL;
+}
 
-static void merge_state_init(merge_state *state, int *fds, int count)
+/**
+ * Разбить все числа на partitions диапазонов примерно одинакового размера.
+ * Каждая запись индекса приходится на RUN_INDEX_STRIDE чисел, поэтому границы - квантили первых чисел из индексов.
+ * Возвращает массив из partitions + 1 границ
+ */
+static long long *get_partition_bounds(sorted_run_t **runs, int count, int partitions)
 {
-    priority_queue_init(&state->pq);
-    state->count = count;
-    page_reader *readers = (page_reader *)malloc(sizeof(page_reader) * count);
-    for (long i = 0; i < count; i++)
+    int keys_count = 0;
+    for (int i = 0; i < count; i++)
     {
-        page_reader *reader = &readers[i];
-        page_reader_init(reader, fds[i], 4096);
-        int number;
-        if (page_reader_try_read_number(reader, &number))
+        keys_count += runs[i]->index.size;
+    }
+
+    int *keys = (int *)malloc(sizeof(int) * (keys_count + 1));
+    int *scratch = (int *)malloc(sizeof(int) * (keys_count + 1));
+    int pos = 0;
+    for (int i = 0; i < count; i++)
+    {
+        for (int e = 0; e < runs[i]->index.size; e++)
         {
-            priority_queue_enqueue(&state->pq, number, (void *)reader);
+            keys[pos++] = runs[i]->index.entries[e].key;
         }
     }
-    state->readers = readers;
+    radix_sort_int32(keys, scratch, keys_count);
+
+    long long *bounds = (long long *)malloc(sizeof(long long) * (partitions + 1));
+    bounds[0] = FULL_RANGE_LOWER;
+    for (int p = 1; p < partitions; p++)
+    {
+        bounds[p] = keys_count == 0
+                        ? FULL_RANGE_LOWER
+                        : keys[(long long)p * keys_count / partitions];
+    }
+    bounds[partitions] = FULL_RANGE_UPPER;
+
+    free(keys);
+    free(scratch);
+    return bounds;
 }
 
-static void merge_state_free(merge_state *state)
+/** Дописать содержимое временного файла в конец результата, возвращает количество скопированных байт */
+static long long append_file(int result_fd, temp_file_t *file, char *buffer, int buffer_size)
 {
-    for (long i = 0; i < state->count; i++)
+    int fd = temp_file_open(file);
+    long long copied = 0;
+    int read_count;
+    while ((read_count = read(fd, buffer, buffer_size)) != 0)
     {
-        page_reader_delete(&state->readers[i]);
+        if (read_count == -1)
+        {
+            perror("read");
+            exit(1);
+        }
+
+        int pos = 0;
+        while (pos < read_count)
+        {
+            int written = write(result_fd, buffer + pos, read_count - pos);
+            if (written == -1)
+            {
+                perror("write");
+                exit(1);
+            }
+            pos += written;
+        }
+        copied += read_count;
     }
-    free(state->readers);
-    priority_queue_delete(&state->pq);
-    state->count = 0;
+    close(fd);
+    return copied;
 }
 
-static bool merge_state_try_read_next_number(merge_state *state, int *number)
+/**
+ * Последний проход в несколько потоков: числа делятся на диапазоны по индексам серий,
+ * каждый поток сливает свой диапазон во временный текстовый файл, затем файлы дописываются в результат по порядку
+ */
+static void merge_partitioned(int result_fd, sorted_run_t **runs, int count, const merge_plan_t *plan,
+                              merge_stats_t *stats)
 {
-    void *ptr = NULL;
-    if (priority_queue_try_dequeue(&state->pq, number, &ptr))
+    int partitions = plan->partitions;
+    long long *bounds = get_partition_bounds(runs, count, partitions);
+    merge_partition_t *parts = (merge_partition_t *)malloc(sizeof(merge_partition_t) * partitions);
+    pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t) * partitions);
+    for (int p = 0; p < partitions; p++)
     {
-        page_reader *reader = (page_reader *)ptr;
-        int next_number;
-        if (page_reader_try_read_number(reader, &next_number))
+        parts[p].plan = plan;
+        parts[p].runs = runs;
+        parts[p].count = count;
+        parts[p].lower = bounds[p];
+        parts[p].upper = bounds[p + 1];
+        parts[p].output = temp_file_new();
+        memset(&parts[p].stats, 0, sizeof(merge_stats_t));
+        int error = pthread_create(&threads[p], NULL, merge_partition_thread, &parts[p]);
+        if (error != 0)
         {
-            priority_queue_enqueue(&state->pq, next_number, reader);
+            fprintf(stderr, "pthread_create: %s\n", strerror(error));
+            exit(1);
         }
+    }
 
-        return true;
+    /* Буфер записи потоков уже свободен - используем такой же под копирование */
+    char *buffer = (char *)malloc(plan->write_buffer_size);
+    for (int p = 0; p < partitions; p++)
+    {
+        pthread_join(threads[p], NULL);
+        temp_file_close(parts[p].output);
+        long long copied = append_file(result_fd, parts[p].output, buffer, plan->write_buffer_size);
+        temp_file_free(parts[p].output);
+
+        stats->bytes_read += parts[p].stats.bytes_read + copied;
+        stats->bytes_written += parts[p].stats.bytes_written + copied;
     }
-    return false;
+
+    free(buffer);
+    free(threads);
+    free(parts);
+    free(bounds);
 }
 
-void merge_files(int result_fd, int *fds, int count)
+void merge_files(int result_fd, sorted_run_t **runs, int count, const merge_options_t *options)
 {
-    merge_state state;
-    merge_state_init(&state, fds, count);
+    if (count == 0)
+    {
+        if (options->stats != NULL)
+        {
+            memset(options->stats, 0, sizeof(merge_stats_t));
+        }
+        return;
+    }
 
-    page_writer_t writer;
-    page_writer_init(&writer, result_fd, 4096);
+    merge_plan_t plan;
+    merge_plan_init(&plan, options);
+    int fan_in = plan.fan_in;
 
-    int number;
-    while (merge_state_try_read_next_number(&state, &number))
+    merge_stats_t stats;
+    memset(&stats, 0, sizeof(stats));
+
+    /*
+     * Очередь серий на слияние. Промежуточные серии добавляются в конец,
+     * поэтому в первую очередь сливаются исходные (более короткие) серии.
+     * Каждое слияние забирает из очереди хотя бы 2 серии и добавляет одну,
+     * поэтому всего в очереди побывает меньше 2 * count серий
+     */
+    sorted_run_t **queue = (sorted_run_t **)malloc(sizeof(sorted_run_t *) * 2 * count);
+    memcpy(queue, runs, sizeof(sorted_run_t *) * count);
+    /* Промежуточные серии принадлежат нам - их нужно удалить после слияния */
+    bool *is_intermediate = (bool *)calloc(2 * count, sizeof(bool));
+    int head = 0;
+    int tail = count;
+
+    /*
+     * Первый промежуточный проход сливает столько серий, чтобы все последующие проходы
+     * (включая последний) сливали ровно fan_in серий
+     */
+    int group_size = (count - 2) % (fan_in - 1) + 2;
+    while (fan_in < tail - head)
     {
-        page_writer_write(&writer, number);
+        sorted_run_t *merged = sorted_run_new();
+        merge_group(-1, merged, queue + head, group_size, &plan, plan.read_memory, FULL_RANGE_LOWER, FULL_RANGE_UPPER,
+                    &stats);
+        ++stats.intermediate_runs;
+
+        for (int i = head; i < head + group_size; i++)
+        {
+            if (is_intermediate[i])
+            {
+                sorted_run_free(queue[i]);
+            }
+        }
+
+        head += group_size;
+        queue[tail] = merged;
+        is_intermediate[tail] = true;
+        ++tail;
+        group_size = fan_in;
     }
 
-    page_writer_flush(&writer);
+    if (plan.partitions == 1)
+    {
+        merge_group(result_fd, NULL, queue + head, tail - head, &plan, plan.read_memory, FULL_RANGE_LOWER,
+                    FULL_RANGE_UPPER, &stats);
+    }
+    else
+    {
+        merge_partitioned(result_fd, queue + head, tail - head, &plan, &stats);
+    }
 
-    page_writer_free(&writer);
-    merge_state_free(&state);
-}
\ No newline at end of file
+    for (int i = head; i < tail; i++)
+    {
+        if (is_intermediate[i])
+        {
+            sorted_run_free(queue[i]);
+        }
+    }
+
+    free(is_intermediate);
+    free(queue);
+    if (options->stats != NULL)
+    {
+        *options->stats = stats;
+    }
+}
@@ -1,15 +1,25 @@
 #include "number_file_reader.h"
+#include "libcoro.h"
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <assert.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdio.h>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAS_X86_SIMD
+#endif
+
+typedef int (*parse_numbers_f)(file_read_state *state, int *out, int max);
+
 typedef struct file_read_state
 {
     /// @brief Дескриптор файла, из которого мы читаем данные
@@ -24,49 +34,74 @@ typedef struct file_read_state
     int pos;
     /// @brief Достигнут ли конец файла
     bool eof;
+    /// @brief Реализация разбора чисел, выбранная под возможности процессора
+    parse_numbers_f parse_numbers;
+    /// @brief Отображение файла в память, либо NULL, если файл читается через read()
+    char *map;
+    /// @brief Размер отображения (размер файла)
+    long long map_length;
+    /// @brief Где заканчиваются разбираемые данные: размер файла или граница, заданная file_read_state_set_limit
+    long long map_size;
+    /// @brief Смещение текущего окна (buf) от начала отображения
+    long long map_offset;
+    /// @brief Сколько байт еще можно прочитать через read(), либо -1, если до конца файла
+    long long remaining;
+    /// @brief Сколько байт файла прочитано через read() или попало в окно отображения
+    long long bytes_read;
 } file_read_state;
 
-/// @brief Достигнут ли конец файла
-#define IS_EOF(state) ((state)->eof)
+/// @brief Размер окна, через которое разбирается отображенный файл
+#define MMAP_WINDOW_SIZE (64 * 1024 * 1024)
 
-/// @brief Достигнут ли конец текущего чанка
-#define IS_END_BUFFER(state) ((state)->size <= (state)->pos)
+/*
+ * Разделителем считается любой символ с кодом не больше пробела.
+ * Это все пробельные символы из isspace() (и заодно управляющие символы, в числах их все равно нет),
+ * а проверка сводится к одному беззнаковому сравнению - его легко векторизовать
+ */
+#define IS_SEPARATOR(c) ((unsigned char)(c) <= ' ')
 
-/// @brief Получить текущий символ, без увеличения длины
-#define CUR_CHAR(state) ((state)->buf[(state)->pos])
-
-file_read_state *file_read_state_new(int fd, int buffer_size)
+/**
+ * Следующее окно отображенного файла: окно просто сдвигается на текущую позицию, ничего не копируется.
+ * Пройденные страницы убираются из адресного пространства, чтобы большой файл не раздувал RSS
+ */
+static void slide_map_window(file_read_state *state)
 {
-    if (buffer_size <= 0)
+    long long new_offset = state->map_offset + state->pos;
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (0 < page_size)
     {
-        return NULL;
+        long long passed = new_offset - new_offset % page_size;
+        long long released = state->map_offset - state->map_offset % page_size;
+        if (released < passed)
+        {
+            madvise(state->map + released, passed - released, MADV_DONTNEED);
+        }
     }
 
-    file_read_state *state = (file_read_state *)malloc(sizeof(file_read_state));
-    state->fd = fd;
-    state->buf = (char *)malloc(buffer_size);
-    state->max_size = buffer_size;
-    state->size = 0;
-    state->pos = 0;
-    state->eof = false;
-    return state;
-}
+    long long length = state->map_size - new_offset;
+    if (MMAP_WINDOW_SIZE < length)
+    {
+        length = MMAP_WINDOW_SIZE;
+    }
 
-void file_read_state_delete(file_read_state *state)
-{
-    free(state->buf);
+    state->bytes_read += new_offset + length - (state->map_offset + state->size);
+    state->map_offset = new_offset;
+    state->buf = state->map + new_offset;
+    state->size = (int)length;
     state->pos = 0;
-    state->eof = true;
-    state->size = 0;
-    state->max_size = 0;
-    state->fd = -1;
-    free(state);
+    state->eof = new_offset + length == state->map_size;
 }
 
 static void read_next_chunk(file_read_state *state)
 {
     assert(!state->eof);
 
+    if (state->map != NULL)
+    {
+        slide_map_window(state);
+        return;
+    }
+
     /*
      * Переносим оставшиеся данные в начало буфера и размер
      */
@@ -81,114 +116,469 @@ static void read_next_chunk(file_read_state *state)
     /*
      * Заполняем оставшееся место в буфере (читаем оставшееся)
      */
+    if (left == state->max_size)
+    {
+        /* Одна лексема заняла весь буфер (например, длинная строка нулей) - увеличиваем буфер */
+        state->max_size *= 2;
+        state->buf = (char *)realloc(state->buf, state->max_size);
+        if (state->buf == NULL)
+        {
+            perror("realloc");
+            exit(1);
+        }
+    }
+
     int to_read = state->max_size - left;
-    assert(to_read + left <= state->max_size);
+    if (0 <= state->remaining && state->remaining < to_read)
+    {
+        to_read = (int)state->remaining;
+    }
 
-    int read_count = read(state->fd, state->buf + left, to_read);
+    int read_count = to_read == 0
+                         ? 0
+                         : coro_read(state->fd, state->buf + left, to_read);
     if (read_count == -1)
     {
         perror("read");
         exit(1);
     }
 
-    if (read_count + left != state->max_size)
-    {
-        /* 
-         * После записанных символов могли остаться старые символы чисел.
-         * Из-за этого может сломаться парсинг, т.к. получится число не помещающееся в int (кастуем long к int получаем -1)
-         */
-        state->buf[read_count + left] = '\0';
-    }
-
     if (read_count == 0)
     {
         state->eof = true;
     }
+    else if (0 <= state->remaining)
+    {
+        state->remaining -= read_count;
+    }
 
+    state->bytes_read += read_count;
     state->size = left + read_count;
 }
 
-static bool skip_whitespaces(file_read_state *state)
+/** Найти первый символ в [from, to), удовлетворяющий условию (разделитель или нет). Скалярная версия */
+static inline int find_scalar(const char *buf, int from, int to, bool separator)
 {
-    while (!IS_EOF(state))
+    while (from < to && IS_SEPARATOR(buf[from]) != separator)
     {
-        /* Читаем новый чанк, если достигли конца текущего */
-        if (state->size <= state->pos)
+        from++;
+    }
+    return from;
+}
+
+#ifdef HAS_X86_SIMD
+
+/**
+ * Найти первый символ в [from, to), удовлетворяющий условию, обрабатывая по 16 байт.
+ * Символ - разделитель, если max(c, ' ') == ' ' (беззнаковое сравнение)
+ */
+static inline int find_sse2(const char *buf, int from, int to, bool separator)
+{
+    const __m128i space = _mm_set1_epi8(' ');
+    while (from + 16 <= to)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i *)(buf + from));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_max_epu8(chars, space), space));
+        if (!separator)
         {
-            read_next_chunk(state);
-            continue;
+            mask = ~mask & 0xFFFFu;
         }
 
-        /* Проходимся по всему буферу, пока не дойдем до конца */
-        while (!IS_END_BUFFER(state))
+        if (mask != 0)
         {
-            if (!isspace(CUR_CHAR(state)))
-            {
-                return true;
-            }
+            return from + __builtin_ctz(mask);
+        }
+        from += 16;
+    }
+
+    return find_scalar(buf, from, to, separator);
+}
 
-            /* Текущий символ - пустая строка, переходим к следующему */
-            state->pos++;
+/** То же самое, что find_sse2, но по 32 байта */
+__attribute__((target("avx2"))) static inline int find_avx2(const char *buf, int from, int to, bool separator)
+{
+    const __m256i space = _mm256_set1_epi8(' ');
+    while (from + 32 <= to)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i *)(buf + from));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_max_epu8(chars, space), space));
+        if (!separator)
+        {
+            mask = ~mask;
         }
+
+        if (mask != 0)
+        {
+            return from + __builtin_ctz(mask);
+        }
+        from += 32;
     }
 
-    return false;
+    return find_sse2(buf, from, to, separator);
 }
 
-bool file_read_state_get_next_number(file_read_state *state, int *read_number)
+#endif
+
+/**
+ * Перевести до 8 цифр, которые заканчиваются в end, в число за несколько умножений (SWAR).
+ * Байты перед числом заменяются на '0', после чего все 8 байт переводятся в цифры и
+ * попарно сворачиваются: 8 цифр -> 4 двузначных -> 2 четырехзначных -> 1 восьмизначное.
+ * Требует, чтобы перед end в буфере было хотя бы 8 байт и 0 < length <= 8.
+ * Если среди байт есть не цифры, возвращает false - тогда число разбирается посимвольно
+ */
+static inline bool convert_8_digits(const char *end, int length, uint32_t *value)
 {
+    assert(0 < length && length <= 8);
+    uint64_t chunk;
+    memcpy(&chunk, end - 8, sizeof(chunk));
+
+    /* Младшие байты (little-endian) - символы перед числом */
+    uint64_t keep_mask = ~UINT64_C(0) << (8 * (8 - length));
+    chunk = (chunk & keep_mask) | (UINT64_C(0x3030303030303030) & ~keep_mask);
+
     /*
-     * Пропускаем пустые строки с учетом:
-     * - Их может быть несколько
-     * - Придется прочитать следующий чанк из файла
-     * - Файл закончится
+     * Байт - цифра, если ни b + 0x46 (больше '9'), ни b - 0x30 (меньше '0') не выставляют старший бит.
+     * Переносы между байтами дают только ложные срабатывания, а с ними просто выбирается медленный путь
      */
-    if (!skip_whitespaces(state))
+    if (((chunk + UINT64_C(0x4646464646464646)) | (chunk - UINT64_C(0x3030303030303030))) &
+        UINT64_C(0x8080808080808080))
     {
         return false;
     }
+    chunk -= UINT64_C(0x3030303030303030);
 
-    /*
-     * При чтении чанка, число могло быть обрезано.
-     * Поэтому вначале находим конец этого числа:
-     * - Если это пустая строка - то парсим число и возвращаем
-     * - Если достигнут конец буфера - читаем следующий чанк и повторяем
-     */
-    while (!IS_EOF(state))
+    chunk = (chunk * 10) + (chunk >> 8);
+    chunk = ((chunk & UINT64_C(0x000000FF000000FF)) * UINT64_C(0x000F424000000064)
+             + (((chunk >> 16) & UINT64_C(0x000000FF000000FF)) * UINT64_C(0x0000271000000001))) >> 32;
+    *value = (uint32_t)chunk;
+    return true;
+}
+
+/** Посимвольно дописать к value цифры из [start, end) до первой не цифры. Возвращает количество цифр */
+static inline int convert_digits(const char *start, const char *end, uint32_t *value)
+{
+    const char *pos = start;
+    for (; pos < end && '0' <= *pos && *pos <= '9'; pos++)
+    {
+        *value = *value * 10 + (uint32_t)(*pos - '0');
+    }
+    return pos - start;
+}
+
+/**
+ * Перевести лексему [start, end) в число. Допускается знак в начале.
+ * Как и strtol, число заканчивается на первом символе, который не цифра ("12a4" - это 12).
+ * Лексема без цифр ("-", "abc") числом не считается - тогда возвращается false.
+ * Арифметика беззнаковая, поэтому при переполнении число "заворачивается" так же, как при касте long к int
+ */
+static inline bool convert_token(const char *buf, const char *start, const char *end, int *out)
+{
+    bool negative = false;
+    if (*start == '-')
+    {
+        negative = true;
+        start++;
+    }
+    else if (*start == '+')
+    {
+        start++;
+    }
+
+    uint32_t value = 0;
+    bool converted = false;
+    int length = end - start;
+    if (length == 0)
+    {
+        return false;
+    }
+
+    if (8 <= end - buf && length <= 8)
+    {
+        converted = convert_8_digits(end, length, &value);
+    }
+    else if (8 < length && convert_digits(start, end - 8, &value) == length - 8)
+    {
+        /* Старшие цифры посимвольно, последние 8 - разом */
+        uint32_t low;
+        if (convert_8_digits(end, 8, &low))
+        {
+            value = value * 100000000u + low;
+            converted = true;
+        }
+    }
+
+    if (!converted)
     {
-        int delta = 1;
-        while (state->pos + delta < state->size)
+        /* Число в самом начале буфера (перед ним нет 8 байт), либо в лексеме не только цифры */
+        value = 0;
+        if (convert_digits(start, end, &value) == 0)
         {
-            if (isspace(*(state->buf + state->pos + delta)))
+            return false;
+        }
+    }
+
+    *out = (int)(negative ? 0u - value : value);
+    return true;
+}
+
+/** Набор инструкций, которым ищутся границы чисел */
+enum simd_level
+{
+    SIMD_SCALAR,
+    SIMD_SSE2,
+    SIMD_AVX2,
+};
+
+/**
+ * Общий цикл разбора чисел. Вызывается с константным level из функций ниже,
+ * поэтому после встраивания выбор реализации поиска происходит на этапе компиляции
+ */
+static inline __attribute__((always_inline)) int parse_numbers_generic(file_read_state *state, int *out, int max, enum simd_level level)
+{
+    int count = 0;
+    while (count < max)
+    {
+        /* Пропускаем разделители. Если буфер закончился - читаем следующий чанк */
+        int start;
+        int end;
+#ifdef HAS_X86_SIMD
+        if (level == SIMD_AVX2)
+        {
+            start = find_avx2(state->buf, state->pos, state->size, false);
+        }
+        else if (level == SIMD_SSE2)
+        {
+            start = find_sse2(state->buf, state->pos, state->size, false);
+        }
+        else
+#endif
+        {
+            start = find_scalar(state->buf, state->pos, state->size, false);
+        }
+
+        if (start == state->size)
+        {
+            state->pos = state->size;
+            if (state->eof)
             {
-                /* В условии сказано, что числа укладываются в int */
-                int number = (int)strtol(state->buf + state->pos,
-                                         NULL /* Адрес не передаем, т.к. вычислили сами */,
-                                         10);
-                state->pos += delta;
-                *read_number = number;
-                return true;
+                break;
             }
 
-            delta++;
+            read_next_chunk(state);
+            continue;
+        }
+
+        /* Ищем конец числа */
+#ifdef HAS_X86_SIMD
+        if (level == SIMD_AVX2)
+        {
+            end = find_avx2(state->buf, start, state->size, true);
+        }
+        else if (level == SIMD_SSE2)
+        {
+            end = find_sse2(state->buf, start, state->size, true);
+        }
+        else
+#endif
+        {
+            end = find_scalar(state->buf, start, state->size, true);
         }
 
-        read_next_chunk(state);
-        if (IS_EOF(state))
+        if (end == state->size && !state->eof)
         {
             /*
-             * Если достигли конца файла, то последнее число - не обрезано.
-             * Возвращаем его и
+             * Число могло быть обрезано границей чанка.
+             * Переносим его в начало буфера, дочитываем и разбираем заново
              */
+            state->pos = start;
+            read_next_chunk(state);
+            continue;
+        }
 
-            int number = (int)strtol(state->buf + state->pos,
-                                     NULL,
-                                     10);
-            state->pos += delta;
-            *read_number = number;
-            return true;
+        if (convert_token(state->buf, state->buf + start, state->buf + end, out + count))
+        {
+            ++count;
         }
+        state->pos = end;
     }
 
-    return false;
+    return count;
+}
+
+static int parse_numbers_scalar(file_read_state *state, int *out, int max)
+{
+    return parse_numbers_generic(state, out, max, SIMD_SCALAR);
+}
+
+#ifdef HAS_X86_SIMD
+
+static int parse_numbers_sse2(file_read_state *state, int *out, int max)
+{
+    return parse_numbers_generic(state, out, max, SIMD_SSE2);
+}
+
+__attribute__((target("avx2"))) static int parse_numbers_avx2(file_read_state *state, int *out, int max)
+{
+    return parse_numbers_generic(state, out, max, SIMD_AVX2);
+}
+
+#endif
+
+static parse_numbers_f select_parser(number_parser_t parser)
+{
+    switch (parser)
+    {
+#ifdef HAS_X86_SIMD
+    case NUMBER_PARSER_AVX2:
+        return __builtin_cpu_supports("avx2")
+                   ? parse_numbers_avx2
+                   : NULL;
+    case NUMBER_PARSER_SSE2:
+        return parse_numbers_sse2;
+#endif
+    case NUMBER_PARSER_SCALAR:
+        return parse_numbers_scalar;
+    default:
+        return NULL;
+    }
+}
+
+static file_read_state *file_read_state_alloc(int fd)
+{
+    file_read_state *state = (file_read_state *)malloc(sizeof(file_read_state));
+    state->fd = fd;
+    state->buf = NULL;
+    state->max_size = 0;
+    state->size = 0;
+    state->pos = 0;
+    state->eof = false;
+    state->map = NULL;
+    state->map_length = 0;
+    state->map_size = 0;
+    state->map_offset = 0;
+    state->remaining = -1;
+    state->bytes_read = 0;
+
+    /* Выбираем самую быструю реализацию, которую поддерживает процессор */
+    state->parse_numbers = select_parser(NUMBER_PARSER_AVX2);
+    if (state->parse_numbers == NULL)
+    {
+        state->parse_numbers = select_parser(NUMBER_PARSER_SSE2);
+    }
+    if (state->parse_numbers == NULL)
+    {
+        state->parse_numbers = select_parser(NUMBER_PARSER_SCALAR);
+    }
+    return state;
+}
+
+file_read_state *file_read_state_new(int fd, int buffer_size)
+{
+    if (buffer_size <= 0)
+    {
+        return NULL;
+    }
+
+    file_read_state *state = file_read_state_alloc(fd);
+    state->buf = (char *)malloc(buffer_size);
+    state->max_size = buffer_size;
+    return state;
+}
+
+file_read_state *file_read_state_new_mmap(int fd, int buffer_size)
+{
+    struct stat sb;
+    if (fstat(fd, &sb) == -1 || !S_ISREG(sb.st_mode) || sb.st_size == 0)
+    {
+        /* Пайпы, сокеты и т.д. отобразить нельзя (а пустой файл и не нужно) - читаем через read() */
+        return file_read_state_new(fd, buffer_size);
+    }
+
+    /* Читаем с текущей позиции, как и read() */
+    off_t start = lseek(fd, 0, SEEK_CUR);
+    if (start == -1)
+    {
+        start = 0;
+    }
+
+    char *map = (char *)mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED)
+    {
+        return file_read_state_new(fd, buffer_size);
+    }
+    madvise(map, sb.st_size, MADV_SEQUENTIAL);
+
+    file_read_state *state = file_read_state_alloc(fd);
+    state->map = map;
+    state->map_length = sb.st_size;
+    state->map_size = sb.st_size;
+    state->map_offset = start < sb.st_size ? start : sb.st_size;
+    state->buf = map + state->map_offset;
+    /* Окно пока пустое - первое окно выставит read_next_chunk() */
+    state->eof = state->map_offset == state->map_size;
+    return state;
+}
+
+void file_read_state_delete(file_read_state *state)
+{
+    if (state->map != NULL)
+    {
+        munmap(state->map, state->map_length);
+    }
+    else
+    {
+        free(state->buf);
+    }
+    state->map = NULL;
+    state->buf = NULL;
+    state->pos = 0;
+    state->eof = true;
+    state->size = 0;
+    state->max_size = 0;
+    state->fd = -1;
+    free(state);
+}
+
+void file_read_state_set_limit(file_read_state *state, long long length)
+{
+    assert(state->size == 0 && state->pos == 0);
+
+    if (state->map != NULL)
+    {
+        if (state->map_offset + length < state->map_size)
+        {
+            state->map_size = state->map_offset + length;
+        }
+        state->eof = state->map_offset == state->map_size;
+        return;
+    }
+
+    state->remaining = length;
+}
+
+bool file_read_state_set_parser(file_read_state *state, number_parser_t parser)
+{
+    parse_numbers_f parse_numbers = select_parser(parser);
+    if (parse_numbers == NULL)
+    {
+        return false;
+    }
+
+    state->parse_numbers = parse_numbers;
+    return true;
+}
+
+int file_read_state_get_numbers(file_read_state *state, int *out, int max)
+{
+    return state->parse_numbers(state, out, max);
+}
+
+bool file_read_state_get_next_number(file_read_state *state, int *read_number)
+{
+    return state->parse_numbers(state, read_number, 1) == 1;
+}
+
+long long file_read_state_bytes_read(const file_read_state *state)
+{
+    return state->bytes_read;
 }
@@ -0,0 +1,221 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "page_writer.h"
+#include "direct_io.h"
+
+/** Сколько байт может "перелиться" за границу буфера: число и пробел после него */
+#define CHUNK_SLACK (MAX_INT_TEXT_LENGTH + 1)
+
+/** Все двузначные числа подряд: цифры записываются сразу парами */
+static const char DIGIT_PAIRS[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint32_t POWERS_OF_10[] = {
+    0, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+
+/**
+ * Количество цифр в числе без ветвлений:
+ * по количеству значащих бит оценивается количество цифр (log10(2) ~ 1233 / 4096), затем оценка уточняется одним сравнением
+ */
+static inline int count_digits(uint32_t value)
+{
+    int estimate = ((32 - __builtin_clz(value | 1)) * 1233) >> 12;
+    return estimate - (value < POWERS_OF_10[estimate]) + 1;
+}
+
+int format_int(char *dst, int number)
+{
+    uint32_t value = (uint32_t)number;
+    int length = 0;
+    if (number < 0)
+    {
+        *dst = '-';
+        value = 0u - value;
+        length = 1;
+    }
+
+    int digits = count_digits(value);
+    length += digits;
+
+    /* Заполняем с конца по две цифры */
+    char *pos = dst + length;
+    while (100 <= value)
+    {
+        uint32_t pair = (value % 100) * 2;
+        value /= 100;
+        pos -= 2;
+        memcpy(pos, DIGIT_PAIRS + pair, 2);
+    }
+
+    if (10 <= value)
+    {
+        pos -= 2;
+        memcpy(pos, DIGIT_PAIRS + value * 2, 2);
+    }
+    else
+    {
+        *--pos = (char)('0' + value);
+    }
+
+    return length;
+}
+
+void page_writer_init(page_writer_t *writer, int fd, int capacity)
+{
+    writer->chunk = (char *)malloc(sizeof(char) * (capacity + CHUNK_SLACK));
+    writer->fd = fd;
+    writer->capacity = capacity;
+    writer->size = 0;
+    writer->bytes_written = 0;
+    writer->direct = NULL;
+}
+
+bool page_writer_enable_direct(page_writer_t *writer)
+{
+    assert(writer->size == 0 && writer->direct == NULL);
+    if (writer->capacity % DIRECT_IO_ALIGNMENT != 0)
+    {
+        return false;
+    }
+
+    direct_output_t *direct = (direct_output_t *)malloc(sizeof(direct_output_t));
+    if (!direct_output_init(direct, writer->fd, writer->capacity + CHUNK_SLACK))
+    {
+        free(direct);
+        return false;
+    }
+
+    free(writer->chunk);
+    writer->chunk = direct_output_buffer(direct);
+    writer->direct = direct;
+    return true;
+}
+
+/** Закончить запись через O_DIRECT: дальше буфер обычный */
+static void page_writer_finish_direct(page_writer_t *writer)
+{
+    direct_output_finish(writer->direct, writer->size);
+    writer->bytes_written += writer->size;
+    writer->size = 0;
+
+    direct_output_free(writer->direct);
+    free(writer->direct);
+    writer->direct = NULL;
+    writer->chunk = (char *)malloc(sizeof(char) * (writer->capacity + CHUNK_SLACK));
+}
+
+void page_writer_free(page_writer_t *writer)
+{
+    if (writer->direct != NULL)
+    {
+        /* Буфер принадлежит записи через O_DIRECT */
+        direct_output_free(writer->direct);
+        free(writer->direct);
+        writer->direct = NULL;
+        writer->chunk = NULL;
+    }
+    free(writer->chunk);
+    writer->chunk = NULL;
+    writer->capacity = 0;
+    writer->size = 0;
+}
+
+static void write_all(int fd, const char *data, int size)
+{
+    int pos = 0;
+    while (pos < size)
+    {
+        int written = write(fd, data + pos, size - pos);
+        if (written == -1)
+        {
+            perror("write");
+            exit(1);
+        }
+
+        pos += written;
+    }
+}
+
+/**
+ * Сбросить полный буфер: записывается ровно capacity байт,
+ * а то, что перелилось за границу, переносится в начало
+ */
+static void page_writer_flush_full(page_writer_t *writer)
+{
+    assert(writer->capacity <= writer->size);
+
+    int overflow = writer->size - writer->capacity;
+    if (writer->direct != NULL)
+    {
+        /* Буфер уходит на запись целиком, а перелившееся число переезжает во второй буфер */
+        char *next = direct_output_submit(writer->direct, writer->capacity);
+        memcpy(next, writer->chunk + writer->capacity, overflow);
+        writer->chunk = next;
+    }
+    else
+    {
+        write_all(writer->fd, writer->chunk, writer->capacity);
+        memcpy(writer->chunk, writer->chunk + writer->capacity, overflow);
+    }
+    writer->bytes_written += writer->capacity;
+    writer->size = overflow;
+}
+
+void page_writer_flush(page_writer_t *writer)
+{
+    if (writer->direct != NULL)
+    {
+        page_writer_finish_direct(writer);
+        return;
+    }
+
+    if (writer->size == 0)
+    {
+        return;
+    }
+
+    write_all(writer->fd, writer->chunk, writer->size);
+    writer->bytes_written += writer->size;
+    writer->size = 0;
+}
+
+void page_writer_write(page_writer_t *writer, int number)
+{
+    page_writer_write_many(writer, &number, 1);
+}
+
+void page_writer_write_many(page_writer_t *writer, const int *numbers, int count)
+{
+    char *chunk = writer->chunk;
+    int size = writer->size;
+    for (int i = 0; i < count; i++)
+    {
+        /* Пока size < capacity, места в хвосте хватает на любое число */
+        size += format_int(chunk + size, numbers[i]);
+        chunk[size] = ' ';
+        ++size;
+
+        if (writer->capacity <= size)
+        {
+            writer->size = size;
+            page_writer_flush_full(writer);
+            chunk = writer->chunk;
+            size = writer->size;
+        }
+    }
+    writer->size = size;
+}
@@ -1,144 +1,238 @@
 #include <assert.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "priority_queue.h"
+
+#if PRIORITY_QUEUE_ARITY != 4
+#error "sift_down выбирает минимум ровно из четырех потомков"
+#endif
+
 #define DEFAULT_HEAP_CAPACITY 16
+#define CACHE_LINE_SIZE 64
 
-#define PARENT(x) (((x)-1) / 2)
-#define LEFT_CHILD(x) (2 * (x) + 1)
-#define RIGHT_CHILD(x) (2 * (x) + 2)
+#define PARENT(x) (((x)-1) / PRIORITY_QUEUE_ARITY)
+#define FIRST_CHILD(x) (PRIORITY_QUEUE_ARITY * (x) + 1)
 
 void priority_queue_init(priority_queue_t *pq)
 {
     pq->size = 0;
     pq->capacity = 0;
-    pq->heap = NULL;
+    pq->keys = NULL;
+    pq->values = NULL;
+    pq->keys_block = NULL;
 }
 
 void priority_queue_delete(priority_queue_t *pq)
 {
-    free(pq->heap);
-    pq->heap = NULL;
+    free(pq->keys_block);
+    free(pq->values);
+    pq->keys_block = NULL;
+    pq->keys = NULL;
+    pq->values = NULL;
     pq->size = 0;
     pq->capacity = 0;
 }
 
-static inline void swap(pq_entry_t *heap, int left, int right)
+/**
+ * Переносит содержимое в массивы новой емкости.
+ * Блок ключей выровнен по кэш-линии, а сами ключи начинаются со сдвигом на ARITY - 1 элементов:
+ * тогда первый потомок любого узла попадает на границу 32 байт, и все потомки лежат в одной кэш-линии
+ */
+static void grow(priority_queue_t *pq, int new_capacity)
 {
-    pq_entry_t tmp = heap[left];
-    heap[left] = heap[right];
-    heap[right] = tmp;
+    void *block = NULL;
+    size_t block_size = sizeof(int64_t) * (new_capacity + PRIORITY_QUEUE_ARITY - 1);
+    if (posix_memalign(&block, CACHE_LINE_SIZE, block_size) != 0)
+    {
+        perror("posix_memalign");
+        exit(1);
+    }
+
+    int64_t *keys = (int64_t *)block + PRIORITY_QUEUE_ARITY - 1;
+    void **values = (void **)realloc(pq->values, sizeof(void *) * new_capacity);
+    if (values == NULL)
+    {
+        perror("realloc");
+        exit(1);
+    }
+
+    if (pq->size != 0)
+    {
+        memcpy(keys, pq->keys, sizeof(int64_t) * pq->size);
+    }
+    free(pq->keys_block);
+
+    pq->keys_block = (int64_t *)block;
+    pq->keys = keys;
+    pq->values = values;
+    pq->capacity = new_capacity;
 }
 
-static void heapify_up(priority_queue_t *pq)
+/** Просеивание вверх от index: родители сдвигаются вниз, новый элемент записывается один раз */
+static void sift_up(priority_queue_t *pq, int index, int64_t key, void *value)
 {
-    /* Наш новый элемент находится последним */
-    int current_index = pq->size - 1;
-    while (0 < current_index)
+    int64_t *keys = pq->keys;
+    void **values = pq->values;
+    while (0 < index)
     {
-        int parent_index = PARENT(current_index);
-        if (pq->heap[current_index].key < pq->heap[parent_index].key)
-        {
-            swap(pq->heap, parent_index, current_index);
-            current_index = parent_index;
-        }
-        else
+        int parent = PARENT(index);
+        if (keys[parent] <= key)
         {
             break;
         }
+
+        keys[index] = keys[parent];
+        values[index] = values[parent];
+        index = parent;
     }
+
+    keys[index] = key;
+    values[index] = value;
 }
 
-void priority_queue_enqueue(priority_queue_t *pq, int key, void *value)
+/**
+ * Индекс наименьшего из четырех потомков, начиная с first, и его ключ.
+ * Без ветвлений (исход сравнений случаен) и без повторного чтения ключей по вычисленному индексу
+ */
+static inline int min_of_four(const int64_t *keys, int first, int64_t *min_key)
 {
-    assert(pq != NULL);
+    int64_t k0 = keys[first], k1 = keys[first + 1], k2 = keys[first + 2], k3 = keys[first + 3];
+    int left = k1 < k0 ? first + 1 : first;
+    int64_t left_key = k1 < k0 ? k1 : k0;
+    int right = k3 < k2 ? first + 3 : first + 2;
+    int64_t right_key = k3 < k2 ? k3 : k2;
+    *min_key = right_key < left_key ? right_key : left_key;
+    return right_key < left_key ? right : left;
+}
 
-    if (pq->capacity == 0)
+/** Просеивание вниз от вершины: на каждом уровне выбирается наименьший из потомков */
+static void sift_down(priority_queue_t *pq, int64_t key, void *value)
+{
+    int64_t *keys = pq->keys;
+    void **values = pq->values;
+    int size = pq->size;
+    int index = 0;
+    while (FIRST_CHILD(index) < size)
     {
-        pq_entry_t *heap = (pq_entry_t *)malloc(sizeof(pq_entry_t) * DEFAULT_HEAP_CAPACITY);
-        pq->size = 1;
-        pq->capacity = DEFAULT_HEAP_CAPACITY;
-        heap[0] = (pq_entry_t){
-            .key = key,
-            .value = value};
-        pq->heap = heap;
-        return;
-    }
+        int first = FIRST_CHILD(index);
+        int min = first;
+        int64_t min_key = keys[first];
+        if (first + PRIORITY_QUEUE_ARITY <= size)
+        {
+            min = min_of_four(keys, first, &min_key);
+        }
+        else
+        {
+            /* Последний узел с неполным набором потомков */
+            for (int child = first + 1; child < size; child++)
+            {
+                if (keys[child] < min_key)
+                {
+                    min = child;
+                    min_key = keys[child];
+                }
+            }
+        }
 
-    if (pq->size == pq->capacity)
-    {
-        int new_capacity = pq->capacity * 2;
-        pq->heap = (pq_entry_t *)realloc(pq->heap, new_capacity);
-        pq->capacity = new_capacity;
+        if (key <= min_key)
+        {
+            break;
+        }
+
+        keys[index] = min_key;
+        values[index] = values[min];
+        index = min;
     }
 
-    pq->heap[pq->size] = (pq_entry_t){
-        .key = key,
-        .value = value};
-    ++pq->size;
-    heapify_up(pq);
+    keys[index] = key;
+    values[index] = value;
 }
 
-static void heapify_down(priority_queue_t *pq)
+/**
+ * Просеивание при извлечении: на место вершины встает последний элемент, который почти всегда принадлежит нижним уровням.
+ * Поэтому дыра сначала опускается до листа по наименьшим потомкам без сравнения с ключом, затем ключ поднимается от листа
+ */
+static void sift_down_from_leaf(priority_queue_t *pq, int64_t key, void *value)
 {
-    int current_index = 0;
-    while (LEFT_CHILD(current_index) < pq->size)
+    int64_t *keys = pq->keys;
+    void **values = pq->values;
+    int size = pq->size;
+    int index = 0;
+    while (FIRST_CHILD(index) + PRIORITY_QUEUE_ARITY <= size)
     {
-        int left = LEFT_CHILD(current_index);
-        int right = RIGHT_CHILD(current_index);
-
-        if (right < pq->size)
+        /* Спуск идет до листа, поэтому внуков (16 ключей в двух кэш-линиях) можно подгружать заранее */
+        int grandchild = FIRST_CHILD(FIRST_CHILD(index));
+        if (grandchild < size)
         {
-            /* Есть оба потомка */
-            int min = pq->heap[left].key < pq->heap[right].key
-                          ? left
-                          : right;
-            if (pq->heap[current_index].key < pq->heap[min].key)
-            {
-                return;
-            }
-            swap(pq->heap, min, current_index);
-            current_index = min;
+            __builtin_prefetch(&keys[grandchild]);
+            __builtin_prefetch(&keys[grandchild] + 8);
         }
-        else
+        int64_t min_key;
+        int min = min_of_four(keys, FIRST_CHILD(index), &min_key);
+        keys[index] = min_key;
+        values[index] = values[min];
+        index = min;
+    }
+
+    /* Последний узел с неполным набором потомков */
+    int first = FIRST_CHILD(index);
+    if (first < size)
+    {
+        int min = first;
+        for (int child = first + 1; child < size; child++)
         {
-            /* 
-             * Если есть только левый потомок, то проверяем только его и заканчиваем,
-             * т.к. это означает конец кучи (массива)
-             */
-            if (pq->heap[current_index].key <= pq->heap[left].key)
+            if (keys[child] < keys[min])
             {
-                return;
+                min = child;
             }
-
-            swap(pq->heap, left, current_index);
-            return;
         }
+
+        keys[index] = keys[min];
+        values[index] = values[min];
+        index = min;
     }
+
+    sift_up(pq, index, key, value);
 }
 
-bool priority_queue_try_dequeue(priority_queue_t *pq, int *key, void **value)
+void priority_queue_enqueue(priority_queue_t *pq, int64_t key, void *value)
 {
-    if (pq->size == 0)
+    assert(pq != NULL);
+
+    if (pq->size == pq->capacity)
     {
-        return false;
+        grow(pq, pq->capacity == 0
+                     ? DEFAULT_HEAP_CAPACITY
+                     : pq->capacity * 2);
     }
 
-    pq_entry_t top_entry = pq->heap[0];
-    *key = top_entry.key;
-    *value = top_entry.value;
+    ++pq->size;
+    sift_up(pq, pq->size - 1, key, value);
+}
 
-    if (pq->size == 1)
+bool priority_queue_try_dequeue(priority_queue_t *pq, int64_t *key, void **value)
+{
+    if (pq->size == 0)
     {
-        pq->size = 0;
-        memset(pq->heap, 0, sizeof(pq_entry_t));
-        return true;
+        return false;
     }
 
-    swap(pq->heap, 0, pq->size - 1);
+    *key = pq->keys[0];
+    *value = pq->values[0];
+
     pq->size -= 1;
-    heapify_down(pq);
+    if (pq->size != 0)
+    {
+        sift_down_from_leaf(pq, pq->keys[pq->size], pq->values[pq->size]);
+    }
     return true;
 }
+
+void priority_queue_replace_top(priority_queue_t *pq, int64_t key, void *value)
+{
+    assert(0 < pq->size);
+    sift_down(pq, key, value);
+}
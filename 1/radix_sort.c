@@ -0,0 +1,234 @@
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "radix_sort.h"
+
+#define RADIX_BITS 8
+#define RADIX_SIZE (1 << RADIX_BITS)
+#define RADIX_MASK (RADIX_SIZE - 1)
+#define RADIX_PASSES (32 / RADIX_BITS)
+#define RADIX_PASSES_64 (64 / RADIX_BITS)
+
+/** Для маленьких массивов построение гистограмм дороже самой сортировки */
+#define INSERTION_SORT_THRESHOLD 64
+
+/**
+ * Ключ сортировки - число с инвертированным знаковым битом.
+ * Так отрицательные числа оказываются меньше положительных при беззнаковом сравнении
+ */
+#define RADIX_KEY(x) ((uint32_t)(x) ^ 0x80000000u)
+#define RADIX_DIGIT(x, pass) ((RADIX_KEY(x) >> ((pass) * RADIX_BITS)) & RADIX_MASK)
+#define RADIX_KEY_64(x) ((uint64_t)(x) ^ UINT64_C(0x8000000000000000))
+#define RADIX_DIGIT_64(x, pass) ((RADIX_KEY_64(x) >> ((pass) * RADIX_BITS)) & RADIX_MASK)
+
+static void insertion_sort(int *array, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        int number = array[i];
+        int j = i - 1;
+        while (0 <= j && number < array[j])
+        {
+            array[j + 1] = array[j];
+            --j;
+        }
+        array[j + 1] = number;
+    }
+}
+
+/** Построить гистограммы всех разрядов за один проход по массиву */
+static void build_histograms(const int *array, int count, int histograms[RADIX_PASSES][RADIX_SIZE])
+{
+    memset(histograms, 0, sizeof(int) * RADIX_PASSES * RADIX_SIZE);
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t key = RADIX_KEY(array[i]);
+        ++histograms[0][key & RADIX_MASK];
+        ++histograms[1][(key >> 8) & RADIX_MASK];
+        ++histograms[2][(key >> 16) & RADIX_MASK];
+        ++histograms[3][key >> 24];
+    }
+}
+
+/**
+ * Превратить гистограмму разряда в смещения начала каждой корзины.
+ * Возвращает false, если все числа попали в одну корзину и проход можно пропустить
+ */
+static bool histogram_to_offsets(int *histogram, int count)
+{
+    int sum = 0;
+    for (int d = 0; d < RADIX_SIZE; d++)
+    {
+        int bucket = histogram[d];
+        if (bucket == count)
+        {
+            return false;
+        }
+
+        histogram[d] = sum;
+        sum += bucket;
+    }
+
+    return true;
+}
+
+void radix_sort_int32(int *array, int *scratch, int count)
+{
+    if (count < INSERTION_SORT_THRESHOLD)
+    {
+        insertion_sort(array, count);
+        return;
+    }
+
+    int histograms[RADIX_PASSES][RADIX_SIZE];
+    build_histograms(array, count, histograms);
+
+    int *src = array;
+    int *dst = scratch;
+    for (int pass = 0; pass < RADIX_PASSES; pass++)
+    {
+        int *offsets = histograms[pass];
+        if (!histogram_to_offsets(offsets, count))
+        {
+            continue;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            int number = src[i];
+            dst[offsets[RADIX_DIGIT(number, pass)]++] = number;
+        }
+
+        int *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    /* Если было нечетное количество проходов, то результат во вспомогательном массиве */
+    if (src != array)
+    {
+        memcpy(array, src, sizeof(int) * count);
+    }
+}
+
+static void insertion_sort_int64(int64_t *array, int count)
+{
+    for (int i = 1; i < count; i++)
+    {
+        int64_t number = array[i];
+        int j = i - 1;
+        while (0 <= j && number < array[j])
+        {
+            array[j + 1] = array[j];
+            --j;
+        }
+        array[j + 1] = number;
+    }
+}
+
+static void build_histograms_64(const int64_t *array, int count, int histograms[RADIX_PASSES_64][RADIX_SIZE])
+{
+    memset(histograms, 0, sizeof(int) * RADIX_PASSES_64 * RADIX_SIZE);
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t key = RADIX_KEY_64(array[i]);
+        for (int pass = 0; pass < RADIX_PASSES_64; pass++)
+        {
+            ++histograms[pass][(key >> (pass * RADIX_BITS)) & RADIX_MASK];
+        }
+    }
+}
+
+void radix_sort_int64(int64_t *array, int64_t *scratch, int count)
+{
+    if (count < INSERTION_SORT_THRESHOLD)
+    {
+        insertion_sort_int64(array, count);
+        return;
+    }
+
+    int histograms[RADIX_PASSES_64][RADIX_SIZE];
+    build_histograms_64(array, count, histograms);
+
+    int64_t *src = array;
+    int64_t *dst = scratch;
+    for (int pass = 0; pass < RADIX_PASSES_64; pass++)
+    {
+        int *offsets = histograms[pass];
+        if (!histogram_to_offsets(offsets, count))
+        {
+            continue;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            int64_t number = src[i];
+            dst[offsets[RADIX_DIGIT_64(number, pass)]++] = number;
+        }
+
+        int64_t *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != array)
+    {
+        memcpy(array, src, sizeof(int64_t) * count);
+    }
+}
+
+static inline int64_t record_key_at(const char *record, int key_offset)
+{
+    int64_t key;
+    memcpy(&key, record + key_offset, sizeof(key));
+    return key;
+}
+
+void radix_sort_records(char *records, char *scratch, int count, int width, int key_offset)
+{
+    if (width == (int)sizeof(int64_t) && key_offset == 0)
+    {
+        radix_sort_int64((int64_t *)records, (int64_t *)scratch, count);
+        return;
+    }
+
+    int histograms[RADIX_PASSES_64][RADIX_SIZE];
+    memset(histograms, 0, sizeof(histograms));
+    for (int i = 0; i < count; i++)
+    {
+        uint64_t key = RADIX_KEY_64(record_key_at(records + (long long)i * width, key_offset));
+        for (int pass = 0; pass < RADIX_PASSES_64; pass++)
+        {
+            ++histograms[pass][(key >> (pass * RADIX_BITS)) & RADIX_MASK];
+        }
+    }
+
+    /* Записи переносятся целиком: на каждый проход - одно копирование записи */
+    char *src = records;
+    char *dst = scratch;
+    for (int pass = 0; pass < RADIX_PASSES_64; pass++)
+    {
+        int *offsets = histograms[pass];
+        if (!histogram_to_offsets(offsets, count))
+        {
+            continue;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            const char *record = src + (long long)i * width;
+            int digit = RADIX_DIGIT_64(record_key_at(record, key_offset), pass);
+            memcpy(dst + (long long)offsets[digit]++ * width, record, width);
+        }
+
+        char *tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    if (src != records)
+    {
+        memcpy(records, src, (size_t)count * width);
+    }
+}
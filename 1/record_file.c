@@ -0,0 +1,151 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "record_file.h"
+#include "libcoro.h"
+
+static void write_all(int fd, const char *data, int size)
+{
+    int pos = 0;
+    while (pos < size)
+    {
+        int written = coro_write(fd, data + pos, size - pos);
+        if (written == -1)
+        {
+            perror("write");
+            exit(1);
+        }
+
+        pos += written;
+    }
+}
+
+void record_writer_init(record_writer_t *writer, int fd, int capacity, int width)
+{
+    assert(0 < width && 0 < capacity);
+
+    writer->fd = fd;
+    writer->width = width;
+    writer->chunk = (char *)malloc(sizeof(char) * capacity);
+    writer->size = 0;
+    writer->capacity = capacity;
+    writer->bytes_written = 0;
+}
+
+void record_writer_free(record_writer_t *writer)
+{
+    free(writer->chunk);
+    writer->chunk = NULL;
+    writer->capacity = 0;
+    writer->size = 0;
+}
+
+void record_writer_write_many(record_writer_t *writer, const char *records, int count)
+{
+    long long left = (long long)count * writer->width;
+    /* Одна запись - самый частый случай при слиянии: копируем ее целиком, если она помещается */
+    if (left <= writer->capacity - writer->size)
+    {
+        memcpy(writer->chunk + writer->size, records, left);
+        writer->size += (int)left;
+        if (writer->size == writer->capacity)
+        {
+            record_writer_flush(writer);
+        }
+        return;
+    }
+
+    while (0 < left)
+    {
+        int to_copy = writer->capacity - writer->size;
+        if (left < to_copy)
+        {
+            to_copy = (int)left;
+        }
+
+        memcpy(writer->chunk + writer->size, records, to_copy);
+        writer->size += to_copy;
+        records += to_copy;
+        left -= to_copy;
+
+        if (writer->size == writer->capacity)
+        {
+            record_writer_flush(writer);
+        }
+    }
+}
+
+void record_writer_flush(record_writer_t *writer)
+{
+    write_all(writer->fd, writer->chunk, writer->size);
+    writer->bytes_written += writer->size;
+    writer->size = 0;
+}
+
+void record_reader_init(record_reader_t *reader, int fd, int capacity, int width)
+{
+    assert(0 < width && width <= capacity);
+
+    reader->fd = fd;
+    reader->width = width;
+    reader->chunk = (char *)malloc(sizeof(char) * capacity);
+    reader->capacity = capacity;
+    reader->size = 0;
+    reader->pos = 0;
+    reader->eof = false;
+    reader->bytes_read = 0;
+}
+
+void record_reader_free(record_reader_t *reader)
+{
+    free(reader->chunk);
+    reader->fd = -1;
+    reader->chunk = NULL;
+    reader->capacity = 0;
+    reader->size = 0;
+    reader->pos = 0;
+    reader->eof = true;
+}
+
+const char *record_reader_fill_next(record_reader_t *reader)
+{
+    int left = reader->size - reader->pos;
+    memmove(reader->chunk, reader->chunk + reader->pos, left);
+    reader->pos = 0;
+    reader->size = left;
+
+    while (!reader->eof && reader->size < reader->capacity)
+    {
+        int current_read = coro_read(reader->fd, reader->chunk + reader->size, reader->capacity - reader->size);
+        if (current_read == -1)
+        {
+            perror("read");
+            exit(1);
+        }
+
+        if (current_read == 0)
+        {
+            reader->eof = true;
+            break;
+        }
+
+        reader->size += current_read;
+        reader->bytes_read += current_read;
+    }
+
+    if (reader->size < reader->width)
+    {
+        if (reader->size != 0)
+        {
+            fprintf(stderr, "Файл записей обрезан: размер не кратен размеру записи\n");
+            exit(1);
+        }
+        return NULL;
+    }
+
+    reader->pos = reader->width;
+    return reader->chunk;
+}
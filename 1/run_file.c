@@ -0,0 +1,708 @@
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+
+#include "run_file.h"
+#include "libcoro.h"
+#include "direct_io.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/** Заголовок блока упакованной серии */
+typedef struct run_block_header
+{
+    /** Количество чисел в блоке. Меньше RUN_BLOCK_SIZE только у последнего блока */
+    uint32_t count;
+    /** Минимальное (первое) число блока */
+    int32_t min;
+    /** Разрядность упакованных разностей */
+    uint32_t bits;
+} run_block_header_t;
+
+/** Максимальный размер блока: заголовок и разности по 32 бита */
+#define RUN_BLOCK_MAX_BYTES ((int)sizeof(run_block_header_t) + RUN_BLOCK_SIZE * (int)sizeof(uint32_t))
+
+/** Инверсия знакового бита переводит порядок int в порядок uint32_t */
+#define SIGN_BIT 0x80000000u
+
+/*
+ * Раскладка блока (как в SIMD-BP128): числа блока делятся на 4 "полосы" - i-е число попадает в полосу i % 4.
+ * В каждой полосе хранится разность с предыдущим числом этой же полосы (для первых четырех - с минимумом),
+ * и разности всех полос упаковываются одновременно: 32-битное слово j полосы l лежит по смещению 16 * j + 4 * l.
+ * Поэтому и упаковка, и распаковка, и восстановление чисел префиксной суммой делаются сразу для 4 чисел
+ */
+
+/** Разрядность числа: сколько младших бит нужно, чтобы его записать */
+static inline int bit_width(uint32_t value)
+{
+    return value == 0
+               ? 0
+               : 32 - __builtin_clz(value);
+}
+
+#ifdef __SSE2__
+
+/** Закодировать ровно RUN_BLOCK_SIZE чисел (count из них настоящие), вернуть размер блока в байтах */
+static int encode_block(const int *values, int count, char *dst)
+{
+    const __m128i sign = _mm_set1_epi32((int)SIGN_BIT);
+    __m128i deltas[RUN_BLOCK_SIZE / 4];
+    __m128i prev = _mm_set1_epi32(values[0] ^ (int)SIGN_BIT);
+    __m128i any = _mm_setzero_si128();
+    for (int j = 0; j < RUN_BLOCK_SIZE / 4; j++)
+    {
+        __m128i cur = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(values + 4 * j)), sign);
+        deltas[j] = _mm_sub_epi32(cur, prev);
+        any = _mm_or_si128(any, deltas[j]);
+        prev = cur;
+    }
+
+    uint32_t lanes[4];
+    _mm_storeu_si128((__m128i *)lanes, any);
+    int bits = bit_width(lanes[0] | lanes[1] | lanes[2] | lanes[3]);
+
+    run_block_header_t header = {(uint32_t)count, values[0], (uint32_t)bits};
+    memcpy(dst, &header, sizeof(header));
+    char *out = dst + sizeof(header);
+
+    if (bits == 0)
+    {
+        return sizeof(header);
+    }
+
+    __m128i acc = _mm_setzero_si128();
+    int shift = 0;
+    for (int j = 0; j < RUN_BLOCK_SIZE / 4; j++)
+    {
+        acc = _mm_or_si128(acc, _mm_sll_epi32(deltas[j], _mm_cvtsi32_si128(shift)));
+        shift += bits;
+        if (32 <= shift)
+        {
+            _mm_storeu_si128((__m128i *)out, acc);
+            out += sizeof(__m128i);
+            shift -= 32;
+            /* Старшие биты разности, не влезшие в слово */
+            acc = shift == 0
+                      ? _mm_setzero_si128()
+                      : _mm_srl_epi32(deltas[j], _mm_cvtsi32_si128(bits - shift));
+        }
+    }
+
+    return out - dst;
+}
+
+/** Раскодировать RUN_BLOCK_SIZE чисел из упакованных разностей */
+static void decode_block(const char *src, int32_t min, int bits, int *values)
+{
+    const __m128i sign = _mm_set1_epi32((int)SIGN_BIT);
+    __m128i prev = _mm_set1_epi32(min ^ (int)SIGN_BIT);
+    if (bits == 0)
+    {
+        for (int j = 0; j < RUN_BLOCK_SIZE / 4; j++)
+        {
+            _mm_storeu_si128((__m128i *)(values + 4 * j), _mm_xor_si128(prev, sign));
+        }
+        return;
+    }
+
+    const __m128i mask = _mm_set1_epi32(bits == 32 ? -1 : (int)((1u << bits) - 1));
+    __m128i cur = _mm_loadu_si128((const __m128i *)src);
+    int word = 0;
+    int shift = 0;
+    for (int j = 0; j < RUN_BLOCK_SIZE / 4; j++)
+    {
+        __m128i delta = _mm_srl_epi32(cur, _mm_cvtsi32_si128(shift));
+        shift += bits;
+        if (32 <= shift)
+        {
+            shift -= 32;
+            if (++word < bits)
+            {
+                cur = _mm_loadu_si128((const __m128i *)(src + sizeof(__m128i) * word));
+                if (shift != 0)
+                {
+                    delta = _mm_or_si128(delta, _mm_sll_epi32(cur, _mm_cvtsi32_si128(bits - shift)));
+                }
+            }
+        }
+
+        prev = _mm_add_epi32(prev, _mm_and_si128(delta, mask));
+        _mm_storeu_si128((__m128i *)(values + 4 * j), _mm_xor_si128(prev, sign));
+    }
+}
+
+#else
+
+/** Закодировать ровно RUN_BLOCK_SIZE чисел (count из них настоящие), вернуть размер блока в байтах */
+static int encode_block(const int *values, int count, char *dst)
+{
+    uint32_t deltas[RUN_BLOCK_SIZE];
+    uint32_t any = 0;
+    for (int i = 0; i < RUN_BLOCK_SIZE; i++)
+    {
+        uint32_t prev = (uint32_t)values[i < 4 ? 0 : i - 4] ^ SIGN_BIT;
+        deltas[i] = ((uint32_t)values[i] ^ SIGN_BIT) - prev;
+        any |= deltas[i];
+    }
+    int bits = bit_width(any);
+
+    run_block_header_t header = {(uint32_t)count, values[0], (uint32_t)bits};
+    memcpy(dst, &header, sizeof(header));
+    char *out = dst + sizeof(header);
+
+    if (bits == 0)
+    {
+        return sizeof(header);
+    }
+
+    uint32_t acc[4] = {0, 0, 0, 0};
+    int shift = 0;
+    for (int j = 0; j < RUN_BLOCK_SIZE / 4; j++)
+    {
+        const uint32_t *delta = deltas + 4 * j;
+        for (int l = 0; l < 4; l++)
+        {
+            acc[l] |= delta[l] << shift;
+        }
+
+        shift += bits;
+        if (32 <= shift)
+        {
+            memcpy(out, acc, sizeof(acc));
+            out += sizeof(acc);
+            shift -= 32;
+            for (int l = 0; l < 4; l++)
+            {
+                acc[l] = shift == 0
+                             ? 0
+                             : delta[l] >> (bits - shift);
+            }
+        }
+    }
+
+    return out - dst;
+}
+
+/** Раскодировать RUN_BLOCK_SIZE чисел из упакованных разностей */
+static void decode_block(const char *src, int32_t min, int bits, int *values)
+{
+    uint32_t prev[4];
+    for (int l = 0; l < 4; l++)
+    {
+        prev[l] = (uint32_t)min ^ SIGN_BIT;
+    }
+
+    if (bits == 0)
+    {
+        for (int i = 0; i < RUN_BLOCK_SIZE; i++)
+        {
+            values[i] = min;
+        }
+        return;
+    }
+
+    uint32_t mask = bits == 32 ? UINT32_MAX : (1u << bits) - 1;
+    uint32_t cur[4];
+    memcpy(cur, src, sizeof(cur));
+    int word = 0;
+    int shift = 0;
+    for (int j = 0; j < RUN_BLOCK_SIZE / 4; j++)
+    {
+        uint32_t delta[4];
+        for (int l = 0; l < 4; l++)
+        {
+            delta[l] = cur[l] >> shift;
+        }
+
+        shift += bits;
+        if (32 <= shift)
+        {
+            shift -= 32;
+            if (++word < bits)
+            {
+                memcpy(cur, src + sizeof(cur) * word, sizeof(cur));
+                for (int l = 0; l < 4 && shift != 0; l++)
+                {
+                    delta[l] |= cur[l] << (bits - shift);
+                }
+            }
+        }
+
+        for (int l = 0; l < 4; l++)
+        {
+            prev[l] += delta[l] & mask;
+            values[4 * j + l] = (int)(prev[l] ^ SIGN_BIT);
+        }
+    }
+}
+
+#endif
+
+void run_index_init(run_index_t *index)
+{
+    index->entries = NULL;
+    index->size = 0;
+    index->capacity = 0;
+}
+
+void run_index_free(run_index_t *index)
+{
+    free(index->entries);
+    index->entries = NULL;
+    index->size = 0;
+    index->capacity = 0;
+}
+
+static void run_index_add(run_index_t *index, int key, long long offset)
+{
+    if (index->size == index->capacity)
+    {
+        index->capacity = index->capacity == 0
+                              ? 16
+                              : index->capacity * 2;
+        index->entries = (run_index_entry_t *)realloc(index->entries, sizeof(run_index_entry_t) * index->capacity);
+    }
+
+    index->entries[index->size].key = key;
+    index->entries[index->size].offset = offset;
+    ++index->size;
+}
+
+long long run_index_find(const run_index_t *index, int key)
+{
+    /*
+     * Нужна последняя запись с первым числом строго меньше key:
+     * в блоке перед записью с первым числом, равным key, тоже могут быть числа, равные key
+     */
+    int left = 0;
+    int right = index->size;
+    while (left < right)
+    {
+        int middle = left + (right - left) / 2;
+        if (index->entries[middle].key < key)
+        {
+            left = middle + 1;
+        }
+        else
+        {
+            right = middle;
+        }
+    }
+
+    return left == 0
+               ? 0
+               : index->entries[left - 1].offset;
+}
+
+/** Индекс первого числа, не меньшего key, в отсортированном массиве */
+static int lower_bound(const int *values, int count, long long key)
+{
+    int left = 0;
+    int right = count;
+    while (left < right)
+    {
+        int middle = left + (right - left) / 2;
+        if (values[middle] < key)
+        {
+            left = middle + 1;
+        }
+        else
+        {
+            right = middle;
+        }
+    }
+
+    return left;
+}
+
+static void write_all(int fd, const char *data, int size)
+{
+    int pos = 0;
+    while (pos < size)
+    {
+        int written = coro_write(fd, data + pos, size - pos);
+        if (written == -1)
+        {
+            perror("write");
+            exit(1);
+        }
+
+        pos += written;
+    }
+}
+
+void run_writer_init(run_writer_t *writer, int fd, int capacity, run_format_t format, run_index_t *index)
+{
+    assert(capacity % sizeof(int) == 0);
+
+    writer->fd = fd;
+    writer->format = format;
+    /* За буфером - место под один блок, который "перелился" через границу */
+    writer->chunk = (char *)malloc(sizeof(char) * (capacity + RUN_BLOCK_MAX_BYTES));
+    writer->size = 0;
+    writer->capacity = capacity;
+    writer->pending = format == RUN_FORMAT_PACKED
+                          ? (int *)malloc(sizeof(int) * RUN_BLOCK_SIZE)
+                          : NULL;
+    writer->pending_count = 0;
+    writer->bytes_written = 0;
+    writer->numbers_written = 0;
+    writer->index = index;
+    writer->direct = NULL;
+}
+
+bool run_writer_enable_direct(run_writer_t *writer)
+{
+    assert(writer->size == 0 && writer->direct == NULL);
+    if (writer->capacity % DIRECT_IO_ALIGNMENT != 0)
+    {
+        return false;
+    }
+
+    direct_output_t *direct = (direct_output_t *)malloc(sizeof(direct_output_t));
+    if (!direct_output_init(direct, writer->fd, writer->capacity + RUN_BLOCK_MAX_BYTES))
+    {
+        free(direct);
+        return false;
+    }
+
+    free(writer->chunk);
+    writer->chunk = direct_output_buffer(direct);
+    writer->direct = direct;
+    return true;
+}
+
+void run_writer_free(run_writer_t *writer)
+{
+    if (writer->direct != NULL)
+    {
+        /* Буфер принадлежит записи через O_DIRECT */
+        direct_output_free(writer->direct);
+        free(writer->direct);
+        writer->direct = NULL;
+        writer->chunk = NULL;
+    }
+    free(writer->chunk);
+    free(writer->pending);
+    writer->chunk = NULL;
+    writer->pending = NULL;
+    writer->size = 0;
+    writer->capacity = 0;
+    writer->pending_count = 0;
+}
+
+static void run_writer_flush(run_writer_t *writer, int size)
+{
+    int overflow = writer->size - size;
+    if (writer->direct != NULL)
+    {
+        /* Буфер уходит на запись, а перелившийся блок переезжает во второй буфер */
+        char *next = direct_output_submit(writer->direct, size);
+        memcpy(next, writer->chunk + size, overflow);
+        writer->chunk = next;
+    }
+    else
+    {
+        write_all(writer->fd, writer->chunk, size);
+        memmove(writer->chunk, writer->chunk + size, overflow);
+    }
+    writer->bytes_written += size;
+    writer->size = overflow;
+}
+
+static void run_writer_append_block(run_writer_t *writer, const int *values, int count)
+{
+    /* Блоки всегда полные (кроме последнего), поэтому запись индекса приходится на начало блока */
+    if (writer->index != NULL && writer->numbers_written % RUN_INDEX_STRIDE == 0)
+    {
+        run_index_add(writer->index, values[0], writer->bytes_written + writer->size);
+    }
+    writer->numbers_written += count;
+
+    writer->size += encode_block(values, count, writer->chunk + writer->size);
+    if (writer->capacity <= writer->size)
+    {
+        run_writer_flush(writer, writer->capacity);
+    }
+}
+
+static void run_writer_write_many_raw(run_writer_t *writer, const int *numbers, int count)
+{
+    if (writer->index != NULL)
+    {
+        long long next = (writer->numbers_written + RUN_INDEX_STRIDE - 1) / RUN_INDEX_STRIDE * RUN_INDEX_STRIDE;
+        for (; next < writer->numbers_written + count; next += RUN_INDEX_STRIDE)
+        {
+            run_index_add(writer->index, numbers[next - writer->numbers_written], next * sizeof(int));
+        }
+    }
+    writer->numbers_written += count;
+
+    /* Емкость кратна размеру int, поэтому число никогда не разрезается границей чанка */
+    const char *data = (const char *)numbers;
+    int left = count * sizeof(int);
+    while (0 < left)
+    {
+        int to_copy = writer->capacity - writer->size;
+        if (left < to_copy)
+        {
+            to_copy = left;
+        }
+
+        memcpy(writer->chunk + writer->size, data, to_copy);
+        writer->size += to_copy;
+        data += to_copy;
+        left -= to_copy;
+
+        if (writer->size == writer->capacity)
+        {
+            run_writer_flush(writer, writer->capacity);
+        }
+    }
+}
+
+static void run_writer_write_many_packed(run_writer_t *writer, const int *numbers, int count)
+{
+    int i = 0;
+    while (i < count)
+    {
+        /* Целые блоки кодируются прямо из входного массива, без копирования в pending */
+        if (writer->pending_count == 0 && RUN_BLOCK_SIZE <= count - i)
+        {
+            run_writer_append_block(writer, numbers + i, RUN_BLOCK_SIZE);
+            i += RUN_BLOCK_SIZE;
+            continue;
+        }
+
+        int to_copy = RUN_BLOCK_SIZE - writer->pending_count;
+        if (count - i < to_copy)
+        {
+            to_copy = count - i;
+        }
+
+        memcpy(writer->pending + writer->pending_count, numbers + i, sizeof(int) * to_copy);
+        writer->pending_count += to_copy;
+        i += to_copy;
+
+        if (writer->pending_count == RUN_BLOCK_SIZE)
+        {
+            run_writer_append_block(writer, writer->pending, RUN_BLOCK_SIZE);
+            writer->pending_count = 0;
+        }
+    }
+}
+
+void run_writer_write_many(run_writer_t *writer, const int *numbers, int count)
+{
+    if (writer->format == RUN_FORMAT_PACKED)
+    {
+        run_writer_write_many_packed(writer, numbers, count);
+    }
+    else
+    {
+        run_writer_write_many_raw(writer, numbers, count);
+    }
+}
+
+void run_writer_finish(run_writer_t *writer)
+{
+    if (0 < writer->pending_count)
+    {
+        /* Неполный блок дополняется последним числом - его разности нулевые */
+        int count = writer->pending_count;
+        for (int i = count; i < RUN_BLOCK_SIZE; i++)
+        {
+            writer->pending[i] = writer->pending[count - 1];
+        }
+
+        run_writer_append_block(writer, writer->pending, count);
+        writer->pending_count = 0;
+    }
+
+    if (writer->direct != NULL)
+    {
+        direct_output_finish(writer->direct, writer->size);
+        writer->bytes_written += writer->size;
+        writer->size = 0;
+        return;
+    }
+
+    if (0 < writer->size)
+    {
+        run_writer_flush(writer, writer->size);
+    }
+}
+
+void run_reader_init(run_reader_t *reader, int fd, int capacity, run_format_t format)
+{
+    assert(capacity % sizeof(int) == 0);
+    assert(format != RUN_FORMAT_PACKED || RUN_BLOCK_MAX_BYTES <= capacity);
+
+    reader->fd = fd;
+    reader->format = format;
+    reader->chunk = (char *)malloc(sizeof(char) * capacity);
+    reader->capacity = capacity;
+    reader->size = 0;
+    reader->pos = 0;
+    reader->eof = false;
+    reader->values = NULL;
+    reader->count = 0;
+    reader->index = 0;
+    reader->block = format == RUN_FORMAT_PACKED
+                        ? (int *)malloc(sizeof(int) * RUN_BLOCK_SIZE)
+                        : NULL;
+    reader->upper = (long long)INT32_MAX + 1;
+    reader->finished = false;
+    reader->bytes_read = 0;
+}
+
+void run_reader_set_range(run_reader_t *reader, long long lower, long long upper)
+{
+    assert(reader->values == NULL);
+
+    reader->upper = upper;
+    while (run_reader_next_block(reader))
+    {
+        reader->index = lower_bound(reader->values, reader->count, lower);
+        if (reader->index < reader->count)
+        {
+            break;
+        }
+    }
+}
+
+void run_reader_free(run_reader_t *reader)
+{
+    free(reader->chunk);
+    free(reader->block);
+    reader->fd = -1;
+    reader->chunk = NULL;
+    reader->block = NULL;
+    reader->values = NULL;
+    reader->capacity = 0;
+    reader->size = 0;
+    reader->pos = 0;
+    reader->count = 0;
+    reader->index = 0;
+    reader->eof = true;
+    reader->finished = true;
+}
+
+/**
+ * Дочитать файл так, чтобы в буфере было хотя бы required непрочитанных байт (если файл не закончится раньше).
+ * Также дочитывает, пока размер буфера не кратен sizeof(int)
+ */
+static void run_reader_fill(run_reader_t *reader, int required)
+{
+    int left = reader->size - reader->pos;
+    memmove(reader->chunk, reader->chunk + reader->pos, left);
+    reader->pos = 0;
+    reader->size = left;
+
+    while (!reader->eof && (reader->size < required || reader->size % sizeof(int) != 0))
+    {
+        int current_read = coro_read(reader->fd, reader->chunk + reader->size, reader->capacity - reader->size);
+        if (current_read == -1)
+        {
+            perror("read");
+            exit(1);
+        }
+
+        if (current_read == 0)
+        {
+            reader->eof = true;
+            break;
+        }
+
+        reader->size += current_read;
+        reader->bytes_read += current_read;
+    }
+}
+
+static bool run_reader_next_block_raw(run_reader_t *reader)
+{
+    reader->pos = reader->size;
+    run_reader_fill(reader, reader->capacity);
+    reader->values = (const int *)reader->chunk;
+    reader->count = reader->size / sizeof(int);
+    reader->index = 0;
+    reader->pos = reader->count * sizeof(int);
+    return 0 < reader->count;
+}
+
+static void run_reader_corrupted()
+{
+    fprintf(stderr, "Временный файл серии поврежден\n");
+    exit(1);
+}
+
+static bool run_reader_next_block_packed(run_reader_t *reader)
+{
+    run_block_header_t header;
+    if (reader->size - reader->pos < (int)sizeof(header))
+    {
+        run_reader_fill(reader, sizeof(header));
+        if (reader->size == 0)
+        {
+            return false;
+        }
+        if (reader->size < (int)sizeof(header))
+        {
+            run_reader_corrupted();
+        }
+    }
+
+    memcpy(&header, reader->chunk + reader->pos, sizeof(header));
+    if (header.count == 0 || RUN_BLOCK_SIZE < header.count || 32 < header.bits)
+    {
+        run_reader_corrupted();
+    }
+
+    int block_size = sizeof(header) + header.bits * 4 * sizeof(uint32_t);
+    if (reader->size - reader->pos < block_size)
+    {
+        run_reader_fill(reader, block_size);
+        if (reader->size < block_size)
+        {
+            run_reader_corrupted();
+        }
+    }
+
+    decode_block(reader->chunk + reader->pos + sizeof(header), header.min, header.bits, reader->block);
+    reader->pos += block_size;
+    reader->values = reader->block;
+    reader->count = header.count;
+    reader->index = 0;
+    return true;
+}
+
+bool run_reader_next_block(run_reader_t *reader)
+{
+    if (reader->finished)
+    {
+        return false;
+    }
+
+    bool has_block = reader->format == RUN_FORMAT_PACKED
+                         ? run_reader_next_block_packed(reader)
+                         : run_reader_next_block_raw(reader);
+    if (!has_block)
+    {
+        reader->finished = true;
+        return false;
+    }
+
+    /* Граница проверяется раз на блок: блок, в котором она проходит, обрезается, и серия на нем заканчивается */
+    if (reader->upper <= reader->values[reader->count - 1])
+    {
+        reader->count = lower_bound(reader->values, reader->count, reader->upper);
+        reader->finished = true;
+    }
+
+    return 0 < reader->count;
+}
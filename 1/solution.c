@@ -7,6 +7,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
 
 #include "libcoro.h"
 #include "utils.h"
@@ -33,9 +35,24 @@ typedef struct coro_sort_context
      * @brief Стек из файлов, которые необходимо отсортировать
      */
     stack_t *files;
+
+    /**
+     * @brief Стек временных файлов с отсортированными сериями
+     */
+    stack_t *runs;
+
+    /**
+     * @brief Параметры сортировки: объем памяти, доступный этой корутине, и способ чтения файлов
+     */
+    external_sort_options_t options;
+
+    /**
+     * @brief Статистика потока: общая для всех его корутин, т.к. они не вытесняют друг друга
+     */
+    external_sort_stats_t *stats;
 } coro_sort_context_t;
 
-/** Единица, участвующая в сортировке */
+/** Единица, участвующая в сортировке: файл целиком или его часть */
 typedef struct sort_element
 {
     /**
@@ -49,13 +66,19 @@ typedef struct sort_element
     int fd;
 
     /**
-     * @brief Временный файл, в который необходимо сохранять отсортированные значения
+     * @brief Сколько байт, начиная с текущей позиции дескриптора, нужно отсортировать, либо -1 - до конца файла
      */
-    temp_file_t *temp_file;
+    long long length;
 } sort_element_t;
 
+/** Минимальный размер части файла: меньшие части не окупают отдельную серию */
+#define MIN_CHUNK_SIZE (16 * 1024 * 1024)
+
+/** Сколько последних переключений корутин хранит трассировка каждого потока (-T) */
+#define TRACE_CAPACITY (1 << 20)
+
 static void
-sort_element_init(sort_element_t *e, const char *filename)
+sort_element_init(sort_element_t *e, const char *filename, long long offset, long long length)
 {
     int fd = open(filename, O_RDONLY);
     if (fd == -1)
@@ -65,28 +88,36 @@ sort_element_init(sort_element_t *e, const char *filename)
         exit(1);
     }
 
-    e->temp_file = temp_file_new();
+    if (0 < offset && lseek(fd, offset, SEEK_SET) == -1)
+    {
+        perror("lseek");
+        exit(1);
+    }
+
     e->filename = strdup(filename);
     e->fd = fd;
+    e->length = length;
 }
 
 static void
 sort_element_free(sort_element_t *e)
 {
     close(e->fd);
-    temp_file_free(e->temp_file);
     free(e->filename);
     e->fd = -1;
     e->filename = NULL;
-    e->temp_file = NULL;
 }
 
 static void
-sort_context_init(coro_sort_context_t *ctx, int id, stack_t *files)
+sort_context_init(coro_sort_context_t *ctx, int id, stack_t *files, stack_t *runs, const external_sort_options_t *options,
+                  external_sort_stats_t *stats)
 {
 
     ctx->coroutine_id = id;
     ctx->files = files;
+    ctx->runs = runs;
+    ctx->options = *options;
+    ctx->stats = stats;
 }
 
 /// @brief Функция для запуска алгоритма внешней сортировки файла
@@ -103,22 +134,21 @@ sort_external_coro(void *context)
     while (stack_try_pop(ctx->files, &value))
     {
         sort_element_t *se = (sort_element_t *)value;
-        sort_file_external_coro(se->fd, temp_file_fd(se->temp_file));
+        sort_file_external_coro(se->fd, se->length, ctx->runs, &ctx->options, ctx->stats);
     }
 
     return 0;
 }
 
 static void
-init_coro(prog_args_t *args)
+init_coro(prog_args_t *args, struct timespec *coro_lat)
 {
     struct timespec latency;
     us_to_timespec(args->latency_us, &latency);
-    struct timespec coro_lat;
-    timespec_div(&latency, args->files_count, &coro_lat);
-    fprintf(stderr, "Рассчитанная задержка корутин: %lld с, %lld нс\n", (long long)coro_lat.tv_sec, (long long)coro_lat.tv_nsec);
+    timespec_div(&latency, args->files_count, coro_lat);
+    fprintf(stderr, "Рассчитанная задержка корутин: %lld с, %lld нс\n", (long long)coro_lat->tv_sec, (long long)coro_lat->tv_nsec);
     fprintf(stderr, "Количество корутин: %d\n", args->coro_count);
-    coro_sched_init(&coro_lat);
+    fprintf(stderr, "Количество потоков: %d\n", args->threads);
 }
 
 static void display_coro_stats(struct coro *c)
@@ -128,29 +158,258 @@ static void display_coro_stats(struct coro *c)
     printf("Корутина завершилась:\n\tВремя работы: %lld с, %lld нс\n\tПереключений контекста: %lld\n\tЛожных переключений контекста: %lld\n", 
     (long long)stats.worktime.tv_sec, (long long)stats.worktime.tv_nsec, 
     (long long)stats.switch_count, (long long)stats.false_switch_count);
+    /* Задержка от готовности до запуска - по ней подбирается -l */
+    printf("\tЗадержка до запуска (%lld замеров): p50 %lld нс, p99 %lld нс, макс. %lld нс\n",
+           stats.latency_samples, coro_stats_latency_percentile(&stats, 0.5),
+           coro_stats_latency_percentile(&stats, 0.99), stats.max_latency_ns);
+}
+
+static void display_stack_pool_stats(void)
+{
+    coro_stack_pool_stats_t stats;
+    coro_stack_pool_stats(&stats);
+    printf("Стеки корутин:\n\tВыделено: %lld\n\tПовторно использовано: %lld\n\tПиковый RSS: %lld КБ\n",
+           stats.allocated, stats.reused, stats.peak_rss_kb);
+}
+
+static long long
+get_file_size(const char *filename)
+{
+    struct stat sb;
+    if (stat(filename, &sb) == -1)
+    {
+        perror("stat");
+        exit(1);
+    }
+
+    return sb.st_size;
+}
+
+/**
+ * Найти границу части файла: первый разделитель, начиная с offset.
+ * Число, попавшее на желаемую границу, целиком остается в предыдущей части
+ */
+static long long
+find_chunk_boundary(int fd, long long offset, long long size)
+{
+    char buffer[4096];
+    while (offset < size)
+    {
+        ssize_t read_count = pread(fd, buffer, sizeof(buffer), offset);
+        if (read_count == -1)
+        {
+            perror("pread");
+            exit(1);
+        }
+        if (read_count == 0)
+        {
+            break;
+        }
+
+        for (ssize_t i = 0; i < read_count; i++)
+        {
+            if ((unsigned char)buffer[i] <= ' ')
+            {
+                return offset + i;
+            }
+        }
+        offset += read_count;
+    }
+
+    return size;
 }
 
+/**
+ * Создать единицы сортировки. В одном потоке каждый файл сортируется целиком.
+ * В нескольких - большие файлы режутся на части по разделителям (или по границам записей размером record_width),
+ * чтобы работы хватило всем потокам
+ */
 static sort_element_t *
-create_sort_elements(const char **filenames, int count)
+create_sort_elements(const char **filenames, int count, int threads, int record_width, int *elements_count)
 {
-    sort_element_t *sort_elements = (sort_element_t *) malloc(sizeof(sort_element_t) * count);
+    long long *sizes = (long long *)malloc(sizeof(long long) * count);
+    long long total_size = 0;
     for (int i = 0; i < count; i++)
     {
-        sort_element_init(sort_elements + i, filenames[i]);
+        sizes[i] = get_file_size(filenames[i]);
+        total_size += sizes[i];
     }
+
+    long long chunk_size = total_size / threads;
+    if (chunk_size < MIN_CHUNK_SIZE)
+    {
+        chunk_size = MIN_CHUNK_SIZE;
+    }
+
+    int *chunks = (int *)malloc(sizeof(int) * count);
+    int total_chunks = 0;
+    for (int i = 0; i < count; i++)
+    {
+        chunks[i] = threads == 1
+                        ? 1
+                        : (int)((sizes[i] + chunk_size - 1) / chunk_size);
+        if (chunks[i] < 1)
+        {
+            chunks[i] = 1;
+        }
+        total_chunks += chunks[i];
+    }
+
+    sort_element_t *sort_elements = (sort_element_t *) malloc(sizeof(sort_element_t) * total_chunks);
+    int e = 0;
+    for (int i = 0; i < count; i++)
+    {
+        if (chunks[i] == 1)
+        {
+            sort_element_init(sort_elements + e++, filenames[i], 0, -1);
+            continue;
+        }
+
+        int fd = open(filenames[i], O_RDONLY);
+        if (fd == -1)
+        {
+            perror("open");
+            exit(1);
+        }
+
+        long long begin = 0;
+        for (int c = 1; c <= chunks[i]; c++)
+        {
+            long long end = c == chunks[i]
+                                ? sizes[i]
+                                : sizes[i] * c / chunks[i];
+            if (end < begin)
+            {
+                end = begin;
+            }
+            end = record_width == 0
+                      ? find_chunk_boundary(fd, end, sizes[i])
+                      : end - end % record_width;
+            sort_element_init(sort_elements + e++, filenames[i], begin, end - begin);
+            begin = end;
+        }
+        close(fd);
+    }
+
+    free(chunks);
+    free(sizes);
+    *elements_count = total_chunks;
     return sort_elements;
 }
 
-static void 
-init_files_stack(stack_t *files_stack, sort_element_t* elements, int count)
+/** Поток сортировки: свой планировщик корутин, свои единицы сортировки и свои серии */
+typedef struct sort_worker
+{
+    /** Единицы сортировки этого потока */
+    stack_t files;
+    /** Серии, полученные этим потоком */
+    stack_t runs;
+    /** Суммарный размер единиц сортировки - для распределения работы */
+    long long load;
+    /** Количество корутин в потоке */
+    int coro_count;
+    struct timespec quantum;
+    /** Как корутины потока выполняют ввод-вывод */
+    coro_io_backend_t io_backend;
+    /** Записывать ли переключения корутин */
+    bool trace;
+    /** Записанные переключения, либо NULL */
+    coro_trace_t *trace_result;
+    external_sort_options_t options;
+    /** Время фаз и ввод-вывод всех корутин потока */
+    external_sort_stats_t stats;
+} sort_worker_t;
+
+/** Распределить единицы сортировки по потокам: очередная единица достается наименее загруженному */
+static void
+distribute_sort_elements(sort_worker_t *workers, int threads, sort_element_t *elements, int count)
 {
-    stack_init(files_stack);
     for (int i = 0; i < count; i++)
     {
-        stack_push(files_stack, elements + i);
+        long long length = elements[i].length < 0
+                               ? get_file_size(elements[i].filename)
+                               : elements[i].length;
+        int target = 0;
+        for (int t = 1; t < threads; t++)
+        {
+            if (workers[t].load < workers[target].load)
+            {
+                target = t;
+            }
+        }
+
+        stack_push(&workers[target].files, elements + i);
+        workers[target].load += length;
     }
 }
 
+static void *
+run_sort_worker(void *arg)
+{
+    sort_worker_t *worker = (sort_worker_t *)arg;
+    coro_sched_init(&worker->quantum);
+    coro_io_set_backend(worker->io_backend);
+    if (worker->trace)
+    {
+        coro_trace_start(TRACE_CAPACITY);
+    }
+
+    coro_sort_context_t *contexts = (coro_sort_context_t *) malloc(sizeof(coro_sort_context_t) * worker->coro_count);
+    for (long i = 0; i < worker->coro_count; i++)
+    {
+        coro_sort_context_t *cur_ctx = contexts + i;
+        sort_context_init(cur_ctx, i, &worker->files, &worker->runs, &worker->options, &worker->stats);
+        coro_new(sort_external_coro, cur_ctx);
+    }
+
+    struct coro *c;
+    while ((c = coro_sched_wait()) != NULL)
+    {
+        display_coro_stats(c);
+        coro_delete(c);
+    }
+
+    worker->trace_result = coro_trace_stop();
+    display_stack_pool_stats();
+    coro_stack_pool_clear();
+    free(contexts);
+    return NULL;
+}
+
+/** Записать переключения корутин count потоков в файл трассировки и освободить их */
+static void
+write_traces(const char *path, coro_trace_t **traces, int count)
+{
+    FILE *out = fopen(path, "w");
+    if (out == NULL)
+    {
+        perror("fopen");
+        exit(1);
+    }
+
+    coro_trace_write_json(out, traces, count);
+    fclose(out);
+
+    for (int t = 0; t < count; t++)
+    {
+        coro_trace_free(traces[t]);
+    }
+}
+
+/** Записать переключения корутин всех потоков в файл трассировки */
+static void
+write_trace(const char *path, sort_worker_t *workers, int threads)
+{
+    coro_trace_t **traces = (coro_trace_t **) malloc(sizeof(coro_trace_t *) * threads);
+    for (int t = 0; t < threads; t++)
+    {
+        traces[t] = workers[t].trace_result;
+        workers[t].trace_result = NULL;
+    }
+    write_traces(path, traces, threads);
+    free(traces);
+}
+
 static void
 display_work_time(struct timespec *start, struct timespec *end)
 {
@@ -159,51 +418,305 @@ display_work_time(struct timespec *start, struct timespec *end)
     printf("Общее время работы: %lld с, %lld нс\n", (long long)diff.tv_sec, (long long)diff.tv_nsec);
 }
 
+static long long
+elapsed_ns(struct timespec *start, struct timespec *end)
+{
+    struct timespec diff;
+    timespec_sub(end, start, &diff);
+    return diff.tv_sec * 1000000000LL + diff.tv_nsec;
+}
+
+/** Итоги по фазам: сортировка (всеми потоками) и слияние */
+typedef struct sort_summary
+{
+    long long sort_wall_ns;
+    long long merge_wall_ns;
+    /** Сумма статистики всех потоков сортировки */
+    external_sort_stats_t sort;
+    merge_stats_t merge;
+} sort_summary_t;
+
+static void
+display_summary(FILE *out, const sort_summary_t *summary)
+{
+    fprintf(out, "Фазы сортировки (время работы корутин): разбор %lld мс, сортировка %lld мс, запись серий %lld мс\n",
+           summary->sort.parse_ns / 1000000, summary->sort.sort_ns / 1000000, summary->sort.spill_ns / 1000000);
+    fprintf(out, "Сортировка: %lld мс, %d серий; слияние: %lld мс, %d промежуточных серий\n",
+           summary->sort_wall_ns / 1000000, summary->sort.runs,
+           summary->merge_wall_ns / 1000000, summary->merge.intermediate_runs);
+    fprintf(out, "Прочитано: %lld байт, записано: %lld байт\n",
+           summary->sort.bytes_read + summary->merge.bytes_read,
+           summary->sort.bytes_written + summary->merge.bytes_written);
+}
+
+/** Записать итоги в файл строками "имя значение" - их разбирает bench_sorter */
+static void
+write_stats(const char *path, const sort_summary_t *summary)
+{
+    FILE *out = fopen(path, "w");
+    if (out == NULL)
+    {
+        perror("fopen");
+        exit(1);
+    }
+
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == -1)
+    {
+        perror("getrusage");
+        exit(1);
+    }
+
+    fprintf(out, "sort_wall_ns %lld\n", summary->sort_wall_ns);
+    fprintf(out, "merge_wall_ns %lld\n", summary->merge_wall_ns);
+    fprintf(out, "parse_ns %lld\n", summary->sort.parse_ns);
+    fprintf(out, "sort_ns %lld\n", summary->sort.sort_ns);
+    fprintf(out, "spill_ns %lld\n", summary->sort.spill_ns);
+    fprintf(out, "numbers %lld\n", summary->sort.numbers);
+    fprintf(out, "presorted_numbers %lld\n", summary->sort.presorted_numbers);
+    fprintf(out, "runs %d\n", summary->sort.runs);
+    fprintf(out, "intermediate_runs %d\n", summary->merge.intermediate_runs);
+    fprintf(out, "input_bytes %lld\n", summary->sort.bytes_read);
+    fprintf(out, "spill_bytes %lld\n", summary->sort.bytes_written);
+    fprintf(out, "merge_read_bytes %lld\n", summary->merge.bytes_read);
+    fprintf(out, "merge_write_bytes %lld\n", summary->merge.bytes_written);
+    fprintf(out, "peak_rss_kb %ld\n", usage.ru_maxrss);
+    fclose(out);
+}
+
+static void
+init_merge_options(merge_options_t *options, const prog_args_t *args, merge_stats_t *stats)
+{
+    options->strategy = args->merge_strategy;
+    options->max_memory_bytes = args->max_memory_bytes;
+    options->max_fan_in = args->max_fan_in;
+    options->write_buffer_size = args->write_buffer_size;
+    options->run_format = args->run_format;
+    options->threads = args->threads;
+    options->stats = stats;
+    options->record = args->record;
+    options->direct_io = args->direct_io;
+}
+
+/** Сортировка стандартного ввода: одна корутина со всем бюджетом памяти */
+typedef struct stream_context
+{
+    external_sort_options_t options;
+    /** Серии, если числа не поместились в память */
+    stack_t runs;
+    external_sort_stats_t stats;
+    /** Все числа поместились в память - результат уже записан */
+    bool in_memory;
+} stream_context_t;
+
+static int
+sort_stream_entry(void *context)
+{
+    stream_context_t *ctx = (stream_context_t *)context;
+    ctx->in_memory = sort_stream_coro(STDIN_FILENO, STDOUT_FILENO, &ctx->runs, &ctx->options, &ctx->stats);
+    return 0;
+}
+
+/**
+ * Отсортировать стандартный ввод в стандартный вывод. Вывод занят результатом,
+ * поэтому итоги печатаются в stderr, а статистика корутины не печатается
+ */
+static void
+sort_stream(const prog_args_t *args, struct timespec *quantum)
+{
+    coro_sched_init(quantum);
+    coro_io_set_backend(args->io_backend);
+    if (args->trace_path != NULL)
+    {
+        coro_trace_start(TRACE_CAPACITY);
+    }
+
+    stream_context_t ctx = {
+        .options = {
+            .max_memory_bytes = args->max_memory_bytes,
+            .reader = args->reader,
+            .run_format = args->run_format,
+            .record = args->record,
+            .direct_io = args->direct_io,
+        },
+        .in_memory = false,
+    };
+    stack_init(&ctx.runs);
+    memset(&ctx.stats, 0, sizeof(ctx.stats));
+
+    struct timespec start_time;
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    coro_new(sort_stream_entry, &ctx);
+    struct coro *c;
+    while ((c = coro_sched_wait()) != NULL)
+    {
+        coro_delete(c);
+    }
+
+    struct timespec sorted_time;
+    clock_gettime(CLOCK_MONOTONIC, &sorted_time);
+    coro_trace_t *trace = coro_trace_stop();
+    if (trace != NULL)
+    {
+        write_traces(args->trace_path, &trace, 1);
+    }
+
+    sort_summary_t summary;
+    memset(&summary, 0, sizeof(summary));
+    summary.sort = ctx.stats;
+    if (!ctx.in_memory)
+    {
+        merge_options_t merge_options;
+        init_merge_options(&merge_options, args, &summary.merge);
+        merge_files(STDOUT_FILENO, (sorted_run_t **)ctx.runs.values, ctx.runs.size, &merge_options);
+        for (int i = 0; i < ctx.runs.size; i++)
+        {
+            sorted_run_free((sorted_run_t *)ctx.runs.values[i]);
+        }
+    }
+
+    struct timespec end_time;
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    summary.sort_wall_ns = elapsed_ns(&start_time, &sorted_time);
+    summary.merge_wall_ns = elapsed_ns(&sorted_time, &end_time);
+    fprintf(stderr, "Все числа поместились в память: %s\n", ctx.in_memory ? "да" : "нет");
+    display_summary(stderr, &summary);
+    if (args->stats_path != NULL)
+    {
+        write_stats(args->stats_path, &summary);
+    }
+
+    coro_stack_pool_clear();
+    stack_free(&ctx.runs);
+}
+
 int main(int argc, const char **argv)
 {
     prog_args_t args;
     extract_program_args(argc, argv, &args);
-    init_coro(&args);
+    struct timespec coro_lat;
+    init_coro(&args, &coro_lat);
+
+    if (args.stream)
+    {
+        sort_stream(&args, &coro_lat);
+        free(args.filenames);
+        return 0;
+    }
+
+    int threads = args.threads;
+    int elements_count;
+    sort_element_t *sort_elements = create_sort_elements(args.filenames, args.files_count, threads, args.record.width,
+                                                           &elements_count);
 
     /*
-     * Запускаем корутины для каждого файла в списке
+     * Корутины делятся между потоками (хотя бы по одной на поток).
+     * Бюджет памяти делится поровну между всеми корутинами, т.к. каждая держит свой буфер серии
      */
-    sort_element_t *sort_elements = create_sort_elements(args.filenames, args.files_count);
-    stack_t files_stack;
-    init_files_stack(&files_stack, sort_elements, args.files_count);
-
-    coro_sort_context_t *contexts = (coro_sort_context_t *) malloc(sizeof(coro_sort_context_t) * args.coro_count);
-    for (long i = 0; i < args.coro_count; i++)
+    sort_worker_t *workers = (sort_worker_t *) malloc(sizeof(sort_worker_t) * threads);
+    int total_coro_count = 0;
+    for (int t = 0; t < threads; t++)
     {
-        coro_sort_context_t *cur_ctx = contexts + i;
-        sort_context_init(cur_ctx, i, &files_stack);
-        coro_new(sort_external_coro, cur_ctx);
+        sort_worker_t *worker = workers + t;
+        stack_init(&worker->files);
+        stack_init(&worker->runs);
+        worker->load = 0;
+        worker->coro_count = args.coro_count / threads + (t < args.coro_count % threads);
+        if (worker->coro_count < 1)
+        {
+            worker->coro_count = 1;
+        }
+        worker->quantum = coro_lat;
+        worker->io_backend = args.io_backend;
+        worker->trace = args.trace_path != NULL;
+        worker->trace_result = NULL;
+        memset(&worker->stats, 0, sizeof(worker->stats));
+        total_coro_count += worker->coro_count;
+    }
+    distribute_sort_elements(workers, threads, sort_elements, elements_count);
+
+    external_sort_options_t sort_options = {
+        .max_memory_bytes = args.max_memory_bytes / total_coro_count,
+        .reader = args.reader,
+        .run_format = args.run_format,
+        .record = args.record,
+        .direct_io = args.direct_io,
+    };
+    for (int t = 0; t < threads; t++)
+    {
+        workers[t].options = sort_options;
     }
 
     struct timespec start_time;
-    clock_gettime(CLOCK_REALTIME, &start_time);
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
 
-    struct coro *c;
-    while ((c = coro_sched_wait()) != NULL)
+    if (threads == 1)
     {
-        display_coro_stats(c);
-        coro_delete(c);
+        run_sort_worker(workers);
     }
-
-    int *fds = (int *)malloc(sizeof(int) * args.files_count);
-    for (long i = 0; i < args.files_count; i++)
+    else
     {
-        int temp_fd = temp_file_fd(sort_elements[i].temp_file);
-        if (lseek(temp_fd, 0, SEEK_SET) == -1)
+        pthread_t *thread_ids = (pthread_t *) malloc(sizeof(pthread_t) * threads);
+        for (int t = 0; t < threads; t++)
         {
-            perror("lseek");
-            exit(1);
+            int error = pthread_create(thread_ids + t, NULL, run_sort_worker, workers + t);
+            if (error != 0)
+            {
+                fprintf(stderr, "pthread_create: %s\n", strerror(error));
+                exit(1);
+            }
+        }
+        for (int t = 0; t < threads; t++)
+        {
+            pthread_join(thread_ids[t], NULL);
         }
+        free(thread_ids);
+    }
+
+    struct timespec sorted_time;
+    clock_gettime(CLOCK_MONOTONIC, &sorted_time);
+
+    if (args.trace_path != NULL)
+    {
+        write_trace(args.trace_path, workers, threads);
+    }
+
+    sort_summary_t summary;
+    memset(&summary, 0, sizeof(summary));
+    for (int t = 0; t < threads; t++)
+    {
+        external_sort_stats_t *stats = &workers[t].stats;
+        summary.sort.parse_ns += stats->parse_ns;
+        summary.sort.sort_ns += stats->sort_ns;
+        summary.sort.spill_ns += stats->spill_ns;
+        summary.sort.bytes_read += stats->bytes_read;
+        summary.sort.bytes_written += stats->bytes_written;
+        summary.sort.numbers += stats->numbers;
+        summary.sort.presorted_numbers += stats->presorted_numbers;
+        summary.sort.runs += stats->runs;
+    }
+
+    /* Исходные файлы больше не нужны - освобождаем дескрипторы под слияние */
+    for (int i = 0; i < elements_count; i++)
+    {
+        sort_element_free(sort_elements + i);
+    }
 
-        fds[i] = temp_fd;
+    /* Сливаем все серии, полученные всеми потоками из всех файлов */
+    int runs_count = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        runs_count += workers[t].runs.size;
+    }
+    sorted_run_t **runs = (sorted_run_t **) malloc(sizeof(sorted_run_t *) * (runs_count + 1));
+    int run = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        memcpy(runs + run, workers[t].runs.values, sizeof(sorted_run_t *) * workers[t].runs.size);
+        run += workers[t].runs.size;
     }
 
-    int result_fd = open("result.txt",
+    int result_fd = open(args.record.width == 0 ? RESULT_FILENAME : RECORD_RESULT_FILENAME,
                          O_CREAT | O_RDWR | O_APPEND | O_TRUNC,
                          S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH);
     if (result_fd == -1)
@@ -212,22 +725,38 @@ int main(int argc, const char **argv)
         exit(1);
     }
 
-    merge_files(result_fd, fds, args.files_count);
+    /* Результат (с -D) пишется из основного потока - тем же способом ввода-вывода, что и серии */
+    coro_io_set_backend(args.io_backend);
+    merge_options_t merge_options;
+    init_merge_options(&merge_options, &args, &summary.merge);
+    merge_files(result_fd, runs, runs_count, &merge_options);
 
     struct timespec end_time;
-    clock_gettime(CLOCK_REALTIME, &end_time);
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
     display_work_time(&start_time, &end_time);
 
+    summary.sort_wall_ns = elapsed_ns(&start_time, &sorted_time);
+    summary.merge_wall_ns = elapsed_ns(&sorted_time, &end_time);
+    display_summary(stdout, &summary);
+    if (args.stats_path != NULL)
+    {
+        write_stats(args.stats_path, &summary);
+    }
+
     close(result_fd);
-    for (int i = 0; i < args.files_count; i++)
+    for (int i = 0; i < runs_count; i++)
     {
-        sort_element_free(sort_elements + i);
+        sorted_run_free(runs[i]);
     }
 
-    free(fds);
+    for (int t = 0; t < threads; t++)
+    {
+        stack_free(&workers[t].files);
+        stack_free(&workers[t].runs);
+    }
+    free(runs);
+    free(workers);
     free(sort_elements);
-    free(contexts);
     free(args.filenames);
-    stack_free(&files_stack);
     return 0;
 }
@@ -4,13 +4,220 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <stdbool.h>
+#include <limits.h>
 
 #include "utils.h"
 
 #define DEFAULT_LATENCY 100000
+/** Объем памяти для сортировки по умолчанию - 256 МБ */
+#define DEFAULT_MAX_MEMORY (256LL * 1024 * 1024)
 
 void print_usage(const char **argv);
 
+/** Проверить, что аргумент совпадает с короткой или длинной формой опции */
+static bool is_option(const char *arg, const char *short_name, const char *long_name)
+{
+    return strcmp(arg, short_name) == 0 || strcmp(arg, long_name) == 0;
+}
+
+/** Получить значение опции, либо завершить программу, если его нет */
+static const char *get_option_value(int argc, const char **argv, int i)
+{
+    if (argc <= i + 1)
+    {
+        print_usage(argv);
+        exit(1);
+    }
+
+    return argv[i + 1];
+}
+
+static long long parse_latency(const char *value)
+{
+    long long latency = strtoll(value, NULL, 10);
+    if (latency == 0)
+    {
+        printf("Задержка не может быть равна 0\n");
+        exit(1);
+    }
+
+    if (latency < 0)
+    {
+        printf("Задержка не может быть отрицательной\n");
+        exit(1);
+    }
+
+    return latency;
+}
+
+static int parse_coro_count(const char *value)
+{
+    int coro_count = (int)strtol(value, NULL, 10);
+    if (coro_count == 0)
+    {
+        printf("Количество корутин должно быть положительным. Передано 0\n");
+        exit(1);
+    }
+
+    if (coro_count < 0)
+    {
+        printf("Количество корутин должно быть положительным. Передано %d\n", coro_count);
+        exit(1);
+    }
+
+    return coro_count;
+}
+
+/** Распарсить объем памяти. Поддерживаются суффиксы K, M, G */
+static long long parse_memory(const char *value)
+{
+    char *end = NULL;
+    long long memory = strtoll(value, &end, 10);
+    switch (*end)
+    {
+    case 'K':
+    case 'k':
+        memory *= 1024;
+        break;
+    case 'M':
+    case 'm':
+        memory *= 1024 * 1024;
+        break;
+    case 'G':
+    case 'g':
+        memory *= 1024 * 1024 * 1024;
+        break;
+    case '\0':
+        break;
+    default:
+        printf("Неизвестный суффикс объема памяти: %s\n", end);
+        exit(1);
+    }
+
+    if (memory <= 0)
+    {
+        printf("Объем памяти должен быть положительным. Передано %s\n", value);
+        exit(1);
+    }
+
+    return memory;
+}
+
+static int parse_fan_in(const char *value)
+{
+    int fan_in = (int)strtol(value, NULL, 10);
+    if (fan_in < 2)
+    {
+        printf("За один проход должно сливаться хотя бы 2 серии. Передано %s\n", value);
+        exit(1);
+    }
+
+    return fan_in;
+}
+
+static int parse_threads(const char *value)
+{
+    int threads = (int)strtol(value, NULL, 10);
+    if (threads < 1)
+    {
+        printf("Количество потоков должно быть положительным. Передано %s\n", value);
+        exit(1);
+    }
+
+    return threads;
+}
+
+static merge_strategy_t parse_merge_strategy(const char *value)
+{
+    if (strcmp(value, "heap") == 0)
+    {
+        return MERGE_STRATEGY_HEAP;
+    }
+
+    if (strcmp(value, "loser-tree") == 0)
+    {
+        return MERGE_STRATEGY_LOSER_TREE;
+    }
+
+    printf("Неизвестный алгоритм слияния: %s\n", value);
+    exit(1);
+}
+
+static file_reader_mode_t parse_reader(const char *value)
+{
+    if (strcmp(value, "read") == 0)
+    {
+        return FILE_READER_READ;
+    }
+
+    if (strcmp(value, "mmap") == 0)
+    {
+        return FILE_READER_MMAP;
+    }
+
+    printf("Неизвестный способ чтения файлов: %s\n", value);
+    exit(1);
+}
+
+static run_format_t parse_run_format(const char *value)
+{
+    if (strcmp(value, "raw") == 0)
+    {
+        return RUN_FORMAT_RAW;
+    }
+
+    if (strcmp(value, "packed") == 0)
+    {
+        return RUN_FORMAT_PACKED;
+    }
+
+    printf("Неизвестный формат серий: %s\n", value);
+    exit(1);
+}
+
+static coro_io_backend_t parse_io_backend(const char *value)
+{
+    if (strcmp(value, "uring") == 0)
+    {
+        return CORO_IO_URING;
+    }
+
+    if (strcmp(value, "threads") == 0)
+    {
+        return CORO_IO_THREADS;
+    }
+
+    if (strcmp(value, "sync") == 0)
+    {
+        return CORO_IO_SYNC;
+    }
+
+    printf("Неизвестный способ ввода-вывода: %s\n", value);
+    exit(1);
+}
+
+/** Распарсить формат записей WIDTH[:KEY_OFFSET] */
+static record_format_t parse_record_format(const char *value)
+{
+    char *end = NULL;
+    record_format_t format = {(int)strtol(value, &end, 10), 0};
+    if (*end == ':')
+    {
+        format.key_offset = (int)strtol(end + 1, &end, 10);
+    }
+
+    if (*end != '\0' || format.width < (int)sizeof(int64_t) || RECORD_MAX_WIDTH < format.width ||
+        format.key_offset < 0 || format.width - (int)sizeof(int64_t) < format.key_offset)
+    {
+        printf("Неверный формат записей: %s. Нужно WIDTH[:KEY_OFFSET], 8 <= WIDTH <= %d, ключ (8 байт) внутри записи\n",
+               value, RECORD_MAX_WIDTH);
+        exit(1);
+    }
+
+    return format;
+}
+
 void extract_program_args(int argc, const char **argv, prog_args_t *args)
 {
     if (argc < 2)
@@ -25,61 +232,120 @@ void extract_program_args(int argc, const char **argv, prog_args_t *args)
         exit(0);
     }
 
-    int i = 1;
     long long latency = DEFAULT_LATENCY;
-    if (strcmp(argv[1], "-l") == 0 || strcmp(argv[1], "--latency") == 0)
+    int coro_count = -1;
+    long long max_memory = DEFAULT_MAX_MEMORY;
+    merge_strategy_t merge_strategy = MERGE_STRATEGY_LOSER_TREE;
+    int max_fan_in = 0;
+    long long write_buffer_size = 0;
+    file_reader_mode_t reader = FILE_READER_READ;
+    run_format_t run_format = RUN_FORMAT_PACKED;
+    int threads = 1;
+    coro_io_backend_t io_backend = CORO_IO_URING;
+    const char *trace_path = NULL;
+    const char *stats_path = NULL;
+    record_format_t record = {0, 0};
+    bool direct_io = false;
+
+    int i = 1;
+    /* Одиночный "-" - не опция, а стандартный ввод */
+    while (i < argc && argv[i][0] == '-' && argv[i][1] != '\0')
     {
-        if (argc <= 3)
+        if (is_option(argv[i], "-l", "--latency"))
         {
-            /** Указана только задержка - без файлов */
-            print_usage(argv);
-            exit(1);
+            latency = parse_latency(get_option_value(argc, argv, i));
         }
-
-        latency = strtoll(argv[2], NULL, 10);
-        if (latency == 0)
+        else if (is_option(argv[i], "-c", "--coro-count"))
         {
-            printf("Задержка не может быть равна 0\n");
-            exit(1);
+            coro_count = parse_coro_count(get_option_value(argc, argv, i));
         }
-
-        if (latency < 0)
+        else if (is_option(argv[i], "-m", "--memory"))
         {
-            printf("Задержка не может быть отрицательной\n");
-            exit(1);
+            max_memory = parse_memory(get_option_value(argc, argv, i));
         }
-
-        i = 3;
-    }
-
-    int coro_count = -1;
-    if (strcmp(argv[3], "-c") == 0 || strcmp(argv[3], "--latency") == 0)
-    {
-        if (argc <= 5)
+        else if (is_option(argv[i], "-M", "--merge"))
         {
-            print_usage(argv);
-            exit(1);
+            merge_strategy = parse_merge_strategy(get_option_value(argc, argv, i));
         }
-
-        coro_count = (int)strtol(argv[4], NULL, 10);
-        if (coro_count == 0)
+        else if (is_option(argv[i], "-F", "--fan-in"))
         {
-            printf("Количество корутин должно быть положительным. Передано 0\n");
-            exit(1);
+            max_fan_in = parse_fan_in(get_option_value(argc, argv, i));
         }
-
-        if (coro_count < 0)
+        else if (is_option(argv[i], "-w", "--write-buffer"))
+        {
+            write_buffer_size = parse_memory(get_option_value(argc, argv, i));
+            if (INT_MAX < write_buffer_size)
+            {
+                printf("Слишком большой буфер записи: %s\n", argv[i + 1]);
+                exit(1);
+            }
+        }
+        else if (is_option(argv[i], "-r", "--reader"))
+        {
+            reader = parse_reader(get_option_value(argc, argv, i));
+        }
+        else if (is_option(argv[i], "-R", "--run-format"))
+        {
+            run_format = parse_run_format(get_option_value(argc, argv, i));
+        }
+        else if (is_option(argv[i], "-t", "--threads"))
+        {
+            threads = parse_threads(get_option_value(argc, argv, i));
+        }
+        else if (is_option(argv[i], "-i", "--io"))
         {
-            printf("Количество корутин должно быть положительным. Передано %d\n", coro_count);
+            io_backend = parse_io_backend(get_option_value(argc, argv, i));
+        }
+        else if (is_option(argv[i], "-T", "--trace"))
+        {
+            trace_path = get_option_value(argc, argv, i);
+        }
+        else if (is_option(argv[i], "-S", "--stats"))
+        {
+            stats_path = get_option_value(argc, argv, i);
+        }
+        else if (is_option(argv[i], "-D", "--direct-io"))
+        {
+            /* Опция без значения */
+            direct_io = true;
+            i += 1;
+            continue;
+        }
+        else if (is_option(argv[i], "-K", "--records"))
+        {
+            record = parse_record_format(get_option_value(argc, argv, i));
+        }
+        else
+        {
+            printf("Неизвестная опция: %s\n", argv[i]);
+            print_usage(argv);
             exit(1);
         }
 
-        i = 5;
+        i += 2;
+    }
+
+    if (argc <= i)
+    {
+        /** Указаны только опции - без файлов */
+        print_usage(argv);
+        exit(1);
     }
 
     int files_count = argc - i;
+    bool stream = false;
+    for (int f = i; f < argc; f++)
+    {
+        stream |= strcmp(argv[f], STREAM_FILENAME) == 0;
+    }
+    if (stream && files_count != 1)
+    {
+        printf("Стандартный ввод (%s) сортируется только без других файлов\n", STREAM_FILENAME);
+        exit(1);
+    }
+
     const char **filenames = (const char **)malloc(sizeof(char *) * files_count);
-    for (int f = 0; f < files_count; f++)
+    for (int f = 0; f < files_count && !stream; f++)
     {
         const char *filename = argv[f + i];
         struct stat sb;
@@ -97,19 +363,49 @@ void extract_program_args(int argc, const char **argv, prog_args_t *args)
 
         filenames[f] = filename;
     }
+    if (stream)
+    {
+        filenames[0] = STREAM_FILENAME;
+    }
     args->filenames = filenames;
+    args->stream = stream;
+    args->record = record;
     args->files_count = files_count;
     args->latency_us = latency;
     args->coro_count = coro_count == -1
                            ? files_count
                            : coro_count;
+    args->max_memory_bytes = max_memory;
+    args->merge_strategy = merge_strategy;
+    args->max_fan_in = max_fan_in;
+    args->write_buffer_size = (int)write_buffer_size;
+    args->reader = reader;
+    args->run_format = run_format;
+    args->threads = threads;
+    args->io_backend = io_backend;
+    args->trace_path = trace_path;
+    args->stats_path = stats_path;
+    args->direct_io = direct_io;
 }
 
 void print_usage(const char **argv)
 {
-    printf("Использование: %s [-l|--latency LATENCY] [-c|--coro-count CORO_COUNT] <file1> <file2> ...\n", argv[0]);
+    printf("Использование: %s [-l|--latency LATENCY] [-c|--coro-count CORO_COUNT] [-m|--memory MEMORY] [-M|--merge heap|loser-tree] [-F|--fan-in FAN_IN] [-w|--write-buffer SIZE] [-r|--reader read|mmap] [-R|--run-format raw|packed] [-t|--threads THREADS] [-i|--io uring|threads|sync] [-T|--trace FILE] [-S|--stats FILE] [-K|--records WIDTH[:KEY_OFFSET]] [-D|--direct-io] <file1> <file2> ... | -\n", argv[0]);
+    printf("\t-K|--records WIDTH[:KEY_OFFSET] - файлы состоят из двоичных записей по WIDTH байт, отсортировать их по 64-битному знаковому ключу (порядок байтов процессора) со смещением KEY_OFFSET (по умолчанию 0). Результат - записи подряд в %s\n", RECORD_RESULT_FILENAME);
+    printf("\t- - вместо файлов: читать числа из стандартного ввода и писать результат в стандартный вывод (вместо result.txt). Если числа помещаются в бюджет памяти, они сортируются в памяти без временных файлов\n");
     printf("\t-l|--latency LATENCY - указать задержку в мкс. Если не указано, будет выставлено в 100000 (100мс)\n");
     printf("\t-c|--coro-count CORO_COUNT - указать количество корутин, которое нужно использовать. Если не указано - равняется количеству переданных файлов\n");
+    printf("\t-m|--memory MEMORY - максимальный объем памяти для сортировки в байтах (поддерживаются суффиксы K, M, G). Делится поровну между корутинами. Если не указано - 256M\n");
+    printf("\t-M|--merge heap|loser-tree - алгоритм слияния серий: d-арная куча или дерево проигравших. Если не указано - loser-tree\n");
+    printf("\t-F|--fan-in FAN_IN - максимальное количество серий, сливаемых за один проход. Если не указано - определяется лимитом дескрипторов и объемом памяти\n");
+    printf("\t-w|--write-buffer SIZE - размер буфера записи при слиянии (поддерживаются суффиксы K, M, G). Если не указано - 1M\n");
+    printf("\t-r|--reader read|mmap - способ чтения исходных файлов: через read() в буфер или отображением в память. Если не указано - read\n");
+    printf("\t-R|--run-format raw|packed - формат временных файлов с сериями: числа как в памяти или блоки с упакованными разностями. Если не указано - packed\n");
+    printf("\t-t|--threads THREADS - количество потоков: файлы (и части больших файлов) сортируются в нескольких потоках, в каждом - свои корутины, последний проход слияния делится между потоками по диапазонам чисел. Если не указано - 1\n");
+    printf("\t-i|--io uring|threads|sync - как корутины читают исходные файлы и пишут серии: через io_uring (если он недоступен - через пул потоков), через пул потоков или блокирующими read/write. Пока идет ввод-вывод, работают другие корутины (кроме sync). Если не указано - uring\n");
+    printf("\t-T|--trace FILE - записать переключения корутин сортировки в FILE в формате Chrome trace event (открывается в chrome://tracing или Perfetto)\n");
+    printf("\t-D|--direct-io - писать серии и result.txt через O_DIRECT, мимо кэша страниц: пока один буфер записи пишется на диск, заполняется второй, поэтому буферы записи занимают вдвое больше памяти. Где O_DIRECT не поддерживается (tmpfs, пайп), запись идет как обычно\n");
+    printf("\t-S|--stats FILE - записать в FILE время фаз (разбор, сортировка, запись серий, слияние), объем ввода-вывода и пиковый RSS строками \"имя значение\"\n");
 }
 
 #define TEMP_FILE_MASK "/tmp/coro-sort-XXXXXX\0"
@@ -137,13 +433,44 @@ temp_file_t *temp_file_new()
 
 int temp_file_fd(temp_file_t *temp_file)
 {
+    if (temp_file->fd == -1)
+    {
+        int fd = open(temp_file->filename, O_RDWR);
+        if (fd == -1)
+        {
+            perror("open");
+            exit(1);
+        }
+        temp_file->fd = fd;
+    }
+
     return temp_file->fd;
 }
 
+int temp_file_open(temp_file_t *temp_file)
+{
+    int fd = open(temp_file->filename, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("open");
+        exit(1);
+    }
+
+    return fd;
+}
+
+void temp_file_close(temp_file_t *temp_file)
+{
+    if (temp_file->fd != -1)
+    {
+        close(temp_file->fd);
+        temp_file->fd = -1;
+    }
+}
+
 void temp_file_free(temp_file_t *temp_file)
 {
-    close(temp_file->fd);
+    temp_file_close(temp_file);
     unlink(temp_file->filename);
-    temp_file->fd = -1;
     free(temp_file);
 }
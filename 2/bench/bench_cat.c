@@ -0,0 +1,104 @@
+/*
+ * Пропускная способность пайплайна "producer | cat | cat > file" в шеле:
+ * встроенный cat (splice) против программы /bin/cat (read/write).
+ * Шел запускается с командой на stdin, время - от запуска до завершения.
+ *
+ * Использование: bench_cat [SHELL] [SIZE_MB] [OUT_FILE]
+ */
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_SHELL "./terminal"
+#define DEFAULT_SIZE_MB 2048
+#define DEFAULT_OUT_FILE "/tmp/bench_cat.out"
+#define RUNS 3
+
+extern char** environ;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Выполнить command в шеле, вернуть время работы, нс */
+static long long run_shell(const char* shell, const char* command)
+{
+	int in_pipe[2];
+	if (pipe(in_pipe) == -1)
+	{
+		perror("pipe");
+		exit(1);
+	}
+
+	int null_fd = open("/dev/null", O_WRONLY);
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, null_fd, STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, in_pipe[1]);
+
+	long long start = now_ns();
+	pid_t pid;
+	char* argv[] = {(char*)shell, NULL};
+	int error = posix_spawn(&pid, shell, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(in_pipe[0]);
+	close(null_fd);
+	if (error != 0)
+	{
+		fprintf(stderr, "posix_spawn %s: %s\n", shell, strerror(error));
+		exit(1);
+	}
+
+	write(in_pipe[1], command, strlen(command));
+	close(in_pipe[1]);
+	waitpid(pid, NULL, 0);
+	return now_ns() - start;
+}
+
+static void bench(const char* shell, const char* name, const char* command,
+                  int size_mb)
+{
+	long long best = -1;
+	for (int run = 0; run < RUNS; run++)
+	{
+		long long ns = run_shell(shell, command);
+		if (best == -1 || ns < best)
+		{
+			best = ns;
+		}
+	}
+
+	double seconds = best / 1e9;
+	printf("%-10s %10.3f %10.1f\n", name, seconds, size_mb / seconds);
+}
+
+int main(int argc, char** argv)
+{
+	const char* shell = 1 < argc ? argv[1] : DEFAULT_SHELL;
+	int size_mb = 2 < argc ? atoi(argv[2]) : DEFAULT_SIZE_MB;
+	const char* out_file = 3 < argc ? argv[3] : DEFAULT_OUT_FILE;
+
+	char builtin_command[256];
+	char external_command[256];
+	snprintf(builtin_command, sizeof(builtin_command),
+	         "head -c %dM /dev/zero | cat | cat > %s\n", size_mb, out_file);
+	snprintf(external_command, sizeof(external_command),
+	         "head -c %dM /dev/zero | /bin/cat | /bin/cat > %s\n", size_mb,
+	         out_file);
+
+	printf("%-10s %10s %10s\n", "cat", "seconds", "MB/s");
+	bench(shell, "builtin", builtin_command, size_mb);
+	bench(shell, "/bin/cat", external_command, size_mb);
+
+	unlink(out_file);
+	return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Пропускная способность разбора: сгенерированный скрипт на несколько MB
+ * подается парсеру порциями по 1024 байта (как в main), каждая строка
+ * проходит parser_pop_next + parse_command и освобождается.
+ *
+ * Использование: bench_parse [SIZE_MB]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "parse_command.h"
+#include "parser.h"
+
+#define DEFAULT_SIZE_MB 16
+#define FEED_SIZE 1024
+#define RUNS 3
+
+static const char* const lines[] = {
+    "ls -la /tmp\n",
+    "echo \"hello world\" | grep hello | wc -l > out.txt\n",
+    "cat file.txt | sort -u | head -n 10 >> log.txt\n",
+    "make -j8 && ./run_tests --verbose || echo 'tests failed'\n",
+    "printf \"%s\\n\" a\\ b \"c\\\"d\" 'e f' &\n",
+    "# комментарий\n",
+    "cd ../some/long/directory/name/for/parsing\n",
+};
+
+static char* generate_script(size_t size, size_t* out_size, int* out_lines)
+{
+	char* script = (char*)malloc(size + 256);
+	size_t used = 0;
+	int count = 0;
+	while (used < size)
+	{
+		const char* line = lines[count % (sizeof(lines) / sizeof(lines[0]))];
+		size_t len = strlen(line);
+		memcpy(script + used, line, len);
+		used += len;
+		++count;
+	}
+
+	*out_size = used;
+	*out_lines = count;
+	return script;
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Разобрать скрипт целиком, вернуть количество команд */
+static int parse_script(const char* script, size_t size)
+{
+	struct parser* p = parser_new();
+	int commands = 0;
+	for (size_t offset = 0; offset < size; offset += FEED_SIZE)
+	{
+		size_t len = size - offset < FEED_SIZE ? size - offset : FEED_SIZE;
+		parser_feed(p, script + offset, (uint32_t)len);
+
+		struct command_line* line = NULL;
+		while (true)
+		{
+			enum parser_error err = parser_pop_next(p, &line);
+			if (err == PARSER_ERR_NONE && line == NULL)
+			{
+				break;
+			}
+			if (err != PARSER_ERR_NONE)
+			{
+				continue;
+			}
+
+			command_t cmd;
+			if (parse_command(line, &cmd) == 0)
+			{
+				++commands;
+			}
+			free_command(&cmd);
+			command_line_delete(line);
+		}
+	}
+
+	parser_delete(p);
+	return commands;
+}
+
+int main(int argc, char** argv)
+{
+	int size_mb = 1 < argc ? atoi(argv[1]) : DEFAULT_SIZE_MB;
+
+	size_t size;
+	int line_count;
+	char* script =
+	    generate_script((size_t)size_mb * 1024 * 1024, &size, &line_count);
+
+	long long best = -1;
+	int commands = 0;
+	for (int run = 0; run < RUNS; run++)
+	{
+		long long start = now_ns();
+		commands = parse_script(script, size);
+		long long ns = now_ns() - start;
+		if (best == -1 || ns < best)
+		{
+			best = ns;
+		}
+	}
+
+	double seconds = best / 1e9;
+	printf("%d lines, %d commands, %.1f MB\n", line_count, commands,
+	       size / 1024.0 / 1024.0);
+	printf("%.3f s, %.1f MB/s, %.0f commands/s\n", seconds,
+	       size / 1024.0 / 1024.0 / seconds, commands / seconds);
+
+	free(script);
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Скорость выполнения длинного скрипта шелом: скрипт из встроенных команд
+ * (без запуска программ, чтобы мерить сам шел) передается файлом
+ * (./terminal script.sh) и через pipe (./terminal < script).
+ *
+ * Использование: bench_script [SHELL] [LINES] [SCRIPT_FILE]
+ */
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_SHELL "./terminal"
+#define DEFAULT_LINES 100000
+#define DEFAULT_SCRIPT_FILE "/tmp/bench_script.sh"
+#define RUNS 3
+
+/* cd выполняется в самом шеле, после || - не выполняется */
+static const char* const script_line = "cd . && cd /tmp || echo never\n";
+
+extern char** environ;
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static char* generate_script(int lines, size_t* out_size)
+{
+	size_t len = strlen(script_line);
+	char* script = (char*)malloc(len * lines);
+	for (int i = 0; i < lines; i++)
+	{
+		memcpy(script + len * i, script_line, len);
+	}
+
+	*out_size = len * lines;
+	return script;
+}
+
+/*
+ * Запустить шел и дождаться его. Если script != NULL, он пишется в stdin
+ * шела через pipe, иначе шел получает путь к файлу скрипта
+ */
+static long long run_shell(const char* shell, const char* script_file,
+                           const char* script, size_t size)
+{
+	int in_pipe[2];
+	if (pipe(in_pipe) == -1)
+	{
+		perror("pipe");
+		exit(1);
+	}
+
+	int null_fd = open("/dev/null", O_WRONLY);
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, null_fd, STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, in_pipe[1]);
+
+	long long start = now_ns();
+	pid_t pid;
+	char* argv[] = {(char*)shell, script == NULL ? (char*)script_file : NULL,
+	                NULL};
+	int error = posix_spawn(&pid, shell, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(in_pipe[0]);
+	close(null_fd);
+	if (error != 0)
+	{
+		fprintf(stderr, "posix_spawn %s: %s\n", shell, strerror(error));
+		exit(1);
+	}
+
+	size_t written = 0;
+	while (script != NULL && written < size)
+	{
+		ssize_t rc = write(in_pipe[1], script + written, size - written);
+		if (rc == -1)
+		{
+			perror("write");
+			break;
+		}
+		written += rc;
+	}
+	close(in_pipe[1]);
+	waitpid(pid, NULL, 0);
+	return now_ns() - start;
+}
+
+static void bench(const char* shell, const char* name, const char* script_file,
+                  const char* script, size_t size, int lines)
+{
+	long long best = -1;
+	for (int run = 0; run < RUNS; run++)
+	{
+		long long ns = run_shell(shell, script_file, script, size);
+		if (best == -1 || ns < best)
+		{
+			best = ns;
+		}
+	}
+
+	double seconds = best / 1e9;
+	printf("%-8s %10.3f %14.0f\n", name, seconds, lines / seconds);
+}
+
+int main(int argc, char** argv)
+{
+	const char* shell = 1 < argc ? argv[1] : DEFAULT_SHELL;
+	int lines = 2 < argc ? atoi(argv[2]) : DEFAULT_LINES;
+	const char* script_file = 3 < argc ? argv[3] : DEFAULT_SCRIPT_FILE;
+
+	size_t size;
+	char* script = generate_script(lines, &size);
+	int fd = open(script_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1 || write(fd, script, size) != (ssize_t)size)
+	{
+		perror(script_file);
+		return 1;
+	}
+	close(fd);
+
+	printf("%d lines, %zu bytes\n", lines, size);
+	printf("%-8s %10s %14s\n", "mode", "seconds", "commands/s");
+	bench(shell, "file", script_file, NULL, 0, lines);
+	bench(shell, "pipe", NULL, script, size, lines);
+
+	unlink(script_file);
+	free(script);
+	return 0;
+}
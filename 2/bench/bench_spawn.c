@@ -0,0 +1,88 @@
+/*
+ * Задержка запуска программы в зависимости от объема памяти шела: fork +
+ * execvp против posix_spawn (launch_exe.c). Шел "раздувается" до указанного
+ * RSS, затем N раз запускается и дожидается /bin/true.
+ *
+ * Использование: bench_spawn [MAX_RSS_MB] [N]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "launch_exe.h"
+
+#define DEFAULT_MAX_RSS_MB 1024
+#define DEFAULT_ITERATIONS 200
+
+typedef pid_t (*launch_fn)(const exe_t* exe);
+
+static pid_t launch_fork(const exe_t* exe)
+{
+	return launch_exe_fork(exe, NULL, STDIN_FILENO, STDOUT_FILENO, -1);
+}
+
+static pid_t launch_spawn(const exe_t* exe)
+{
+	return launch_exe_spawn(exe, STDIN_FILENO, STDOUT_FILENO);
+}
+
+static long long now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Средняя задержка запуска и ожидания одного потомка, мкс */
+static double measure(launch_fn launch, const exe_t* exe, int iterations)
+{
+	long long start = now_ns();
+	for (int i = 0; i < iterations; i++)
+	{
+		pid_t pid = launch(exe);
+		if (pid == -1)
+		{
+			exit(1);
+		}
+		waitpid(pid, NULL, 0);
+	}
+
+	return (double)(now_ns() - start) / iterations / 1000.0;
+}
+
+int main(int argc, char** argv)
+{
+	int max_rss_mb = 1 < argc ? atoi(argv[1]) : DEFAULT_MAX_RSS_MB;
+	int iterations = 2 < argc ? atoi(argv[2]) : DEFAULT_ITERATIONS;
+
+	exe_t exe = {
+	    .name = "/bin/true",
+	    .args = NULL,
+	    .args_count = 0,
+	};
+
+	printf("%10s %12s %12s %8s\n", "rss_mb", "fork_us", "spawn_us",
+	       "speedup");
+
+	char* ballast = NULL;
+	int rss_mb = 0;
+	while (rss_mb <= max_rss_mb)
+	{
+		/* Страницы заполняются, чтобы попасть в таблицы страниц */
+		ballast = (char*)realloc(ballast, (size_t)rss_mb * 1024 * 1024 + 1);
+		memset(ballast, 1, (size_t)rss_mb * 1024 * 1024 + 1);
+
+		double fork_us = measure(launch_fork, &exe, iterations);
+		double spawn_us = measure(launch_spawn, &exe, iterations);
+		printf("%10d %12.1f %12.1f %7.1fx\n", rss_mb, fork_us, spawn_us,
+		       fork_us / spawn_us);
+
+		rss_mb = rss_mb == 0 ? 64 : rss_mb * 4;
+	}
+
+	free(ballast);
+	return 0;
+}
@@ -8,17 +8,30 @@
 #include <unistd.h>
 
 #include "builtin_command.h"
+#include "fd_copy.h"
 
 struct builtin_command
 {
 	/** Название встроенной команды */
 	const char* name;
 	/** Функция для ее выполнения с переданными аргументами */
-	int (*exec)(int argc, const char** argv);
+	int (*exec)(job_table_t* jobs, int argc, const char** argv);
+	/**
+	 * Может ли встроенная команда выполнить эти аргументы, либо NULL - любые.
+	 * Если нет, запускается одноименная программа
+	 */
+	bool (*accepts)(int argc, const char** argv);
+	/**
+	 * Команда меняет состояние шела (cd, exit, задания), поэтому одиночная
+	 * выполняется в самом шеле. Остальные всегда выполняются в потомке: так
+	 * SIGPIPE или чтение из терминала не останавливают шел
+	 */
+	bool in_shell;
 };
 
-static int do_exit(int argc, const char** argv)
+static int do_exit(job_table_t* jobs, int argc, const char** argv)
 {
+	(void)jobs;
 	if (argc == 0)
 	{
 		exit(0);
@@ -48,8 +61,9 @@ static const char* get_pwd()
 	return pw->pw_dir;
 }
 
-static int do_cd(int argc, const char** argv)
+static int do_cd(job_table_t* jobs, int argc, const char** argv)
 {
+	(void)jobs;
 	const char* path;
 	if (argc == 0)
 	{
@@ -79,14 +93,163 @@ static int do_cd(int argc, const char** argv)
 	return ret_code;
 }
 
+static int do_jobs(job_table_t* jobs, int argc, const char** argv)
+{
+	(void)argv;
+	if (argc != 0)
+	{
+		dprintf(STDERR_FILENO, "jobs: аргументы не поддерживаются\n");
+		return 1;
+	}
+
+	job_table_reap(jobs);
+	job_table_print(jobs, STDOUT_FILENO);
+	return 0;
+}
+
+/*
+ * wait - дождаться всех фоновых заданий, wait %N|PID ... - указанных.
+ * Код - код последнего из указанных заданий
+ */
+static int do_wait(job_table_t* jobs, int argc, const char** argv)
+{
+	if (argc == 0)
+	{
+		while (0 < jobs->size)
+		{
+			job_table_wait(jobs, jobs->jobs);
+		}
+		return 0;
+	}
+
+	int ret_code = 0;
+	for (int i = 0; i < argc; i++)
+	{
+		job_t* job = job_table_find(jobs, argv[i]);
+		if (job == NULL)
+		{
+			dprintf(STDERR_FILENO, "wait: %s: нет такого задания\n", argv[i]);
+			ret_code = 127;
+			continue;
+		}
+		ret_code = job_table_wait(jobs, job);
+	}
+	return ret_code;
+}
+
+/*
+ * fg [%N] - перевести задание (по умолчанию последнее) на передний план.
+ * Задания не выделяются в отдельные группы процессов, поэтому это ожидание
+ * задания с печатью его команды, как делает bash
+ */
+static int do_fg(job_table_t* jobs, int argc, const char** argv)
+{
+	if (1 < argc)
+	{
+		dprintf(STDERR_FILENO, "fg: слишком много аргументов\n");
+		return 1;
+	}
+
+	job_t* job = job_table_find(jobs, argc == 0 ? NULL : argv[0]);
+	if (job == NULL)
+	{
+		dprintf(STDERR_FILENO, "fg: нет такого задания\n");
+		return 1;
+	}
+
+	dprintf(STDOUT_FILENO, "%s\n", job->text);
+	return job_table_wait(jobs, job);
+}
+
+/* Встроенный cat понимает только файлы и "-" (stdin), опции - дело /bin/cat */
+static bool cat_accepts(int argc, const char** argv)
+{
+	for (int i = 0; i < argc; i++)
+	{
+		if (argv[i][0] == '-' && argv[i][1] != '\0')
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Переслать файл в stdout, "-" - stdin */
+static int cat_one(const char* path)
+{
+	bool is_stdin = strcmp(path, "-") == 0;
+	int fd = is_stdin ? STDIN_FILENO : open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		dprintf(STDERR_FILENO, "cat: %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	int ret_code = 0;
+	if (fd_copy(fd, STDOUT_FILENO) == -1)
+	{
+		dprintf(STDERR_FILENO, "cat: %s: %s\n", path, strerror(errno));
+		ret_code = 1;
+	}
+
+	if (!is_stdin)
+	{
+		close(fd);
+	}
+	return ret_code;
+}
+
+/*
+ * cat [FILE ...] - пересылка байтов без копирования через пользовательское
+ * пространство (см. fd_copy): в пайплайне данные идут из пайпа в пайп или файл
+ * через splice
+ */
+static int do_cat(job_table_t* jobs, int argc, const char** argv)
+{
+	(void)jobs;
+	if (argc == 0)
+	{
+		return cat_one("-");
+	}
+
+	int ret_code = 0;
+	for (int i = 0; i < argc; i++)
+	{
+		ret_code |= cat_one(argv[i]);
+	}
+	return ret_code;
+}
+
 static const builtin_command_t builtin_commands[] = {
     {
         .name = "exit",
         .exec = do_exit,
+        .in_shell = true,
     },
     {
         .name = "cd",
         .exec = do_cd,
+        .in_shell = true,
+    },
+    {
+        .name = "jobs",
+        .exec = do_jobs,
+        .in_shell = true,
+    },
+    {
+        .name = "wait",
+        .exec = do_wait,
+        .in_shell = true,
+    },
+    {
+        .name = "fg",
+        .exec = do_fg,
+        .in_shell = true,
+    },
+    {
+        .name = "cat",
+        .exec = do_cat,
+        .accepts = cat_accepts,
     },
 };
 
@@ -106,19 +269,28 @@ static int find_command(const char* name, const builtin_command_t** command)
 	return -1;
 }
 
-const builtin_command_t* get_builtin_command(const char* name)
+const builtin_command_t* get_builtin_command(const char* name,
+                                            const char** argv,
+                                            int argc)
 {
 	const builtin_command_t* ptr;
-	if (find_command(name, &ptr) == 0)
+	if (find_command(name, &ptr) == 0 &&
+	    (ptr->accepts == NULL || ptr->accepts(argc, argv)))
 	{
 		return ptr;
 	}
 	return NULL;
 }
 
+bool builtin_runs_in_shell(const builtin_command_t* cmd)
+{
+	return cmd->in_shell;
+}
+
 int exec_builtin_command(const builtin_command_t* cmd,
+                         job_table_t* jobs,
                          const char** argv,
                          int argc)
 {
-	return cmd->exec(argc, argv);
+	return cmd->exec(jobs, argc, argv);
 }
\ No newline at end of file
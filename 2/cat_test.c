@@ -0,0 +1,108 @@
+#include "unit.h"
+
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define BIG_FILE "cat_test_big.bin"
+#define SCRIPT_FILE "cat_test_script.sh"
+#define MARKER_FILE "cat_test_marker.txt"
+
+extern char **environ;
+
+static const char *shell_path;
+
+static void
+write_file(const char *path, const char *data, size_t size)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	unit_fail_if(fd == -1);
+	unit_fail_if(write(fd, data, size) != (ssize_t)size);
+	close(fd);
+}
+
+static void
+create_big_file(void)
+{
+	/* Намного больше буфера пайпа, чтобы cat упирался в закрытый пайп */
+	size_t size = 8 * 1024 * 1024;
+	char *data = malloc(size);
+	memset(data, 'x', size);
+	write_file(BIG_FILE, data, size);
+	free(data);
+}
+
+/*
+ * Запустить шел и прочитать из его stdout только 10 байт, как "| head -c 10".
+ * script_arg - путь к скрипту для argv, иначе скрипт подается в stdin.
+ * Возвращает статус waitpid
+ */
+static int
+run_shell_head(const char *script_arg)
+{
+	int out_pipe[2];
+	unit_fail_if(pipe(out_pipe) == -1);
+	int in_fd = open(script_arg == NULL ? SCRIPT_FILE : "/dev/null",
+			 O_RDONLY);
+	unit_fail_if(in_fd == -1);
+
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, out_pipe[0]);
+
+	char *argv[] = {(char *)shell_path, (char *)script_arg, NULL};
+	pid_t pid;
+	int error = posix_spawn(&pid, shell_path, &actions, NULL, argv,
+				environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(in_fd);
+	close(out_pipe[1]);
+	unit_fail_if(error != 0);
+
+	char buf[10];
+	unit_fail_if(read(out_pipe[0], buf, sizeof(buf)) <= 0);
+	close(out_pipe[0]);
+
+	int status;
+	unit_fail_if(waitpid(pid, &status, 0) == -1);
+	return status;
+}
+
+static void
+test_cat_sigpipe(const char *script_arg)
+{
+	unit_test_start();
+	const char *script = "cat " BIG_FILE "\necho after > " MARKER_FILE "\n";
+	write_file(SCRIPT_FILE, script, strlen(script));
+	unlink(MARKER_FILE);
+
+	int status = run_shell_head(script_arg);
+	unit_check(WIFEXITED(status), "shell is not killed by SIGPIPE");
+	unit_check(WIFEXITED(status) && WEXITSTATUS(status) == 0,
+		   "exit code is of the last command");
+	struct stat st;
+	unit_check(stat(MARKER_FILE, &st) == 0, "next line is executed");
+
+	unlink(MARKER_FILE);
+	unlink(SCRIPT_FILE);
+	unit_test_finish();
+}
+
+int
+main(int argc, char **argv)
+{
+	shell_path = argc > 1 ? argv[1] : "./terminal";
+	create_big_file();
+	unit_msg("Script file");
+	test_cat_sigpipe(SCRIPT_FILE);
+	unit_msg("Script in stdin");
+	test_cat_sigpipe(NULL);
+	unlink(BIG_FILE);
+	return 0;
+}
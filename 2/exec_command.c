@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <assert.h>
 #include <complex.h>
 #include <errno.h>
@@ -10,6 +11,7 @@
 
 #include "builtin_command.h"
 #include "exec_command.h"
+#include "launch_exe.h"
 
 #define PIPE_READ 0
 #define PIPE_WRITE 1
@@ -17,50 +19,14 @@
 #define RET_CODE_SUCCESS(code) ((code) == 0)
 #define RET_CODE_FAILURE(code) (!RET_CODE_SUCCESS(code))
 
-static char** build_execvp_argv(exe_t* exe)
-{
-	int argv_count = exe->args_count + 2 /* Название самой программы + NULL */;
-	char** argv = (char**)calloc(argv_count, sizeof(char*));
-	argv[0] = strdup(exe->name);
-	argv[argv_count - 1] = NULL;
-	for (int i = 0; i < exe->args_count; i++)
-	{
-		argv[i + 1] = strdup(exe->args[i]);
-	}
-
-	return argv;
-}
-
-/* Запустить указанную команду в потомке. На этом моменте stdout и stdin должны
- * быть настроены */
-__attribute__((noreturn)) static void exec_exe_child(exe_t* exe)
+static int wait_child(pid_t pid)
 {
-	const builtin_command_t* bc;
-	if ((bc = get_builtin_command(exe->name)) != NULL)
-	{
-		exit(exec_builtin_command(bc, exe->args, exe->args_count));
-	}
-
-	char** argv = build_execvp_argv(exe);
-	execvp(argv[0], argv);
-	perror("execvp");
-	dprintf(STDERR_FILENO, "[Log:%d]: ошибка исполнения: %s", getpid(),
-	        argv[0]);
-	if (0 < exe->args_count)
+	if (pid == -1)
 	{
-		for (int i = 0; i < exe->args_count; i++)
-		{
-			dprintf(STDERR_FILENO, " %s", exe->args[i]);
-		}
+		/* Потомок не запустился */
+		return 1;
 	}
 
-	dprintf(STDERR_FILENO, "\n");
-
-	exit(1);
-}
-
-static int wait_child(pid_t pid)
-{
 	int status;
 	int ret_pid = waitpid(pid, &status, 0);
 	if (ret_pid == -1)
@@ -81,27 +47,52 @@ static int wait_child(pid_t pid)
 	return WEXITSTATUS(status);
 }
 
-static int exec_pipeline(pipeline_t* pp)
+/*
+ * Подменить стандартный дескриптор шела на fd. Возвращает сохраненную копию
+ * исходного, либо -1, если подменять не нужно
+ */
+static int replace_std_fd(int fd, int target)
 {
-	if (pp->piped_count == 0)
+	if (fd == target)
 	{
-		/* Короткий путь для единственной команды */
-		const builtin_command_t* bc;
-		if ((bc = get_builtin_command(pp->last.name)) != NULL)
-		{
-			return exec_builtin_command(bc, pp->last.args, pp->last.args_count);
-		}
+		return -1;
+	}
 
-		int child_pid;
-		if ((child_pid = fork()) == 0)
-		{
-			exec_exe_child(&pp->last);
-			return 1;
-		}
+	int saved = fcntl(target, F_DUPFD_CLOEXEC, 0);
+	dup2(fd, target);
+	return saved;
+}
 
-		return wait_child(child_pid);
+static void restore_std_fd(int saved, int target)
+{
+	if (saved != -1)
+	{
+		dup2(saved, target);
+		close(saved);
 	}
+}
+
+/*
+ * Одиночная встроенная команда, меняющая состояние шела (cd, exit), выполняется
+ * в самом шеле, но ее вывод может быть перенаправлен в out_fd
+ */
+static int exec_builtin_in_shell(const builtin_command_t* bc,
+                                 const exe_t* exe,
+                                 job_table_t* jobs,
+                                 int in_fd,
+                                 int out_fd)
+{
+	int saved_stdin = replace_std_fd(in_fd, STDIN_FILENO);
+	int saved_stdout = replace_std_fd(out_fd, STDOUT_FILENO);
+	int ret_code = exec_builtin_command(bc, jobs, exe->args, exe->args_count);
+	restore_std_fd(saved_stdout, STDOUT_FILENO);
+	restore_std_fd(saved_stdin, STDIN_FILENO);
+	return ret_code;
+}
 
+/* Выполнить пайплайн, вывод последней команды - в out_fd */
+static int exec_pipeline(pipeline_t* pp, job_table_t* jobs, int out_fd)
+{
 	/*
 	 * Если имеется пайплайн (не 1 команда), то ее представление следующее:
 	 *
@@ -109,102 +100,67 @@ static int exec_pipeline(pipeline_t* pp)
 	 * pp->last
 	 *
 	 * Таким образом, все организуется в цикл (i - текущий индекс):
-	 * - Читаем из предыдущего пайпа
+	 * - Читаем из предыдущего пайпа (in_fd)
 	 * - Создаем следующий и пишем в него
-	 * - После создания потомка обмениваем предыдущий и текущий пайпы
+	 * - После запуска потомка читающим становится новый пайп
 	 *
-	 * Команды в пайплайне (pp->piped) всегда выполняются в subshell, т.е. в
-	 * потомке. Но если последняя команда встроенная (exit, cd), то
-	 * - Выполняется в самом шеле
-	 * - Надо перенаправить STDIN из предыдущего пайпа и
-	 * - Восстановить STDIN после выполнения.
+	 * Перенаправления задаются при запуске потомка (file actions
+	 * posix_spawn), сам шел свои stdin/stdout не трогает. Пайпы открываются с
+	 * O_CLOEXEC, поэтому лишние концы пайпов потомкам не достаются.
 	 *
-	 * Но даже если и не встроенная, то не нужно вызывать pipe, т.к. вывод будет
-	 * в STDOUT
+	 * Как и в bash, в пайплайне из нескольких команд все они (и встроенные
+	 * тоже) выполняются в subshell, т.е. в потомке: "echo 1 | exit 2" шел не
+	 * закрывает. В самом шеле выполняется только одиночная встроенная команда,
+	 * меняющая его состояние (cd, exit, задания): одиночный cat в потомке, чтобы
+	 * SIGPIPE убивал его, а не шел
 	 */
-
-	/* Первая команда в пайплайне будет использовать исходные stdin/stdout */
-	int saved_stdin = dup(STDIN_FILENO);
-	int prev_pipe[2] = {
-	    [PIPE_READ] = STDIN_FILENO,
-	    [PIPE_WRITE] = STDOUT_FILENO,
-	};
-	int* child_pids = (int*)malloc(sizeof(int) * pp->piped_count);
+	int in_fd = STDIN_FILENO;
+	pid_t* child_pids = NULL;
+	if (0 < pp->piped_count)
+	{
+		child_pids = (pid_t*)malloc(sizeof(pid_t) * pp->piped_count);
+	}
 
 	for (int i = 0; i < pp->piped_count; i++)
 	{
 		int cur_pipe[2];
-		if (pipe(cur_pipe) == -1)
+		if (pipe2(cur_pipe, O_CLOEXEC) == -1)
 		{
 			perror("pipe");
 			exit(1);
 		}
 
-		int child_pid;
-		if ((child_pid = fork()) == 0)
-		{
-			if (cur_pipe[PIPE_WRITE] != STDOUT_FILENO)
-			{
-				if (dup2(cur_pipe[PIPE_WRITE], STDOUT_FILENO) == -1)
-				{
-					dprintf(STDERR_FILENO, "dup2(STDOUT_FILENO): %s\n",
-					        strerror(errno));
-					exit(1);
-				}
-				close(cur_pipe[PIPE_WRITE]);
-			}
+		child_pids[i] = launch_exe(pp->piped + i, jobs, in_fd,
+		                           cur_pipe[PIPE_WRITE], cur_pipe[PIPE_READ]);
 
-			if (prev_pipe[PIPE_READ] != STDIN_FILENO)
-			{
-				if (dup2(prev_pipe[PIPE_READ], STDIN_FILENO) == -1)
-				{
-					dprintf(STDERR_FILENO, "dup2(STDIN_FILENO): %s\n",
-					        strerror(errno));
-					exit(1);
-				}
-				close(prev_pipe[PIPE_READ]);
-			}
-
-			exec_exe_child(pp->piped + i);
+		if (in_fd != STDIN_FILENO)
+		{
+			close(in_fd);
 		}
-
-		close(prev_pipe[PIPE_READ]);
 		close(cur_pipe[PIPE_WRITE]);
-
-		child_pids[i] = child_pid;
-		prev_pipe[PIPE_READ] = cur_pipe[PIPE_READ];
-		prev_pipe[PIPE_WRITE] = cur_pipe[PIPE_WRITE];
+		in_fd = cur_pipe[PIPE_READ];
 	}
+
 	/* Результат работы пайплайна - код последней команды в нем */
 	int ret_code;
 
-	/* Последняя команда должна выполняться сразу же если это встроенная
-	 * (сохранение семантики bash) */
 	const builtin_command_t* builtin;
-	if ((builtin = get_builtin_command(pp->last.name)) != NULL)
+	if (pp->piped_count == 0 &&
+	    (builtin = get_builtin_command(pp->last.name, pp->last.args,
+	                                   pp->last.args_count)) != NULL &&
+	    builtin_runs_in_shell(builtin))
 	{
-		/* При запуске встроенной команды необходимо читать вывод из
-		 * последнего пайпа, но при этом нужно и частить */
-		dup2(prev_pipe[PIPE_READ], STDIN_FILENO);
 		ret_code =
-		    exec_builtin_command(builtin, pp->last.args, pp->last.args_count);
+		    exec_builtin_in_shell(builtin, &pp->last, jobs, in_fd, out_fd);
 	}
 	else
 	{
-		int last_child_pid;
-		if ((last_child_pid = fork()) == 0)
-		{
-			if (prev_pipe[PIPE_READ != STDIN_FILENO])
-			{
-				dup2(prev_pipe[PIPE_READ], STDIN_FILENO);
-				close(prev_pipe[PIPE_READ]);
-			}
-
-			exec_exe_child(&pp->last);
-			return 1;
-		}
+		ret_code = wait_child(launch_exe(&pp->last, jobs, in_fd, out_fd, -1));
+	}
 
-		ret_code = wait_child(last_child_pid);
+	if (in_fd != STDIN_FILENO)
+	{
+		close(in_fd);
 	}
 
 	for (int i = 0; i < pp->piped_count; i++)
@@ -213,20 +169,6 @@ static int exec_pipeline(pipeline_t* pp)
 	}
 	free(child_pids);
 
-	/* Восстанавливаем STDIN */
-	dup2(saved_stdin, STDIN_FILENO);
-	close(saved_stdin);
-	if (prev_pipe[PIPE_READ] != STDIN_FILENO)
-	{
-		/*
-		 * Возможна ситуация, когда после закрытия STDIN на предыдущем шаге
-		 * pipe вернет дескриптор 0 (STDIN).
-		 * Такое может произойти, если команд в в пайплайне 3.
-		 * Например: echo 1 | echo 2 | echo 3
-		 */
-		close(prev_pipe[PIPE_READ]);
-	}
-
 	return ret_code;
 }
 
@@ -240,7 +182,7 @@ static int get_out_fd(const char* filename, bool is_append, int* fd)
 
 	/* -rw|-r-|-r- */
 	const int mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
-	int flags = O_CREAT | O_WRONLY;
+	int flags = O_CREAT | O_WRONLY | O_CLOEXEC;
 	flags |= (is_append ? O_APPEND : O_TRUNC);
 	if ((*fd = open(filename, flags, mode)) == -1)
 	{
@@ -263,33 +205,30 @@ static void close_out_fd(int fd)
  * Запустить выполнение пайплайна с учетом возможного перенаправления STDOUT.
  * Вызывается последним в цепочке вызовов
  */
-static void exec_pipeline_redirect(pipeline_t* pl, command_t* cmd)
+static int exec_pipeline_redirect(pipeline_t* pl,
+                                  command_t* cmd,
+                                  job_table_t* jobs)
 {
 	int fd;
 	if (get_out_fd(cmd->redirect_filename, cmd->append, &fd) == -1)
 	{
-		return;
+		return 1;
 	}
 
-	int saved_stdout = dup(STDOUT_FILENO);
-	dup2(fd, STDOUT_FILENO);
-
-	exec_pipeline(pl);
-
-	dup2(saved_stdout, STDOUT_FILENO);
-	close(saved_stdout);
+	int ret_code = exec_pipeline(pl, jobs, fd);
 	close_out_fd(fd);
+	return ret_code;
 }
 
-static void exec_command_main(command_t* cmd)
+/* Выполнить цепочку пайплайнов. Код - код последнего выполненного пайплайна */
+static int exec_command_main(command_t* cmd, job_table_t* jobs)
 {
 	if (0 == cmd->chained_count)
 	{
-		exec_pipeline_redirect(&cmd->first, cmd);
-		return;
+		return exec_pipeline_redirect(&cmd->first, cmd, jobs);
 	}
 
-	int prev_ret_code = exec_pipeline(&cmd->first);
+	int prev_ret_code = exec_pipeline(&cmd->first, jobs, STDOUT_FILENO);
 
 	pipeline_condition_t* pc;
 	for (int i = 0; i < cmd->chained_count; i++)
@@ -305,91 +244,109 @@ static void exec_command_main(command_t* cmd)
 		{
 			if (i == (cmd->chained_count - 1))
 			{
-				/* Обновлять код не нужно, т.к. это последняя итерация */
-				exec_pipeline_redirect(
-				    &cmd->chained[cmd->chained_count - 1].pipeline, cmd);
+				prev_ret_code = exec_pipeline_redirect(
+				    &cmd->chained[cmd->chained_count - 1].pipeline, cmd, jobs);
 			}
 			else
 			{
-				prev_ret_code = exec_pipeline(&pc->pipeline);
+				prev_ret_code =
+				    exec_pipeline(&pc->pipeline, jobs, STDOUT_FILENO);
 			}
 		}
 	}
+
+	return prev_ret_code;
 }
 
-static void child_atexit(void)
+/* Дописать в text строку str, расширяя буфер */
+static void text_append(char** text, int* size, int* capacity, const char* str)
 {
-	kill(getppid(), SIGUSR1);
+	int len = strlen(str);
+	if (*capacity < *size + len + 1)
+	{
+		*capacity = (*size + len + 1) * 2;
+		*text = (char*)realloc(*text, *capacity);
+	}
+	memcpy(*text + *size, str, len + 1);
+	*size += len;
 }
 
-void exec_command(command_t* cmd)
+static void pipeline_append_text(char** text,
+                                 int* size,
+                                 int* capacity,
+                                 const pipeline_t* pp)
 {
-	if (cmd->is_bg)
+	for (int i = 0; i <= pp->piped_count; i++)
 	{
-		int child_pid;
-		if ((child_pid = fork()) == 0)
+		const exe_t* exe = i < pp->piped_count ? pp->piped + i : &pp->last;
+		if (0 < i)
 		{
-			atexit(child_atexit);
-			exec_command_main(cmd);
-			exit(0);
+			text_append(text, size, capacity, " | ");
+		}
+		text_append(text, size, capacity, exe->name);
+		for (int a = 0; a < exe->args_count; a++)
+		{
+			text_append(text, size, capacity, " ");
+			text_append(text, size, capacity, exe->args[a]);
 		}
-
-		dprintf(STDERR_FILENO, "Запущен потомок %d\n", child_pid);
-	}
-	else
-	{
-		exec_command_main(cmd);
 	}
 }
 
-static void itoa(char* buf, int buf_len, int val, int* len, char** start)
+/* Текст команды для таблицы заданий (аргументы без кавычек) */
+static char* build_job_text(const command_t* cmd)
 {
-	char val_ch;
-	int i = buf_len - 1;
-	do
+	char* text = NULL;
+	int size = 0;
+	int capacity = 0;
+	pipeline_append_text(&text, &size, &capacity, &cmd->first);
+	for (int i = 0; i < cmd->chained_count; i++)
 	{
-		val_ch = (char)(val % 10) + '0';
-		buf[i] = val_ch;
-		i--;
-		val /= 10;
-	} while (0 < val && 0 <= i);
-	*len = buf_len - i;
-	*start = buf + i;
+		text_append(&text, &size, &capacity,
+		            cmd->chained[i].is_and ? " && " : " || ");
+		pipeline_append_text(&text, &size, &capacity,
+		                     &cmd->chained[i].pipeline);
+	}
+	if (cmd->redirect_filename != NULL)
+	{
+		text_append(&text, &size, &capacity, cmd->append ? " >> " : " > ");
+		text_append(&text, &size, &capacity, cmd->redirect_filename);
+	}
+	return text;
 }
 
-static void sigusr1_handler(int signum, siginfo_t* info, void* context_ptr)
+int exec_command(command_t* cmd, job_table_t* jobs)
 {
-	(void)context_ptr;
-	if (signum != SIGUSR1)
+	if (!cmd->is_bg)
 	{
-		return;
+		return exec_command_main(cmd, jobs);
 	}
 
-	pid_t child_pid = info->si_pid;
-	int status;
-
-	waitpid(child_pid, &status, 0);
+	/*
+	 * Фоновая команда целиком выполняется в subshell, код subshell - код
+	 * команды. Его забирает job_table_reap, когда придет SIGCHLD
+	 */
+	pid_t child_pid = fork();
+	if (child_pid == -1)
+	{
+		perror("fork");
+		return 1;
+	}
+	if (child_pid == 0)
+	{
+		/* _exit: буферы stdio и atexit принадлежат шелу, а не subshell */
+		_exit(exec_command_main(cmd, jobs));
+	}
 
-	char buf[12];
-	int len;
-	char* start;
-	itoa(buf, 12, info->si_pid, &len, &start);
-	write(STDERR_FILENO, "Потомок ", sizeof("Потомок "));
-	write(STDERR_FILENO, start, len);
-	write(STDERR_FILENO, " завершился\n", sizeof(" завершился\n"));
+	char* text = build_job_text(cmd);
+	job_table_add(jobs, child_pid, text);
+	free(text);
+	/* Как в bash: запуск фоновой команды успешен */
+	return 0;
 }
 
-void setup_executor()
+void setup_executor(job_table_t* jobs, bool interactive)
 {
-	struct sigaction sa = {
-	    .sa_flags = SA_SIGINFO,
-	    .sa_sigaction = sigusr1_handler,
-	};
-	sigemptyset(&sa.sa_mask);
+	/* Как bash: о заданиях сообщаем только в интерактивном режиме */
+	job_table_init(jobs, interactive);
+}
 
-	if (sigaction(SIGUSR1, &sa, NULL) == -1)
-	{
-		perror("sigaction");
-		exit(1);
-	}
-}
\ No newline at end of file
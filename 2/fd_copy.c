@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "fd_copy.h"
+
+/** Сколько байт пересылается одним вызовом: емкость пайпа по умолчанию */
+#define FD_COPY_CHUNK (64 * 1024)
+
+/** Размер буфера для пересылки через read/write */
+#define FD_COPY_BUFFER (128 * 1024)
+
+/*
+ * Отказывается ли ядро пересылать данные между такими дескрипторами.
+ * Тогда можно перейти на read/write, если еще ничего не переслано
+ */
+static bool is_unsupported(int error)
+{
+	return error == EINVAL || error == ENOSYS || error == EXDEV ||
+	       error == EBADF || error == EOPNOTSUPP;
+}
+
+/*
+ * Пересылка через ядро: 1 - все переслано, 0 - ядро отказало до пересылки
+ * первого байта (нужен read/write), -1 - ошибка. Отказ посреди пересылки -
+ * тоже ошибка: часть данных уже ушла, и что стало с остальными, неизвестно
+ */
+static int copy_in_kernel(int in_fd, int out_fd, bool use_splice)
+{
+	bool moved_any = false;
+	while (true)
+	{
+		ssize_t moved =
+		    use_splice
+		        ? splice(in_fd, NULL, out_fd, NULL, FD_COPY_CHUNK,
+		                 SPLICE_F_MOVE | SPLICE_F_MORE)
+		        : copy_file_range(in_fd, NULL, out_fd, NULL, FD_COPY_CHUNK, 0);
+		if (moved == 0)
+		{
+			return 1;
+		}
+		if (moved == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return !moved_any && is_unsupported(errno) ? 0 : -1;
+		}
+		moved_any = true;
+	}
+}
+
+static int copy_in_user(int in_fd, int out_fd)
+{
+	char buffer[FD_COPY_BUFFER];
+	while (true)
+	{
+		ssize_t read_count = read(in_fd, buffer, sizeof(buffer));
+		if (read_count == 0)
+		{
+			return 0;
+		}
+		if (read_count == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+
+		ssize_t pos = 0;
+		while (pos < read_count)
+		{
+			ssize_t written = write(out_fd, buffer + pos, read_count - pos);
+			if (written == -1)
+			{
+				if (errno == EINTR)
+				{
+					continue;
+				}
+				return -1;
+			}
+			pos += written;
+		}
+	}
+}
+
+int fd_copy(int in_fd, int out_fd)
+{
+	struct stat in_stat;
+	struct stat out_stat;
+	if (fstat(in_fd, &in_stat) == -1 || fstat(out_fd, &out_stat) == -1)
+	{
+		return -1;
+	}
+
+	bool has_pipe = S_ISFIFO(in_stat.st_mode) || S_ISFIFO(out_stat.st_mode);
+	bool files = S_ISREG(in_stat.st_mode) && S_ISREG(out_stat.st_mode);
+	if (has_pipe || files)
+	{
+		int rc = copy_in_kernel(in_fd, out_fd, has_pipe);
+		if (rc != 0)
+		{
+			return rc == 1 ? 0 : -1;
+		}
+	}
+
+	return copy_in_user(in_fd, out_fd);
+}
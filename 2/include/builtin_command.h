@@ -1,21 +1,32 @@
 #ifndef BUILTIN_COMMAND_H
 #define BUILTIN_COMMAND_H
 
+#include "job_table.h"
+
 typedef struct builtin_command builtin_command_t;
 
 /**
- * Получить встроенную команду с указанным именем.
- * Если команда нашлась, то возвращается указатель на нее, иначе NULL.
+ * Получить встроенную команду с указанным именем, которая умеет выполнить эти
+ * аргументы (например, встроенный cat не понимает опций - тогда запускается
+ * программа cat). Если команда нашлась, то возвращается указатель на нее, иначе
+ * NULL.
+ */
+const builtin_command_t* get_builtin_command(const char* name, const char** argv, int argc);
+
+/**
+ * Выполняется ли одиночная команда в самом шеле. Если нет, она, как и
+ * встроенные команды внутри пайплайна, выполняется в потомке
  */
-const builtin_command_t* get_builtin_command(const char* name);
+bool builtin_runs_in_shell(const builtin_command_t* cmd);
 
 /**
  * Выполнить встроенную команду.
  * Команда получается через вызов get_builtin_command.
  *
+ * jobs - таблица фоновых заданий шела (для jobs, wait, fg)
  * argv - массив строк, которые указал пользователь в командной строке, не
  * содержит самого названия команды
  */
-int exec_builtin_command(const builtin_command_t *cmd, const char** argv, int argc);
+int exec_builtin_command(const builtin_command_t *cmd, job_table_t* jobs, const char** argv, int argc);
 
 #endif
\ No newline at end of file
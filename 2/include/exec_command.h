@@ -2,11 +2,18 @@
 #define EXEC_COMMAND_H
 
 #include "command.h"
+#include "job_table.h"
 
-/** Функция для настройки окружения исполнения команд */
-void setup_executor();
+/**
+ * Функция для настройки окружения исполнения команд: таблицы заданий.
+ * interactive - команды вводит пользователь в терминале
+ */
+void setup_executor(job_table_t* jobs, bool interactive);
 
-/** Выполнить указанную команду */
-void exec_command(command_t* command);
+/**
+ * Выполнить указанную команду. Фоновые команды добавляются в jobs.
+ * Возвращает код завершения (для фоновой - 0)
+ */
+int exec_command(command_t* command, job_table_t* jobs);
 
 #endif
\ No newline at end of file
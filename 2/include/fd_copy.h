@@ -0,0 +1,14 @@
+#ifndef FD_COPY_H
+#define FD_COPY_H
+
+/**
+ * Переслать все данные из in_fd (до конца) в out_fd по возможности без
+ * копирования через пользовательское пространство: splice, если хотя бы один
+ * из дескрипторов - пайп, copy_file_range между обычными файлами. Если ядро
+ * отказывает сразу (терминал, файл с O_APPEND, разные файловые системы),
+ * данные пересылаются через read/write.
+ * Возвращает 0, либо -1 при ошибке (errno выставлен)
+ */
+int fd_copy(int in_fd, int out_fd);
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef JOB_TABLE_H
+#define JOB_TABLE_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+/** Фоновое задание - команда, запущенная с & */
+typedef struct job
+{
+	/** Номер задания, который видит пользователь (%1, %2, ...) */
+	int id;
+	/** Процесс (subshell), выполняющий команду */
+	pid_t pid;
+	/** Текст команды - для jobs и fg */
+	char* text;
+} job_t;
+
+/**
+ * Таблица фоновых заданий.
+ * SIGCHLD заблокирован и читается через signalfd: шел ждет его в poll вместе
+ * со stdin и собирает завершившиеся задания без обработчиков сигналов
+ */
+typedef struct job_table
+{
+	job_t* jobs;
+	/** Количество заданий в массиве jobs */
+	int size;
+	/** Вместимость массива jobs */
+	int capacity;
+	/** signalfd для SIGCHLD */
+	int signal_fd;
+	/**
+	 * Сообщать о запуске и завершении заданий (как bash в интерактивном
+	 * режиме). В обоих режимах завершившееся задание сразу удаляется
+	 */
+	bool notify;
+} job_table_t;
+
+/**
+ * Инициализировать таблицу: заблокировать SIGCHLD и создать signalfd.
+ * notify - сообщать о запуске и завершении заданий
+ */
+void job_table_init(job_table_t* table, bool notify);
+
+/** Освободить таблицу. Задания, которые еще работают, не ждем */
+void job_table_free(job_table_t* table);
+
+/** Добавить запущенное задание. Текст команды копируется */
+job_t* job_table_add(job_table_t* table, pid_t pid, const char* text);
+
+/**
+ * Собрать завершившиеся задания, не блокируясь, и удалить их из таблицы.
+ * Вызывается, когда signal_fd готов к чтению, и только когда у шела нет
+ * потомков переднего плана
+ */
+void job_table_reap(job_table_t* table);
+
+/**
+ * Найти задание по спецификации: "%N" - номер задания, "N" - pid, NULL -
+ * последнее запущенное. Если не нашлось, возвращается NULL
+ */
+job_t* job_table_find(job_table_t* table, const char* spec);
+
+/** Дождаться задания и удалить его из таблицы. Возвращает код завершения */
+int job_table_wait(job_table_t* table, job_t* job);
+
+/** Напечатать работающие задания в fd (для jobs) */
+void job_table_print(job_table_t* table, int fd);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef LAUNCH_EXE_H
+#define LAUNCH_EXE_H
+
+#include <sys/types.h>
+
+#include "command.h"
+#include "job_table.h"
+
+/**
+ * Запустить программу в потомке: stdin берется из in_fd, stdout пишется в
+ * out_fd (STDIN_FILENO/STDOUT_FILENO - без перенаправления).
+ * Внешние программы запускаются через posix_spawn, встроенные команды - через
+ * fork (subshell). Остальные дескрипторы шела должны быть открыты с O_CLOEXEC,
+ * кроме close_fd - его потомок после fork закрывает сам (-1 - нечего
+ * закрывать). jobs - таблица заданий для встроенных команд в subshell.
+ * Возвращает pid потомка, либо -1, если запустить не удалось
+ */
+pid_t launch_exe(const exe_t* exe,
+                 job_table_t* jobs,
+                 int in_fd,
+                 int out_fd,
+                 int close_fd);
+
+/**
+ * Запустить программу через posix_spawnp. В glibc это clone(CLONE_VM |
+ * CLONE_VFORK): таблицы страниц родителя не копируются, поэтому время запуска
+ * не зависит от объема памяти шела. Перенаправления - file actions, маска
+ * сигналов потомка сбрасывается
+ */
+pid_t launch_exe_spawn(const exe_t* exe, int in_fd, int out_fd);
+
+/** Запустить программу (или встроенную команду) в потомке через fork */
+pid_t launch_exe_fork(const exe_t* exe,
+                      job_table_t* jobs,
+                      int in_fd,
+                      int out_fd,
+                      int close_fd);
+
+#endif
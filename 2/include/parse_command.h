@@ -6,6 +6,8 @@
 
 /**
  * Создать объект команды из промпта пользователя.
+ * Строки команды не копируются, а указывают в память cmd_line, поэтому
+ * cmd_line удаляется только после free_command.
  * В случае ошибки возвращается -1, иначе (успех) 0
  */
 int parse_command(struct command_line *cmd_line, command_t *command);
@@ -78,6 +78,10 @@ struct command_line
     bool is_background;
 };
 
+/**
+ * The line, its exprs, args and strings are one memory block, so deleting
+ * is a single free.
+ */
 void command_line_delete(struct command_line *line);
 
 struct parser *
@@ -85,6 +89,13 @@ parser_new(void);
 
 void parser_feed(struct parser *p, const char *str, uint32_t len);
 
+/**
+ * Parse @a str in place, without copying - for example, an mmapped script.
+ * All the fed data must be already parsed. The memory must stay valid until
+ * the lines are popped or the next parser_feed(), which copies the rest.
+ */
+void parser_attach(struct parser *p, const char *str, uint32_t len);
+
 enum parser_error
 parser_pop_next(struct parser *p, struct command_line **out);
 
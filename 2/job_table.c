@@ -0,0 +1,190 @@
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "job_table.h"
+
+void job_table_init(job_table_t* table, bool notify)
+{
+	table->jobs = NULL;
+	table->size = 0;
+	table->capacity = 0;
+	table->notify = notify;
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+	{
+		perror("sigprocmask");
+		exit(1);
+	}
+
+	table->signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (table->signal_fd == -1)
+	{
+		perror("signalfd");
+		exit(1);
+	}
+}
+
+void job_table_free(job_table_t* table)
+{
+	for (int i = 0; i < table->size; i++)
+	{
+		free(table->jobs[i].text);
+	}
+	free(table->jobs);
+	table->jobs = NULL;
+	table->size = 0;
+	table->capacity = 0;
+	close(table->signal_fd);
+	table->signal_fd = -1;
+}
+
+job_t* job_table_add(job_table_t* table, pid_t pid, const char* text)
+{
+	if (table->size == table->capacity)
+	{
+		table->capacity = table->capacity == 0 ? 4 : table->capacity * 2;
+		table->jobs =
+		    (job_t*)realloc(table->jobs, sizeof(job_t) * table->capacity);
+	}
+
+	/* Как в bash: номер на 1 больше последнего, пока задания не кончатся */
+	job_t* job = table->jobs + table->size;
+	job->id = table->size == 0 ? 1 : table->jobs[table->size - 1].id + 1;
+	job->pid = pid;
+	job->text = strdup(text);
+	++table->size;
+
+	if (table->notify)
+	{
+		dprintf(STDERR_FILENO, "[%d] %d\n", job->id, (int)pid);
+	}
+	return job;
+}
+
+static void job_table_remove(job_table_t* table, job_t* job)
+{
+	free(job->text);
+	int index = (int)(job - table->jobs);
+	/* Порядок сохраняется: номера заданий идут по возрастанию */
+	memmove(job, job + 1, sizeof(job_t) * (table->size - index - 1));
+	--table->size;
+}
+
+static int status_to_code(int status)
+{
+	if (WIFEXITED(status))
+	{
+		return WEXITSTATUS(status);
+	}
+	if (WIFSIGNALED(status))
+	{
+		return 128 + WTERMSIG(status);
+	}
+	return 1;
+}
+
+static job_t* find_by_pid(job_table_t* table, pid_t pid)
+{
+	for (int i = 0; i < table->size; i++)
+	{
+		if (table->jobs[i].pid == pid)
+		{
+			return table->jobs + i;
+		}
+	}
+	return NULL;
+}
+
+void job_table_reap(job_table_t* table)
+{
+	/* Несколько SIGCHLD могут слиться в один, поэтому важен только факт */
+	struct signalfd_siginfo info;
+	while (read(table->signal_fd, &info, sizeof(info)) == sizeof(info))
+	{
+	}
+
+	int status;
+	pid_t pid;
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		job_t* job = find_by_pid(table, pid);
+		if (job == NULL)
+		{
+			continue;
+		}
+
+		/*
+		 * Задание забывается сразу: в скрипте о нем некому сообщить, и
+		 * завершившиеся задания копились бы в таблице без конца
+		 */
+		if (table->notify)
+		{
+			dprintf(STDERR_FILENO, "[%d]  Done(%d)\t%s\n", job->id,
+			        status_to_code(status), job->text);
+		}
+		job_table_remove(table, job);
+	}
+}
+
+job_t* job_table_find(job_table_t* table, const char* spec)
+{
+	if (table->size == 0)
+	{
+		return NULL;
+	}
+
+	if (spec == NULL)
+	{
+		return table->jobs + table->size - 1;
+	}
+
+	char* end;
+	bool by_id = spec[0] == '%';
+	long value = strtol(by_id ? spec + 1 : spec, &end, 10);
+	if (*end != '\0' || end == spec)
+	{
+		return NULL;
+	}
+
+	for (int i = 0; i < table->size; i++)
+	{
+		job_t* job = table->jobs + i;
+		if ((by_id && job->id == value) || (!by_id && job->pid == value))
+		{
+			return job;
+		}
+	}
+	return NULL;
+}
+
+int job_table_wait(job_table_t* table, job_t* job)
+{
+	int status;
+	/* SIGCHLD заблокирован, поэтому EINTR здесь быть не может */
+	if (waitpid(job->pid, &status, 0) == -1)
+	{
+		perror("waitpid");
+		status = 1 << 8;
+	}
+
+	job_table_remove(table, job);
+	return status_to_code(status);
+}
+
+void job_table_print(job_table_t* table, int fd)
+{
+	for (int i = 0; i < table->size; i++)
+	{
+		job_t* job = table->jobs + i;
+		dprintf(fd, "[%d]  Running\t%s\n", job->id, job->text);
+	}
+}
@@ -0,0 +1,165 @@
+#include <errno.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "builtin_command.h"
+#include "launch_exe.h"
+
+extern char** environ;
+
+/*
+ * Массив аргументов для exec. Строки не копируются: после fork они уже в
+ * памяти потомка, а posix_spawn возвращается только после exec
+ */
+static char** build_execvp_argv(const exe_t* exe)
+{
+	int argv_count = exe->args_count + 2 /* Название самой программы + NULL */;
+	char** argv = (char**)calloc(argv_count, sizeof(char*));
+	argv[0] = (char*)exe->name;
+	argv[argv_count - 1] = NULL;
+	for (int i = 0; i < exe->args_count; i++)
+	{
+		argv[i + 1] = (char*)exe->args[i];
+	}
+
+	return argv;
+}
+
+static void print_exec_error(const exe_t* exe, int error)
+{
+	dprintf(STDERR_FILENO, "execvp: %s\n", strerror(error));
+	dprintf(STDERR_FILENO, "[Log:%d]: ошибка исполнения: %s", getpid(),
+	        exe->name);
+	for (int i = 0; i < exe->args_count; i++)
+	{
+		dprintf(STDERR_FILENO, " %s", exe->args[i]);
+	}
+
+	dprintf(STDERR_FILENO, "\n");
+}
+
+/* Перенаправить дескриптор потомка: fd становится target */
+static void redirect_fd(int fd, int target)
+{
+	if (fd == target)
+	{
+		return;
+	}
+
+	if (dup2(fd, target) == -1)
+	{
+		dprintf(STDERR_FILENO, "dup2(%d): %s\n", target, strerror(errno));
+		exit(1);
+	}
+	close(fd);
+}
+
+/* Запустить указанную команду в потомке. На этом моменте stdout и stdin должны
+ * быть настроены */
+__attribute__((noreturn)) static void exec_exe_child(const exe_t* exe,
+                                                    job_table_t* jobs)
+{
+	const builtin_command_t* bc;
+	if ((bc = get_builtin_command(exe->name, exe->args, exe->args_count)) !=
+	    NULL)
+	{
+		/* _exit: память и буферы stdio шела потомку не принадлежат */
+		int code = exec_builtin_command(bc, jobs, exe->args, exe->args_count);
+		fflush(stdout);
+		_exit(code);
+	}
+
+	char** argv = build_execvp_argv(exe);
+	execvp(argv[0], argv);
+	print_exec_error(exe, errno);
+	free(argv);
+	exit(1);
+}
+
+pid_t launch_exe_fork(const exe_t* exe,
+                      job_table_t* jobs,
+                      int in_fd,
+                      int out_fd,
+                      int close_fd)
+{
+	pid_t child_pid = fork();
+	if (child_pid == -1)
+	{
+		perror("fork");
+		return -1;
+	}
+
+	if (child_pid == 0)
+	{
+		/* Шел блокирует SIGCHLD (см. job_table), программам он нужен */
+		sigset_t empty;
+		sigemptyset(&empty);
+		sigprocmask(SIG_SETMASK, &empty, NULL);
+		if (close_fd != -1)
+		{
+			close(close_fd);
+		}
+		redirect_fd(in_fd, STDIN_FILENO);
+		redirect_fd(out_fd, STDOUT_FILENO);
+		exec_exe_child(exe, jobs);
+	}
+
+	return child_pid;
+}
+
+pid_t launch_exe_spawn(const exe_t* exe, int in_fd, int out_fd)
+{
+	posix_spawn_file_actions_t actions;
+	posix_spawn_file_actions_init(&actions);
+	if (in_fd != STDIN_FILENO)
+	{
+		posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+	}
+	if (out_fd != STDOUT_FILENO)
+	{
+		posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+	}
+
+	/* Шел блокирует SIGCHLD (см. job_table), программам он нужен */
+	posix_spawnattr_t attr;
+	posix_spawnattr_init(&attr);
+	sigset_t empty;
+	sigemptyset(&empty);
+	posix_spawnattr_setsigmask(&attr, &empty);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK);
+
+	char** argv = build_execvp_argv(exe);
+	pid_t child_pid;
+	int error =
+	    posix_spawnp(&child_pid, argv[0], &actions, &attr, argv, environ);
+	free(argv);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (error != 0)
+	{
+		/* Ошибку exec (нет такой программы) glibc возвращает сюда же */
+		print_exec_error(exe, error);
+		return -1;
+	}
+
+	return child_pid;
+}
+
+pid_t launch_exe(const exe_t* exe,
+                 job_table_t* jobs,
+                 int in_fd,
+                 int out_fd,
+                 int close_fd)
+{
+	if (get_builtin_command(exe->name, exe->args, exe->args_count) != NULL)
+	{
+		return launch_exe_fork(exe, jobs, in_fd, out_fd, close_fd);
+	}
+
+	return launch_exe_spawn(exe, in_fd, out_fd);
+}
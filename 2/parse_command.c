@@ -36,28 +36,15 @@ internal void exe_state_init(exe_state_t* state)
 
 internal void exe_state_update(exe_state_t* state, struct command_raw* cmd)
 {
-	state->exe = strdup(cmd->exe);
-	if (0 < cmd->arg_count)
-	{
-		char** args = malloc(sizeof(char*) * cmd->arg_count);
-		for (uint32_t i = 0; i < cmd->arg_count; i++)
-		{
-			args[i] = strdup(cmd->args[i]);
-		}
-
-		state->args = (const char**)args;
-		state->args_count = cmd->arg_count;
-	}
-	else
-	{
-		state->args_count = 0;
-		state->args = NULL;
-	}
+	/* Строки и массив аргументов живут в блоке command_line, не копируем */
+	state->exe = cmd->exe;
+	state->args = (const char**)cmd->args;
+	state->args_count = cmd->arg_count;
 }
 
 internal void exe_state_build(exe_state_t* state, exe_t* exe)
 {
-	/* Эти значения уже скопированы, поэтому просто отдаем */
+	/* Эти значения принадлежат command_line, поэтому просто отдаем */
 	exe->name = state->exe;
 	exe->args = state->args;
 	exe->args_count = state->args_count;
@@ -65,8 +52,7 @@ internal void exe_state_build(exe_state_t* state, exe_t* exe)
 
 internal void exe_state_free(exe_state_t* s)
 {
-	/* Выделенные strdup строки удаляем уже в команде, чтобы уменьшить общую
-	 * работу */
+	/* Строки принадлежат command_line и удаляются вместе с ней */
 	s->args = NULL;
 	s->args_count = 0;
 	s->exe = NULL;
@@ -210,7 +196,7 @@ internal void build_state_init(build_state_t* state, struct command_line* line)
 	}
 	else
 	{
-		state->filename = strdup(line->out_file);
+		state->filename = line->out_file;
 		state->append = line->out_type == OUTPUT_TYPE_FILE_APPEND;
 	}
 
@@ -357,28 +343,13 @@ int parse_command(struct command_line* line, command_t* command)
 	return 0;
 }
 
-internal void exe_free(exe_t* e)
-{
-	for (int i = 0; i < e->args_count; i++)
-	{
-		free((void*)e->args[i]);
-	}
-
-	free((void*)e->args);
-	e->args = NULL;
-	free((void*)e->name);
-	e->name = NULL;
-}
-
 internal void pipeline_free(pipeline_t* p)
 {
-	exe_free(&p->last);
+	/* Строки и аргументы принадлежат command_line, освобождаем только массив */
+	p->last.name = NULL;
+	p->last.args = NULL;
 	if (p->piped != NULL)
 	{
-		for (int i = 0; i < p->piped_count; i++)
-		{
-			exe_free(p->piped + i);
-		}
 		free(p->piped);
 		p->piped = NULL;
 	}
@@ -388,7 +359,7 @@ void free_command(command_t* cmd)
 {
 	cmd->append = false;
 	cmd->is_bg = false;
-	free((void*)cmd->redirect_filename);
+	cmd->redirect_filename = NULL;
 
 	pipeline_free(&cmd->first);
 	if (cmd->chained != NULL)
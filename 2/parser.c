@@ -5,13 +5,6 @@
 #include <stdlib.h>
 #include <string.h>
 
-struct parser
-{
-    char *buffer;
-    uint32_t size;
-    uint32_t capacity;
-};
-
 enum token_type
 {
     TOKEN_TYPE_NONE,
@@ -25,80 +18,170 @@ enum token_type
     TOKEN_TYPE_BACKGROUND,
 };
 
+/**
+ * A string token is a slice of the parser input while its characters go in
+ * a row there. Once quotes or escapes break the sequence, the token is moved
+ * to the end of the scratch buffer and unescaped there. The scratch buffer
+ * keeps all such tokens of the current line and is reused between lines,
+ * so tokenizing does not allocate.
+ */
 struct token
 {
     enum token_type type;
-    char *data;
+    /** Valid if the token is not a copy. */
+    const char *data;
     uint32_t size;
+    /** The token is in the scratch at @a scratch_begin. */
+    bool is_copy;
+    uint32_t scratch_begin;
+    char *scratch;
+    /** Scratch bytes taken by the copied tokens of the current line. */
+    uint32_t scratch_used;
+    uint32_t scratch_capacity;
+};
+
+/** A string of the line being parsed: in the input or in the scratch. */
+struct token_slice
+{
+    /** NULL if the string is in the scratch at @a offset. */
+    const char *data;
+    uint32_t offset;
+    uint32_t size;
+};
+
+enum parse_item_type
+{
+    PARSE_ITEM_EXE,
+    PARSE_ITEM_ARG,
+    PARSE_ITEM_PIPE,
+    PARSE_ITEM_AND,
+    PARSE_ITEM_OR,
+};
+
+/**
+ * An element of the line being parsed. The command line is built from them
+ * only when the whole line is found, so incomplete input costs nothing.
+ */
+struct parse_item
+{
+    enum parse_item_type type;
+    /** Valid for EXE and ARG. */
+    struct token_slice str;
+};
+
+struct parser
+{
+    /** Own memory for fed data. */
+    char *buffer;
     uint32_t capacity;
+    /**
+     * Data being parsed: the buffer or memory given to parser_attach().
+     * Parsed lines are skipped by moving @a begin, not by memmove.
+     */
+    const char *input;
+    uint32_t begin;
+    uint32_t size;
+    struct token token;
+    /** Items of the line being parsed, reused between lines. */
+    struct parse_item *items;
+    uint32_t item_count;
+    uint32_t item_capacity;
 };
 
-static char *
-token_strdup(const struct token *t)
+static void
+token_scratch_reserve(struct token *t, uint32_t size)
 {
-    assert(t->type == TOKEN_TYPE_STR);
-    assert(t->size > 0);
-    char *res = malloc(t->size + 1);
-    memcpy(res, t->data, t->size);
-    res[t->size] = 0;
-    return res;
+    if (size <= t->scratch_capacity)
+        return;
+    t->scratch_capacity = (t->scratch_capacity + 1) * 2;
+    if (t->scratch_capacity < size)
+        t->scratch_capacity = size;
+    t->scratch = realloc(t->scratch, t->scratch_capacity);
 }
 
+/** Append the character at @a src, which is in the parser input. */
 static void
-token_append(struct token *t, char c)
+token_append(struct token *t, const char *src)
 {
-    if (t->size == t->capacity)
+    if (!t->is_copy)
     {
-        t->capacity = (t->capacity + 1) * 2;
-        t->data = realloc(t->data, sizeof(*t->data) * t->capacity);
+        if (t->size == 0)
+            t->data = src;
+        if (t->data + t->size == src)
+        {
+            ++t->size;
+            return;
+        }
+        token_scratch_reserve(t, t->scratch_begin + t->size + 1);
+        memcpy(t->scratch + t->scratch_begin, t->data, t->size);
+        t->is_copy = true;
     }
     else
     {
-        assert(t->size < t->capacity);
+        token_scratch_reserve(t, t->scratch_begin + t->size + 1);
     }
-    t->data[t->size++] = c;
+    t->scratch[t->scratch_begin + t->size++] = *src;
 }
 
 static void
 token_reset(struct token *t)
 {
+    t->data = NULL;
     t->size = 0;
+    t->is_copy = false;
+    t->scratch_begin = t->scratch_used;
     t->type = TOKEN_TYPE_NONE;
 }
 
-static void
-command_append_arg(struct command_raw *cmd, char *arg)
+/** Keep the string token until the line is built. */
+static struct token_slice
+token_take(struct token *t)
 {
-    if (cmd->arg_count == cmd->arg_capacity)
-    {
-        cmd->arg_capacity = (cmd->arg_capacity + 1) * 2;
-        cmd->args = realloc(cmd->args, sizeof(*cmd->args) * cmd->arg_capacity);
-    }
-    else
+    assert(t->type == TOKEN_TYPE_STR);
+    assert(t->size > 0);
+    struct token_slice res = {t->data, t->scratch_begin, t->size};
+    if (t->is_copy)
     {
-        assert(cmd->arg_count < cmd->arg_capacity);
+        res.data = NULL;
+        t->scratch_used = t->scratch_begin + t->size;
     }
-    cmd->args[cmd->arg_count++] = arg;
+    return res;
 }
 
-void command_line_delete(struct command_line *line)
+static void
+parser_add_item(struct parser *p, enum parse_item_type type,
+                struct token_slice str)
 {
-    while (line->head != NULL)
+    if (p->item_count == p->item_capacity)
     {
-        struct expr *e = line->head;
-        if (e->type == EXPR_TYPE_COMMAND)
-        {
-            struct command_raw *cmd = &e->cmd;
-            free(cmd->exe);
-            for (uint32_t i = 0; i < cmd->arg_count; ++i)
-                free(cmd->args[i]);
-            free(cmd->args);
-        }
-		line->head = e->next;
-        free(e);
+        p->item_capacity = (p->item_capacity + 1) * 2;
+        p->items = realloc(p->items, sizeof(*p->items) * p->item_capacity);
     }
-    free(line->out_file);
-    free(line);
+    struct parse_item *item = &p->items[p->item_count++];
+    item->type = type;
+    item->str = str;
+}
+
+/** Is the last item of the line being parsed a command or its argument. */
+static bool
+parser_ends_with_command(const struct parser *p)
+{
+    assert(p->item_count > 0);
+    enum parse_item_type type = p->items[p->item_count - 1].type;
+    return type == PARSE_ITEM_EXE || type == PARSE_ITEM_ARG;
+}
+
+/** Copy the string to @a *dst as a C string and move @a *dst past it. */
+static char *
+parser_copy_str(const struct parser *p, struct token_slice str, char **dst)
+{
+    const char *src = str.data != NULL ? str.data
+                                       : p->token.scratch + str.offset;
+    char *res = *dst;
+    memcpy(res, src, str.size);
+    res[str.size] = 0;
+    *dst += str.size + 1;
+    return res;
 }
 
 static void
@@ -111,6 +194,85 @@ command_line_append(struct command_line *line, struct expr *e)
     line->tail = e;
 }
 
+/**
+ * Build the command line from the parsed items in one block: the line,
+ * exprs, arg arrays and strings. Strings are copied once, because they must
+ * be zero-terminated and outlive the input, which is reused or read-only.
+ */
+static struct command_line *
+parser_build_line(const struct parser *p, enum output_type out_type,
+                  struct token_slice out_file, bool is_background)
+{
+    uint32_t expr_count = 0;
+    uint32_t arg_count = 0;
+    size_t str_size = 0;
+    for (uint32_t i = 0; i < p->item_count; ++i)
+    {
+        const struct parse_item *item = &p->items[i];
+        if (item->type == PARSE_ITEM_ARG)
+            ++arg_count;
+        else
+            ++expr_count;
+        if (item->type == PARSE_ITEM_EXE || item->type == PARSE_ITEM_ARG)
+            str_size += item->str.size + 1;
+    }
+    if (out_type != OUTPUT_TYPE_STDOUT)
+        str_size += out_file.size + 1;
+
+    struct command_line *line = malloc(sizeof(*line) +
+                                       sizeof(struct expr) * expr_count +
+                                       sizeof(char *) * arg_count + str_size);
+    memset(line, 0, sizeof(*line));
+    struct expr *e = (struct expr *)(line + 1);
+    char **args = (char **)(e + expr_count);
+    char *str = (char *)(args + arg_count);
+    for (uint32_t i = 0; i < p->item_count; ++i)
+    {
+        const struct parse_item *item = &p->items[i];
+        if (item->type == PARSE_ITEM_ARG)
+        {
+            struct command_raw *cmd = &line->tail->cmd;
+            if (cmd->arg_count == 0)
+                cmd->args = args;
+            *args++ = parser_copy_str(p, item->str, &str);
+            cmd->arg_capacity = ++cmd->arg_count;
+            continue;
+        }
+        memset(e, 0, sizeof(*e));
+        switch (item->type)
+        {
+        case PARSE_ITEM_EXE:
+            e->type = EXPR_TYPE_COMMAND;
+            e->cmd.exe = parser_copy_str(p, item->str, &str);
+            break;
+        case PARSE_ITEM_PIPE:
+            e->type = EXPR_TYPE_PIPE;
+            break;
+        case PARSE_ITEM_AND:
+            e->type = EXPR_TYPE_AND;
+            break;
+        case PARSE_ITEM_OR:
+            e->type = EXPR_TYPE_OR;
+            break;
+        default:
+            assert(false);
+            break;
+        }
+        command_line_append(line, e++);
+    }
+    line->out_type = out_type;
+    if (out_type != OUTPUT_TYPE_STDOUT)
+        line->out_file = parser_copy_str(p, out_file, &str);
+    line->is_background = is_background;
+    return line;
+}
+
+void command_line_delete(struct command_line *line)
+{
+    /* The exprs, args and strings are in the same block. */
+    free(line);
+}
+
 struct parser *
 parser_new(void)
 {
@@ -119,31 +281,57 @@ parser_new(void)
 
 void parser_feed(struct parser *p, const char *str, uint32_t len)
 {
-    uint32_t cap = p->capacity - p->size;
-    if (cap < len)
+    uint32_t rest = p->size - p->begin;
+    if (p->input != p->buffer || p->capacity - p->size < len)
     {
-        uint32_t new_capacity = (p->capacity + 1) * 2;
-        if (new_capacity - p->size < len)
-            new_capacity = p->size + len;
-        p->buffer = realloc(p->buffer, sizeof(*p->buffer) * new_capacity);
-        p->capacity = new_capacity;
+        /*
+         * The unparsed rest is moved to the buffer start only when the space
+         * is over, so each byte is moved O(1) times on average. It is
+         * usually one incomplete line.
+         */
+        if (p->capacity < rest + len)
+        {
+            uint32_t new_capacity = (p->capacity + 1) * 2;
+            if (new_capacity < rest + len)
+                new_capacity = rest + len;
+            char *buffer = malloc(sizeof(*buffer) * new_capacity);
+            if (rest > 0)
+                memcpy(buffer, p->input + p->begin, rest);
+            free(p->buffer);
+            p->buffer = buffer;
+            p->capacity = new_capacity;
+        }
+        else if (rest > 0)
+        {
+            memmove(p->buffer, p->input + p->begin, rest);
+        }
+        p->input = p->buffer;
+        p->begin = 0;
+        p->size = rest;
     }
     memcpy(p->buffer + p->size, str, len);
     p->size += len;
     assert(p->size <= p->capacity);
 }
 
+void parser_attach(struct parser *p, const char *str, uint32_t len)
+{
+    assert(p->begin == p->size);
+    p->input = str;
+    p->begin = 0;
+    p->size = len;
+}
+
 static void
 parser_consume(struct parser *p, uint32_t size)
 {
-    assert(p->size >= size);
-    if (size == p->size)
+    assert(p->size - p->begin >= size);
+    p->begin += size;
+    if (p->begin == p->size && p->input == p->buffer)
     {
+        p->begin = 0;
         p->size = 0;
-        return;
     }
-    memmove(p->buffer, p->buffer + size, p->size - size);
-    p->size -= size;
 }
 
 static uint32_t
@@ -203,7 +391,7 @@ parse_token(const char *pos, const char *end, struct token *out)
                 default:
                     break;
                 }
-                token_append(out, '\\');
+                token_append(out, pos - 1);
                 goto append_and_next;
             }
             assert(quote == 0);
@@ -305,7 +493,7 @@ parse_token(const char *pos, const char *end, struct token *out)
             goto append_and_next;
         }
     append_and_next:
-        token_append(out, c);
+        token_append(out, pos);
         ++pos;
     }
     return 0;
@@ -314,82 +502,75 @@ parse_token(const char *pos, const char *end, struct token *out)
 enum parser_error
 parser_pop_next(struct parser *p, struct command_line **out)
 {
-    struct command_line *line = calloc(1, sizeof(*line));
-    char *pos = p->buffer;
+    const char *pos = p->input + p->begin;
     const char *begin = pos;
-    char *end = pos + p->size;
-    struct token token = {0};
+    const char *end = p->input + p->size;
+    struct token *token = &p->token;
     enum parser_error res = PARSER_ERR_NONE;
+    enum output_type out_type = OUTPUT_TYPE_STDOUT;
+    struct token_slice out_file = {0};
+    bool is_background = false;
+    p->item_count = 0;
+    token->scratch_used = 0;
+    *out = NULL;
 
     while (pos < end)
     {
-        uint32_t used = parse_token(pos, end, &token);
+        uint32_t used = parse_token(pos, end, token);
         if (used == 0)
-            goto return_no_line;
+            return PARSER_ERR_NONE;
         pos += used;
-        struct expr *e;
-        switch (token.type)
+        switch (token->type)
         {
         case TOKEN_TYPE_STR:
-            if (line->tail != NULL && line->tail->type == EXPR_TYPE_COMMAND)
-            {
-                command_append_arg(&line->tail->cmd, token_strdup(&token));
-                continue;
-            }
-            e = calloc(1, sizeof(*e));
-            e->type = EXPR_TYPE_COMMAND;
-            e->cmd.exe = token_strdup(&token);
-            command_line_append(line, e);
+            if (p->item_count > 0 && parser_ends_with_command(p))
+                parser_add_item(p, PARSE_ITEM_ARG, token_take(token));
+            else
+                parser_add_item(p, PARSE_ITEM_EXE, token_take(token));
             continue;
         case TOKEN_TYPE_NEW_LINE:
             /* Skip new lines. */
-            if (line->tail == NULL)
+            if (p->item_count == 0)
                 continue;
             goto close_and_return;
         case TOKEN_TYPE_PIPE:
-            if (line->tail == NULL)
+            if (p->item_count == 0)
             {
                 res = PARSER_ERR_PIPE_WITH_NO_LEFT_ARG;
                 goto return_error;
             }
-            if (line->tail->type != EXPR_TYPE_COMMAND)
+            if (!parser_ends_with_command(p))
             {
                 res = PARSER_ERR_PIPE_WITH_LEFT_ARG_NOT_A_COMMAND;
                 goto return_error;
             }
-            e = calloc(1, sizeof(*e));
-            e->type = EXPR_TYPE_PIPE;
-            command_line_append(line, e);
+            parser_add_item(p, PARSE_ITEM_PIPE, (struct token_slice){0});
             continue;
         case TOKEN_TYPE_AND:
-            if (line->tail == NULL)
+            if (p->item_count == 0)
             {
                 res = PARSER_ERR_AND_WITH_NO_LEFT_ARG;
                 goto return_error;
             }
-            if (line->tail->type != EXPR_TYPE_COMMAND)
+            if (!parser_ends_with_command(p))
             {
                 res = PARSER_ERR_AND_WITH_LEFT_ARG_NOT_A_COMMAND;
                 goto return_error;
             }
-            e = calloc(1, sizeof(*e));
-            e->type = EXPR_TYPE_AND;
-            command_line_append(line, e);
+            parser_add_item(p, PARSE_ITEM_AND, (struct token_slice){0});
             continue;
         case TOKEN_TYPE_OR:
-            if (line->tail == NULL)
+            if (p->item_count == 0)
             {
                 res = PARSER_ERR_OR_WITH_NO_LEFT_ARG;
                 goto return_error;
             }
-            if (line->tail->type != EXPR_TYPE_COMMAND)
+            if (!parser_ends_with_command(p))
             {
                 res = PARSER_ERR_OR_WITH_LEFT_ARG_NOT_A_COMMAND;
                 goto return_error;
             }
-            e = calloc(1, sizeof(*e));
-            e->type = EXPR_TYPE_OR;
-            command_line_append(line, e);
+            parser_add_item(p, PARSE_ITEM_OR, (struct token_slice){0});
             continue;
         case TOKEN_TYPE_OUT_NEW:
         case TOKEN_TYPE_OUT_APPEND:
@@ -399,50 +580,50 @@ parser_pop_next(struct parser *p, struct command_line **out)
             assert(false);
         }
     }
-    goto return_no_line;
+    return PARSER_ERR_NONE;
 
 close_and_return:
-    if (token.type == TOKEN_TYPE_OUT_NEW || token.type == TOKEN_TYPE_OUT_APPEND)
+    if (token->type == TOKEN_TYPE_OUT_NEW || token->type == TOKEN_TYPE_OUT_APPEND)
     {
-        if (token.type == TOKEN_TYPE_OUT_NEW)
-            line->out_type = OUTPUT_TYPE_FILE_NEW;
+        if (token->type == TOKEN_TYPE_OUT_NEW)
+            out_type = OUTPUT_TYPE_FILE_NEW;
         else
-            line->out_type = OUTPUT_TYPE_FILE_APPEND;
-        uint32_t used = parse_token(pos, end, &token);
+            out_type = OUTPUT_TYPE_FILE_APPEND;
+        uint32_t used = parse_token(pos, end, token);
         if (used == 0)
-            goto return_no_line;
+            return PARSER_ERR_NONE;
         pos += used;
-        if (token.type != TOKEN_TYPE_STR)
+        if (token->type != TOKEN_TYPE_STR)
         {
             res = PARSER_ERR_OUTOUT_REDIRECT_BAD_ARG;
             goto return_error;
         }
-        line->out_file = token_strdup(&token);
-        used = parse_token(pos, end, &token);
+        out_file = token_take(token);
+        used = parse_token(pos, end, token);
         if (used == 0)
-            goto return_no_line;
+            return PARSER_ERR_NONE;
         pos += used;
     }
-    if (token.type == TOKEN_TYPE_BACKGROUND)
+    if (token->type == TOKEN_TYPE_BACKGROUND)
     {
-        line->is_background = true;
-        uint32_t used = parse_token(pos, end, &token);
+        is_background = true;
+        uint32_t used = parse_token(pos, end, token);
         if (used == 0)
-            goto return_no_line;
+            return PARSER_ERR_NONE;
         pos += used;
     }
-    if (token.type == TOKEN_TYPE_NEW_LINE)
+    if (token->type == TOKEN_TYPE_NEW_LINE)
     {
-        assert(line->tail != NULL);
-        parser_consume(p, pos - begin);
-        if (line->tail->type != EXPR_TYPE_COMMAND)
+        assert(p->item_count > 0);
+        if (!parser_ends_with_command(p))
         {
-            res = PARSER_ERR_ENDS_NOT_WITH_A_COMMAND;
-            goto return_no_line;
+            parser_consume(p, pos - begin);
+            return PARSER_ERR_ENDS_NOT_WITH_A_COMMAND;
         }
-        res = PARSER_ERR_NONE;
-        *out = line;
-        goto return_final;
+        /* Build before consuming: the slices point to the input. */
+        *out = parser_build_line(p, out_type, out_file, is_background);
+        parser_consume(p, pos - begin);
+        return PARSER_ERR_NONE;
     }
     res = PARSER_ERR_TOO_LATE_ARGUMENTS;
     goto return_error;
@@ -454,30 +635,23 @@ return_error:
      */
     while (pos < end)
     {
-        uint32_t used = parse_token(pos, end, &token);
+        uint32_t used = parse_token(pos, end, token);
         if (used == 0)
             break;
         pos += used;
-        if (token.type == TOKEN_TYPE_NEW_LINE)
+        if (token->type == TOKEN_TYPE_NEW_LINE)
         {
             parser_consume(p, pos - begin);
-            goto return_no_line;
+            return res;
         }
     }
-    res = PARSER_ERR_NONE;
-    goto return_no_line;
-
-return_no_line:
-    command_line_delete(line);
-    *out = NULL;
-
-return_final:
-    free(token.data);
-    return res;
+    return PARSER_ERR_NONE;
 }
 
 void parser_delete(struct parser *p)
 {
     free(p->buffer);
+    free(p->token.scratch);
+    free(p->items);
     free(p);
 }
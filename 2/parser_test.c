@@ -819,6 +819,151 @@ test_errors(void)
 	unit_test_finish();
 }
 
+static void
+test_escape_scratch(void)
+{
+	unit_test_start();
+	struct parser *p = parser_new();
+	struct command_line *line = NULL;
+
+	const char *str = "echo a\\ b \"c\\\"d\" plain e\"f\" > o\\ ut.txt\n"
+		"printf x\\\\y \"h i\"\n";
+	parser_feed(p, str, strlen(str));
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	struct command_line *first = line;
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	struct command_line *second = line;
+
+	unit_msg("Escaped tokens of the first line outlive the second one");
+	struct expr *e = first->head;
+	unit_check(strcmp(e->cmd.exe, "echo") == 0, "exe");
+	unit_check(e->cmd.arg_count == 4, "arg count");
+	unit_check(strcmp(e->cmd.args[0], "a b") == 0, "escaped space");
+	unit_check(strcmp(e->cmd.args[1], "c\"d") == 0, "escaped quote");
+	unit_check(strcmp(e->cmd.args[2], "plain") == 0, "plain arg");
+	unit_check(strcmp(e->cmd.args[3], "ef") == 0, "glued quotes");
+	unit_check(first->out_type == OUTPUT_TYPE_FILE_NEW, "out type");
+	unit_check(strcmp(first->out_file, "o ut.txt") == 0, "escaped file");
+
+	e = second->head;
+	unit_check(strcmp(e->cmd.exe, "printf") == 0, "exe");
+	unit_check(e->cmd.arg_count == 2, "arg count");
+	unit_check(strcmp(e->cmd.args[0], "x\\y") == 0, "escaped backslash");
+	unit_check(strcmp(e->cmd.args[1], "h i") == 0, "quoted arg");
+
+	command_line_delete(first);
+	command_line_delete(second);
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	unit_check(line == NULL, "no more lines");
+	parser_delete(p);
+	unit_test_finish();
+}
+
+static void
+test_split_feed(void)
+{
+	unit_test_start();
+	struct parser *p = parser_new();
+	struct command_line *line = NULL;
+
+	unit_msg("Token is split between feeds");
+	const char *parts[] = {"echo hel", "lo\\ wor", "ld \"a ", "b\" tail\n"};
+	for (int i = 0; i < 3; ++i) {
+		parser_feed(p, parts[i], strlen(parts[i]));
+		unit_fail_if(parser_pop_next(p, &line) != PARSER_ERR_NONE);
+		unit_fail_if(line != NULL);
+	}
+	parser_feed(p, parts[3], strlen(parts[3]));
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	struct expr *e = line->head;
+	unit_check(strcmp(e->cmd.exe, "echo") == 0, "exe");
+	unit_check(e->cmd.arg_count == 3, "arg count");
+	unit_check(strcmp(e->cmd.args[0], "hello world") == 0, "arg[0]");
+	unit_check(strcmp(e->cmd.args[1], "a b") == 0, "arg[1]");
+	unit_check(strcmp(e->cmd.args[2], "tail") == 0, "arg[2]");
+	command_line_delete(line);
+
+	unit_msg("Long argument fed by pieces");
+	enum { ARG_SIZE = 10000, PIECE_SIZE = 1000 };
+	char *arg = malloc(ARG_SIZE + 1);
+	for (int i = 0; i < ARG_SIZE; ++i)
+		arg[i] = 'a' + i % 26;
+	arg[ARG_SIZE] = 0;
+	parser_feed(p, "echo ", 5);
+	for (int i = 0; i < ARG_SIZE; i += PIECE_SIZE) {
+		parser_feed(p, arg + i, PIECE_SIZE);
+		unit_fail_if(parser_pop_next(p, &line) != PARSER_ERR_NONE);
+		unit_fail_if(line != NULL);
+	}
+	parser_feed(p, "\n", 1);
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	unit_check(line->head->cmd.arg_count == 1, "arg count");
+	unit_check(strcmp(line->head->cmd.args[0], arg) == 0, "long arg");
+	command_line_delete(line);
+	free(arg);
+
+	parser_delete(p);
+	unit_test_finish();
+}
+
+static void
+test_check_exe(struct parser *p, const char *exe, const char *arg)
+{
+	struct command_line *line = NULL;
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	unit_fail_if(line == NULL);
+	unit_check(strcmp(line->head->cmd.exe, exe) == 0, exe);
+	if (arg == NULL) {
+		unit_check(line->head->cmd.arg_count == 0, "no args");
+	} else {
+		unit_check(line->head->cmd.arg_count == 1, "one arg");
+		unit_check(strcmp(line->head->cmd.args[0], arg) == 0, arg);
+	}
+	command_line_delete(line);
+}
+
+static void
+test_consume(void)
+{
+	unit_test_start();
+	struct parser *p = parser_new();
+	struct command_line *line = NULL;
+
+	unit_msg("Several lines in one feed");
+	const char *str = "a 1\nb 2\nc 3\nd";
+	parser_feed(p, str, strlen(str));
+	test_check_exe(p, "a", "1");
+	test_check_exe(p, "b", "2");
+	test_check_exe(p, "c", "3");
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	unit_check(line == NULL, "incomplete line");
+
+	unit_msg("Feed after a partial consume");
+	str = " 4\ne\nf\n";
+	parser_feed(p, str, strlen(str));
+	test_check_exe(p, "d", "4");
+	test_check_exe(p, "e", NULL);
+	parser_feed(p, "g\n", 2);
+	test_check_exe(p, "f", NULL);
+	test_check_exe(p, "g", NULL);
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	unit_check(line == NULL, "no more lines");
+
+	unit_msg("Attached input is copied by the next feed");
+	char script[] = "x 1\ny 2\nz";
+	parser_attach(p, script, strlen(script));
+	test_check_exe(p, "x", "1");
+	test_check_exe(p, "y", "2");
+	unit_check(parser_pop_next(p, &line) == PARSER_ERR_NONE, "parse");
+	unit_check(line == NULL, "incomplete line");
+	parser_feed(p, " 3\n", 3);
+	memset(script, '#', strlen(script));
+	test_check_exe(p, "z", "3");
+
+	parser_delete(p);
+	unit_test_finish();
+}
+
 int
 main(void)
 {
@@ -834,5 +979,8 @@ main(void)
 	test_logical_operators();
 	test_background();
 	test_errors();
+	test_escape_scratch();
+	test_split_feed();
+	test_consume();
 	return 0;
 }
@@ -1,14 +1,22 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "exec_command.h"
 #include "parse_command.h"
 #include "parser.h"
 
 #define PROMPT "$> "
+/* Скрипты читаются большими блоками: меньше системных вызовов */
+#define READ_SIZE (64 * 1024)
 
 __attribute__((unused)) static void print_command_line_parsed(
     const struct command_line* line)
@@ -67,53 +75,185 @@ __attribute__((unused)) static void print_command_line_parsed(
 	}
 }
 
-int main(void)
+/*
+ * Дождаться, пока в fd появятся данные. Пока ждем, собираем завершившиеся
+ * фоновые задания: SIGCHLD приходит через signalfd, поэтому read не
+ * прерывается сигналами, а код задания не теряется
+ */
+static int wait_input(int fd, job_table_t* jobs)
 {
-	const size_t buf_size = 1024;
-	char buf[buf_size];
-	int rc;
-	struct parser* p = parser_new();
-	setup_executor();
-	write(STDOUT_FILENO, PROMPT, sizeof(PROMPT));
-	while ((rc = read(STDIN_FILENO, buf, buf_size)) > 0 || rc == -1)
+	struct pollfd fds[2] = {
+	    {.fd = fd, .events = POLLIN},
+	    {.fd = jobs->signal_fd, .events = POLLIN},
+	};
+	while (true)
 	{
-        if (rc == -1)
-        {
-            if (errno == EINTR)
-            {
-                /* 
-                 * Возможно, когда фоновый процесс посылает нам SIGUSR1
-                 */
-                continue;
-            }
-			perror("read");
+		if (poll(fds, 2, -1) == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("poll");
+			return -1;
+		}
+
+		if (fds[1].revents & POLLIN)
+		{
+			job_table_reap(jobs);
+		}
+		if (fds[0].revents != 0)
+		{
+			return 0;
+		}
+	}
+}
+
+static void print_prompt(bool interactive)
+{
+	if (interactive)
+	{
+		write(STDOUT_FILENO, PROMPT, sizeof(PROMPT) - 1);
+	}
+}
+
+/*
+ * Выполнить все полностью введенные команды из парсера. Возвращает код
+ * последней выполненной команды, если команд не было - status
+ */
+static int exec_parsed(struct parser* p, job_table_t* jobs, int status)
+{
+	struct command_line* line = NULL;
+	while (true)
+	{
+		enum parser_error err = parser_pop_next(p, &line);
+		if (err == PARSER_ERR_NONE && line == NULL)
 			break;
+		if (err != PARSER_ERR_NONE)
+		{
+			dprintf(STDERR_FILENO, "Error: %d\n", (int)err);
+			continue;
+		}
+		/* print_command_line_parsed(line); */
+		command_t cmd;
+		if (parse_command(line, &cmd) == 0)
+		{
+			status = exec_command(&cmd, jobs);
 		}
+		free_command(&cmd);
+		command_line_delete(line);
 
-		parser_feed(p, buf, rc);
-		struct command_line* line = NULL;
-		while (true)
+		/* В скрипте read между командами нет - собираем задания здесь */
+		if (0 < jobs->size)
 		{
-			enum parser_error err = parser_pop_next(p, &line);
-			if (err == PARSER_ERR_NONE && line == NULL)
-				break;
-			if (err != PARSER_ERR_NONE)
+			job_table_reap(jobs);
+		}
+	}
+	return status;
+}
+
+/* Последняя строка может быть без '\n' - как bash, выполняем и ее */
+static int exec_rest(struct parser* p, job_table_t* jobs, int status)
+{
+	parser_feed(p, "\n", 1);
+	return exec_parsed(p, jobs, status);
+}
+
+/*
+ * Читать команды из fd и выполнять их по мере поступления. Возвращает код
+ * последней команды
+ */
+static int exec_stream(int fd, struct parser* p, job_table_t* jobs,
+                       bool interactive)
+{
+	char* buf = (char*)malloc(READ_SIZE);
+	int rc;
+	int status = 0;
+	print_prompt(interactive);
+	while (wait_input(fd, jobs) == 0 &&
+	       ((rc = read(fd, buf, READ_SIZE)) > 0 || rc == -1))
+	{
+		if (rc == -1)
+		{
+			if (errno == EINTR)
 			{
-				printf("Error: %d\n", (int)err);
 				continue;
 			}
-			/* print_command_line_parsed(line); */
-			command_t cmd;
-			if (parse_command(line, &cmd) == 0)
-			{
-				exec_command(&cmd);
-			}
-			free_command(&cmd);
-			command_line_delete(line);
+			perror("read");
+			break;
 		}
-		write(STDOUT_FILENO, PROMPT, sizeof(PROMPT));
+
+		parser_feed(p, buf, rc);
+		status = exec_parsed(p, jobs, status);
+		/* Сообщения о завершившихся заданиях - перед приглашением */
+		job_table_reap(jobs);
+		print_prompt(interactive);
+	}
+
+	status = exec_rest(p, jobs, status);
+	free(buf);
+	return status;
+}
+
+/*
+ * Выполнить скрипт из файла. Обычный файл отображается в память и
+ * разбирается на месте, без read и копирования в буфер парсера. Остальное
+ * (pipe, /dev/stdin) читается как поток. Возвращает код последней команды
+ */
+static int exec_script(const char* path, struct parser* p, job_table_t* jobs)
+{
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		dprintf(STDERR_FILENO, "%s: %s\n", path, strerror(errno));
+		return 127;
+	}
+
+	struct stat st;
+	void* script = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && 0 < st.st_size &&
+	    st.st_size <= UINT32_MAX)
+	{
+		script = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
 	}
-    /* TODO: bad file descriptor */
+
+	if (script == MAP_FAILED)
+	{
+		int status = exec_stream(fd, p, jobs, false);
+		close(fd);
+		return status;
+	}
+
+	madvise(script, st.st_size, MADV_SEQUENTIAL);
+	parser_attach(p, (const char*)script, (uint32_t)st.st_size);
+	int status = exec_parsed(p, jobs, 0);
+	/* Копирует остаток из отображения, поэтому munmap - после */
+	status = exec_rest(p, jobs, status);
+	munmap(script, st.st_size);
+	close(fd);
+	return status;
+}
+
+int main(int argc, char** argv)
+{
+	/* Скрипт передан файлом или через pipe - приглашение не нужно */
+	bool interactive = argc < 2 && isatty(STDIN_FILENO);
+	struct parser* p = parser_new();
+	job_table_t jobs;
+	setup_executor(&jobs, interactive);
+
+	/* Как в bash: код шела - код последней команды */
+	int rc;
+	if (argc < 2)
+	{
+		rc = exec_stream(STDIN_FILENO, p, &jobs, interactive);
+	}
+	else
+	{
+		rc = exec_script(argv[1], p, &jobs);
+	}
+
+	job_table_free(&jobs);
 	parser_delete(p);
-	return 0;
+	return rc;
 }